@@ -0,0 +1,1052 @@
+/**
+ * bench_codec.c - Throughput and quality benchmark for the plane codec
+ * Part of Adaptive DCT Image Compressor
+ *
+ * Usage: bench_codec [width height]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <utils.h>
+#include "../include/blockify.h"
+#include "../include/codec.h"
+#include "../include/entropy.h"
+#include "../include/jpeg.h"
+#include "../include/pack.h"
+#include "../include/tune.h"
+
+#define BENCH_REPEATS 3
+
+/**
+ * Structure to hold the result of one benchmark configuration
+ */
+typedef struct {
+    double encode_ms;        // Best encode time over the repeats
+    double decode_ms;        // Best decode time over the repeats
+    size_t size;             // Compressed size in bytes
+    double psnr;             // Quality of the decoded image
+} BenchResult;
+
+// Deterministic test image: smooth shading, texture and hard edges
+static void fill_bench_image(unsigned char *pixels, int width, int height) {
+    unsigned seed = 12345;
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            seed = seed * 1103515245u + 12345u;
+            double value = 110.0 + 70.0 * sin(i / 37.0) * cos(j / 53.0);
+            value += 25.0 * sin(i / 3.0 + j / 5.0) * ((i / 128 + j / 128) % 2);
+            value += ((i / 64) % 3 == 0 && (j / 64) % 3 == 0) ? 60.0 : 0.0;
+            value += (double) ((seed >> 16) % 9) - 4.0;
+            pixels[(size_t) i * width + j] = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+    }
+}
+
+static double elapsed_ms(clock_t start) {
+    return (double) (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+static BenchResult run_config(const unsigned char *pixels, int width, int height, const CodecParams *params) {
+    BenchResult result = {1e30, 1e30, 0, 0.0};
+    size_t count = (size_t) width * height;
+
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+        clock_t start = clock();
+        unsigned char *stream = codec_encode(pixels, width, height, params, &result.size);
+        double encode_ms = elapsed_ms(start);
+
+        int decoded_width, decoded_height;
+        start = clock();
+        unsigned char *decoded = codec_decode(stream, result.size, &decoded_width, &decoded_height);
+        double decode_ms = elapsed_ms(start);
+
+        if (encode_ms < result.encode_ms) result.encode_ms = encode_ms;
+        if (decode_ms < result.decode_ms) result.decode_ms = decode_ms;
+        result.psnr = plane_psnr(pixels, decoded, count);
+
+        free(stream);
+        free(decoded);
+    }
+
+    return result;
+}
+
+static void print_result(const char *name, const BenchResult *result, int width, int height) {
+    double megapixels = (double) width * height / 1e6;
+    printf("%-24s %9.1f %9.1f %9.2f %8.2f %8.2f\n", name,
+           result->encode_ms, result->decode_ms,
+           result->size * 8.0 / ((double) width * height), result->psnr,
+           megapixels / ((result->encode_ms + result->decode_ms) / 1000.0));
+}
+
+// Forward + inverse transform of every block of the image, nothing else
+static double time_transform_only(DCTContext *ctx, const unsigned char *pixels, int width, int height) {
+    int n = ctx->block_size;
+    double **block = alloc_array(n, n);
+    double **coeffs = alloc_array(n, n);
+    double best = 1e30;
+
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+        clock_t start = clock();
+        for (int row = 0; row + n <= height; row += n) {
+            for (int col = 0; col + n <= width; col += n) {
+                for (int i = 0; i < n; i++) {
+                    for (int j = 0; j < n; j++) {
+                        block[i][j] = pixels[(size_t) (row + i) * width + col + j] - 128.0;
+                    }
+                }
+                dct_forward(ctx, block, coeffs);
+                dct_inverse(ctx, coeffs, block);
+            }
+        }
+        double ms = elapsed_ms(start);
+        if (ms < best) best = ms;
+    }
+
+    free_array(block, n);
+    free_array(coeffs, n);
+    return best;
+}
+
+// Exact vs multiplierless approximate transform
+static void bench_approximate_dct(const unsigned char *pixels, int width, int height) {
+    printf("=== Approximate DCT preview mode ===\n");
+    printf("%-24s %9s %9s %9s %8s %8s\n", "Configuration", "enc ms", "dec ms", "bpp", "PSNR", "MP/s");
+
+    int block_sizes[2] = {4, 8};
+    for (int i = 0; i < 2; i++) {
+        CodecParams params = codec_default_params();
+        params.block_size = block_sizes[i];
+
+        BenchResult exact = run_config(pixels, width, height, &params);
+        params.approximate_dct = 1;
+        BenchResult approx = run_config(pixels, width, height, &params);
+
+        char name[64];
+        sprintf(name, "%dx%d exact", block_sizes[i], block_sizes[i]);
+        print_result(name, &exact, width, height);
+        sprintf(name, "%dx%d approximate", block_sizes[i], block_sizes[i]);
+        print_result(name, &approx, width, height);
+        printf("%-24s encode %.2fx, decode %.2fx faster, PSNR cost %.2f dB\n", "",
+               exact.encode_ms / approx.encode_ms, exact.decode_ms / approx.decode_ms,
+               exact.psnr - approx.psnr);
+
+        DCTContext *exact_ctx = dct_init(block_sizes[i]);
+        DCTContext *approx_ctx = dct_init_approximate(block_sizes[i]);
+        double exact_ms = time_transform_only(exact_ctx, pixels, width, height);
+        double approx_ms = time_transform_only(approx_ctx, pixels, width, height);
+        printf("%-24s transform only: %.1f ms exact, %.1f ms approximate (%.2fx)\n\n", "",
+               exact_ms, approx_ms, exact_ms / approx_ms);
+        dct_free(exact_ctx);
+        dct_free(approx_ctx);
+    }
+}
+
+// DCT-domain quality search vs a binary search that encodes and decodes every candidate
+static void bench_target_quality(const unsigned char *pixels, int width, int height) {
+    printf("=== Target-quality search ===\n");
+
+    double thresholds[3] = {32.0, 36.0, 40.0};
+    for (int t = 0; t < 3; t++) {
+        CodecParams params = codec_default_params();
+        CodecTarget target = {CODEC_TARGET_PSNR, thresholds[t]};
+        CodecTargetResult result;
+        size_t size;
+
+        clock_t start = clock();
+        unsigned char *stream = codec_encode_target(pixels, width, height, &params, &target, &result, &size);
+        double target_ms = elapsed_ms(start);
+        free(stream);
+
+        start = clock();
+        int low = 1;
+        int high = 100;
+        while (low < high) {
+            int decoded_width, decoded_height;
+            params.quality = (low + high) / 2;
+            stream = codec_encode(pixels, width, height, &params, &size);
+            unsigned char *decoded = codec_decode(stream, size, &decoded_width, &decoded_height);
+            if (plane_psnr(pixels, decoded, (size_t) width * height) >= thresholds[t]) {
+                high = params.quality;
+            } else {
+                low = params.quality + 1;
+            }
+            free(stream);
+            free(decoded);
+        }
+        double naive_ms = elapsed_ms(start);
+
+        printf("PSNR >= %.0f dB: quality %d (%.2f dB, %d encodes) in %.1f ms; full-encode search quality %d in %.1f ms (%.2fx)\n",
+               thresholds[t], result.quality, result.achieved, result.encodes, target_ms, low, naive_ms,
+               naive_ms / target_ms);
+    }
+    printf("\n");
+}
+
+// Encode time and quality as the deadline tightens
+static void bench_deadline(const unsigned char *pixels, int width, int height) {
+    printf("=== Deadline-aware encoding (quadtree, adaptive, optimized tables) ===\n");
+    printf("%-12s %9s %7s %9s %9s %8s\n", "Budget", "enc ms", "effort", "degraded", "bpp", "PSNR");
+
+    CodecParams params = codec_default_params();
+    params.quadtree = 1;
+    params.adaptive = 1;
+
+    double full_ms = 0.0;
+    double fractions[4] = {0.0, 0.75, 0.5, 0.25};
+    for (int i = 0; i < 4; i++) {
+        params.time_budget_ms = full_ms * fractions[i];
+        CodecEncodeStats stats;
+        size_t size;
+        int decoded_width, decoded_height;
+        unsigned char *stream = codec_encode_with_stats(pixels, width, height, &params, &stats, &size);
+        unsigned char *decoded = codec_decode(stream, size, &decoded_width, &decoded_height);
+        if (i == 0) {
+            full_ms = stats.elapsed_ms;
+        }
+
+        char name[32];
+        if (i == 0) {
+            sprintf(name, "none");
+        } else {
+            sprintf(name, "%.0f ms", params.time_budget_ms);
+        }
+        printf("%-12s %9.1f %7d %8.0f%% %9.2f %8.2f\n", name, stats.elapsed_ms, stats.effort,
+               100.0 * stats.degraded_rows / stats.total_rows, size * 8.0 / ((double) width * height),
+               plane_psnr(pixels, decoded, (size_t) width * height));
+
+        free(stream);
+        free(decoded);
+    }
+    printf("\n");
+}
+
+// Kernel microbenchmarks and the end-to-end effect of applying the winners
+static void bench_autotune(const unsigned char *pixels, int width, int height) {
+    printf("=== Kernel autotuning ===\n");
+    printf("%-8s %12s %12s %12s %8s %12s %12s %8s\n", "Block", "matrix ns", "factor. ns", "sse2 ns", "winner",
+           "divide ns", "recip. ns", "winner");
+
+    TuneProfile profile;
+    tune_measure(&profile);
+    int sizes[TUNE_SIZE_COUNT] = {4, 8, 16, 32};
+    for (int s = 0; s < TUNE_SIZE_COUNT; s++) {
+        printf("%2dx%-5d %12.1f %12.1f %12.1f %8d %12.1f %12.1f %8d\n", sizes[s], sizes[s],
+               profile.dct_ns[s][DCT_KERNEL_MATRIX], profile.dct_ns[s][DCT_KERNEL_FACTORIZED],
+               profile.dct_ns[s][DCT_KERNEL_SSE2], profile.dct_kernel[s],
+               profile.quant_ns[s][QUANT_KERNEL_DIVIDE], profile.quant_ns[s][QUANT_KERNEL_RECIPROCAL],
+               profile.quant_kernel[s]);
+    }
+
+    for (int s = 0; s < TUNE_SIZE_COUNT; s++) {
+        CodecParams params = codec_default_params();
+        params.block_size = sizes[s];
+
+        TuneProfile untuned = profile;
+        for (int k = 0; k < TUNE_SIZE_COUNT; k++) {
+            untuned.dct_kernel[k] = DCT_KERNEL_MATRIX;
+            untuned.quant_kernel[k] = QUANT_KERNEL_DIVIDE;
+        }
+        tune_apply(&untuned);
+        BenchResult before = run_config(pixels, width, height, &params);
+        tune_apply(&profile);
+        BenchResult after = run_config(pixels, width, height, &params);
+
+        printf("%2dx%-5d encode %.1f -> %.1f ms, decode %.1f -> %.1f ms\n", sizes[s], sizes[s],
+               before.encode_ms, after.encode_ms, before.decode_ms, after.decode_ms);
+    }
+    printf("\n");
+}
+
+// Open a user-space last-level cache miss counter, or -1 where the PMU is not exposed
+static int llc_counter_open(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// LLC misses of one encode and one decode (-1 without a counter)
+static void count_llc_misses(int counter, const unsigned char *pixels, int width, int height,
+                             const CodecParams *params, long long *encode_misses, long long *decode_misses) {
+    size_t size;
+    int w, h;
+    long long value = -1;
+    *encode_misses = -1;
+    *decode_misses = -1;
+    if (counter < 0) {
+        free(codec_encode(pixels, width, height, params, &size));
+        return;
+    }
+
+    ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    unsigned char *stream = codec_encode(pixels, width, height, params, &size);
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counter, &value, sizeof(value)) == (ssize_t) sizeof(value)) *encode_misses = value;
+
+    ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    unsigned char *decoded = codec_decode(stream, size, &w, &h);
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counter, &value, sizeof(value)) == (ssize_t) sizeof(value)) *decode_misses = value;
+
+    free(stream);
+    free(decoded);
+}
+
+// Allocating encoder vs encoding into one reused worst-case buffer
+static void bench_encode_into(const unsigned char *pixels, int width, int height) {
+    printf("=== Encode into caller buffer (%dx%d) ===\n", width, height);
+    printf("%-10s %12s %12s %12s %8s\n", "Block", "Alloc ms", "Into ms", "Bound KB", "Used");
+
+    int sizes[3] = {8, 16, 32};
+    for (int s = 0; s < 3; s++) {
+        CodecParams params = codec_default_params();
+        params.block_size = sizes[s];
+        size_t bound = codec_max_compressed_size(width, height, &params);
+        unsigned char *output = (unsigned char*)malloc(bound);
+        if (!output) {
+            fprintf(stderr, "Memory allocation failed when creating output buffer\n");
+            exit(EXIT_FAILURE);
+        }
+
+        double alloc_ms = 0, into_ms = 0;
+        size_t size = 0;
+        for (int r = 0; r < BENCH_REPEATS; r++) {
+            clock_t start = clock();
+            unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+            double ms = elapsed_ms(start);
+            free(stream);
+            if (r == 0 || ms < alloc_ms) alloc_ms = ms;
+
+            start = clock();
+            codec_encode_into(pixels, width, height, &params, output, bound);
+            ms = elapsed_ms(start);
+            if (r == 0 || ms < into_ms) into_ms = ms;
+        }
+        printf("%2dx%-7d %12.1f %12.1f %12.0f %7.1f%%\n", sizes[s], sizes[s], alloc_ms, into_ms,
+               bound / 1024.0, 100.0 * size / bound);
+        free(output);
+    }
+    printf("\n");
+}
+
+// Per-pixel block gather vs the SIMD blockify pass over the whole plane
+static void bench_blockify(const unsigned char *pixels, int width, int height) {
+    printf("=== Blockify (%dx%d) ===\n", width, height);
+    printf("%-8s %12s %12s %12s\n", "Block", "Gather ms", "Blockify ms", "Unblock ms");
+
+    int sizes[4] = {4, 8, 16, 32};
+    for (int s = 0; s < 4; s++) {
+        int n = sizes[s];
+        int cols = (width + n - 1) / n;
+        int rows = (height + n - 1) / n;
+        short *blocks = (short*)malloc((size_t) cols * rows * n * n * sizeof(short));
+        unsigned char *restored = (unsigned char*)malloc((size_t) width * height);
+        if (!blocks || !restored) {
+            fprintf(stderr, "Memory allocation failed when creating benchmark buffers\n");
+            exit(EXIT_FAILURE);
+        }
+
+        double gather_ms = 0, blockify_ms = 0, unblockify_ms = 0;
+        for (int r = 0; r < BENCH_REPEATS; r++) {
+            clock_t start = clock();
+            for (int by = 0; by < rows; by++) {
+                for (int bx = 0; bx < cols; bx++) {
+                    short *block = blocks + ((size_t) by * cols + bx) * n * n;
+                    for (int i = 0; i < n; i++) {
+                        for (int j = 0; j < n; j++) {
+                            int y = by * n + i < height ? by * n + i : height - 1;
+                            int x = bx * n + j < width ? bx * n + j : width - 1;
+                            block[i * n + j] = (short) (pixels[(size_t) y * width + x] - 128);
+                        }
+                    }
+                }
+            }
+            double ms = elapsed_ms(start);
+            if (r == 0 || ms < gather_ms) gather_ms = ms;
+
+            start = clock();
+            blockify(pixels, width, width, height, n, cols, rows, blocks);
+            ms = elapsed_ms(start);
+            if (r == 0 || ms < blockify_ms) blockify_ms = ms;
+
+            start = clock();
+            unblockify(blocks, n, cols, rows, restored, width, width, height);
+            ms = elapsed_ms(start);
+            if (r == 0 || ms < unblockify_ms) unblockify_ms = ms;
+        }
+        printf("%2dx%-5d %12.2f %12.2f %12.2f\n", n, n, gather_ms, blockify_ms, unblockify_ms);
+
+        free(blocks);
+        free(restored);
+    }
+    printf("\n");
+}
+
+// Dense quantize + zigzag + symbol count vs the sparse path, on the image's DCT blocks
+static void bench_sparse(const unsigned char *pixels, int width, int height) {
+    printf("=== Sparse Quantization (%dx%d, quality 50) ===\n", width, height);
+    printf("%-8s %10s %12s %12s\n", "Block", "Nonzeros", "Dense ms", "Sparse ms");
+
+    int sizes[4] = {4, 8, 16, 32};
+    for (int s = 0; s < 4; s++) {
+        int n = sizes[s];
+        int cols = width / n;
+        int rows = height / n;
+        int blocks = cols * rows;
+        DCTContext *dct_ctx = dct_init(n);
+        QuantContext *quant_ctx = quant_init(n, 50, 0);
+        double ***coeffs = (double***)malloc((size_t) blocks * sizeof(double**));
+        int **dense = alloc_int_array(n, n);
+        int *zigzag = (int*)malloc((size_t) n * n * sizeof(int));
+        SparseBlock sparse;
+        sparse.values = (int*)malloc((size_t) n * n * sizeof(int));
+        if (!coeffs || !zigzag || !sparse.values) {
+            fprintf(stderr, "Memory allocation failed when creating benchmark buffers\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // Transform once so only the stages after the DCT are timed
+        for (int b = 0; b < blocks; b++) {
+            double **block = create_block_from_pixels(pixels, width, (size_t) (b / cols) * n, (size_t) (b % cols) * n, n);
+            coeffs[b] = alloc_array(n, n);
+            dct_forward(dct_ctx, block, coeffs[b]);
+            free_array(block, n);
+        }
+
+        unsigned dc_freq[HUFF_DC_SYMBOLS], ac_freq[HUFF_AC_SYMBOLS];
+        double dense_ms = 0, sparse_ms = 0;
+        long long nonzeros = 0;
+        for (int r = 0; r < BENCH_REPEATS; r++) {
+            int pred = 0;
+            memset(dc_freq, 0, sizeof(dc_freq));
+            memset(ac_freq, 0, sizeof(ac_freq));
+            clock_t start = clock();
+            for (int b = 0; b < blocks; b++) {
+                quantize(quant_ctx, coeffs[b], dense, 0.0);
+                block_to_zigzag(dense, zigzag, n);
+                huffman_count_block(zigzag, n * n, &pred, dc_freq, ac_freq);
+            }
+            double ms = elapsed_ms(start);
+            if (r == 0 || ms < dense_ms) dense_ms = ms;
+
+            pred = 0;
+            nonzeros = 0;
+            start = clock();
+            for (int b = 0; b < blocks; b++) {
+                quantize_sparse(quant_ctx, coeffs[b], &sparse, 0.0);
+                huffman_count_sparse(&sparse, n * n, &pred, dc_freq, ac_freq);
+                nonzeros += sparse.count;
+            }
+            ms = elapsed_ms(start);
+            if (r == 0 || ms < sparse_ms) sparse_ms = ms;
+        }
+        printf("%2dx%-5d %10.2f %12.2f %12.2f\n", n, n, blocks > 0 ? (double) nonzeros / blocks : 0.0,
+               dense_ms, sparse_ms);
+
+        for (int b = 0; b < blocks; b++) free_array(coeffs[b], n);
+        free(coeffs);
+        free(zigzag);
+        free(sparse.values);
+        free_int_array(dense, n);
+        quant_free(quant_ctx);
+        dct_free(dct_ctx);
+    }
+    printf("\n");
+}
+
+// Decode throughput; most blocks end early, which the sparse decode path exploits
+static void bench_decode(const unsigned char *pixels, int width, int height) {
+    printf("=== Decode (%dx%d) ===\n", width, height);
+    printf("%-8s %8s %9s %9s %8s\n", "Block", "Quality", "bpp", "dec ms", "MP/s");
+
+    int sizes[4] = {4, 8, 16, 32};
+    int qualities[2] = {50, 90};
+    for (int s = 0; s < 4; s++) {
+        for (int q = 0; q < 2; q++) {
+            CodecParams params = codec_default_params();
+            params.block_size = sizes[s];
+            params.quality = qualities[q];
+            BenchResult result = run_config(pixels, width, height, &params);
+            printf("%2dx%-5d %8d %9.2f %9.1f %8.2f\n", sizes[s], sizes[s], qualities[q],
+                   result.size * 8.0 / ((double) width * height), result.decode_ms,
+                   (double) width * height / 1e6 / (result.decode_ms / 1000.0));
+        }
+    }
+    printf("\n");
+}
+
+// Serial vs two-phase parallel decode of a single-tile stream (wall clock)
+static void bench_parallel_decode(const unsigned char *pixels, int width, int height) {
+    printf("=== Parallel Decode (%dx%d, one tile, %ld CPUs) ===\n", width, height, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-10s %10s %10s\n", "Threads", "dec ms", "MP/s");
+
+    CodecParams params = codec_default_params();
+    params.tile_size = 0;
+    size_t size;
+    unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+
+    int thread_counts[5] = {0, 1, 2, 4, 8};
+    for (int k = 0; k < 5; k++) {
+        double best = 1e30;
+        for (int r = 0; r < BENCH_REPEATS; r++) {
+            int decoded_width, decoded_height;
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            unsigned char *decoded = codec_decode_parallel(stream, size, thread_counts[k], &decoded_width, &decoded_height);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double ms = (double) (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6;
+            if (ms < best) best = ms;
+            free(decoded);
+        }
+        char label[16];
+        if (thread_counts[k] == 0) {
+            snprintf(label, sizeof(label), "serial");
+        } else {
+            snprintf(label, sizeof(label), "%d", thread_counts[k]);
+        }
+        printf("%-10s %10.1f %10.2f\n", label, best, (double) width * height / 1e6 / (best / 1000.0));
+    }
+    printf("\n");
+    free(stream);
+}
+
+// Zigzag vs per-image adaptive scan order, on the benchmark image and on
+// directional content (diagonal stripes) whose energy is off the zigzag path
+static void bench_adaptive_scan(const unsigned char *pixels, int width, int height) {
+    printf("=== Adaptive scan order (%dx%d) ===\n", width, height);
+    printf("%-10s %6s %11s %11s %9s %9s %9s\n", "Image", "Block", "zigzag bpp", "scan bpp", "saving",
+           "enc z/s", "dec z/s");
+
+    unsigned char *stripes = (unsigned char*)malloc((size_t) width * height);
+    if (!stripes) {
+        fprintf(stderr, "Memory allocation failed when creating benchmark image\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            double value = 128.0 + 80.0 * sin(j * 1.1 + i * 0.35) + 15.0 * cos(i / 40.0);
+            stripes[(size_t) i * width + j] = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+    }
+
+    const unsigned char *images[2] = {pixels, stripes};
+    const char *names[2] = {"bench", "stripes"};
+    int sizes[3] = {8, 16, 32};
+    for (int m = 0; m < 2; m++) {
+        for (int s = 0; s < 3; s++) {
+            CodecParams params = codec_default_params();
+            params.block_size = sizes[s];
+            BenchResult zigzag = run_config(images[m], width, height, &params);
+            params.adaptive_scan = 1;
+            BenchResult scan = run_config(images[m], width, height, &params);
+
+            double pixels_count = (double) width * height;
+            printf("%-10s %3dx%-2d %11.3f %11.3f %8.1f%% %4.0f/%-4.0f %4.0f/%-4.0f\n", names[m], sizes[s], sizes[s],
+                   zigzag.size * 8.0 / pixels_count, scan.size * 8.0 / pixels_count,
+                   100.0 * (1.0 - (double) scan.size / zigzag.size),
+                   zigzag.encode_ms, scan.encode_ms, zigzag.decode_ms, scan.decode_ms);
+        }
+    }
+    printf("\n");
+    free(stripes);
+}
+
+// Transform-only vs palette blocks, on a screen capture (text and UI
+// panels) and on the benchmark image, where few blocks qualify
+static void bench_palette(const unsigned char *pixels, int width, int height) {
+    printf("=== Palette blocks (%dx%d) ===\n", width, height);
+    printf("%-8s %6s %9s %9s %8s %9s %9s %9s\n", "Image", "Block", "DCT bpp", "pal bpp", "saving",
+           "enc d/p", "dec d/p", "palette%");
+
+    unsigned char *screen = (unsigned char*)malloc((size_t) width * height);
+    if (!screen) {
+        fprintf(stderr, "Memory allocation failed when creating benchmark image\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            int panel = (j / 256 + i / 192) % 3;
+            int glyph = (i % 14) < 9 && (j % 8) < 6 && ((i / 14) * 7 + (j / 8) * 13) % 9 != 0 &&
+                        ((i % 14) * 3 + (j % 8) * 5 + (j / 8)) % 4 == 0;
+            int border = j % 256 == 0 || i % 192 == 0;
+            unsigned char shade = (unsigned char) (panel == 0 ? 250 : (panel == 1 ? 225 : 40));
+            screen[(size_t) i * width + j] = border ? 128 : (glyph ? (unsigned char) (panel == 2 ? 230 : 16) : shade);
+        }
+    }
+
+    const unsigned char *images[2] = {screen, pixels};
+    const char *names[2] = {"screen", "bench"};
+    int sizes[3] = {4, 8, 16};
+    for (int m = 0; m < 2; m++) {
+        for (int s = 0; s < 3; s++) {
+            CodecParams params = codec_default_params();
+            params.block_size = sizes[s];
+            BenchResult plain = run_config(images[m], width, height, &params);
+            params.palette = 1;
+            BenchResult palette = run_config(images[m], width, height, &params);
+
+            CodecEncodeStats stats;
+            size_t size;
+            free(codec_encode_with_stats(images[m], width, height, &params, &stats, &size));
+            double pixels_count = (double) width * height;
+            printf("%-8s %3dx%-2d %9.3f %9.3f %7.1f%% %4.0f/%-4.0f %4.0f/%-4.0f %8.1f%%\n", names[m], sizes[s],
+                   sizes[s], plain.size * 8.0 / pixels_count, palette.size * 8.0 / pixels_count,
+                   100.0 * (1.0 - (double) palette.size / plain.size), plain.encode_ms, palette.encode_ms,
+                   plain.decode_ms, palette.decode_ms,
+                   100.0 * stats.palette_blocks * sizes[s] * sizes[s] / pixels_count);
+        }
+    }
+    printf("\n");
+    free(screen);
+}
+
+// Baseline JPEG export against the codec's own 8x8 streams at the same quality
+static void bench_jpeg(const unsigned char *pixels, int width, int height) {
+    printf("=== Baseline JPEG export (%dx%d) ===\n", width, height);
+    printf("%-8s %9s %9s %9s %9s %9s %9s\n", "Quality", "ADCT bpp", "JPEG bpp", "ADCT dB", "JPEG dB",
+           "enc ms", "dec ms");
+
+    int qualities[3] = {50, 75, 90};
+    for (int q = 0; q < 3; q++) {
+        CodecParams params = codec_default_params();
+        params.block_size = 8;
+        params.quality = qualities[q];
+        BenchResult codec = run_config(pixels, width, height, &params);
+
+        BenchResult jpeg = {1e30, 1e30, 0, 0.0};
+        for (int r = 0; r < BENCH_REPEATS; r++) {
+            clock_t start = clock();
+            unsigned char *file = jpeg_encode(pixels, width, height, qualities[q], &jpeg.size);
+            double encode_ms = elapsed_ms(start);
+
+            int decoded_width, decoded_height;
+            start = clock();
+            unsigned char *decoded = jpeg_decode(file, jpeg.size, &decoded_width, &decoded_height);
+            double decode_ms = elapsed_ms(start);
+
+            if (encode_ms < jpeg.encode_ms) jpeg.encode_ms = encode_ms;
+            if (decode_ms < jpeg.decode_ms) jpeg.decode_ms = decode_ms;
+            jpeg.psnr = plane_psnr(pixels, decoded, (size_t) width * height);
+            free(file);
+            free(decoded);
+        }
+
+        double pixels_count = (double) width * height;
+        printf("%-8d %9.3f %9.3f %9.2f %9.2f %9.1f %9.1f\n", qualities[q], codec.size * 8.0 / pixels_count,
+               jpeg.size * 8.0 / pixels_count, codec.psnr, jpeg.psnr, jpeg.encode_ms, jpeg.decode_ms);
+    }
+    printf("\n");
+}
+
+// Lossless recompression of exported JPEGs: size saved and the cost of both directions
+static void bench_jpeg_recompress(const unsigned char *pixels, int width, int height) {
+    printf("=== JPEG recompression (%dx%d) ===\n", width, height);
+    printf("%-8s %10s %10s %9s %9s %9s\n", "Quality", "JPEG B", "packed B", "saved %", "pack ms", "unpack ms");
+
+    int qualities[3] = {50, 75, 90};
+    for (int q = 0; q < 3; q++) {
+        size_t size, packed_size = 0, restored_size = 0;
+        unsigned char *file = jpeg_encode(pixels, width, height, qualities[q], &size);
+        double pack_ms = 1e30, unpack_ms = 1e30;
+        for (int r = 0; r < BENCH_REPEATS; r++) {
+            clock_t start = clock();
+            unsigned char *packed = jpeg_recompress(file, size, &packed_size);
+            double ms = elapsed_ms(start);
+            if (ms < pack_ms) pack_ms = ms;
+
+            start = clock();
+            unsigned char *restored = jpeg_restore(packed, packed_size, &restored_size);
+            ms = elapsed_ms(start);
+            if (ms < unpack_ms) unpack_ms = ms;
+            free(packed);
+            free(restored);
+        }
+        printf("%-8d %10zu %10zu %9.2f %9.1f %9.1f\n", qualities[q], size, packed_size,
+               100.0 * (1.0 - (double) packed_size / size), pack_ms, unpack_ms);
+        free(file);
+    }
+    printf("\n");
+}
+
+// Default tables only vs per-tile table mode selection from the symbol histograms
+static void bench_table_modes(const unsigned char *pixels, int width, int height) {
+    printf("=== Entropy table selection (%dx%d) ===\n", width, height);
+    printf("%-8s %12s %12s %8s %9s %9s   %s\n", "Tile", "default bpp", "chosen bpp", "saving", "def ms",
+           "chosen ms", "modes default/both/DC/AC");
+
+    int tile_sizes[5] = {16, 32, 64, 256, 0};
+    for (int t = 0; t < 5; t++) {
+        CodecParams params = codec_default_params();
+        params.tile_size = tile_sizes[t];
+        params.optimize_huffman = 0;
+        BenchResult fixed = run_config(pixels, width, height, &params);
+        params.optimize_huffman = 1;
+        BenchResult chosen = run_config(pixels, width, height, &params);
+
+        CodecEncodeStats stats;
+        size_t size;
+        free(codec_encode_with_stats(pixels, width, height, &params, &stats, &size));
+
+        char label[16];
+        if (tile_sizes[t] == 0) {
+            snprintf(label, sizeof(label), "whole");
+        } else {
+            snprintf(label, sizeof(label), "%d", tile_sizes[t]);
+        }
+        printf("%-8s %12.4f %12.4f %7.2f%% %9.1f %9.1f   %zu/%zu/%zu/%zu\n", label,
+               fixed.size * 8.0 / ((double) width * height), chosen.size * 8.0 / ((double) width * height),
+               100.0 * (1.0 - (double) chosen.size / fixed.size), fixed.encode_ms, chosen.encode_ms,
+               stats.table_modes[CODEC_TABLES_DEFAULT], stats.table_modes[CODEC_TABLES_OPTIMIZED],
+               stats.table_modes[CODEC_TABLES_OPTIMIZED_DC], stats.table_modes[CODEC_TABLES_OPTIMIZED_AC]);
+    }
+    printf("\n");
+}
+
+// 8-bit planes against the same image widened to 10, 12 and 16 bits
+static void bench_bit_depth(const unsigned char *pixels, int width, int height) {
+    size_t count = (size_t) width * height;
+    unsigned short *samples = (unsigned short*)malloc(count * sizeof(unsigned short));
+    if (!samples) {
+        fprintf(stderr, "Memory allocation failed when creating benchmark image\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("=== Bit depth (%dx%d, quality 75) ===\n", width, height);
+    printf("%-8s %9s %9s %9s %12s\n", "Depth", "Enc ms", "Dec ms", "bpp", "ns/sample");
+    CodecParams params = codec_default_params();
+    BenchResult base = run_config(pixels, width, height, &params);
+    printf("%-8d %9.1f %9.1f %9.2f %12.1f\n", 8, base.encode_ms, base.decode_ms, base.size * 8.0 / count,
+           (base.encode_ms + base.decode_ms) * 1e6 / count);
+
+    int depths[3] = {10, 12, 16};
+    for (int d = 0; d < 3; d++) {
+        // Low bits carry a little detail the 8-bit plane cannot hold
+        for (size_t k = 0; k < count; k++) {
+            samples[k] = (unsigned short) ((pixels[k] << (depths[d] - 8)) | (k * 7 % (1u << (depths[d] - 8))));
+        }
+        double encode_ms = 1e30, decode_ms = 1e30;
+        size_t size = 0;
+        for (int r = 0; r < BENCH_REPEATS; r++) {
+            clock_t start = clock();
+            unsigned char *stream = codec_encode16(samples, width, height, depths[d], &params, &size);
+            double elapsed = elapsed_ms(start);
+            if (elapsed < encode_ms) encode_ms = elapsed;
+
+            int w, h, depth;
+            start = clock();
+            unsigned short *decoded = codec_decode16(stream, size, &w, &h, &depth);
+            elapsed = elapsed_ms(start);
+            if (elapsed < decode_ms) decode_ms = elapsed;
+            free(stream);
+            free(decoded);
+        }
+        printf("%-8d %9.1f %9.1f %9.2f %12.1f\n", depths[d], encode_ms, decode_ms, size * 8.0 / count,
+               (encode_ms + decode_ms) * 1e6 / count);
+    }
+    printf("\n");
+    free(samples);
+}
+
+// Raster vs Morton super-tile traversal on a wide single-tile image
+static void bench_traversal(void) {
+    int width = 16384;
+    int height = 512;
+    unsigned char *pixels = (unsigned char*)malloc((size_t) width * height);
+    if (!pixels) {
+        fprintf(stderr, "Memory allocation failed when creating benchmark image\n");
+        exit(EXIT_FAILURE);
+    }
+    fill_bench_image(pixels, width, height);
+
+    int counter = llc_counter_open();
+    printf("=== Block traversal (%dx%d, one tile) ===\n", width, height);
+    printf("%-8s %-8s %12s %12s %14s %14s\n", "Block", "Order", "Encode ms", "Decode ms", "Enc LLC miss", "Dec LLC miss");
+
+    int sizes[3] = {8, 16, 32};
+    const char *names[2] = {"raster", "morton"};
+    int orders[2] = {CODEC_TRAVERSAL_RASTER, CODEC_TRAVERSAL_MORTON};
+    for (int s = 0; s < 3; s++) {
+        CodecParams params = codec_default_params();
+        params.block_size = sizes[s];
+        params.tile_size = 0;
+
+        for (int o = 0; o < 2; o++) {
+            codec_set_traversal(orders[o]);
+            BenchResult result = run_config(pixels, width, height, &params);
+            long long encode_misses, decode_misses;
+            count_llc_misses(counter, pixels, width, height, &params, &encode_misses, &decode_misses);
+            if (counter >= 0) {
+                printf("%2dx%-5d %-8s %12.1f %12.1f %14lld %14lld\n", sizes[s], sizes[s], names[o],
+                       result.encode_ms, result.decode_ms, encode_misses, decode_misses);
+            } else {
+                printf("%2dx%-5d %-8s %12.1f %12.1f %14s %14s\n", sizes[s], sizes[s], names[o],
+                       result.encode_ms, result.decode_ms, "n/a", "n/a");
+            }
+        }
+    }
+    codec_set_traversal(CODEC_TRAVERSAL_RASTER);
+    if (counter < 0) {
+        printf("(no hardware cache counters available here)\n");
+    } else {
+        close(counter);
+    }
+    printf("\n");
+
+    free(pixels);
+}
+
+// Malloc vs huge-page backed codec buffers on a multi-hundred-megapixel untiled plane
+static void bench_large_pages(void) {
+    int width = 16384;
+    int height = 16384;
+    unsigned char *pixels = (unsigned char*)malloc((size_t) width * height);
+    if (!pixels) {
+        fprintf(stderr, "Memory allocation failed when creating benchmark image\n");
+        exit(EXIT_FAILURE);
+    }
+    fill_bench_image(pixels, width, height);
+
+    printf("=== Huge-page buffers (%dx%d, %.0f MP, one tile) ===\n", width, height, (double) width * height / 1e6);
+    printf("%-12s %12s %12s %10s\n", "Pages", "Encode ms", "Decode ms", "MP/s");
+
+    CodecParams params = codec_default_params();
+    params.tile_size = 0;
+    const char *names[3] = {"malloc", "transparent", "explicit"};
+    int modes[3] = {LARGE_PAGES_NONE, LARGE_PAGES_TRANSPARENT, LARGE_PAGES_EXPLICIT};
+    for (int m = 0; m < 3; m++) {
+        set_large_pages(modes[m]);
+        struct timespec start, middle, end;
+        size_t size;
+        int decoded_width, decoded_height;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+        clock_gettime(CLOCK_MONOTONIC, &middle);
+        unsigned char *decoded = codec_decode(stream, size, &decoded_width, &decoded_height);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double encode_ms = (middle.tv_sec - start.tv_sec) * 1e3 + (middle.tv_nsec - start.tv_nsec) / 1e6;
+        double decode_ms = (end.tv_sec - middle.tv_sec) * 1e3 + (end.tv_nsec - middle.tv_nsec) / 1e6;
+        printf("%-12s %12.1f %12.1f %10.2f\n", names[m], encode_ms, decode_ms,
+               (double) width * height / 1e3 / (encode_ms + decode_ms));
+        free(stream);
+        free(decoded);
+    }
+    set_large_pages(LARGE_PAGES_NONE);
+    printf("\n");
+
+    free(pixels);
+}
+
+// Random access to many small images: one file each vs one mapped pack
+static void bench_pack(void) {
+    int count = 20000;
+    int distinct = 64;
+    int width = 48;
+    int height = 32;
+    const char *dir = "/tmp/bench_pack_files";
+    const char *pack_path = "/tmp/bench_pack.adpk";
+
+    unsigned char *pixels = (unsigned char*)malloc((size_t) width * height);
+    unsigned char *streams[64];
+    size_t sizes[64];
+    char path[256];
+    if (!pixels) {
+        fprintf(stderr, "Memory allocation failed when creating benchmark image\n");
+        exit(EXIT_FAILURE);
+    }
+    CodecParams params = codec_default_params();
+    for (int d = 0; d < distinct; d++) {
+        fill_bench_image(pixels, width, height);
+        pixels[d] ^= 0x55;
+        streams[d] = codec_encode(pixels, width, height, &params, &sizes[d]);
+    }
+
+    mkdir(dir, 0755);
+    remove(pack_path);
+    PackWriter *writer = pack_writer_open(pack_path);
+    for (int k = 0; k < count; k++) {
+        snprintf(path, sizeof(path), "%s/%d.adct", dir, k);
+        FILE *file = fopen(path, "wb");
+        if (!file || !writer) {
+            fprintf(stderr, "Cannot set up the pack benchmark\n");
+            exit(EXIT_FAILURE);
+        }
+        fwrite(streams[k % distinct], 1, sizes[k % distinct], file);
+        fclose(file);
+        pack_writer_add(writer, (unsigned long long) k, streams[k % distinct], sizes[k % distinct]);
+    }
+    pack_writer_close(writer);
+
+    // Same pseudo-random id sequence for every run; fetch only, then fetch and decode
+    unsigned char *buffer = (unsigned char*)malloc(1 << 16);
+    PackReader *reader = pack_open(pack_path);
+    double ms[2][2];
+    long checksum[2][2] = {{0, 0}, {0, 0}};
+    for (int storage = 0; storage < 2; storage++) {
+        for (int decode = 0; decode < 2; decode++) {
+            unsigned seed = 99;
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int r = 0; r < count; r++) {
+                seed = seed * 1103515245u + 12345u;
+                unsigned id = (seed >> 8) % (unsigned) count;
+                const unsigned char *stream = buffer;
+                size_t size;
+                if (storage == 0) {
+                    snprintf(path, sizeof(path), "%s/%u.adct", dir, id);
+                    FILE *file = fopen(path, "rb");
+                    size = fread(buffer, 1, 1 << 16, file);
+                    fclose(file);
+                } else {
+                    PackEntry entry;
+                    pack_find(reader, id, &entry);
+                    stream = pack_stream(reader, &entry);
+                    size = (size_t) entry.length;
+                }
+                if (decode) {
+                    int w, h;
+                    unsigned char *decoded = codec_decode(stream, size, &w, &h);
+                    checksum[storage][decode] += decoded[0];
+                    free(decoded);
+                } else {
+                    checksum[storage][decode] += stream[size - 1];
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            ms[storage][decode] = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        }
+    }
+    pack_close(reader);
+
+    printf("=== Pack file (%d images of %dx%d, random access) ===\n", count, width, height);
+    printf("%-12s %12s %14s %12s %14s\n", "Storage", "Fetch ms", "Fetches/s", "Decode ms", "Images/s");
+    const char *names[2] = {"files", "pack"};
+    for (int storage = 0; storage < 2; storage++) {
+        printf("%-12s %12.1f %14.0f %12.1f %14.0f\n", names[storage], ms[storage][0], count / (ms[storage][0] / 1e3),
+               ms[storage][1], count / (ms[storage][1] / 1e3));
+    }
+    int same = checksum[0][0] == checksum[1][0] && checksum[0][1] == checksum[1][1];
+    printf("%s\n\n", same ? "(same images fetched)" : "(fetched images differ)");
+
+    for (int k = 0; k < count; k++) {
+        snprintf(path, sizeof(path), "%s/%d.adct", dir, k);
+        remove(path);
+    }
+    rmdir(dir);
+    remove(pack_path);
+    for (int d = 0; d < distinct; d++) free(streams[d]);
+    free(buffer);
+    free(pixels);
+}
+
+// Peak resident set size of the process in MB
+static double peak_rss_mb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+// Strip-wise encode of an image file much larger than the strip buffers
+static void bench_out_of_core(void) {
+    int width = 16384;
+    int height = 8192;
+    int band = 512;
+    const char *input_path = "/tmp/bench_out_of_core.raw";
+    const char *output_path = "/tmp/bench_out_of_core.adct";
+
+    // Written band by band so the benchmark itself never holds the image
+    unsigned char *rows = (unsigned char*)malloc((size_t) width * band);
+    unsigned char *tile = (unsigned char*)malloc((size_t) width * band);
+    FILE *file = fopen(input_path, "wb");
+    if (!rows || !tile || !file) {
+        fprintf(stderr, "Cannot set up the out-of-core benchmark\n");
+        exit(EXIT_FAILURE);
+    }
+    fill_bench_image(tile, width, band);
+    for (int y = 0; y < height; y += band) {
+        for (int i = 0; i < band; i++) {
+            // Shift each band so the content is not periodic
+            memcpy(rows + (size_t) i * width, tile + (size_t) ((i + y / 3) % band) * width, width);
+        }
+        fwrite(rows, 1, (size_t) width * band, file);
+    }
+    fclose(file);
+    free(rows);
+    free(tile);
+
+    CodecParams params = codec_default_params();
+    params.tile_size = 256;
+    double rss_before = peak_rss_mb();
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long long size = 0;
+    int ok = codec_encode_file(input_path, 0, width, height, &params, output_path, &size);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double) (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("=== Out-of-core encoding (%dx%d, %.0f MB input) ===\n", width, height, (double) width * height / 1048576.0);
+    printf("%s: %.2f s, %.1f MP/s, %llu bytes, peak RSS %.1f -> %.1f MB\n\n", ok ? "ok" : "error", seconds,
+           (double) width * height / 1e6 / seconds, size, rss_before, peak_rss_mb());
+
+    remove(input_path);
+    remove(output_path);
+}
+
+int main(int argc, char **argv) {
+    int width = 1024;
+    int height = 1024;
+    if (argc == 3) {
+        width = atoi(argv[1]);
+        height = atoi(argv[2]);
+    }
+
+    unsigned char *pixels = (unsigned char*)malloc((size_t) width * height);
+    if (!pixels) {
+        fprintf(stderr, "Memory allocation failed when creating benchmark image\n");
+        return EXIT_FAILURE;
+    }
+    fill_bench_image(pixels, width, height);
+
+    printf("Benchmark image: %dx%d (%.1f MP), best of %d runs\n\n",
+           width, height, (double) width * height / 1e6, BENCH_REPEATS);
+
+    bench_approximate_dct(pixels, width, height);
+    bench_target_quality(pixels, width, height);
+    bench_deadline(pixels, width, height);
+    bench_autotune(pixels, width, height);
+    bench_blockify(pixels, width, height);
+    bench_sparse(pixels, width, height);
+    bench_decode(pixels, width, height);
+    bench_parallel_decode(pixels, width, height);
+    bench_adaptive_scan(pixels, width, height);
+    bench_table_modes(pixels, width, height);
+    bench_palette(pixels, width, height);
+    bench_jpeg(pixels, width, height);
+    bench_jpeg_recompress(pixels, width, height);
+    bench_bit_depth(pixels, width, height);
+    bench_encode_into(pixels, width, height);
+    bench_traversal();
+    bench_out_of_core();
+    bench_pack();
+    bench_large_pages();
+
+    free(pixels);
+    return 0;
+}
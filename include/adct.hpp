@@ -0,0 +1,380 @@
+/**
+ * adct.hpp - Header-only C++20 interface
+ * Part of Adaptive DCT Image Compressor
+ *
+ * RAII owners for the C contexts and results, plus views over caller
+ * memory so nothing is copied on the way in or out. The block size is a
+ * template parameter: Encoder<8> and Decoder<8> create their contexts for
+ * that size once, and their block views have a static extent, so row
+ * tables live on the stack and no size is checked at run time.
+ *
+ * transform and inverse run a DCT kernel instantiated for the block size,
+ * with constant loop bounds the compiler unrolls and vectorizes, and keep
+ * their intermediate block on the stack. Each output sums in the order of
+ * the C matrix kernel, so results are bit-identical to DCT_KERNEL_MATRIX
+ * and DCT_KERNEL_SSE2 whatever kernel dct_set_default_kernel / tune_apply
+ * picked (the factorized one agrees to rounding). Quantization goes to the
+ * C functions, which take one pointer per row, so a view is handed over
+ * as a small array of row pointers into the caller's buffer.
+ *
+ * Every const method only reads the encoder or decoder, so threads may
+ * share one.
+ */
+
+#ifndef ADCT_HPP
+#define ADCT_HPP
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <codec.h>
+
+namespace adct {
+
+/**
+ * Block sizes the codec supports
+ */
+template <int BlockSize>
+concept SupportedBlockSize = BlockSize == 4 || BlockSize == 8 || BlockSize == 16 || BlockSize == 32;
+
+/**
+ * Non-owning view of an N x N block in caller memory, mdspan-style:
+ * element (i, j) is data[i * stride + j]
+ */
+template <typename T, int N>
+class BlockView {
+public:
+    static constexpr int extent = N;
+
+    /**
+     * View a block whose rows are stride elements apart
+     *
+     * @param data First element of the block
+     * @param stride Distance between rows in elements (N for a packed block)
+     */
+    constexpr explicit BlockView(T *data, std::size_t stride = N) : data_(data), stride_(stride) {}
+
+    /**
+     * View block (block_row, block_col) of a row-major plane
+     *
+     * @param plane First element of the plane
+     * @param width Plane width in elements
+     * @param block_row Block row index
+     * @param block_col Block column index
+     * @return View of that block
+     */
+    static constexpr BlockView in_plane(T *plane, std::size_t width, std::size_t block_row, std::size_t block_col) {
+        return BlockView(plane + block_row * N * width + block_col * N, width);
+    }
+
+    /** A packed N x N array viewed as a block */
+    constexpr BlockView(std::span<T, static_cast<std::size_t>(N) * N> packed) : data_(packed.data()), stride_(N) {}
+
+    /** Const view of the same block */
+    template <typename U = T>
+        requires(!std::is_const_v<U>)
+    constexpr operator BlockView<const U, N>() const { return BlockView<const U, N>(data_, stride_); }
+
+    constexpr T &operator()(std::size_t i, std::size_t j) const { return data_[i * stride_ + j]; }
+    constexpr T *row(std::size_t i) const { return data_ + i * stride_; }
+    constexpr T *data() const { return data_; }
+    constexpr std::size_t stride() const { return stride_; }
+
+private:
+    T *data_;
+    std::size_t stride_;
+};
+
+/**
+ * Non-owning view of a packed 8-bit grayscale image
+ */
+struct ImageView {
+    std::span<const unsigned char> pixels;   // width * height pixels, row-major
+    int width;
+    int height;
+};
+
+namespace detail {
+
+struct DctDeleter {
+    void operator()(DCTContext *ctx) const { dct_free(ctx); }
+};
+
+struct QuantDeleter {
+    void operator()(QuantContext *ctx) const { quant_free(ctx); }
+};
+
+struct FreeDeleter {
+    void operator()(unsigned char *data) const { free(data); }
+};
+
+// Row-pointer table in the form the C kernels take; only pointers are
+// built. The kernels never write their input, so const views are safe.
+template <typename T, int N>
+std::array<std::remove_const_t<T> *, N> rows(BlockView<T, N> view) {
+    std::array<std::remove_const_t<T> *, N> table;
+    for (int i = 0; i < N; i++) {
+        table[i] = const_cast<std::remove_const_t<T> *>(view.row(i));
+    }
+    return table;
+}
+
+// c = a * b for N x N operands given as (row, column) accessors. Every
+// element is summed from 0.0 over k in ascending order, as matrix_multiply
+// in dct.c does; only the loop nest differs, so that j runs innermost.
+template <int N, typename A, typename B, typename C>
+void multiply(A a, B b, C c) {
+    for (int i = 0; i < N; i++) {
+        double row[N] = {};
+        for (int k = 0; k < N; k++) {
+            double scale = a(i, k);
+            for (int j = 0; j < N; j++) {
+                row[j] += scale * b(k, j);
+            }
+        }
+        for (int j = 0; j < N; j++) {
+            c(i, j, row[j]);
+        }
+    }
+}
+
+// Exact DCT basis of one block size, copied from a DCTContext into contiguous storage
+template <int N>
+class Basis {
+public:
+    explicit Basis(const DCTContext *ctx) {
+        for (int i = 0; i < N; i++) {
+            for (int j = 0; j < N; j++) {
+                matrix_[i * N + j] = ctx->dct_matrix[i][j];
+                transposed_[i * N + j] = ctx->transposed_dct[i][j];
+            }
+        }
+    }
+
+    // output = DCT * (input * DCT^T), rows first like dct_forward
+    template <typename In, typename Out>
+    void forward(BlockView<In, N> input, BlockView<Out, N> output) const {
+        double scratch[N][N];
+        multiply<N>([&](int i, int k) { return static_cast<double>(input(i, k)); },
+                    [&](int k, int j) { return transposed_[k * N + j]; },
+                    [&](int i, int j, double v) { scratch[i][j] = v; });
+        multiply<N>([&](int i, int k) { return matrix_[i * N + k]; },
+                    [&](int k, int j) { return scratch[k][j]; },
+                    [&](int i, int j, double v) { output(i, j) = v; });
+    }
+
+    // output = (DCT^T * input) * DCT, columns first like dct_inverse
+    template <typename In, typename Out>
+    void inverse(BlockView<In, N> input, BlockView<Out, N> output) const {
+        double scratch[N][N];
+        multiply<N>([&](int i, int k) { return transposed_[i * N + k]; },
+                    [&](int k, int j) { return static_cast<double>(input(k, j)); },
+                    [&](int i, int j, double v) { scratch[i][j] = v; });
+        multiply<N>([&](int i, int k) { return scratch[i][k]; },
+                    [&](int k, int j) { return matrix_[k * N + j]; },
+                    [&](int i, int j, double v) { output(i, j) = v; });
+    }
+
+private:
+    std::array<double, N * N> matrix_;
+    std::array<double, N * N> transposed_;
+};
+
+// Buffer allocated by the C codec, released with free()
+class Buffer {
+public:
+    Buffer() = default;
+    Buffer(unsigned char *data, std::size_t size) : data_(data), size_(data ? size : 0) {}
+
+    explicit operator bool() const { return data_ != nullptr; }
+    std::span<const unsigned char> bytes() const { return {data_.get(), size_}; }
+    const unsigned char *data() const { return data_.get(); }
+    std::size_t size() const { return size_; }
+
+    /** Hand the buffer to C code, which must free() it */
+    unsigned char *release() {
+        size_ = 0;
+        return data_.release();
+    }
+
+private:
+    std::unique_ptr<unsigned char, FreeDeleter> data_;
+    std::size_t size_ = 0;
+};
+
+} // namespace detail
+
+using DctHandle = std::unique_ptr<DCTContext, detail::DctDeleter>;
+using QuantHandle = std::unique_ptr<QuantContext, detail::QuantDeleter>;
+
+/**
+ * Compressed stream owned by the caller; empty if encoding failed
+ */
+class Stream : public detail::Buffer {
+public:
+    using Buffer::Buffer;
+};
+
+/**
+ * Decoded image owned by the caller; empty if decoding failed
+ */
+class Image : public detail::Buffer {
+public:
+    Image() = default;
+    Image(unsigned char *pixels, int width, int height)
+        : Buffer(pixels, static_cast<std::size_t>(width) * height), width_(pixels ? width : 0),
+          height_(pixels ? height : 0) {}
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    ImageView view() const { return {bytes(), width_, height_}; }
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+};
+
+/**
+ * Encoder for one block size
+ */
+template <int BlockSize>
+    requires SupportedBlockSize<BlockSize>
+class Encoder {
+public:
+    using PixelBlock = BlockView<const double, BlockSize>;
+    using CoeffBlock = BlockView<double, BlockSize>;
+    using QuantBlock = BlockView<int, BlockSize>;
+
+    /**
+     * @param quality Quality factor (1-100)
+     * @param adaptive Adaptive quantization
+     */
+    explicit Encoder(int quality = 75, bool adaptive = false)
+        : dct_(dct_init(BlockSize)), quant_(quant_init(BlockSize, quality, adaptive)), basis_(dct_.get()),
+          quality_(quality), adaptive_(adaptive) {}
+
+    /**
+     * Forward DCT of a level-shifted block with the fixed-size kernel
+     *
+     * @param pixels Input samples centered around zero
+     * @param coeffs Output coefficients (may overlap the input)
+     */
+    void transform(PixelBlock pixels, CoeffBlock coeffs) const { basis_.forward(pixels, coeffs); }
+
+    /**
+     * Quantize a block of coefficients
+     *
+     * @param coeffs DCT coefficients
+     * @param quantized Output quantized coefficients
+     * @param variance Block variance (used when adaptive)
+     */
+    void quantize(BlockView<const double, BlockSize> coeffs, QuantBlock quantized, double variance = 0.0) const {
+        auto in = detail::rows(coeffs);
+        auto out = detail::rows(quantized);
+        ::quantize(quant_.get(), in.data(), out.data(), variance);
+    }
+
+    /**
+     * Encode a whole image; params.block_size is forced to BlockSize
+     *
+     * @param image Pixels to encode (width * height bytes)
+     * @param params Encoder parameters (quality and adaptive default to the encoder's)
+     * @return Owned stream, empty on invalid input
+     */
+    Stream encode(ImageView image, CodecParams params) const {
+        if (image.width <= 0 || image.height <= 0 ||
+            image.pixels.size() != static_cast<std::size_t>(image.width) * image.height) {
+            return {};
+        }
+        params.block_size = BlockSize;
+        std::size_t size = 0;
+        unsigned char *stream = codec_encode(image.pixels.data(), image.width, image.height, &params, &size);
+        return Stream(stream, size);
+    }
+
+    Stream encode(ImageView image) const {
+        CodecParams params = codec_default_params();
+        params.quality = quality_;
+        params.adaptive = adaptive_;
+        return encode(image, params);
+    }
+
+    DCTContext *dct() const { return dct_.get(); }
+    QuantContext *quant() const { return quant_.get(); }
+
+private:
+    DctHandle dct_;
+    QuantHandle quant_;
+    detail::Basis<BlockSize> basis_;
+    int quality_;
+    bool adaptive_;
+};
+
+/**
+ * Decoder for one block size
+ */
+template <int BlockSize>
+    requires SupportedBlockSize<BlockSize>
+class Decoder {
+public:
+    using QuantBlock = BlockView<const int, BlockSize>;
+    using CoeffBlock = BlockView<double, BlockSize>;
+
+    /**
+     * @param quality Quality factor the blocks were quantized with
+     * @param adaptive Adaptive quantization
+     */
+    explicit Decoder(int quality = 75, bool adaptive = false)
+        : dct_(dct_init(BlockSize)), quant_(quant_init(BlockSize, quality, adaptive)), basis_(dct_.get()) {}
+
+    /**
+     * Dequantize a block
+     *
+     * @param quantized Quantized coefficients
+     * @param coeffs Output coefficients
+     * @param variance Block variance (used when adaptive)
+     */
+    void dequantize(QuantBlock quantized, CoeffBlock coeffs, double variance = 0.0) const {
+        auto in = detail::rows(quantized);
+        auto out = detail::rows(coeffs);
+        ::dequantize(quant_.get(), in.data(), out.data(), variance);
+    }
+
+    /**
+     * Inverse DCT back to level-shifted samples with the fixed-size kernel
+     *
+     * @param coeffs Input coefficients
+     * @param pixels Output samples (may overlap the input)
+     */
+    void inverse(BlockView<const double, BlockSize> coeffs, CoeffBlock pixels) const {
+        basis_.inverse(coeffs, pixels);
+    }
+
+    /**
+     * Decode a stream
+     * Streams carry their own block size; any codec stream decodes.
+     *
+     * @param stream Compressed bytes
+     * @return Owned image, empty on a malformed stream
+     */
+    Image decode(std::span<const unsigned char> stream) const {
+        int width = 0;
+        int height = 0;
+        unsigned char *pixels = codec_decode(stream.data(), stream.size(), &width, &height);
+        return Image(pixels, width, height);
+    }
+
+    DCTContext *dct() const { return dct_.get(); }
+    QuantContext *quant() const { return quant_.get(); }
+
+private:
+    DctHandle dct_;
+    QuantHandle quant_;
+    detail::Basis<BlockSize> basis_;
+};
+
+} // namespace adct
+
+#endif /* ADCT_HPP */
@@ -0,0 +1,96 @@
+/**
+ * blockify.h - Header file for raster / block-major reordering
+ * Part of Adaptive DCT Image Compressor
+ *
+ * Converts a region of an 8-bit raster plane into contiguous level-shifted
+ * int16 blocks and back, so the transform stages read and write each block
+ * as one run of memory instead of block_size rows of the plane. Blocks are
+ * stored one after another in raster block order; inside a block, samples
+ * are row-major. The 16-bit variants do the same for planes of 9- to
+ * 16-bit samples, whose level-shifted values still fit an int16.
+ */
+
+#ifndef BLOCKIFY_H
+#define BLOCKIFY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Reorder a region of a raster plane into block-major int16 samples minus 128
+ * Columns at or past width repeat column width - 1 and rows at or past
+ * height repeat row height - 1, matching the codec's edge padding.
+ *
+ * @param plane Top-left pixel of the region
+ * @param stride Distance between plane rows in bytes
+ * @param width Valid columns from the region's left edge (at least 1)
+ * @param height Valid rows from the region's top edge (at least 1)
+ * @param block_size Block edge (4, 8, 16 or 32)
+ * @param cols Blocks across the region
+ * @param rows Blocks down the region
+ * @param blocks Output of cols * rows * block_size^2 samples
+ */
+void blockify(const unsigned char *plane, size_t stride, int width, int height,
+              int block_size, int cols, int rows, short *blocks);
+
+/**
+ * Write block-major samples back to a raster plane, adding 128 and
+ * saturating to 0-255; pixels at or past width / height are dropped
+ *
+ * @param blocks cols * rows * block_size^2 samples in blockify's order
+ * @param block_size Block edge (4, 8, 16 or 32)
+ * @param cols Blocks across the region
+ * @param rows Blocks down the region
+ * @param plane Top-left pixel of the region
+ * @param stride Distance between plane rows in bytes
+ * @param width Columns to write from the region's left edge
+ * @param height Rows to write from the region's top edge
+ */
+void unblockify(const short *blocks, int block_size, int cols, int rows,
+                unsigned char *plane, size_t stride, int width, int height);
+
+/**
+ * Reorder a region of a 16-bit raster plane into block-major samples minus 2^(bit_depth - 1)
+ * Edges are replicated as in blockify. Samples must be below 2^bit_depth.
+ *
+ * @param plane Top-left sample of the region
+ * @param stride Distance between plane rows in samples
+ * @param width Valid columns from the region's left edge (at least 1)
+ * @param height Valid rows from the region's top edge (at least 1)
+ * @param bit_depth Bits per sample (9-16)
+ * @param block_size Block edge (4, 8, 16 or 32)
+ * @param cols Blocks across the region
+ * @param rows Blocks down the region
+ * @param blocks Output of cols * rows * block_size^2 samples
+ */
+void blockify16(const unsigned short *plane, size_t stride, int width, int height, int bit_depth,
+                int block_size, int cols, int rows, short *blocks);
+
+/**
+ * Write block-major samples back to a 16-bit raster plane, adding
+ * 2^(bit_depth - 1) and saturating to 0 - 2^bit_depth - 1; pixels at or past
+ * width / height are dropped
+ *
+ * @param blocks cols * rows * block_size^2 samples in blockify16's order
+ * @param block_size Block edge (4, 8, 16 or 32)
+ * @param cols Blocks across the region
+ * @param rows Blocks down the region
+ * @param bit_depth Bits per sample (9-16)
+ * @param plane Top-left sample of the region
+ * @param stride Distance between plane rows in samples
+ * @param width Columns to write from the region's left edge
+ * @param height Rows to write from the region's top edge
+ */
+void unblockify16(const short *blocks, int block_size, int cols, int rows, int bit_depth,
+                  unsigned short *plane, size_t stride, int width, int height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLOCKIFY_H */
@@ -0,0 +1,379 @@
+/**
+ * codec.h - Header file for the plane-level image codec
+ * Part of Adaptive DCT Image Compressor
+ *
+ * Ties the DCT, quantization and entropy stages together into a tiled
+ * stream. Each tile is an independently decodable segment, located through
+ * an index that follows the stream header:
+ *
+ *   header (32 bytes) | index (tile_count x 12 bytes) | scan order | tile segments
+ *
+ * The scan order is only present with CODEC_FLAG_ADAPTIVE_SCAN: a u16
+ * count, then the natural index (row * block_size + column) of that many
+ * AC positions, coded right after DC, one byte each for blocks up to 16x16
+ * and two bytes for 32x32 (all little-endian). The remaining AC positions
+ * follow in zigzag order. Index offsets are relative to the first tile
+ * segment.
+ *
+ * Header byte 7 holds the bit depth of streams from codec_encode16 (9-16)
+ * and is 0 for 8-bit streams. Deeper samples are level shifted by
+ * 2^(bit_depth - 1) and quantized with steps scaled by 2^(bit_depth - 8)
+ * (see quant_set_bit_depth), so every other stage is shared.
+ *
+ * With CODEC_FLAG_PALETTE, every block of a tile whose table mode byte has
+ * CODEC_TILE_PALETTE set starts with a mode bit. A 1 marks a
+ * palette block: a bit that reuses the colors of the tile's previous
+ * palette block, or else two bits of color count minus one and the colors
+ * as bit_depth-bit samples, then one index per sample in row-major order
+ * (no bits for one color, 1 bit for two, 2 bits for three or four).
+ * Palette blocks are exact, carry no level byte and leave the DC predictor
+ * alone.
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils.h>
+#include <dct.h>
+#include <quantization.h>
+#include <entropy.h>
+#include <metrics.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CODEC_VERSION 1
+#define CODEC_HEADER_SIZE 32
+#define CODEC_INDEX_ENTRY_SIZE 12
+
+#define CODEC_MAX_BIT_DEPTH 16           // Deepest samples codec_encode16 takes
+
+#define CODEC_FLAG_ADAPTIVE 0x1          // Blocks carry an adaptive quantization level
+#define CODEC_FLAG_OPTIMIZE_HUFFMAN 0x2  // Tiles may carry their own Huffman tables
+#define CODEC_FLAG_QUADTREE 0x4          // 32x32 regions are split into 4x4 to 32x32 blocks
+#define CODEC_FLAG_APPROX_DCT 0x8        // Multiplierless approximate transform for 4x4 and 8x8 blocks
+#define CODEC_FLAG_ADAPTIVE_SCAN 0x10    // Coefficients follow a per-image scan order instead of the zigzag
+#define CODEC_FLAG_PALETTE 0x20          // Blocks of few distinct samples may be coded as a palette
+
+#define CODEC_PALETTE_COLORS 4           // Most distinct samples a palette block holds
+
+/**
+ * Structure to hold encoder parameters
+ */
+typedef struct {
+    int block_size;          // Transform block size (4, 8, 16 or 32)
+    int quality;             // Quality factor (1-100)
+    int adaptive;            // Adaptive quantization (0 = off, 1 = on)
+    int tile_size;           // Tile edge in pixels, rounded up to a multiple of block_size (0 = one tile)
+    int optimize_huffman;    // Per-tile optimized Huffman tables (1) or the default tables (0)
+    int quadtree;            // Choose the block size per region by quadtree split (block_size is ignored)
+    int approximate_dct;     // Use the multiplierless approximate DCT (fast preview quality)
+    int adaptive_scan;       // Derive the scan order from coefficient statistics (ignored with quadtree)
+    int palette;             // Code blocks of at most CODEC_PALETTE_COLORS samples as a palette (ignored with quadtree)
+    double time_budget_ms;   // Encode time budget; effort is shed when behind (0 = no deadline)
+} CodecParams;
+
+/*
+ * Entropy table modes, recorded in the first byte of every tile segment.
+ * With CODEC_FLAG_OPTIMIZE_HUFFMAN the encoder estimates the size of the
+ * tile under each mode from its symbol histograms (table bytes included)
+ * and keeps the smallest; otherwise every tile uses the default tables.
+ */
+#define CODEC_TABLES_DEFAULT 0       // Default DC and AC tables
+#define CODEC_TABLES_OPTIMIZED 1     // Optimized DC and AC tables, carried in the tile
+#define CODEC_TABLES_OPTIMIZED_DC 2  // Optimized DC table, default AC table
+#define CODEC_TABLES_OPTIMIZED_AC 3  // Default DC table, optimized AC table
+#define CODEC_TABLES_MODES 4
+#define CODEC_TILE_PALETTE 0x80      // Mode byte bit: the tile's blocks carry a palette mode bit
+
+/**
+ * Structure to report how an encode went
+ */
+typedef struct {
+    int effort;              // CODEC_EFFORT_* level in use when the encode finished
+    double elapsed_ms;       // Wall-clock encode time
+    size_t degraded_rows;    // Block rows coded below full effort
+    size_t total_rows;       // Block rows in the stream, counted per tile
+    size_t table_modes[CODEC_TABLES_MODES]; // Tiles coded in each CODEC_TABLES_* mode
+    size_t palette_blocks;   // Blocks coded as a palette (CODEC_FLAG_PALETTE)
+} CodecEncodeStats;
+
+#define CODEC_EFFORT_FULL 3            // Everything the parameters ask for
+#define CODEC_EFFORT_NO_RDO 2          // Quadtree regions use fixed 8x8 blocks instead of the RD search
+#define CODEC_EFFORT_DEFAULT_TABLES 1  // Also the default Huffman tables instead of optimized ones
+#define CODEC_EFFORT_STATIC_QUANT 0    // Also the static quantization matrix instead of adaptive
+
+#define CODEC_TRAVERSAL_RASTER 0  // Transform stages walk blocks in raster order across the tile
+#define CODEC_TRAVERSAL_MORTON 1  // 64x64 super-tiles in raster order, blocks in Morton order inside
+
+#define CODEC_TARGET_PSNR 0       // Target a minimum PSNR in dB
+#define CODEC_TARGET_SSIM 1       // Target a minimum SSIM (0-1)
+
+/**
+ * Structure to describe a quality floor for codec_encode_target
+ */
+typedef struct {
+    int metric;              // CODEC_TARGET_PSNR or CODEC_TARGET_SSIM
+    double threshold;        // Minimum value of the metric
+} CodecTarget;
+
+/**
+ * Structure to report how codec_encode_target met its target
+ */
+typedef struct {
+    int quality;             // Quality factor of the returned stream
+    double achieved;         // Metric measured on the decoded stream
+    int estimates;           // Candidate qualities evaluated in the DCT domain
+    int encodes;             // Full encode/decode verifications performed
+} CodecTargetResult;
+
+/**
+ * Structure to describe a rectangle of pixels
+ */
+typedef struct {
+    int x;                   // Left column
+    int y;                   // Top row
+    int width;               // Width in pixels
+    int height;              // Height in pixels
+} CodecRect;
+
+/**
+ * Get the default encoder parameters
+ *
+ * @return Default parameters (8x8 blocks, quality 75, 64x64 tiles, optimized tables)
+ */
+CodecParams codec_default_params(void);
+
+/**
+ * Encode an 8-bit grayscale plane into a tiled stream
+ *
+ * @param pixels Pixel data, row-major, width * height bytes
+ * @param width Width of the image
+ * @param height Height of the image
+ * @param params Encoder parameters
+ * @param out_size Set to the size of the returned stream in bytes
+ * @return Newly allocated stream, or NULL if the parameters are invalid
+ */
+unsigned char* codec_encode(const unsigned char *pixels, int width, int height,
+                            const CodecParams *params, size_t *out_size);
+
+/**
+ * Encode a plane of 9- to 16-bit samples into a tiled stream
+ * Samples go through the same double-precision transform and quantization
+ * as 8-bit planes (only the level shift and the steps depend on the depth),
+ * so the cost per sample is close to codec_encode's. Streams decode with
+ * codec_decode16; the 8-bit decoders refuse them.
+ *
+ * @param pixels Samples, row-major, width * height values below 2^bit_depth
+ * @param width Width of the image
+ * @param height Height of the image
+ * @param bit_depth Bits per sample (9 to CODEC_MAX_BIT_DEPTH)
+ * @param params Encoder parameters
+ * @param out_size Set to the size of the returned stream in bytes
+ * @return Newly allocated stream, or NULL if the parameters are invalid
+ */
+unsigned char* codec_encode16(const unsigned short *pixels, int width, int height, int bit_depth,
+                              const CodecParams *params, size_t *out_size);
+
+/**
+ * Encode like codec_encode and report the effort that was used
+ * With a time budget, elapsed time is checked after every block row against
+ * a linear schedule; each time the encoder is behind it drops one effort
+ * level (no RD search, then default Huffman tables, then static
+ * quantization) and it climbs back when well ahead. The stream format is
+ * unchanged, so any mix of effort levels decodes.
+ *
+ * @param pixels Pixel data, row-major, width * height bytes
+ * @param width Width of the image
+ * @param height Height of the image
+ * @param params Encoder parameters
+ * @param stats Filled with the final effort level, timing and table modes (may be NULL)
+ * @param out_size Set to the size of the returned stream in bytes
+ * @return Newly allocated stream, or NULL if the parameters are invalid
+ */
+unsigned char* codec_encode_with_stats(const unsigned char *pixels, int width, int height,
+                                       const CodecParams *params, CodecEncodeStats *stats, size_t *out_size);
+
+/**
+ * Encode at the lowest quality factor that still meets a quality floor
+ * The image is transformed once; candidate qualities are then scored by
+ * re-quantizing the cached coefficients and measuring the error in the DCT
+ * domain. The chosen candidate is then encoded, decoded and measured on
+ * pixels, and full encodes search down from it if it passes or up if the
+ * estimate was optimistic, until the returned quality passes and the one
+ * below it fails. The search assumes the metric grows with the quality; on
+ * the rare images where it does not, a lower quality further down may pass
+ * as well. SSIM is estimated per block and verified with plane_ssim. If the
+ * floor cannot be met, the quality 100 stream is returned and
+ * result->achieved falls short.
+ *
+ * @param pixels Pixel data, row-major, width * height bytes
+ * @param width Width of the image
+ * @param height Height of the image
+ * @param params Encoder parameters (quality is ignored)
+ * @param target Metric and threshold to reach
+ * @param result Filled with the chosen quality and search statistics (may be NULL)
+ * @param out_size Set to the size of the returned stream in bytes
+ * @return Newly allocated stream, or NULL if the parameters are invalid
+ */
+unsigned char* codec_encode_target(const unsigned char *pixels, int width, int height,
+                                   const CodecParams *params, const CodecTarget *target,
+                                   CodecTargetResult *result, size_t *out_size);
+
+/**
+ * Get the largest stream codec_encode can produce for an image
+ * The bound follows from the format: every coefficient coded with the
+ * longest Huffman code (HUFF_MAX_CODE_LEN) and the largest magnitude
+ * category the clamped coefficients allow, the worst quadtree partition,
+ * optimized tables of every symbol, and byte padding per tile. It depends
+ * only on the dimensions and parameters, never on the pixels.
+ *
+ * @param width Width of the image
+ * @param height Height of the image
+ * @param params Encoder parameters
+ * @return Bound in bytes, or 0 if the parameters are invalid or the bound does not fit a size_t
+ */
+size_t codec_max_compressed_size(int width, int height, const CodecParams *params);
+
+/**
+ * Encode into a caller-provided buffer, with no allocation for the output
+ * A buffer of codec_max_compressed_size bytes always suffices and can be
+ * reused across calls; the stream is identical to codec_encode's.
+ *
+ * @param pixels Raw pixel data (row-major, 8 bits per pixel)
+ * @param width Width of the image
+ * @param height Height of the image
+ * @param params Encoder parameters
+ * @param output Buffer to write the stream into
+ * @param capacity Size of the buffer in bytes
+ * @return Size of the stream in bytes, or 0 if the parameters are invalid or the buffer is too small
+ */
+size_t codec_encode_into(const unsigned char *pixels, int width, int height, const CodecParams *params,
+                         unsigned char *output, size_t capacity);
+
+/**
+ * Validate a stream's header and index and report its dimensions
+ * Nothing is decoded, so this costs the same whatever the image size.
+ *
+ * @param stream Encoded stream
+ * @param size Size of the stream in bytes
+ * @param width Set to the width of the image
+ * @param height Set to the height of the image
+ * @return 1 if the stream is well formed, 0 otherwise
+ */
+int codec_stream_info(const unsigned char *stream, size_t size, int *width, int *height);
+
+/**
+ * Decode a stream produced by codec_encode
+ *
+ * @param stream Encoded stream
+ * @param size Size of the stream in bytes
+ * @param width Set to the width of the image
+ * @param height Set to the height of the image
+ * @return Newly allocated pixel data, or NULL if the stream is invalid or deeper than 8 bits
+ */
+unsigned char* codec_decode(const unsigned char *stream, size_t size, int *width, int *height);
+
+/**
+ * Decode a stream of any bit depth into 16-bit samples
+ * 8-bit streams decode as codec_decode would, widened to 16 bits.
+ *
+ * @param stream Encoded stream
+ * @param size Size of the stream in bytes
+ * @param width Set to the width of the image
+ * @param height Set to the height of the image
+ * @param bit_depth Set to the bits per sample of the stream (8-16)
+ * @return Newly allocated samples, or NULL if the stream is invalid
+ */
+unsigned short* codec_decode16(const unsigned char *stream, size_t size, int *width, int *height,
+                               int *bit_depth);
+
+/**
+ * Decode a stream on several threads, whatever its tile layout
+ * The calling thread entropy decodes the tiles in order into a sparse
+ * coefficient store and publishes each finished block row through an
+ * atomic counter; the other threads dequantize, inverse transform and
+ * write published rows as they appear, and the caller joins them once the
+ * stream is read. The image is identical to codec_decode's.
+ *
+ * @param stream Encoded stream
+ * @param size Size of the stream in bytes
+ * @param threads Reconstruction threads started next to the caller (below 1 decodes serially; threads
+ *                that cannot be created leave their rows to the others and the caller)
+ * @param width Set to the width of the image
+ * @param height Set to the height of the image
+ * @return Newly allocated pixel data, or NULL if the stream is invalid or deeper than 8 bits
+ */
+unsigned char* codec_decode_parallel(const unsigned char *stream, size_t size, int threads,
+                                     int *width, int *height);
+
+/**
+ * Encode a raw 8-bit image file into a stream file with bounded memory
+ * The input is read one tile row at a time (pread) and each tile segment is
+ * written as soon as it is coded, with the index filled in once per tile
+ * row, so memory use is about tile_size input rows plus one tile whatever
+ * the image height. The stream is identical to codec_encode's.
+ *
+ * @param input_path File of row-major pixels (width * height bytes from input_offset)
+ * @param input_offset Byte offset of the first pixel (e.g. past a PGM header)
+ * @param width Width of the image
+ * @param height Height of the image
+ * @param params Encoder parameters; tile_size must be positive
+ * @param output_path Stream file to create (replaced if present)
+ * @param out_size Set to the size of the stream in bytes (may be NULL)
+ * @return 1 on success, 0 on invalid parameters or an I/O error
+ */
+int codec_encode_file(const char *input_path, unsigned long long input_offset, int width, int height,
+                      const CodecParams *params, const char *output_path, unsigned long long *out_size);
+
+/**
+ * Set the order in which the encoder and decoder transform blocks
+ * The entropy-coded stream keeps raster order either way, so streams are
+ * identical; only the memory access pattern changes. Super-tiles keep the
+ * working set of wide tiles (tile_size 0 or large tiles) within a few
+ * pages, at the cost of buffering one band of coefficients in the decoder.
+ * Quadtree streams always walk their regions in raster order. The setting
+ * is process-wide and atomic, and every tile coder takes its value when it
+ * is set up, so changing it while other threads code is safe and only
+ * affects coders set up afterwards. `just bench` compares the two orders,
+ * with LLC miss counts where the PMU is exposed.
+ *
+ * @param traversal CODEC_TRAVERSAL_* value (default CODEC_TRAVERSAL_RASTER)
+ */
+void codec_set_traversal(int traversal);
+
+/**
+ * Get the block traversal order in use
+ *
+ * @return CODEC_TRAVERSAL_* value
+ */
+int codec_traversal(void);
+
+/**
+ * Re-encode only the tiles touched by a set of dirty rectangles
+ * Untouched tile segments are copied from the old stream and the index is
+ * rebuilt, so the cost scales with the edited area rather than the image.
+ * The result is identical to encoding the new pixels from scratch. With
+ * CODEC_FLAG_ADAPTIVE_SCAN an edit that changes the sampled scan order
+ * re-codes every tile, since each one depends on the order.
+ *
+ * @param stream Previously encoded stream
+ * @param size Size of the stream in bytes
+ * @param pixels New pixel data for the whole image (same dimensions)
+ * @param rects Rectangles that changed since the stream was encoded
+ * @param rect_count Number of rectangles
+ * @param out_size Set to the size of the returned stream in bytes
+ * @return Newly allocated stream, or NULL if the old stream is invalid or deeper than 8 bits
+ */
+unsigned char* codec_reencode_dirty(const unsigned char *stream, size_t size, const unsigned char *pixels,
+                                    const CodecRect *rects, int rect_count, size_t *out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CODEC_H */
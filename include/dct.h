@@ -12,8 +12,17 @@
 #include <string.h>
 #include <utils.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define PI 3.14159265358979323846
 
+#define DCT_KERNEL_MATRIX 0       // Separable matrix multiplication
+#define DCT_KERNEL_FACTORIZED 1   // Even/odd butterfly, half the multiplications (rounds differently)
+#define DCT_KERNEL_SSE2 2         // Matrix multiplication two columns at a time, bit-exact (SSE2 builds only)
+#define DCT_KERNEL_COUNT 3
+
 /**
  * Structure to hold DCT context information
  * This helps with supporting variable block sizes
@@ -22,17 +31,68 @@ typedef struct {
     int block_size;          // Block size (4, 8, 16, etc.)
     double **dct_matrix;     // Pre-computed DCT matrix
     double **transposed_dct; // Transposed DCT matrix for fast IDCT
+    int approximate;         // Multiplierless approximation in use (1) or exact DCT (0)
+    double *row_norms;       // Norm of each basis row (all 1.0 for the exact DCT)
+    int kernel;              // DCT_KERNEL_* used by the exact transform
 } DCTContext;
 
 /**
  * Initialize DCT context with given block size
- * This precomputes the DCT matrix for faster transforms
+ * This precomputes the DCT matrix for faster transforms. The kernel is the
+ * default for the block size (see dct_set_default_kernel).
  *
  * @param block_size Size of the block (must be power of 2: 4, 8, 16, etc.)
  * @return Initialized DCT context
  */
 DCTContext* dct_init(int block_size);
 
+/**
+ * Initialize DCT context using a multiplierless approximation of the DCT
+ * The 4-point transform is the H.264 integer core transform and the 8-point
+ * transform is the Cintra-Bayer (2011) approximation; both only need
+ * additions and shifts. Their basis rows are orthogonal but not unit length,
+ * so the forward output is scaled by row_norms[u] * row_norms[v] relative to
+ * the exact DCT, and dct_inverse expects coefficients divided by the same
+ * factor. quant_apply_transform_scale folds both into the quantization tables.
+ * Other block sizes fall back to the exact transform (approximate == 0).
+ *
+ * At quality 75 this costs about 0.2 dB PSNR for 4x4 and 2.3 dB for 8x8
+ * blocks; `just bench` prints the current figures.
+ *
+ * @param block_size Size of the block (4 or 8 for the approximation)
+ * @return Initialized DCT context
+ */
+DCTContext* dct_init_approximate(int block_size);
+
+/**
+ * Check whether a kernel can run in this build
+ *
+ * @param kernel DCT_KERNEL_* value
+ * @return 1 if available, 0 otherwise
+ */
+int dct_kernel_available(int kernel);
+
+/**
+ * Set the kernel that dct_init picks for a block size
+ * Meant to be called once at startup (e.g. by tune_apply), before any
+ * context is created; unavailable kernels are ignored. The matrix and SSE2
+ * kernels give identical results; the factorized one sums in another order,
+ * so streams and decoded pixels can differ from theirs in the last bit of
+ * rounding, and tune_measure never picks it.
+ *
+ * @param block_size Block size (4, 8, 16 or 32)
+ * @param kernel DCT_KERNEL_* value
+ */
+void dct_set_default_kernel(int block_size, int kernel);
+
+/**
+ * Get the kernel that dct_init picks for a block size
+ *
+ * @param block_size Block size
+ * @return DCT_KERNEL_* value (DCT_KERNEL_MATRIX for untuned sizes)
+ */
+int dct_default_kernel(int block_size);
+
 /**
  * Free DCT context resources
  *
@@ -42,7 +102,8 @@ void dct_free(DCTContext *ctx);
 
 /**
  * Forward DCT transform (DCT-II)
- * Takes input block and writes frequency coefficients to output block
+ * Takes input block and writes frequency coefficients to output block.
+ * Only reads the context, so threads may transform with a shared one.
  *
  * @param ctx DCT context containing precomputed matrices
  * @param input Input block in spatial domain (size: block_size x block_size)
@@ -52,7 +113,8 @@ void dct_forward(DCTContext *ctx, double **input, double **output);
 
 /**
  * Inverse DCT transform (IDCT)
- * Takes frequency coefficients and reconstructs the spatial domain block
+ * Takes frequency coefficients and reconstructs the spatial domain block.
+ * Only reads the context, like dct_forward.
  *
  * @param ctx DCT context containing precomputed matrices
  * @param input Input block of frequency coefficients (size: block_size x block_size)
@@ -60,6 +122,19 @@ void dct_forward(DCTContext *ctx, double **input, double **output);
  */
 void dct_inverse(DCTContext *ctx, double **input, double **output);
 
+/**
+ * Inverse DCT of a block whose nonzero coefficients lie in its top-left corner
+ * Gives the same output as dct_inverse while skipping the zero rows and
+ * columns; approximate contexts use the full transform. Only reads the
+ * context, like dct_forward.
+ *
+ * @param ctx DCT context containing precomputed matrices
+ * @param input Coefficients, zero outside the top-left extent x extent square
+ * @param output Output block for reconstructed spatial data
+ * @param extent Rows and columns of the corner that may be nonzero
+ */
+void dct_inverse_sparse(DCTContext *ctx, double **input, double **output, int extent);
+
 /**
  * Helper function to create and initialize a block from pixel data
  *
@@ -70,7 +145,8 @@ void dct_inverse(DCTContext *ctx, double **input, double **output);
  * @param block_size Size of the block to create
  * @return Initialized block with pixel data centered around zero
  */
-double** create_block_from_pixels(unsigned char *pixels, int width, int row_start, int col_start, int block_size);
+double** create_block_from_pixels(const unsigned char *pixels, size_t width, size_t row_start, size_t col_start,
+                                  int block_size);
 
 /**
  * Helper function to copy coefficients back to integer array
@@ -81,5 +157,9 @@ double** create_block_from_pixels(unsigned char *pixels, int width, int row_star
  */
 void copy_block_to_coefficients(double **block, int **coefficients, int block_size);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* DCT_H */
 
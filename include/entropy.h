@@ -10,6 +10,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <utils.h>
+#include <quantization.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /**
  * Structure to represent Huffman tree node
@@ -117,6 +122,361 @@ void block_to_zigzag(int **block, int *zigzag, int block_size);
  */
 void zigzag_to_block(int *zigzag, int **block, int block_size);
 
+/**
+ * Maximum Huffman code length for canonical tables (as in JPEG)
+ */
+#define HUFF_MAX_CODE_LEN 16
+
+/**
+ * Alphabet sizes for block coding: DC tables code magnitude categories,
+ * AC tables code (run << 4) | category, with 0x00 = EOB and 0xF0 = ZRL
+ */
+#define HUFF_DC_SYMBOLS 16
+#define HUFF_AC_SYMBOLS 256
+
+/**
+ * Largest coefficient magnitude the block coder can represent
+ * (keeps DC differences within category 15)
+ */
+#define ENTROPY_MAX_COEFF 16383
+
+/**
+ * Structure to hold a canonical, length-limited Huffman table
+ * Stored in the JPEG DHT layout so it can be serialized as-is
+ */
+typedef struct {
+    unsigned char bits[HUFF_MAX_CODE_LEN + 1]; // bits[k] = number of codes of length k
+    unsigned char values[HUFF_AC_SYMBOLS];     // Symbols ordered by code length
+    int value_count;                           // Number of symbols in the table
+    unsigned short codes[HUFF_AC_SYMBOLS];     // Code of each symbol (encoder side)
+    unsigned char lengths[HUFF_AC_SYMBOLS];    // Code length of each symbol, 0 if absent
+    int max_code[HUFF_MAX_CODE_LEN + 2];       // Largest code of each length, -1 if none (decoder side)
+    int val_offset[HUFF_MAX_CODE_LEN + 1];     // Offset from a code to its index in values
+} HuffTable;
+
+/**
+ * Structure to write a bit stream (MSB first) into a growable or caller-owned buffer
+ */
+typedef struct {
+    unsigned char *data;    // Output bytes
+    size_t size;            // Number of complete bytes written
+    size_t capacity;        // Allocated size of data
+    unsigned accumulator;   // Pending bits not yet written
+    int bit_count;          // Number of pending bits
+    int fixed;              // data belongs to the caller and never grows
+    int overflow;           // A fixed buffer ran out; later output is dropped
+} BitWriter;
+
+/**
+ * Structure to read a bit stream (MSB first) from a buffer
+ */
+typedef struct {
+    const unsigned char *data; // Input bytes
+    size_t size;               // Number of input bytes
+    size_t pos;                // Next byte to load
+    unsigned accumulator;      // Loaded bits not yet consumed
+    int bit_count;             // Number of loaded bits
+} BitReader;
+
+/**
+ * Probability precision of the adaptive binary range coder: a probability
+ * is the chance of a 0 bit in units of 1 / (1 << RANGE_PROB_BITS), and
+ * moves 1 / (1 << RANGE_PROB_SHIFT) of the way towards each coded bit
+ */
+#define RANGE_PROB_BITS 11
+#define RANGE_PROB_SHIFT 4
+#define RANGE_PROB_INIT (1 << (RANGE_PROB_BITS - 1))
+
+/**
+ * Structure to hold the state of an adaptive binary range encoder
+ * Bytes go to a bit writer, which must stay byte aligned while it is in use.
+ */
+typedef struct {
+    BitWriter *bw;              // Output
+    unsigned long long low;     // Low end of the interval (33 bits with the carry)
+    unsigned range;             // Width of the interval
+    unsigned char cache;        // Last byte not yet written, a carry may still reach it
+    unsigned long long pending; // cache plus the 0xFF bytes queued behind it
+} RangeEncoder;
+
+/**
+ * Structure to hold the state of an adaptive binary range decoder
+ */
+typedef struct {
+    const unsigned char *data;  // Input bytes
+    size_t size;                // Number of input bytes
+    size_t pos;                 // Next byte to load (may pass size; zeros are read there)
+    unsigned range;             // Width of the interval
+    unsigned code;              // Position of the stream inside the interval
+} RangeDecoder;
+
+/**
+ * Build a canonical Huffman table from symbol frequencies
+ * Code lengths are limited to HUFF_MAX_CODE_LEN and the all-ones code is never used
+ *
+ * @param table Table to fill
+ * @param freq Frequency of each symbol
+ * @param symbol_count Number of entries in freq (at most HUFF_AC_SYMBOLS)
+ */
+void build_canonical_huffman_table(HuffTable *table, const unsigned *freq, int symbol_count);
+
+/**
+ * Build the default DC or AC table shared by encoder and decoder
+ * The table is derived from a fixed frequency model, so it never has to be transmitted
+ *
+ * @param table Table to fill
+ * @param is_dc Build the DC table (1) or the AC table (0)
+ */
+void build_default_huffman_table(HuffTable *table, int is_dc);
+
+/**
+ * Fill a Huffman table from DHT-style code length counts and symbols
+ *
+ * @param table Table to fill
+ * @param bits Number of codes of each length (bits[1..16])
+ * @param values Symbols ordered by code length
+ * @return 1 on success, 0 if the counts do not describe a valid prefix code
+ */
+int load_huffman_table(HuffTable *table, const unsigned char *bits, const unsigned char *values);
+
+/**
+ * Count the bits a table spends on the symbols of a histogram
+ * Only the codes are counted: the magnitude bits after each symbol are the
+ * same whatever the table, so sizes from different tables compare directly.
+ *
+ * @param table Huffman table
+ * @param freq Symbol frequencies
+ * @param symbol_count Number of entries in freq
+ * @return Code bits, or SIZE_MAX if a counted symbol has no code in the table
+ */
+size_t huffman_estimate_bits(const HuffTable *table, const unsigned *freq, int symbol_count);
+
+/**
+ * Initialize a bit writer
+ *
+ * @param bw Bit writer
+ * @param initial_capacity Initial size of the output buffer in bytes
+ */
+void bitwriter_init(BitWriter *bw, size_t initial_capacity);
+
+/**
+ * Initialize a bit writer over a caller-owned buffer
+ * The buffer is never reallocated; output past its end is dropped and
+ * flagged in bw->overflow.
+ *
+ * @param bw Bit writer
+ * @param buffer Output buffer
+ * @param capacity Size of the buffer in bytes
+ */
+void bitwriter_init_buffer(BitWriter *bw, unsigned char *buffer, size_t capacity);
+
+/**
+ * Append bits to the stream
+ *
+ * @param bw Bit writer
+ * @param bits Value whose low count bits are written, MSB first
+ * @param count Number of bits to write (0-16)
+ */
+void bitwriter_put_bits(BitWriter *bw, unsigned bits, int count);
+
+/**
+ * Pad the stream with 1-bits up to the next byte boundary
+ *
+ * @param bw Bit writer
+ */
+void bitwriter_align(BitWriter *bw);
+
+/**
+ * Append raw bytes (the stream must be byte aligned)
+ *
+ * @param bw Bit writer
+ * @param bytes Bytes to append
+ * @param count Number of bytes
+ */
+void bitwriter_put_bytes(BitWriter *bw, const unsigned char *bytes, size_t count);
+
+/**
+ * Initialize a bit reader
+ *
+ * @param br Bit reader
+ * @param data Input bytes
+ * @param size Number of input bytes
+ */
+void bitreader_init(BitReader *br, const unsigned char *data, size_t size);
+
+/**
+ * Read bits from the stream (zeros are returned past the end)
+ *
+ * @param br Bit reader
+ * @param count Number of bits to read (0-16)
+ * @return Bits read
+ */
+unsigned bitreader_get_bits(BitReader *br, int count);
+
+/**
+ * Set adaptive probabilities to even odds
+ *
+ * @param probs Probabilities
+ * @param count Number of probabilities
+ */
+void range_probs_init(unsigned short *probs, size_t count);
+
+/**
+ * Start range coding into a byte-aligned bit writer
+ *
+ * @param rc Range encoder
+ * @param bw Bit writer receiving the bytes
+ */
+void range_encoder_init(RangeEncoder *rc, BitWriter *bw);
+
+/**
+ * Code one bit and adapt its probability
+ *
+ * @param rc Range encoder
+ * @param prob Probability of a 0 bit, updated
+ * @param bit Bit to code (0 or 1)
+ */
+void range_encode_bit(RangeEncoder *rc, unsigned short *prob, int bit);
+
+/**
+ * Write the bytes still held by the encoder; the bit writer stays byte aligned
+ *
+ * @param rc Range encoder
+ */
+void range_encoder_finish(RangeEncoder *rc);
+
+/**
+ * Start decoding a stream written by a range encoder
+ *
+ * @param rc Range decoder
+ * @param data Input bytes
+ * @param size Number of input bytes
+ */
+void range_decoder_init(RangeDecoder *rc, const unsigned char *data, size_t size);
+
+/**
+ * Decode one bit and adapt its probability as the encoder did
+ * A truncated stream reads as zeros; rc->pos > rc->size afterwards
+ * means bytes were missing.
+ *
+ * @param rc Range decoder
+ * @param prob Probability of a 0 bit, updated
+ * @return Decoded bit
+ */
+int range_decode_bit(RangeDecoder *rc, unsigned short *prob);
+
+/**
+ * Get the number of bits needed to represent the magnitude of a value
+ *
+ * @param value Coefficient value
+ * @return Magnitude category (0 for zero)
+ */
+int magnitude_category(int value);
+
+/**
+ * Count the DC and AC symbols a block would produce
+ * Used to build optimized tables before encoding
+ *
+ * @param zigzag Quantized coefficients in zigzag order
+ * @param coeff_count Number of coefficients (block_size * block_size)
+ * @param dc_pred DC predictor, updated with this block's DC value
+ * @param dc_freq DC symbol frequencies to update (HUFF_DC_SYMBOLS entries)
+ * @param ac_freq AC symbol frequencies to update (HUFF_AC_SYMBOLS entries)
+ */
+void huffman_count_block(const int *zigzag, int coeff_count, int *dc_pred, unsigned *dc_freq, unsigned *ac_freq);
+
+/**
+ * Huffman encode a block: differential DC followed by (run, category) AC symbols
+ *
+ * @param bw Bit writer
+ * @param zigzag Quantized coefficients in zigzag order
+ * @param coeff_count Number of coefficients (block_size * block_size)
+ * @param dc_pred DC predictor, updated with this block's DC value
+ * @param dc_table DC Huffman table
+ * @param ac_table AC Huffman table
+ */
+void huffman_encode_block(BitWriter *bw, const int *zigzag, int coeff_count, int *dc_pred,
+                          const HuffTable *dc_table, const HuffTable *ac_table);
+
+/**
+ * Count the symbols of a sparse block, equal to huffman_count_block on its dense form
+ * Work is proportional to the number of nonzero coefficients.
+ *
+ * @param block Quantized block from quantize_sparse
+ * @param coeff_count Number of coefficients (block_size * block_size)
+ * @param dc_pred DC predictor, updated with this block's DC value
+ * @param dc_freq DC symbol frequencies to update (HUFF_DC_SYMBOLS entries)
+ * @param ac_freq AC symbol frequencies to update (HUFF_AC_SYMBOLS entries)
+ */
+void huffman_count_sparse(const SparseBlock *block, int coeff_count, int *dc_pred, unsigned *dc_freq,
+                          unsigned *ac_freq);
+
+/**
+ * Huffman encode a sparse block, producing the same bits as huffman_encode_block
+ * Runs come from the distance between set bitmap bits, so zero
+ * coefficients are never visited.
+ *
+ * @param bw Bit writer
+ * @param block Quantized block from quantize_sparse
+ * @param coeff_count Number of coefficients (block_size * block_size)
+ * @param dc_pred DC predictor, updated with this block's DC value
+ * @param dc_table DC Huffman table
+ * @param ac_table AC Huffman table
+ */
+void huffman_encode_sparse(BitWriter *bw, const SparseBlock *block, int coeff_count, int *dc_pred,
+                           const HuffTable *dc_table, const HuffTable *ac_table);
+
+/**
+ * Decode a block written by huffman_encode_block
+ *
+ * @param br Bit reader
+ * @param zigzag Output coefficients in zigzag order
+ * @param coeff_count Number of coefficients (block_size * block_size)
+ * @param dc_pred DC predictor, updated with this block's DC value
+ * @param dc_table DC Huffman table
+ * @param ac_table AC Huffman table
+ * @return 1 on success, 0 if the stream is corrupt
+ */
+int huffman_decode_block(BitReader *br, int *zigzag, int coeff_count, int *dc_pred,
+                         const HuffTable *dc_table, const HuffTable *ac_table);
+
+/**
+ * Decode a block written by huffman_encode_block into sparse form
+ * The result is what quantize_sparse gives for the same coefficients.
+ *
+ * @param br Bit reader
+ * @param block Output block; block->values must hold coeff_count entries
+ * @param coeff_count Number of coefficients (block_size * block_size)
+ * @param dc_pred DC predictor, updated with this block's DC value
+ * @param dc_table DC Huffman table
+ * @param ac_table AC Huffman table
+ * @return 1 on success, 0 if the stream is corrupt
+ */
+int huffman_decode_sparse(BitReader *br, SparseBlock *block, int coeff_count, int *dc_pred,
+                          const HuffTable *dc_table, const HuffTable *ac_table);
+
+/**
+ * Decode a block written by huffman_encode_block straight into dequantized coefficients
+ * Each decoded value is divided by its step, as dequantize would, and stored
+ * at its natural-order position; zero coefficients are never written.
+ *
+ * @param br Bit reader
+ * @param quant Quantization context of the block size
+ * @param block_variance Variance of the block (for adaptive quantization)
+ * @param dct_coeffs Output coefficients, all zero on entry
+ * @param dc_pred DC predictor, updated with this block's DC value
+ * @param dc_table DC Huffman table
+ * @param ac_table AC Huffman table
+ * @param last Set to the zigzag position of the last nonzero coefficient (0 if there is none)
+ * @return 1 on success, 0 if the stream is corrupt (dct_coeffs may be partly written)
+ */
+int huffman_decode_dequantize(BitReader *br, QuantContext *quant, double block_variance, double **dct_coeffs,
+                              int *dc_pred, const HuffTable *dc_table, const HuffTable *ac_table, int *last);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* ENTROPY_H */ 
 
 
@@ -0,0 +1,114 @@
+/**
+ * jpeg.h - Header file for baseline JPEG (JFIF) export and recompression
+ * Part of Adaptive DCT Image Compressor
+ *
+ * Writes a plane as a standards-conformant baseline JPEG, so that any JPEG
+ * decoder (hardware ones included) can read it, and reads such files back.
+ * Every stage is the codec's own: the orthonormal 8x8 DCT is the JPEG
+ * FDCT, the quantization table is the QuantContext one with its steps
+ * rounded to whole numbers (DQT carries integers), and blocks are coded
+ * with the entropy layer's (run, size) symbols under Huffman tables
+ * optimized for the image (DHT).
+ *
+ * Files hold one component (grayscale):
+ *
+ *   SOI | APP0 (JFIF 1.01) | DQT | SOF0 | DHT (DC, AC) | SOS | scan | EOI
+ *
+ * with every 0xFF byte of the entropy-coded scan followed by a stuffed 0x00.
+ *
+ * Existing baseline files (1 to 4 components, any sampling factors,
+ * interleaved or not, restart intervals) can also be recompressed without
+ * touching pixels or the transform: their quantized coefficients are
+ * re-coded with the entropy layer's adaptive binary range coder, with
+ * median-predicted DC and AC contexts taken from the neighbouring blocks,
+ * and restoring gives back the original bytes exactly:
+ *
+ *   "ADJR" | version (1) | reserved (3) | original size (8) | verbatim size (8)
+ *   | CRC-32 of the original file (4) | verbatim bytes | range-coded coefficients
+ *
+ * Sizes and the checksum are little-endian. The verbatim bytes are the file minus its
+ * entropy-coded scan data (markers, tables, metadata and trailing bytes);
+ * the scans are regenerated from the coefficients with the file's own
+ * Huffman tables and restart intervals.
+ */
+
+#ifndef JPEG_H
+#define JPEG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils.h>
+#include <codec.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JPEG_BLOCK_SIZE 8          // Transform size of baseline JPEG
+#define JPEG_MAX_DIMENSION 65535   // Largest width or height SOF0 can carry
+#define JPEG_MAX_AC_LEVEL 1023     // Largest quantized AC magnitude baseline coding allows (size 10)
+#define JPEG_MAX_COMPONENTS 4      // Components a frame (and a scan) may hold
+
+#define JPEG_RECOMPRESSED_HEADER_SIZE 28
+#define JPEG_RECOMPRESSED_VERSION 2
+
+/**
+ * Encode an 8-bit plane as a baseline JPEG
+ * The quantization table is the 8x8 one of quant_init at this quality,
+ * rounded to whole steps; Huffman tables are optimized for the image.
+ *
+ * @param pixels Input pixel data (width * height bytes, row-major)
+ * @param width Image width (1 to JPEG_MAX_DIMENSION)
+ * @param height Image height (1 to JPEG_MAX_DIMENSION)
+ * @param quality Quality factor (1-100, clamped)
+ * @param out_size Set to the size of the file in bytes
+ * @return Newly allocated JPEG file, or NULL on invalid dimensions
+ */
+unsigned char* jpeg_encode(const unsigned char *pixels, int width, int height, int quality, size_t *out_size);
+
+/**
+ * Decode a single-component baseline JPEG
+ * Reads what jpeg_encode writes and other grayscale baseline files,
+ * restart intervals included. Progressive, arithmetic-coded, 12-bit and
+ * multi-component files are refused.
+ *
+ * @param data JPEG file
+ * @param size Size of the file in bytes
+ * @param width Set to the image width
+ * @param height Set to the image height
+ * @return Newly allocated pixel data, or NULL if the file is invalid or unsupported
+ */
+unsigned char* jpeg_decode(const unsigned char *data, size_t size, int *width, int *height);
+
+/**
+ * Recompress a baseline JPEG losslessly
+ * The result is checked by restoring it; files whose scans would not come
+ * back bit for bit (non-standard padding or coding choices) are refused,
+ * as are progressive, arithmetic-coded and 12-bit ones, so the caller can
+ * keep such files as they are.
+ *
+ * @param data JPEG file
+ * @param size Size of the file in bytes
+ * @param out_size Set to the size of the recompressed file in bytes
+ * @return Newly allocated recompressed file, or NULL if the file cannot be recompressed exactly
+ */
+unsigned char* jpeg_recompress(const unsigned char *data, size_t size, size_t *out_size);
+
+/**
+ * Restore the original JPEG bytes of a recompressed file
+ * The restored bytes are checked against the stored size and CRC-32, so a
+ * damaged file is refused rather than restored into a different JPEG.
+ *
+ * @param data Recompressed file from jpeg_recompress
+ * @param size Size of the recompressed file in bytes
+ * @param out_size Set to the size of the JPEG file in bytes
+ * @return Newly allocated JPEG file, or NULL if the recompressed file is invalid
+ */
+unsigned char* jpeg_restore(const unsigned char *data, size_t size, size_t *out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JPEG_H */
@@ -0,0 +1,114 @@
+/**
+ * metrics.h - Header file for image quality metrics
+ * Part of Adaptive DCT Image Compressor
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <utils.h>
+#include <dct.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define METRICS_MAX_PSNR 99.0   // PSNR reported for identical inputs
+
+/**
+ * Mean squared error between two 8-bit planes (SIMD when available)
+ *
+ * @param a First plane
+ * @param b Second plane
+ * @param count Number of samples in each plane
+ * @return Mean squared error
+ */
+double plane_mse(const unsigned char *a, const unsigned char *b, size_t count);
+
+/**
+ * Peak signal-to-noise ratio between two 8-bit planes
+ *
+ * @param a First plane
+ * @param b Second plane
+ * @param count Number of samples in each plane
+ * @return PSNR in dB, METRICS_MAX_PSNR for identical planes
+ */
+double plane_psnr(const unsigned char *a, const unsigned char *b, size_t count);
+
+/**
+ * Convert a mean squared error on the 0-255 scale to PSNR
+ *
+ * @param mse Mean squared error
+ * @return PSNR in dB, METRICS_MAX_PSNR for zero error
+ */
+double mse_to_psnr(double mse);
+
+/**
+ * Structural similarity between two 8-bit planes
+ * Uses 8x8 windows on a 4-pixel grid, built from SIMD 4x4 block sums
+ *
+ * @param a First plane (row-major, width * height)
+ * @param b Second plane (row-major, width * height)
+ * @param width Width of the planes
+ * @param height Height of the planes
+ * @return Mean SSIM (1.0 for identical planes)
+ */
+double plane_ssim(const unsigned char *a, const unsigned char *b, int width, int height);
+
+/**
+ * Multi-scale structural similarity between two 8-bit planes
+ * Five dyadic scales with the standard weights; fewer scales are used
+ * (with renormalized weights) when the planes are too small
+ *
+ * @param a First plane (row-major, width * height)
+ * @param b Second plane (row-major, width * height)
+ * @param width Width of the planes
+ * @param height Height of the planes
+ * @return MS-SSIM (1.0 for identical planes)
+ */
+double plane_ms_ssim(const unsigned char *a, const unsigned char *b, int width, int height);
+
+/**
+ * Squared pixel error of a block computed from its coefficients (Parseval)
+ * For the orthonormal DCT, the sum of squared coefficient differences equals
+ * the sum of squared pixel differences, so no IDCT is needed. Coefficients of
+ * an approximate transform are rescaled with the context's row norms first.
+ *
+ * @param ctx DCT context that produced the coefficients
+ * @param original Coefficients from dct_forward
+ * @param dequantized Coefficients from dequantize
+ * @return Sum of squared errors over the block
+ */
+double dct_domain_sse(DCTContext *ctx, double **original, double **dequantized);
+
+/**
+ * SSIM of a block, taken as a single window, computed from its coefficients
+ * The DC coefficient gives the mean and the AC coefficients give the
+ * variances and covariance (Parseval holds for inner products as well).
+ * Blocks are assumed level-shifted by 128, as the codec feeds them.
+ *
+ * @param ctx DCT context that produced the coefficients
+ * @param original Coefficients from dct_forward
+ * @param dequantized Coefficients from dequantize
+ * @return SSIM of the block
+ */
+double dct_domain_ssim(DCTContext *ctx, double **original, double **dequantized);
+
+/**
+ * PSNR of a whole image from accumulated DCT-domain squared errors
+ *
+ * @param sse Sum of dct_domain_sse over the image's blocks
+ * @param count Number of pixels covered by those blocks
+ * @return PSNR in dB
+ */
+double dct_domain_psnr(double sse, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METRICS_H */
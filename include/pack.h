@@ -0,0 +1,159 @@
+/**
+ * pack.h - Header file for multi-image pack files
+ * Part of Adaptive DCT Image Compressor
+ *
+ * A pack concatenates many compressed streams in one file, followed by an
+ * index sorted by id. Layout (little-endian):
+ *
+ *   header   32 bytes: "ADPK", version, 3 reserved bytes, u64 entry count,
+ *            u64 index offset, 8 reserved bytes
+ *   streams  codec streams, back to back
+ *   index    PACK_ENTRY_SIZE bytes per entry: u64 id, u64 offset, u64 length,
+ *            u32 width, u32 height; strictly increasing ids
+ *
+ * Appending writes new streams and a fresh index after the old index, then
+ * rewrites the header last, so a pack interrupted mid-append still opens
+ * with its previous contents. Replaced entries and old indexes stay in the
+ * file as dead space until pack_compact rewrites it.
+ */
+
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils.h>
+#include <codec.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 32
+#define PACK_ENTRY_SIZE 32
+
+/**
+ * Structure to describe one image in a pack
+ */
+typedef struct {
+    unsigned long long id;       // Caller-chosen key, unique within the pack
+    unsigned long long offset;   // File offset of the stream
+    unsigned long long length;   // Stream size in bytes
+    int width;                   // Image width
+    int height;                  // Image height
+} PackEntry;
+
+typedef struct PackWriter PackWriter;
+typedef struct PackReader PackReader;
+
+/**
+ * Open a pack for appending, creating it if it does not exist
+ *
+ * @param path Pack file
+ * @return Writer, or NULL if the file cannot be opened or is not a pack
+ */
+PackWriter* pack_writer_open(const char *path);
+
+/**
+ * Append a compressed image
+ * The stream is validated and written immediately; it becomes visible to
+ * readers when the writer is closed. Adding an id that is already in the
+ * pack replaces that entry.
+ *
+ * @param writer Writer from pack_writer_open
+ * @param id Key of the image
+ * @param stream Stream produced by the codec
+ * @param size Size of the stream in bytes
+ * @return 1 on success, 0 on an invalid stream or an I/O error
+ */
+int pack_writer_add(PackWriter *writer, unsigned long long id, const unsigned char *stream, size_t size);
+
+/**
+ * Write the index and header, then free the writer
+ *
+ * @param writer Writer from pack_writer_open
+ * @return 1 on success, 0 on an I/O error (the pack keeps its previous contents)
+ */
+int pack_writer_close(PackWriter *writer);
+
+/**
+ * Rewrite a pack with only its live entries, in id order
+ * The compacted file is written next to the pack and renamed over it.
+ *
+ * @param path Pack file
+ * @return 1 on success, 0 on an invalid pack or an I/O error
+ */
+int pack_compact(const char *path);
+
+/**
+ * Map a pack for random access
+ * Only the header is checked here; each entry is bounds-checked when it is
+ * looked up, so opening costs the same whatever the number of images.
+ *
+ * @param path Pack file
+ * @return Reader, or NULL if the file cannot be mapped or is not a pack
+ */
+PackReader* pack_open(const char *path);
+
+/**
+ * Unmap a pack and free the reader
+ *
+ * @param reader Reader to close (NULL is ignored)
+ */
+void pack_close(PackReader *reader);
+
+/**
+ * Get the number of images in a pack
+ *
+ * @param reader Reader from pack_open
+ * @return Entry count
+ */
+size_t pack_count(const PackReader *reader);
+
+/**
+ * Get an entry by position in id order
+ *
+ * @param reader Reader from pack_open
+ * @param index Position, below pack_count
+ * @param entry Set to the entry
+ * @return 1 on success, 0 if the position or the entry is out of range
+ */
+int pack_entry_at(const PackReader *reader, size_t index, PackEntry *entry);
+
+/**
+ * Look up an image by id (binary search of the mapped index)
+ *
+ * @param reader Reader from pack_open
+ * @param id Key of the image
+ * @param entry Set to the entry when found
+ * @return 1 if found, 0 otherwise
+ */
+int pack_find(const PackReader *reader, unsigned long long id, PackEntry *entry);
+
+/**
+ * Get the stream of an entry, pointing into the mapping
+ *
+ * @param reader Reader from pack_open
+ * @param entry Entry from pack_find or pack_entry_at
+ * @return Stream bytes, valid until pack_close
+ */
+const unsigned char* pack_stream(const PackReader *reader, const PackEntry *entry);
+
+/**
+ * Look up and decode an image by id
+ *
+ * @param reader Reader from pack_open
+ * @param id Key of the image
+ * @param width Set to the width of the image
+ * @param height Set to the height of the image
+ * @return Newly allocated pixel data, or NULL if the id is missing or the stream is invalid
+ */
+unsigned char* pack_decode(const PackReader *reader, unsigned long long id, int *width, int *height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACK_H */
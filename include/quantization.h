@@ -12,6 +12,52 @@
 #include <string.h>
 #include <utils.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QUANT_KERNEL_DIVIDE 0       // Divide each coefficient by its step
+#define QUANT_KERNEL_RECIPROCAL 1   // Multiply by precomputed reciprocal steps (rounds exact .5 ties differently)
+#define QUANT_KERNEL_COUNT 2
+
+#define QUANT_SPARSE_WORDS 16       // Bitmap words of a SparseBlock, enough for 32x32
+
+#define QUANT_MAX_BIT_DEPTH 16      // Deepest samples the tables scale to
+#define QUANT_MAX_LEVEL 16383       // Largest quantized magnitude the entropy coder represents (ENTROPY_MAX_COEFF)
+
+/**
+ * Structure to hold one quantized block in sparse zigzag form
+ * Bit k (word k / 64, bit k % 64) is set when zigzag coefficient k is
+ * nonzero, and values holds those coefficients in zigzag order, so work
+ * after quantization scales with the nonzeros rather than block_size^2.
+ */
+typedef struct {
+    unsigned long long bitmap[QUANT_SPARSE_WORDS]; // Nonzero flags in zigzag order
+    int *values;                   // Nonzero coefficients (caller-owned, block_size^2 capacity)
+    int count;                     // Number of nonzero coefficients
+} SparseBlock;
+
+/**
+ * Index of the lowest set bit of a nonzero SparseBlock bitmap word
+ * Walking a bitmap with this and bits &= bits - 1 visits the nonzeros in
+ * zigzag order.
+ *
+ * @param bits Bitmap word (must not be zero)
+ * @return Bit index (0-63)
+ */
+static inline int sparse_lowest_bit(unsigned long long bits) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    int k = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        k++;
+    }
+    return k;
+#endif
+}
+
 /**
  * Structure to hold quantization context information
  */
@@ -21,6 +67,11 @@ typedef struct {
     double **quant_matrix;         // Quantization matrix
     double **dequant_matrix;       // Dequantization matrix (inverse)
     int adaptive;                  // Flag for adaptive quantization
+    int kernel;                    // QUANT_KERNEL_* used for static quantization
+    double **reciprocal_matrix;    // 1 / quant_matrix, for QUANT_KERNEL_RECIPROCAL
+    unsigned char *zigzag_row;     // Row of each zigzag position
+    unsigned char *zigzag_col;     // Column of each zigzag position
+    unsigned char *zigzag_extent;  // Top-left corner holding every position up to each zigzag position
 } QuantContext;
 
 /**
@@ -33,6 +84,28 @@ typedef struct {
  */
 QuantContext* quant_init(int block_size, int quality, int adaptive);
 
+/**
+ * Set the kernel that quant_init picks for a block size
+ * Meant to be called once at startup (e.g. by tune_apply), before any
+ * context is created. QUANT_KERNEL_RECIPROCAL can land on the other side
+ * of a rounding tie than division, so streams encoded with it may differ
+ * from those of a QUANT_KERNEL_DIVIDE encoder (both decode fine), and
+ * codec_reencode_dirty only matches a fresh encode made with the same
+ * kernel. tune_measure never picks it for that reason.
+ *
+ * @param block_size Block size (4, 8, 16 or 32)
+ * @param kernel QUANT_KERNEL_* value
+ */
+void quant_set_default_kernel(int block_size, int kernel);
+
+/**
+ * Get the kernel that quant_init picks for a block size
+ *
+ * @param block_size Block size
+ * @return QUANT_KERNEL_* value (QUANT_KERNEL_DIVIDE for untuned sizes)
+ */
+int quant_default_kernel(int block_size);
+
 /**
  * Free quantization context resources
  *
@@ -49,6 +122,26 @@ void quant_free(QuantContext *ctx);
  */
 double** generate_quant_matrix(int block_size, int quality);
 
+/**
+ * Rescale the tables of a context for samples of another bit depth
+ * Steps are multiplied by 2^(bit_depth - 8) and floored so that no
+ * coefficient of a full-range block quantizes past QUANT_MAX_LEVEL. Call
+ * it right after quant_init, before quant_apply_transform_scale; 8 restores
+ * the 8-bit tables.
+ *
+ * @param ctx Quantization context
+ * @param bit_depth Bits per sample (8 to QUANT_MAX_BIT_DEPTH; other values are ignored)
+ */
+void quant_set_bit_depth(QuantContext *ctx, int bit_depth);
+
+/**
+ * Replace the steps of a static context with whole-number ones, listed in
+ * zigzag order as a JPEG DQT segment lists them
+ * @param ctx Quantization context
+ * @param steps block_size^2 steps in zigzag order (each at least 1)
+ */
+void quant_set_steps(QuantContext *ctx, const unsigned short *steps);
+
 /**
  * Generate dequantization matrix (inverse of quantization matrix)
  *
@@ -58,8 +151,19 @@ double** generate_quant_matrix(int block_size, int quality);
  */
 double** generate_dequant_matrix(double **quant_matrix, int block_size);
 
+/**
+ * Fold the basis scaling of a non-orthonormal transform into the quantization tables
+ * Quantization steps become step * norm[i] * norm[j] and dequantization yields
+ * coefficients divided by norm[i] * norm[j], as dct_init_approximate expects
+ *
+ * @param ctx Quantization context
+ * @param row_norms Norm of each transform basis row (block_size entries)
+ */
+void quant_apply_transform_scale(QuantContext *ctx, const double *row_norms);
+
 /**
  * Apply quantization to DCT coefficients
+ * Only reads the context, so threads may quantize with a shared one.
  *
  * @param ctx Quantization context
  * @param dct_coeffs Input DCT coefficients
@@ -68,8 +172,32 @@ double** generate_dequant_matrix(double **quant_matrix, int block_size);
  */
 void quantize(QuantContext *ctx, double **dct_coeffs, int **quant_coeffs, double block_variance);
 
+/**
+ * Quantize into sparse zigzag form
+ * Produces exactly the coefficients quantize would, after block_to_zigzag,
+ * but writes only the nonzeros. Block sizes up to 32 are supported.
+ *
+ * @param ctx Quantization context
+ * @param dct_coeffs Input DCT coefficients
+ * @param sparse Output block; sparse->values must hold block_size^2 entries
+ * @param block_variance Variance of the block (for adaptive quantization)
+ */
+void quantize_sparse(QuantContext *ctx, double **dct_coeffs, SparseBlock *sparse, double block_variance);
+
+/**
+ * Dequantize a sparse block, equal to dequantize on its dense form
+ *
+ * @param ctx Quantization context
+ * @param sparse Input block
+ * @param dct_coeffs Output dequantized coefficients
+ * @param block_variance Variance of the block (for adaptive quantization)
+ * @return Zigzag position of the last nonzero coefficient (0 if there is none)
+ */
+int dequantize_sparse(QuantContext *ctx, const SparseBlock *sparse, double **dct_coeffs, double block_variance);
+
 /**
  * Apply dequantization (inverse quantization)
+ * Only reads the context, like quantize.
  *
  * @param ctx Quantization context
  * @param quant_coeffs Input quantized coefficients
@@ -97,5 +225,46 @@ double calculate_block_variance(double **block, int block_size);
  */
 double** adjust_matrix_for_block(QuantContext *ctx, double variance, int is_quantize);
 
+/**
+ * Get the factor adaptive dequantization applies to a block's AC entries
+ * adjust_matrix_for_block(ctx, variance, 0) multiplies every entry but the
+ * DC one by it, so a single coefficient can be dequantized without building
+ * the whole matrix.
+ *
+ * @param ctx Quantization context
+ * @param block_variance Variance of the block
+ * @return Scale for the AC entries of dequant_matrix (1 for static quantization)
+ */
+double dequant_block_scale(const QuantContext *ctx, double block_variance);
+
+/**
+ * Check a scan order for quant_set_scan_order: distinct AC positions only
+ *
+ * @param order Natural index (row * block_size + column) of the leading AC positions
+ * @param count Number of positions in order (below block_size^2)
+ * @param block_size Size of the block
+ * @return 1 if the order is usable, 0 otherwise
+ */
+int quant_valid_scan_order(const unsigned short *order, int count, int block_size);
+
+/**
+ * Replace the zigzag order of a context with another scan order
+ * DC stays first, the listed AC positions follow, and the remaining ones
+ * come after them in zigzag order. Every sparse path (quantize_sparse,
+ * dequantize_sparse and the sparse entropy coder) follows the zigzag
+ * tables, so blocks are then coded in this order; encoder and decoder
+ * must install the same one.
+ *
+ * @param ctx Quantization context
+ * @param order Natural index (row * block_size + column) of the leading AC positions
+ * @param count Number of positions in order (0 restores the zigzag order)
+ * @return 1 on success, 0 if the order is not valid (the context is unchanged)
+ */
+int quant_set_scan_order(QuantContext *ctx, const unsigned short *order, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* QUANTIZATION_H */
 
@@ -0,0 +1,176 @@
+/**
+ * server.h - Header file for the local encode/decode daemon
+ * Part of Adaptive DCT Image Compressor
+ *
+ * A long-running process serves codec requests over a Unix domain socket
+ * (SOCK_SEQPACKET). Each message is a fixed-size request or response
+ * header; pixel and compressed payloads travel in memfd shared-memory
+ * buffers whose descriptors are passed alongside (SCM_RIGHTS), so no
+ * payload bytes go through the socket. Buffers are sealed against
+ * shrinking and writes before they are passed, and unsealed ones are
+ * refused, so neither side can pull a mapping out from under the other.
+ * Requests from all connections are queued and shared out among a pool
+ * of worker threads; a worker takes several at once only when the queue
+ * holds more than the idle workers can take.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils.h>
+#include <codec.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SERVER_MAGIC 0x44435444u   // "DTCD"
+#define SERVER_OP_ENCODE 1         // Pixels in, stream out
+#define SERVER_OP_DECODE 2         // Stream in, pixels out
+#define SERVER_OP_STATS 3          // No payload, statistics in the response
+
+#define SERVER_OK 0
+#define SERVER_ERROR_REQUEST 1     // Malformed request or payload descriptor, or image over the size cap
+#define SERVER_ERROR_CODEC 2       // The codec rejected the parameters or stream
+
+#define SERVER_BATCH 8             // Most requests a worker takes from the queue at once
+#define SERVER_DEFAULT_MAX_PIXELS (1ULL << 26) // Image size cap when server_start is given 0
+#define SERVER_LATENCY_WINDOW 1024 // Recent requests kept for percentiles
+
+/**
+ * Structure to hold a shared-memory payload buffer
+ */
+typedef struct {
+    int fd;                  // memfd descriptor (-1 when empty)
+    unsigned char *data;     // Mapping of the whole buffer
+    size_t size;             // Size in bytes
+} SharedBuffer;
+
+/**
+ * Structure to describe a request; an ENCODE or DECODE request carries
+ * its input payload descriptor
+ */
+typedef struct {
+    unsigned magic;          // SERVER_MAGIC
+    unsigned op;             // SERVER_OP_*
+    unsigned id;             // Echoed in the response
+    int width;               // Image width (ENCODE)
+    int height;              // Image height (ENCODE)
+    CodecParams params;      // Encoder parameters (ENCODE)
+    unsigned long long input_size; // Payload bytes used in the input buffer
+} ServerRequest;
+
+/**
+ * Structure to hold aggregate daemon statistics
+ */
+typedef struct {
+    unsigned long long requests;   // Requests completed
+    unsigned long long errors;     // Requests that failed
+    double mean_ms;                // Mean latency (queue + service)
+    double p50_ms;                 // Median latency over the recent window
+    double p99_ms;                 // 99th percentile latency over the recent window
+    double max_ms;                 // Highest latency seen
+} ServerStats;
+
+/**
+ * Structure to describe a response; a successful ENCODE or DECODE response
+ * carries the output payload descriptor
+ */
+typedef struct {
+    unsigned id;             // Request id
+    int status;              // SERVER_OK or SERVER_ERROR_*
+    int width;               // Image width (DECODE)
+    int height;              // Image height (DECODE)
+    unsigned long long output_size; // Payload bytes in the output buffer
+    double queue_ms;         // Time spent waiting for a worker
+    double service_ms;       // Time spent in the codec
+    ServerStats stats;       // Daemon statistics (STATS)
+} ServerResponse;
+
+typedef struct Server Server;
+
+/**
+ * Create a shared-memory buffer
+ *
+ * @param buffer Buffer to fill in
+ * @param size Size in bytes
+ * @return 1 on success, 0 on failure
+ */
+int shared_buffer_create(SharedBuffer *buffer, size_t size);
+
+/**
+ * Seal a shared-memory buffer against resizing and writes
+ * The mapping is replaced by a read-only one (data changes). Sealing is
+ * permanent, so a sealed buffer cannot be refilled for another request.
+ *
+ * @param buffer Buffer from shared_buffer_create
+ * @return 1 if the buffer is sealed (or already was), 0 on failure
+ */
+int shared_buffer_seal(SharedBuffer *buffer);
+
+/**
+ * Unmap and close a shared-memory buffer
+ *
+ * @param buffer Buffer to release (safe on an empty buffer)
+ */
+void shared_buffer_release(SharedBuffer *buffer);
+
+/**
+ * Start the daemon: bind the socket and start the I/O and worker threads
+ * Encode and decode requests for images above max_pixels are refused with
+ * SERVER_ERROR_REQUEST; a decode is checked against the stream header
+ * before anything is decoded, so no client can make the daemon run out
+ * of memory on behalf of the others.
+ *
+ * @param socket_path Filesystem path of the Unix socket (replaced if present)
+ * @param workers Number of worker threads
+ * @param max_pixels Largest width * height served (0 for SERVER_DEFAULT_MAX_PIXELS)
+ * @return Running server, or NULL if the socket cannot be set up
+ */
+Server* server_start(const char *socket_path, int workers, unsigned long long max_pixels);
+
+/**
+ * Stop the daemon, finishing queued requests, and remove the socket
+ *
+ * @param server Server to stop
+ */
+void server_stop(Server *server);
+
+/**
+ * Read the aggregate statistics of a running server
+ *
+ * @param server Server to query
+ * @param stats Filled with the current statistics
+ */
+void server_get_stats(Server *server, ServerStats *stats);
+
+/**
+ * Connect to a daemon
+ *
+ * @param socket_path Filesystem path of the Unix socket
+ * @return Connected descriptor, or -1 on failure
+ */
+int client_connect(const char *socket_path);
+
+/**
+ * Send one request and wait for its response
+ * The input buffer is sealed first (see shared_buffer_seal).
+ *
+ * @param fd Connected descriptor
+ * @param request Request header
+ * @param input Input payload (NULL for STATS), sealed on return
+ * @param response Filled with the response header
+ * @param output Filled with the output payload mapping on success (may be NULL for STATS)
+ * @return 1 if a response was received, 0 on a transport error
+ */
+int client_request(int fd, const ServerRequest *request, SharedBuffer *input,
+                   ServerResponse *response, SharedBuffer *output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SERVER_H */
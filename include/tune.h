@@ -0,0 +1,103 @@
+/**
+ * tune.h - Header file for the startup kernel autotuner
+ * Part of Adaptive DCT Image Compressor
+ *
+ * Microbenchmarks the available DCT and quantization kernels for each block
+ * size, installs the fastest as the defaults used by dct_init and
+ * quant_init, and persists the choice to a small text profile keyed by the
+ * CPU model so later runs skip the measurement.
+ *
+ * Only kernels that reproduce the reference results bit for bit (the matrix
+ * and SSE2 DCTs, divide quantization) are picked, so streams and decoded
+ * pixels do not depend on the machine's profile, and codec_reencode_dirty
+ * matches a fresh encode anywhere. The factorized DCT and reciprocal
+ * quantization are still timed, and a profile edited to name them is
+ * honoured, but results then round differently (see dct.h, quantization.h).
+ */
+
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils.h>
+#include <dct.h>
+#include <quantization.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TUNE_PROFILE_VERSION 2     // 1 could pick kernels that are not bit-exact
+#define TUNE_SIZE_COUNT 4          // Block sizes 4, 8, 16 and 32
+#define TUNE_CPU_MODEL_LENGTH 128
+
+/**
+ * Structure to hold the kernel selection for one machine
+ */
+typedef struct {
+    char cpu_model[TUNE_CPU_MODEL_LENGTH];                 // CPU the profile was measured on
+    int dct_kernel[TUNE_SIZE_COUNT];                       // Fastest bit-exact DCT_KERNEL_* per block size
+    int quant_kernel[TUNE_SIZE_COUNT];                     // Fastest bit-exact QUANT_KERNEL_* per block size
+    double dct_ns[TUNE_SIZE_COUNT][DCT_KERNEL_COUNT];      // Forward + inverse time per block (0 = not measured)
+    double quant_ns[TUNE_SIZE_COUNT][QUANT_KERNEL_COUNT];  // Quantization time per block (0 = not measured)
+} TuneProfile;
+
+/**
+ * Read the CPU model name of this machine
+ *
+ * @param buffer Destination for the model name
+ * @param size Size of the buffer
+ */
+void tune_cpu_model(char *buffer, size_t size);
+
+/**
+ * Microbenchmark every available kernel for every block size
+ * Every kernel is timed; the winners are chosen among the bit-exact ones.
+ *
+ * @param profile Filled with the measurements and the winners
+ */
+void tune_measure(TuneProfile *profile);
+
+/**
+ * Install a profile's winners as the dct_init / quant_init defaults
+ *
+ * @param profile Profile to apply
+ */
+void tune_apply(const TuneProfile *profile);
+
+/**
+ * Write a profile to a file
+ *
+ * @param profile Profile to save
+ * @param path File to write
+ * @return 1 on success, 0 if the file cannot be written
+ */
+int tune_save(const TuneProfile *profile, const char *path);
+
+/**
+ * Read a profile from a file
+ * Timings are not persisted, so they read back as 0.
+ *
+ * @param profile Filled with the stored selection
+ * @param path File to read
+ * @return 1 on success, 0 if the file is missing or malformed
+ */
+int tune_load(TuneProfile *profile, const char *path);
+
+/**
+ * Load the profile for this CPU, or measure and save one on first use,
+ * then apply it
+ *
+ * @param path Profile file
+ * @param profile Filled with the profile in use (may be NULL)
+ * @return 1 if a stored profile was loaded, 0 if it was measured
+ */
+int tune_init(const char *path, TuneProfile *profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TUNE_H */
@@ -11,6 +11,16 @@
 #include <string.h>
 #include <utils.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LARGE_PAGES_NONE 0         // Plain malloc for large buffers
+#define LARGE_PAGES_TRANSPARENT 1  // Anonymous mapping with madvise(MADV_HUGEPAGE)
+#define LARGE_PAGES_EXPLICIT 2     // MAP_HUGETLB from the reserved pool, else transparent
+
+#define LARGE_ALLOC_THRESHOLD (4u << 20) // Smaller requests always use malloc
+
 /**
  * Helper function to allocate 2D double arrays
  *
@@ -45,5 +55,42 @@ int** alloc_int_array(int rows, int cols);
  */
 void free_int_array(int **array, int rows);
 
+/**
+ * Select how alloc_large backs buffers of LARGE_ALLOC_THRESHOLD bytes or more
+ * Each mode falls back to the next weaker one (explicit -> transparent ->
+ * malloc) when the kernel refuses, so the choice never makes allocation fail.
+ * Buffers keep the mode they were allocated with.
+ *
+ * @param mode LARGE_PAGES_NONE (default), LARGE_PAGES_TRANSPARENT or LARGE_PAGES_EXPLICIT
+ */
+void set_large_pages(int mode);
+
+/**
+ * Get the mode set by set_large_pages
+ *
+ * @return Current LARGE_PAGES_* mode
+ */
+int large_pages(void);
+
+/**
+ * Allocate a large, 64-byte aligned buffer, backed by huge pages when enabled
+ * Exits on failure like the other allocators.
+ *
+ * @param size Size in bytes
+ * @return Allocated buffer, released with free_large
+ */
+void* alloc_large(size_t size);
+
+/**
+ * Free a buffer from alloc_large
+ *
+ * @param ptr Buffer to free (NULL is ignored)
+ */
+void free_large(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* UTIL_H */
 
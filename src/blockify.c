@@ -0,0 +1,174 @@
+/**
+ * blockify.c - Implementation file for raster / block-major reordering
+ * Part of Adaptive DCT Image Compressor
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <blockify.h>
+
+// Offset of sample (i, c) of block row by: block c / n of the row, column c % n
+static size_t sample_offset(int n, int cols, int by, int i, int c) {
+    return ((size_t) by * cols + (size_t) (c / n)) * n * n + (size_t) i * n + (size_t) (c % n);
+}
+
+void blockify(const unsigned char *plane, size_t stride, int width, int height,
+              int block_size, int cols, int rows, short *blocks) {
+    int n = block_size;
+    int region_width = cols * n;
+    int direct = region_width < width ? region_width : width;
+
+    for (int by = 0; by < rows; by++) {
+        for (int i = 0; i < n; i++) {
+            int r = by * n + i;
+            const unsigned char *line = plane + (size_t) (r < height ? r : height - 1) * stride;
+            int c = 0;
+
+#if defined(__SSE2__)
+            // 16 pixels per load, widened to two groups of 8 samples; a group
+            // starts on a multiple of 8 and so never straddles blocks of 8 or more
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i bias = _mm_set1_epi16(128);
+            for (; c + 16 <= direct; c += 16) {
+                __m128i bytes = _mm_loadu_si128((const __m128i *) (line + c));
+                __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(bytes, zero), bias);
+                __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(bytes, zero), bias);
+                if (n >= 8) {
+                    _mm_storeu_si128((__m128i *) (blocks + sample_offset(n, cols, by, i, c)), lo);
+                    _mm_storeu_si128((__m128i *) (blocks + sample_offset(n, cols, by, i, c + 8)), hi);
+                } else {
+                    _mm_storel_epi64((__m128i *) (blocks + sample_offset(n, cols, by, i, c)), lo);
+                    _mm_storel_epi64((__m128i *) (blocks + sample_offset(n, cols, by, i, c + 4)),
+                                     _mm_unpackhi_epi64(lo, lo));
+                    _mm_storel_epi64((__m128i *) (blocks + sample_offset(n, cols, by, i, c + 8)), hi);
+                    _mm_storel_epi64((__m128i *) (blocks + sample_offset(n, cols, by, i, c + 12)),
+                                     _mm_unpackhi_epi64(hi, hi));
+                }
+            }
+#endif
+
+            // Tail of the row and replicated columns past the right edge
+            for (; c < region_width; c++) {
+                int source = c < width ? c : width - 1;
+                blocks[sample_offset(n, cols, by, i, c)] = (short) (line[source] - 128);
+            }
+        }
+    }
+}
+
+void unblockify(const short *blocks, int block_size, int cols, int rows,
+                unsigned char *plane, size_t stride, int width, int height) {
+    int n = block_size;
+    int region_width = cols * n;
+    int columns = region_width < width ? region_width : width;
+
+    for (int by = 0; by < rows; by++) {
+        for (int i = 0; i < n && by * n + i < height; i++) {
+            unsigned char *line = plane + (size_t) (by * n + i) * stride;
+            int c = 0;
+
+#if defined(__SSE2__)
+            // Saturating add and pack clamp to 0-255 without branches
+            const __m128i bias = _mm_set1_epi16(128);
+            for (; c + 16 <= columns; c += 16) {
+                __m128i lo, hi;
+                if (n >= 8) {
+                    lo = _mm_loadu_si128((const __m128i *) (blocks + sample_offset(n, cols, by, i, c)));
+                    hi = _mm_loadu_si128((const __m128i *) (blocks + sample_offset(n, cols, by, i, c + 8)));
+                } else {
+                    lo = _mm_unpacklo_epi64(
+                        _mm_loadl_epi64((const __m128i *) (blocks + sample_offset(n, cols, by, i, c))),
+                        _mm_loadl_epi64((const __m128i *) (blocks + sample_offset(n, cols, by, i, c + 4))));
+                    hi = _mm_unpacklo_epi64(
+                        _mm_loadl_epi64((const __m128i *) (blocks + sample_offset(n, cols, by, i, c + 8))),
+                        _mm_loadl_epi64((const __m128i *) (blocks + sample_offset(n, cols, by, i, c + 12))));
+                }
+                _mm_storeu_si128((__m128i *) (line + c),
+                                 _mm_packus_epi16(_mm_adds_epi16(lo, bias), _mm_adds_epi16(hi, bias)));
+            }
+#endif
+
+            for (; c < columns; c++) {
+                int value = blocks[sample_offset(n, cols, by, i, c)] + 128;
+                line[c] = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+            }
+        }
+    }
+}
+
+void blockify16(const unsigned short *plane, size_t stride, int width, int height, int bit_depth,
+                int block_size, int cols, int rows, short *blocks) {
+    int n = block_size;
+    int region_width = cols * n;
+    int direct = region_width < width ? region_width : width;
+    int bias = 1 << (bit_depth - 1);
+
+    for (int by = 0; by < rows; by++) {
+        for (int i = 0; i < n; i++) {
+            int r = by * n + i;
+            const unsigned short *line = plane + (size_t) (r < height ? r : height - 1) * stride;
+            int c = 0;
+
+#if defined(__SSE2__)
+            // 8 samples per load; the subtraction wraps, which is exact for
+            // results in the int16 range
+            const __m128i shift = _mm_set1_epi16((short) bias);
+            for (; c + 8 <= direct; c += 8) {
+                __m128i samples = _mm_sub_epi16(_mm_loadu_si128((const __m128i *) (line + c)), shift);
+                if (n >= 8) {
+                    _mm_storeu_si128((__m128i *) (blocks + sample_offset(n, cols, by, i, c)), samples);
+                } else {
+                    _mm_storel_epi64((__m128i *) (blocks + sample_offset(n, cols, by, i, c)), samples);
+                    _mm_storel_epi64((__m128i *) (blocks + sample_offset(n, cols, by, i, c + 4)),
+                                     _mm_unpackhi_epi64(samples, samples));
+                }
+            }
+#endif
+
+            for (; c < region_width; c++) {
+                int source = c < width ? c : width - 1;
+                blocks[sample_offset(n, cols, by, i, c)] = (short) (line[source] - bias);
+            }
+        }
+    }
+}
+
+void unblockify16(const short *blocks, int block_size, int cols, int rows, int bit_depth,
+                  unsigned short *plane, size_t stride, int width, int height) {
+    int n = block_size;
+    int region_width = cols * n;
+    int columns = region_width < width ? region_width : width;
+    int bias = 1 << (bit_depth - 1);
+    int max = (1 << bit_depth) - 1;
+
+    for (int by = 0; by < rows; by++) {
+        for (int i = 0; i < n && by * n + i < height; i++) {
+            unsigned short *line = plane + (size_t) (by * n + i) * stride;
+            int c = 0;
+
+#if defined(__SSE2__)
+            // Clamp in the signed domain, then add the bias with wrap-around
+            const __m128i low = _mm_set1_epi16((short) -bias);
+            const __m128i high = _mm_set1_epi16((short) (max - bias));
+            const __m128i shift = _mm_set1_epi16((short) bias);
+            for (; c + 8 <= columns; c += 8) {
+                __m128i samples;
+                if (n >= 8) {
+                    samples = _mm_loadu_si128((const __m128i *) (blocks + sample_offset(n, cols, by, i, c)));
+                } else {
+                    samples = _mm_unpacklo_epi64(
+                        _mm_loadl_epi64((const __m128i *) (blocks + sample_offset(n, cols, by, i, c))),
+                        _mm_loadl_epi64((const __m128i *) (blocks + sample_offset(n, cols, by, i, c + 4))));
+                }
+                samples = _mm_min_epi16(_mm_max_epi16(samples, low), high);
+                _mm_storeu_si128((__m128i *) (line + c), _mm_add_epi16(samples, shift));
+            }
+#endif
+
+            for (; c < columns; c++) {
+                int value = blocks[sample_offset(n, cols, by, i, c)] + bias;
+                line[c] = (unsigned short) (value < 0 ? 0 : (value > max ? max : value));
+            }
+        }
+    }
+}
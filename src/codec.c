@@ -0,0 +1,2495 @@
+/**
+ * codec.c - Implementation file for the plane-level image codec
+ * Part of Adaptive DCT Image Compressor
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <codec.h>
+#include <blockify.h>
+
+static const unsigned char codec_magic[4] = {'A', 'D', 'C', 'T'};
+
+#define CODEC_MIN_BLOCK_SIZE 4     // Smallest transform size
+#define CODEC_MAX_BLOCK_SIZE 32    // Largest transform size, also the quadtree region size
+#define CODEC_SIZE_CLASSES 4       // Transform sizes 4, 8, 16 and 32
+#define CODEC_MAX_LEAVES 64        // Leaves of a fully split quadtree region
+#define CODEC_SMOOTH_VARIANCE 4.0  // Nodes flatter than this are never split
+#define CODEC_MAX_DIMENSION (0x7FFFFFFF - CODEC_MAX_BLOCK_SIZE) // Largest width or height, so padding fits an int
+#define CODEC_SUPERTILE 64         // Edge of the super-tiles walked by CODEC_TRAVERSAL_MORTON
+#define CODEC_SCAN_SAMPLE 4        // One block row in this many feeds the adaptive scan statistics
+#define CODEC_PALETTE_CONTRAST 32  // Least 8-bit color spread of a palette block with two or more colors
+
+static int codec_traversal_mode = CODEC_TRAVERSAL_RASTER; // Only accessed atomically, see codec_set_traversal
+
+/**
+ * Structure to describe the geometry of a stream, shared by encoder and decoder
+ */
+typedef struct {
+    int width;               // Image width
+    int height;              // Image height
+    int padded_width;        // Width rounded up to whole blocks
+    int padded_height;       // Height rounded up to whole blocks
+    int block_size;          // Transform block size
+    int quality;             // Quality factor
+    int bit_depth;           // Bits per sample (8 = byte planes, 9-16 = 16-bit planes)
+    unsigned flags;          // CODEC_FLAG_* bits
+    int tile_width;          // Tile width in pixels
+    int tile_height;         // Tile height in pixels
+    int tiles_x;             // Number of tile columns
+    int tiles_y;             // Number of tile rows
+    int tile_count;          // Total number of tiles
+    int scan_count;          // Leading AC positions of the scan order (CODEC_FLAG_ADAPTIVE_SCAN)
+    unsigned short scan[CODEC_MAX_BLOCK_SIZE * CODEC_MAX_BLOCK_SIZE]; // Their natural indexes
+} StreamLayout;
+
+/**
+ * Structure to hold the contexts and scratch buffers used to code one tile
+ */
+typedef struct {
+    const StreamLayout *layout;
+    DCTContext *dct[CODEC_SIZE_CLASSES];     // Per-size DCT contexts, NULL for unused sizes
+    QuantContext *quant[CODEC_SIZE_CLASSES]; // Per-size quantization contexts, NULL for unused sizes
+    double **block;          // Spatial block
+    double **coeffs;         // DCT coefficients
+    double **recon;          // Dequantized coefficients (partition search)
+    double *dequantized;     // Decoded coefficients of every block in the band, zero between blocks (decoder)
+    unsigned char *extents;  // Nonzero extent of every decoded block in the band (see dct_inverse_sparse)
+    SparseBlock sparse;      // Quantized coefficients of the current block (encoder)
+    unsigned long long *nonzero; // Nonzero bitmap of every block in the tile, at its zigzag slot
+    int *values;             // Nonzero coefficients of the tile, packed block by block
+    size_t *value_offsets;   // Start of every block's nonzeros in values
+    size_t value_count;      // Nonzeros stored so far in the tile
+    unsigned char *sizes;    // Transform size of every block in the tile
+    unsigned char *levels;   // Adaptive quantization level of every block in the tile
+    unsigned char *palettes; // Color count of every block in the tile, 0 for transform blocks (CODEC_FLAG_PALETTE)
+    short *palette_colors;   // CODEC_PALETTE_COLORS level-shifted colors per block
+    unsigned char *palette_indexes; // Color index of every sample of a palette block, at its zigzag slot
+    short last_colors[CODEC_PALETTE_COLORS]; // Colors of the tile's latest palette block in stream order
+    int last_count;          // Their number, 0 before the tile's first palette block
+    int tile_palettes;       // Blocks of the current tile start with a palette mode bit
+    int *order;              // Traversal order of the blocks in one band of the tile
+    int traversal;           // CODEC_TRAVERSAL_* in effect when the coder was set up
+    int first_row;           // Image row held at the start of the pixel buffer (strip encoding)
+    short *band;             // Current band of block rows, block-major (see blockify.h)
+    int band_row;            // Image row of the band's top edge
+    int band_col;            // Image column of the band's left edge
+    int band_cols;           // Blocks across the band
+    double lambda;           // Rate-distortion multiplier for the partition search
+    int effort;              // CODEC_EFFORT_* level currently in use
+    double budget_ms;        // Encode time budget (0 = no deadline)
+    double start_ms;         // Time the encode started
+    size_t rows_done;        // Block rows encoded so far
+    size_t rows_total;       // Block rows in the whole stream
+    size_t degraded_rows;    // Block rows encoded below full effort
+    size_t table_modes[CODEC_TABLES_MODES]; // Tiles encoded in each CODEC_TABLES_* mode
+    size_t palette_blocks;   // Blocks encoded as a palette
+    HuffTable default_dc;
+    HuffTable default_ac;
+} TileCoder;
+
+/**
+ * Structure to hand block rows from the entropy decoding thread to the
+ * reconstruction threads of codec_decode_parallel. Rows are numbered in
+ * stream order; row r may be reconstructed once published exceeds r.
+ */
+typedef struct {
+    const StreamLayout *layout;
+    TileCoder *store;        // Coefficient store the entropy thread fills
+    unsigned char *pixels;   // Decoded image
+    int *row_tiles;          // Tile of every block row
+    int *row_indices;        // Block (or quadtree region) row within the tile
+    int *row_blocks;         // Store index of the row's first block
+    size_t *row_offsets;     // Zigzag slot of the row's first block
+    size_t row_count;        // Block rows in the whole stream
+    size_t published;        // Rows fully entropy decoded (atomic)
+    size_t next_row;         // Next row to claim for reconstruction (atomic)
+    int failed;              // Set when a tile is corrupt (atomic)
+} RowQueue;
+
+/**
+ * Structure to hold the transform of a whole image for the quality search
+ */
+typedef struct {
+    int block_size;          // Transform block size
+    size_t block_count;      // Number of blocks in the padded image
+    int adaptive;            // Adaptive quantization flag
+    DCTContext *dct;         // Transform that produced the coefficients
+    double *coeffs;          // Coefficients of every block, row-major within a block
+    double *variances;       // Adaptive quantization variance of every block (0 when off)
+} CoeffCache;
+
+/**
+ * Structure to count how often each coefficient position ends up nonzero,
+ * from which the adaptive scan order is derived
+ */
+typedef struct {
+    const StreamLayout *layout;
+    DCTContext *dct;
+    QuantContext *quant;     // Static or adaptive quantization as the stream uses, zigzag order
+    double **block;          // Spatial block
+    double **coeffs;         // DCT coefficients
+    int **quantized;         // Quantized coefficients
+    short *row_blocks;       // One block row, block-major
+    unsigned long long counts[CODEC_MAX_BLOCK_SIZE * CODEC_MAX_BLOCK_SIZE]; // Nonzeros per natural position
+} ScanStats;
+
+void codec_set_traversal(int traversal) {
+    if (traversal == CODEC_TRAVERSAL_RASTER || traversal == CODEC_TRAVERSAL_MORTON) {
+        __atomic_store_n(&codec_traversal_mode, traversal, __ATOMIC_RELAXED);
+    }
+}
+
+int codec_traversal(void) {
+    return __atomic_load_n(&codec_traversal_mode, __ATOMIC_RELAXED);
+}
+
+CodecParams codec_default_params(void) {
+    CodecParams params;
+    params.block_size = 8;
+    params.quality = 75;
+    params.adaptive = 0;
+    params.tile_size = 64;
+    params.optimize_huffman = 1;
+    params.quadtree = 0;
+    params.approximate_dct = 0;
+    params.adaptive_scan = 0;
+    params.palette = 0;
+    params.time_budget_ms = 0.0;
+    return params;
+}
+
+// Monotonic wall-clock time in milliseconds
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Little-endian field helpers
+static void put_u32(unsigned char *p, unsigned long value) {
+    p[0] = (unsigned char) (value & 0xFF);
+    p[1] = (unsigned char) ((value >> 8) & 0xFF);
+    p[2] = (unsigned char) ((value >> 16) & 0xFF);
+    p[3] = (unsigned char) ((value >> 24) & 0xFF);
+}
+
+static unsigned long get_u32(const unsigned char *p) {
+    return (unsigned long) p[0] | ((unsigned long) p[1] << 8) |
+           ((unsigned long) p[2] << 16) | ((unsigned long) p[3] << 24);
+}
+
+static void put_u64(unsigned char *p, unsigned long long value) {
+    put_u32(p, (unsigned long) (value & 0xFFFFFFFFUL));
+    put_u32(p + 4, (unsigned long) (value >> 32));
+}
+
+static unsigned long long get_u64(const unsigned char *p) {
+    return (unsigned long long) get_u32(p) | ((unsigned long long) get_u32(p + 4) << 32);
+}
+
+static int valid_block_size(int block_size) {
+    return block_size == 4 || block_size == 8 || block_size == 16 || block_size == 32;
+}
+
+// Fill in the derived fields of a layout from its dimensions and tile size; 0 if the tile count overflows
+static int finish_layout(StreamLayout *layout) {
+    int n = layout->block_size;
+    layout->padded_width = (layout->width + n - 1) / n * n;
+    layout->padded_height = (layout->height + n - 1) / n * n;
+    layout->tiles_x = (int) (((long long) layout->padded_width + layout->tile_width - 1) / layout->tile_width);
+    layout->tiles_y = (int) (((long long) layout->padded_height + layout->tile_height - 1) / layout->tile_height);
+
+    long long tile_count = (long long) layout->tiles_x * layout->tiles_y;
+    layout->tile_count = tile_count > 0x7FFFFFFFLL ? 0 : (int) tile_count;
+    return tile_count <= 0x7FFFFFFFLL;
+}
+
+// Number of block (or quadtree region) columns and rows inside a tile
+static void tile_blocks(const StreamLayout *layout, int tx, int ty, int *cols, int *rows) {
+    int x0 = tx * layout->tile_width;
+    int y0 = ty * layout->tile_height;
+    int w = layout->padded_width - x0 < layout->tile_width ? layout->padded_width - x0 : layout->tile_width;
+    int h = layout->padded_height - y0 < layout->tile_height ? layout->padded_height - y0 : layout->tile_height;
+    *cols = w / layout->block_size;
+    *rows = h / layout->block_size;
+}
+
+static int layout_from_params(StreamLayout *layout, int width, int height, const CodecParams *params) {
+    if (width <= 0 || height <= 0 || width > CODEC_MAX_DIMENSION || height > CODEC_MAX_DIMENSION ||
+        params->tile_size > CODEC_MAX_DIMENSION || (!params->quadtree && !valid_block_size(params->block_size))) {
+        fprintf(stderr, "Invalid codec parameters\n");
+        return 0;
+    }
+
+    int n = params->quadtree ? CODEC_MAX_BLOCK_SIZE : params->block_size;
+    layout->width = width;
+    layout->height = height;
+    layout->block_size = n;
+    layout->quality = params->quality < 1 ? 1 : (params->quality > 100 ? 100 : params->quality);
+    layout->bit_depth = 8;
+    layout->flags = 0;
+    if (params->adaptive) layout->flags |= CODEC_FLAG_ADAPTIVE;
+    if (params->optimize_huffman) layout->flags |= CODEC_FLAG_OPTIMIZE_HUFFMAN;
+    if (params->quadtree) layout->flags |= CODEC_FLAG_QUADTREE;
+    if (params->approximate_dct) layout->flags |= CODEC_FLAG_APPROX_DCT;
+    if (params->adaptive_scan && !params->quadtree) layout->flags |= CODEC_FLAG_ADAPTIVE_SCAN;
+    if (params->palette && !params->quadtree) layout->flags |= CODEC_FLAG_PALETTE;
+    layout->scan_count = 0;
+
+    if (params->tile_size <= 0) {
+        layout->tile_width = (width + n - 1) / n * n;
+        layout->tile_height = (height + n - 1) / n * n;
+    } else {
+        layout->tile_width = (params->tile_size + n - 1) / n * n;
+        layout->tile_height = layout->tile_width;
+    }
+
+    if (!finish_layout(layout)) {
+        fprintf(stderr, "Invalid codec parameters: too many tiles\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Bytes per position in the scan order table
+static size_t scan_entry_size(const StreamLayout *layout) {
+    return layout->block_size * layout->block_size > 256 ? 2 : 1;
+}
+
+// Bytes of the scan order table that follows the index (0 without CODEC_FLAG_ADAPTIVE_SCAN)
+static size_t scan_table_size(const StreamLayout *layout) {
+    if (!(layout->flags & CODEC_FLAG_ADAPTIVE_SCAN)) {
+        return 0;
+    }
+    return 2 + (size_t) layout->scan_count * scan_entry_size(layout);
+}
+
+// Stream offset of the first tile segment, which index offsets are relative to
+static unsigned long long payload_offset(const StreamLayout *layout) {
+    return CODEC_HEADER_SIZE + (unsigned long long) layout->tile_count * CODEC_INDEX_ENTRY_SIZE +
+           scan_table_size(layout);
+}
+
+static void write_scan_table(unsigned char *p, const StreamLayout *layout) {
+    p[0] = (unsigned char) (layout->scan_count & 0xFF);
+    p[1] = (unsigned char) (layout->scan_count >> 8);
+    for (int k = 0; k < layout->scan_count; k++) {
+        if (scan_entry_size(layout) == 2) {
+            p[2 + 2 * k] = (unsigned char) (layout->scan[k] & 0xFF);
+            p[3 + 2 * k] = (unsigned char) (layout->scan[k] >> 8);
+        } else {
+            p[2 + k] = (unsigned char) layout->scan[k];
+        }
+    }
+}
+
+// Parse the scan order table from the available bytes; 0 if it is cut short or invalid
+static int read_scan_table(const unsigned char *p, size_t available, StreamLayout *layout) {
+    if (available < 2) {
+        return 0;
+    }
+    layout->scan_count = p[0] | (p[1] << 8);
+    if (layout->scan_count >= layout->block_size * layout->block_size ||
+        available - 2 < (size_t) layout->scan_count * scan_entry_size(layout)) {
+        return 0;
+    }
+    for (int k = 0; k < layout->scan_count; k++) {
+        layout->scan[k] = scan_entry_size(layout) == 2 ? (unsigned short) (p[2 + 2 * k] | (p[3 + 2 * k] << 8))
+                                                       : p[2 + k];
+    }
+    return quant_valid_scan_order(layout->scan, layout->scan_count, layout->block_size);
+}
+
+static void write_header(unsigned char *p, const StreamLayout *layout) {
+    memcpy(p, codec_magic, 4);
+    p[4] = CODEC_VERSION;
+    p[5] = (unsigned char) layout->block_size;
+    p[6] = (unsigned char) layout->quality;
+    p[7] = (unsigned char) (layout->bit_depth > 8 ? layout->bit_depth : 0);
+    put_u32(p + 8, layout->flags);
+    put_u32(p + 12, (unsigned long) layout->width);
+    put_u32(p + 16, (unsigned long) layout->height);
+    put_u32(p + 20, (unsigned long) layout->tile_width);
+    put_u32(p + 24, (unsigned long) layout->tile_height);
+    put_u32(p + 28, (unsigned long) layout->tile_count);
+}
+
+// Parse and validate the header and index of a stream
+static int read_header(const unsigned char *stream, size_t size, StreamLayout *layout) {
+    if (size < CODEC_HEADER_SIZE || memcmp(stream, codec_magic, 4) != 0 || stream[4] != CODEC_VERSION) {
+        fprintf(stderr, "Invalid stream header\n");
+        return 0;
+    }
+
+    layout->block_size = stream[5];
+    layout->quality = stream[6];
+    layout->bit_depth = stream[7] ? stream[7] : 8;
+    layout->flags = (unsigned) get_u32(stream + 8);
+    unsigned long width = get_u32(stream + 12);
+    unsigned long height = get_u32(stream + 16);
+    unsigned long tile_width = get_u32(stream + 20);
+    unsigned long tile_height = get_u32(stream + 24);
+    unsigned long tile_count = get_u32(stream + 28);
+
+    if (!valid_block_size(layout->block_size) || layout->quality < 1 || layout->quality > 100 ||
+        (stream[7] != 0 && (stream[7] <= 8 || stream[7] > CODEC_MAX_BIT_DEPTH)) ||
+        width == 0 || height == 0 || width > CODEC_MAX_DIMENSION || height > CODEC_MAX_DIMENSION ||
+        tile_width == 0 || tile_height == 0 || tile_width % layout->block_size != 0 ||
+        tile_height % layout->block_size != 0 || tile_width > CODEC_MAX_DIMENSION || tile_height > CODEC_MAX_DIMENSION ||
+        ((layout->flags & CODEC_FLAG_QUADTREE) && layout->block_size != CODEC_MAX_BLOCK_SIZE) ||
+        ((layout->flags & CODEC_FLAG_QUADTREE) && (layout->flags & (CODEC_FLAG_ADAPTIVE_SCAN | CODEC_FLAG_PALETTE)))) {
+        fprintf(stderr, "Invalid stream header\n");
+        return 0;
+    }
+
+    layout->width = (int) width;
+    layout->height = (int) height;
+    layout->tile_width = (int) tile_width;
+    layout->tile_height = (int) tile_height;
+
+    if (!finish_layout(layout) || (unsigned long) layout->tile_count != tile_count ||
+        (size - CODEC_HEADER_SIZE) / CODEC_INDEX_ENTRY_SIZE < tile_count) {
+        fprintf(stderr, "Invalid stream index\n");
+        return 0;
+    }
+
+    size_t index_end = CODEC_HEADER_SIZE + tile_count * CODEC_INDEX_ENTRY_SIZE;
+    layout->scan_count = 0;
+    if ((layout->flags & CODEC_FLAG_ADAPTIVE_SCAN) &&
+        !read_scan_table(stream + index_end, size - index_end, layout)) {
+        fprintf(stderr, "Invalid stream scan order\n");
+        return 0;
+    }
+
+    // A segment holds its 8-bit table mode and at least 2 bits per block (a DC
+    // and an end-of-block code, a split flag and more for a quadtree region,
+    // or a mode and reuse bit for a palette). Segments too short for the
+    // blocks the header declares are rejected here, before anything is sized
+    // from the declared dimensions.
+    size_t payload_size = size - (size_t) payload_offset(layout);
+    for (unsigned long t = 0; t < tile_count; t++) {
+        const unsigned char *entry = stream + CODEC_HEADER_SIZE + t * CODEC_INDEX_ENTRY_SIZE;
+        unsigned long long offset = get_u64(entry);
+        unsigned long length = get_u32(entry + 8);
+        int cols, rows;
+        tile_blocks(layout, (int) (t % layout->tiles_x), (int) (t / layout->tiles_x), &cols, &rows);
+        if (offset > payload_size || length > payload_size - offset ||
+            (unsigned long long) length * 8 < 8 + 2ULL * cols * rows) {
+            fprintf(stderr, "Invalid stream index\n");
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Locate a tile segment through the index
+static const unsigned char* tile_segment(const unsigned char *stream, const StreamLayout *layout,
+                                         int tile, size_t *length) {
+    const unsigned char *entry = stream + CODEC_HEADER_SIZE + (size_t) tile * CODEC_INDEX_ENTRY_SIZE;
+    *length = get_u32(entry + 8);
+    return stream + payload_offset(layout) + get_u64(entry);
+}
+
+// Adaptive quantization only sees the variance through clamp(variance / 1000, 0.1, 1.0),
+// so one byte per block carries it to the decoder
+static int variance_to_level(double variance) {
+    double clamped = fmin(1000.0, fmax(100.0, variance));
+    return (int) round((clamped - 100.0) * 255.0 / 900.0);
+}
+
+static double level_to_variance(int level) {
+    return 100.0 + level * 900.0 / 255.0;
+}
+
+// Index of a transform size in the per-size context arrays (4 -> 0 ... 32 -> 3)
+static int size_class(int size) {
+    int c = 0;
+    while ((CODEC_MIN_BLOCK_SIZE << c) < size) c++;
+    return c;
+}
+
+// Ratio of the sample range to the 8-bit range; variances scale with its square
+static double depth_scale(const StreamLayout *layout) {
+    return (double) (1 << (layout->bit_depth - 8));
+}
+
+// Bytes per sample of the planes a layout reads and writes
+static size_t sample_bytes(const StreamLayout *layout) {
+    return layout->bit_depth > 8 ? sizeof(unsigned short) : sizeof(unsigned char);
+}
+
+// Allocate the palette store for coeff_count sample slots and max_blocks blocks
+static void tile_coder_alloc_palettes(TileCoder *tc, size_t coeff_count, size_t max_blocks) {
+    tc->palettes = (unsigned char*)malloc(max_blocks);
+    tc->palette_colors = (short*)malloc(max_blocks * CODEC_PALETTE_COLORS * sizeof(short));
+    tc->palette_indexes = (unsigned char*)alloc_large(coeff_count);
+    if (!tc->palettes || !tc->palette_colors) {
+        fprintf(stderr, "Memory allocation failed when creating palette buffers\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void tile_coder_init(TileCoder *tc, const StreamLayout *layout) {
+    int n = layout->block_size;
+    int quadtree = (layout->flags & CODEC_FLAG_QUADTREE) != 0;
+    int adaptive = (layout->flags & CODEC_FLAG_ADAPTIVE) != 0;
+    // Tiles are clipped to the padded image, so a tile size far beyond the
+    // image (legal in the header) must not size the buffers
+    int tile_width = layout->tile_width < layout->padded_width ? layout->tile_width : layout->padded_width;
+    int tile_height = layout->tile_height < layout->padded_height ? layout->tile_height : layout->padded_height;
+    size_t tile_pixels = (size_t) tile_width * tile_height;
+    size_t max_blocks = tile_pixels / (quadtree ? CODEC_MIN_BLOCK_SIZE * CODEC_MIN_BLOCK_SIZE : n * n);
+
+    tc->layout = layout;
+    tc->traversal = codec_traversal();
+    tc->lambda = 0.0;
+    tc->first_row = 0;
+    tc->effort = CODEC_EFFORT_FULL;
+    tc->budget_ms = 0.0;
+    tc->start_ms = 0.0;
+    tc->rows_done = 0;
+    tc->rows_total = (size_t) layout->tiles_x * (layout->padded_height / n);
+    tc->degraded_rows = 0;
+    memset(tc->table_modes, 0, sizeof(tc->table_modes));
+    tc->palette_blocks = 0;
+    tc->last_count = 0;
+    tc->tile_palettes = 0;
+    for (int c = 0; c < CODEC_SIZE_CLASSES; c++) {
+        int size = CODEC_MIN_BLOCK_SIZE << c;
+        if (!quadtree && size != n) {
+            tc->dct[c] = NULL;
+            tc->quant[c] = NULL;
+            continue;
+        }
+
+        tc->dct[c] = (layout->flags & CODEC_FLAG_APPROX_DCT) ? dct_init_approximate(size) : dct_init(size);
+        tc->quant[c] = quant_init(size, layout->quality, adaptive);
+        if (layout->bit_depth > 8) {
+            quant_set_bit_depth(tc->quant[c], layout->bit_depth);
+        }
+
+        // Distortion is a squared error, so the partition search multiplier
+        // follows the squared mean step of the 8x8 table (high-rate approximation)
+        if (quadtree && size == 8) {
+            double step = 0.0;
+            for (int i = 0; i < 8; i++) {
+                for (int j = 0; j < 8; j++) {
+                    step += tc->quant[c]->quant_matrix[i][j];
+                }
+            }
+            step /= 64.0;
+            tc->lambda = 0.12 * step * step;
+        }
+
+        if (tc->dct[c]->approximate) {
+            quant_apply_transform_scale(tc->quant[c], tc->dct[c]->row_norms);
+        }
+        if (layout->flags & CODEC_FLAG_ADAPTIVE_SCAN) {
+            quant_set_scan_order(tc->quant[c], layout->scan, layout->scan_count);
+        }
+    }
+    tc->block = alloc_array(n, n);
+    tc->coeffs = alloc_array(n, n);
+    tc->recon = alloc_array(n, n);
+    size_t band_samples = (size_t) tile_width * CODEC_SUPERTILE;
+    tc->dequantized = (double*)alloc_large(band_samples * sizeof(double));
+    memset(tc->dequantized, 0, band_samples * sizeof(double));
+    tc->sparse.values = (int*)malloc((size_t) n * n * sizeof(int));
+    tc->nonzero = (unsigned long long*)alloc_large((tile_pixels + 63) / 64 * sizeof(unsigned long long));
+    tc->values = (int*)alloc_large(tile_pixels * sizeof(int));
+    tc->value_offsets = (size_t*)malloc(max_blocks * sizeof(size_t));
+    tc->sizes = (unsigned char*)malloc(max_blocks);
+    tc->levels = (unsigned char*)malloc(max_blocks);
+    tc->extents = (unsigned char*)malloc(max_blocks);
+    tc->order = (int*)malloc(max_blocks * sizeof(int));
+    tc->band = (short*)malloc(band_samples * sizeof(short));
+    if (!tc->sparse.values || !tc->value_offsets || !tc->sizes || !tc->levels || !tc->extents || !tc->order || !tc->band) {
+        fprintf(stderr, "Memory allocation failed when creating tile buffers\n");
+        exit(EXIT_FAILURE);
+    }
+    tc->palettes = NULL;
+    tc->palette_colors = NULL;
+    tc->palette_indexes = NULL;
+    if (layout->flags & CODEC_FLAG_PALETTE) {
+        tile_coder_alloc_palettes(tc, tile_pixels, max_blocks);
+    }
+
+    build_default_huffman_table(&tc->default_dc, 1);
+    build_default_huffman_table(&tc->default_ac, 0);
+}
+
+static void tile_coder_free(TileCoder *tc) {
+    int n = tc->layout->block_size;
+    for (int c = 0; c < CODEC_SIZE_CLASSES; c++) {
+        if (tc->dct[c]) dct_free(tc->dct[c]);
+        if (tc->quant[c]) quant_free(tc->quant[c]);
+    }
+    free_array(tc->block, n);
+    free_array(tc->coeffs, n);
+    free_array(tc->recon, n);
+    free_large(tc->dequantized);
+    free(tc->sparse.values);
+    free_large(tc->nonzero);
+    free_large(tc->values);
+    free(tc->value_offsets);
+    free(tc->sizes);
+    free(tc->levels);
+    free(tc->extents);
+    free(tc->order);
+    free(tc->band);
+    free(tc->palettes);
+    free(tc->palette_colors);
+    free_large(tc->palette_indexes);
+}
+
+/**
+ * Account for one finished block row and adjust the effort to the schedule
+ * The schedule is linear in block rows. Each check that finds the encoder
+ * late drops one level; one that finds it comfortably early restores one,
+ * so a budget between two levels' costs is spent rather than left over.
+ * Static quantization switches the contexts to the plain matrix, which is
+ * what the decoder derives from the adaptive level 255 those blocks carry.
+ */
+static void finish_block_row(TileCoder *tc) {
+    if (tc->effort < CODEC_EFFORT_FULL) {
+        tc->degraded_rows++;
+    }
+    tc->rows_done++;
+    if (tc->budget_ms <= 0.0) {
+        return;
+    }
+
+    double elapsed = now_ms() - tc->start_ms;
+    double allowed = tc->budget_ms * (double) tc->rows_done / (double) tc->rows_total;
+    int effort = tc->effort;
+    if (elapsed > allowed && effort > CODEC_EFFORT_STATIC_QUANT) {
+        effort--;
+    } else if (elapsed < 0.9 * allowed && effort < CODEC_EFFORT_FULL) {
+        effort++;
+    }
+
+    if (effort != tc->effort) {
+        int adaptive = (tc->layout->flags & CODEC_FLAG_ADAPTIVE) && effort > CODEC_EFFORT_STATIC_QUANT;
+        for (int c = 0; c < CODEC_SIZE_CLASSES; c++) {
+            if (tc->quant[c]) tc->quant[c]->adaptive = adaptive;
+        }
+        tc->effort = effort;
+    }
+}
+
+// Block rows per band the transform stages walk together (1 for raster order)
+static int band_height(const TileCoder *tc, int block_size) {
+    return tc->traversal == CODEC_TRAVERSAL_MORTON ? CODEC_SUPERTILE / block_size : 1;
+}
+
+/**
+ * Order of the blocks inside a band of band_rows x cols blocks, as indices
+ * relative to the band's first block (row-major). A span of 1 is raster
+ * order; otherwise the band is a row of span x span super-tiles, each
+ * visited in Z order, skipping positions past the tile edge.
+ */
+static int band_order(int cols, int band_rows, int span, int *order) {
+    int count = 0;
+    if (span == 1) {
+        for (int i = 0; i < band_rows * cols; i++) {
+            order[count++] = i;
+        }
+        return count;
+    }
+
+    for (int sx = 0; sx < cols; sx += span) {
+        for (int k = 0; k < span * span; k++) {
+            int x = sx;
+            int y = 0;
+            for (int bit = 0; (1 << bit) < span; bit++) {
+                x += ((k >> (2 * bit)) & 1) << bit;
+                y += ((k >> (2 * bit + 1)) & 1) << bit;
+            }
+            if (x < cols && y < band_rows) {
+                order[count++] = y * cols + x;
+            }
+        }
+    }
+    return count;
+}
+
+// Point the band at block rows [by0, by0 + band_rows) of a tile
+static void set_band(TileCoder *tc, int tx, int ty, int by0, int band_cols) {
+    tc->band_row = ty * tc->layout->tile_height + by0 * tc->layout->block_size;
+    tc->band_col = tx * tc->layout->tile_width;
+    tc->band_cols = band_cols;
+}
+
+/**
+ * Blockify the current band from the pixel buffer, replicating edge pixels
+ * past the image border; pixels holds the image from row first_row on
+ */
+static void load_band(TileCoder *tc, const void *pixels, int band_rows) {
+    const StreamLayout *layout = tc->layout;
+    size_t start = (size_t) (tc->band_row - tc->first_row) * layout->width + tc->band_col;
+    if (layout->bit_depth > 8) {
+        blockify16((const unsigned short *) pixels + start, (size_t) layout->width, layout->width - tc->band_col,
+                   layout->height - tc->band_row, layout->bit_depth, layout->block_size, tc->band_cols, band_rows,
+                   tc->band);
+        return;
+    }
+    blockify((const unsigned char *) pixels + start, (size_t) layout->width, layout->width - tc->band_col,
+             layout->height - tc->band_row, layout->block_size, tc->band_cols, band_rows, tc->band);
+}
+
+// Write the current band back to the image, dropping pixels past the border
+static void store_band(TileCoder *tc, void *pixels, int band_rows) {
+    const StreamLayout *layout = tc->layout;
+    size_t start = (size_t) tc->band_row * layout->width + tc->band_col;
+    if (layout->bit_depth > 8) {
+        unblockify16(tc->band, layout->block_size, tc->band_cols, band_rows, layout->bit_depth,
+                     (unsigned short *) pixels + start, (size_t) layout->width,
+                     layout->width - tc->band_col, layout->height - tc->band_row);
+        return;
+    }
+    unblockify(tc->band, layout->block_size, tc->band_cols, band_rows, (unsigned char *) pixels + start,
+               (size_t) layout->width, layout->width - tc->band_col, layout->height - tc->band_row);
+}
+
+// Samples of the band block holding image position (row, col); a smaller
+// quadtree leaf starts inside its region's block
+static short* band_sample(TileCoder *tc, int row, int col) {
+    int n = tc->layout->block_size;
+    int r = row - tc->band_row;
+    int c = col - tc->band_col;
+    return tc->band + ((size_t) (r / n) * tc->band_cols + (size_t) (c / n)) * n * n + (size_t) (r % n) * n + c % n;
+}
+
+// Load a level-shifted block from the band
+static void load_block(TileCoder *tc, int size, int row, int col) {
+    int n = tc->layout->block_size;
+    const short *src = band_sample(tc, row, col);
+    for (int i = 0; i < size; ++i) {
+        for (int j = 0; j < size; ++j) {
+            tc->block[i][j] = (double) src[(size_t) i * n + j];
+        }
+    }
+}
+
+// Store a reconstructed block into the band, rounded and clamped to the pixel range
+static void store_block(TileCoder *tc, int size, int row, int col) {
+    int n = tc->layout->block_size;
+    double bias = (double) (1 << (tc->layout->bit_depth - 1));
+    double max = (double) ((1 << tc->layout->bit_depth) - 1);
+    short *dst = band_sample(tc, row, col);
+    for (int i = 0; i < size; ++i) {
+        for (int j = 0; j < size; ++j) {
+            double value = round(tc->block[i][j] + bias);
+            value = value < 0.0 ? 0.0 : (value > max ? max : value);
+            dst[(size_t) i * n + j] = (short) (value - bias);
+        }
+    }
+}
+
+// Bytes write_huffman_table spends on a table
+static size_t huffman_table_bytes(const HuffTable *table) {
+    return HUFF_MAX_CODE_LEN + (size_t) table->value_count;
+}
+
+/**
+ * Size of a histogram under an optimized table, or SIZE_MAX when the table
+ * cannot beat default_bits: any table spends at least one bit per symbol
+ * plus its own bytes, so hopeless tables are never built.
+ */
+static size_t optimized_table_bits(HuffTable *table, const unsigned *freq, int symbol_count, size_t default_bits) {
+    size_t symbols = 0;
+    size_t distinct = 0;
+    for (int i = 0; i < symbol_count; i++) {
+        symbols += freq[i];
+        distinct += freq[i] != 0;
+    }
+    if (symbols + 8 * (HUFF_MAX_CODE_LEN + distinct) >= default_bits) {
+        return SIZE_MAX;
+    }
+    build_canonical_huffman_table(table, freq, symbol_count);
+    return huffman_estimate_bits(table, freq, symbol_count) + 8 * huffman_table_bytes(table);
+}
+
+static void write_huffman_table(BitWriter *bw, const HuffTable *table) {
+    bitwriter_put_bytes(bw, table->bits + 1, HUFF_MAX_CODE_LEN);
+    bitwriter_put_bytes(bw, table->values, table->value_count);
+}
+
+static int read_huffman_table(BitReader *br, HuffTable *table) {
+    unsigned char bits[HUFF_MAX_CODE_LEN + 1];
+    unsigned char values[HUFF_AC_SYMBOLS];
+    int total = 0;
+
+    bits[0] = 0;
+    for (int len = 1; len <= HUFF_MAX_CODE_LEN; len++) {
+        bits[len] = (unsigned char) bitreader_get_bits(br, 8);
+        total += bits[len];
+    }
+    if (total > HUFF_AC_SYMBOLS) {
+        return 0;
+    }
+    for (int i = 0; i < total; i++) {
+        values[i] = (unsigned char) bitreader_get_bits(br, 8);
+    }
+
+    return load_huffman_table(table, bits, values);
+}
+
+// Transform and quantize one block into tc->sparse, returning the variance used
+static double transform_block(TileCoder *tc, int size, int row, int col,
+                              unsigned char *level) {
+    int c = size_class(size);
+    load_block(tc, size, row, col);
+    dct_forward(tc->dct[c], tc->block, tc->coeffs);
+
+    double variance = 0.0;
+    *level = 0;
+    if (tc->layout->flags & CODEC_FLAG_ADAPTIVE) {
+        *level = tc->effort > CODEC_EFFORT_STATIC_QUANT
+                 ? (unsigned char) variance_to_level(calculate_block_variance(tc->block, size) /
+                                                     (depth_scale(tc->layout) * depth_scale(tc->layout)))
+                 : 255;
+        variance = level_to_variance(*level);
+    }
+    quantize_sparse(tc->quant[c], tc->coeffs, &tc->sparse, variance);
+    return variance;
+}
+
+/**
+ * Record a block whose nonzero values already sit at the end of tc->values
+ * Its nonzero bits go to the block's zigzag slot in tc->nonzero. A slot
+ * starts on a multiple of size^2 (quadtree leaves come in Z order), so
+ * blocks of 8x8 and up own whole bitmap words and a 4x4 block owns 16
+ * bits of one word.
+ */
+static void commit_block(TileCoder *tc, int size, unsigned char level, const SparseBlock *block,
+                         int *b, size_t *offset) {
+    int coeff_count = size * size;
+    if (coeff_count >= 64) {
+        memcpy(tc->nonzero + *offset / 64, block->bitmap, (size_t) coeff_count / 64 * sizeof(unsigned long long));
+    } else {
+        unsigned long long *word = tc->nonzero + *offset / 64;
+        int shift = (int) (*offset % 64);
+        unsigned long long mask = ((1ULL << coeff_count) - 1) << shift;
+        *word = (*word & ~mask) | (block->bitmap[0] << shift);
+    }
+
+    tc->value_offsets[*b] = tc->value_count;
+    tc->value_count += (size_t) block->count;
+    tc->sizes[*b] = (unsigned char) size;
+    tc->levels[*b] = level;
+    (*b)++;
+    *offset += coeff_count;
+}
+
+// Append the block in tc->sparse to the tile's coefficient store
+static void append_block(TileCoder *tc, int size, unsigned char level, int *b, size_t *offset) {
+    int *values = tc->values + tc->value_count;
+    for (int k = 0; k < tc->sparse.count; k++) {
+        int value = tc->sparse.values[k];
+        values[k] = value > ENTROPY_MAX_COEFF ? ENTROPY_MAX_COEFF : (value < -ENTROPY_MAX_COEFF ? -ENTROPY_MAX_COEFF : value);
+    }
+    commit_block(tc, size, level, &tc->sparse, b, offset);
+}
+
+/**
+ * Histogram pass deciding whether a block fits a palette
+ * Colors are collected in order of first appearance, and the scan stops at
+ * the first sample that would need one color too many; indexes may be NULL.
+ *
+ * @return Number of colors, or 0 if there are more than CODEC_PALETTE_COLORS
+ */
+static int find_palette(const short *samples, int count, short *colors, unsigned char *indexes) {
+    int used = 0;
+    for (int k = 0; k < count; k++) {
+        int i = 0;
+        while (i < used && colors[i] != samples[k]) i++;
+        if (i == used) {
+            if (used == CODEC_PALETTE_COLORS) {
+                return 0;
+            }
+            colors[used++] = samples[k];
+        }
+        if (indexes) indexes[k] = (unsigned char) i;
+    }
+    return used;
+}
+
+// Index bits per sample of a palette of count colors
+static int palette_index_bits(int count) {
+    return count > 2 ? 2 : count - 1;
+}
+
+/**
+ * Palette of a block worth coding that way, or 0 to transform it
+ * Flat blocks always qualify. With more colors the spread must be wide,
+ * as at text and UI edges: a few close levels are a smooth area that the
+ * transform codes in a handful of coefficients.
+ */
+static int choose_palette(const StreamLayout *layout, const short *samples, int count,
+                          short *colors, unsigned char *indexes) {
+    int used = find_palette(samples, count, colors, indexes);
+    int low = colors[0];
+    int high = colors[0];
+    for (int i = 1; i < used; i++) {
+        low = colors[i] < low ? colors[i] : low;
+        high = colors[i] > high ? colors[i] : high;
+    }
+    if (used > 1 && high - low < CODEC_PALETTE_CONTRAST * (1 << (layout->bit_depth - 8))) {
+        return 0;
+    }
+    return used;
+}
+
+// Record a palette block in the coefficient store as a block without coefficients
+static void commit_palette_block(TileCoder *tc, int size, int *b, size_t *offset) {
+    SparseBlock empty;
+    memset(&empty, 0, sizeof(empty));
+    commit_block(tc, size, 0, &empty, b, offset);
+}
+
+// View block b, stored at zigzag slot offset, as a sparse block
+static void stored_block(const TileCoder *tc, int b, size_t offset, SparseBlock *block) {
+    int coeff_count = tc->sizes[b] * tc->sizes[b];
+    if (coeff_count >= 64) {
+        memcpy(block->bitmap, tc->nonzero + offset / 64, (size_t) coeff_count / 64 * sizeof(unsigned long long));
+    } else {
+        block->bitmap[0] = (tc->nonzero[offset / 64] >> (offset % 64)) & ((1ULL << coeff_count) - 1);
+    }
+    block->values = tc->values + tc->value_offsets[b];
+}
+
+/**
+ * Rate-distortion cost of coding a node as one block
+ * Distortion is measured on the coefficients (equal to the pixel error for
+ * an orthonormal DCT); rate is the category bits plus a nominal 4-bit code
+ * per nonzero coefficient.
+ */
+static double leaf_cost(TileCoder *tc, int size, int row, int col, double *variance) {
+    unsigned char level;
+    double block_variance = transform_block(tc, size, row, col, &level);
+    dequantize_sparse(tc->quant[size_class(size)], &tc->sparse, tc->recon, block_variance);
+    *variance = calculate_block_variance(tc->block, size);
+
+    double distortion = dct_domain_sse(tc->dct[size_class(size)], tc->coeffs, tc->recon);
+    double bits = (tc->layout->flags & CODEC_FLAG_ADAPTIVE) ? 8.0 : 0.0;
+    for (int k = 0; k < tc->sparse.count; k++) {
+        bits += magnitude_category(tc->sparse.values[k]) + 4;
+    }
+    bits += 3 + 4; // DC category code and EOB
+
+    return distortion + tc->lambda * bits;
+}
+
+/**
+ * Pick the cheapest quadtree partition of a node
+ * Leaf sizes are appended to leaves in depth-first (Z) order. Nodes that are
+ * already smooth are not split further.
+ *
+ * @return Rate-distortion cost of the chosen partition
+ */
+static double choose_partition(TileCoder *tc, int size, int row, int col,
+                               unsigned char *leaves, int *leaf_count) {
+    int start = *leaf_count;
+    double variance;
+    double cost = leaf_cost(tc, size, row, col, &variance);
+
+    double scale = depth_scale(tc->layout);
+    if (size > CODEC_MIN_BLOCK_SIZE && variance > CODEC_SMOOTH_VARIANCE * scale * scale) {
+        int half = size / 2;
+        double split_cost = tc->lambda; // One split flag per level, roughly
+        for (int k = 0; k < 4; k++) {
+            split_cost += choose_partition(tc, half, row + (k / 2) * half, col + (k % 2) * half,
+                                           leaves, leaf_count);
+        }
+        if (split_cost < cost) {
+            return split_cost;
+        }
+    }
+
+    leaves[start] = (unsigned char) size;
+    *leaf_count = start + 1;
+    return cost;
+}
+
+// Quantize the leaves of a chosen partition into the tile's coefficient store
+static void place_leaves(TileCoder *tc, int size, int row, int col,
+                         const unsigned char *leaves, int *next, int *b, size_t *offset) {
+    if (leaves[*next] == size) {
+        unsigned char level;
+        (*next)++;
+        transform_block(tc, size, row, col, &level);
+        append_block(tc, size, level, b, offset);
+        return;
+    }
+
+    int half = size / 2;
+    for (int k = 0; k < 4; k++) {
+        place_leaves(tc, half, row + (k / 2) * half, col + (k % 2) * half, leaves, next, b, offset);
+    }
+}
+
+/**
+ * Write the palette of block b, reusing the colors of the tile's previous
+ * palette block when they cover this block's and that takes fewer bits;
+ * the index map follows, packed 16 bits at a time
+ */
+static void write_palette(TileCoder *tc, BitWriter *bw, int b, size_t offset) {
+    int depth = tc->layout->bit_depth;
+    int count = tc->palettes[b];
+    int samples = tc->sizes[b] * tc->sizes[b];
+    short *colors = tc->palette_colors + (size_t) b * CODEC_PALETTE_COLORS;
+    unsigned char *indexes = tc->palette_indexes + offset;
+
+    int remap[CODEC_PALETTE_COLORS];
+    int covered = tc->last_count > 0;
+    for (int i = 0; covered && i < count; i++) {
+        remap[i] = 0;
+        while (remap[i] < tc->last_count && tc->last_colors[remap[i]] != colors[i]) remap[i]++;
+        covered = remap[i] < tc->last_count;
+    }
+    size_t reuse_bits = (size_t) samples * palette_index_bits(tc->last_count);
+    size_t fresh_bits = 2 + (size_t) count * depth + (size_t) samples * palette_index_bits(count);
+    int reuse = covered && reuse_bits <= fresh_bits;
+    bitwriter_put_bits(bw, (unsigned) reuse, 1);
+    if (reuse) {
+        for (int k = 0; k < samples; k++) {
+            indexes[k] = (unsigned char) remap[indexes[k]];
+        }
+        count = tc->last_count;
+    } else {
+        bitwriter_put_bits(bw, (unsigned) (count - 1), 2);
+        for (int i = 0; i < count; i++) {
+            bitwriter_put_bits(bw, (unsigned) (colors[i] + (1 << (depth - 1))), depth);
+        }
+        memcpy(tc->last_colors, colors, (size_t) count * sizeof(short));
+        tc->last_count = count;
+    }
+
+    int bits = palette_index_bits(count);
+    if (bits == 0) {
+        return;
+    }
+
+    // A block holds a multiple of 16 samples, so the words come out full
+    for (int k = 0; k < samples; k += 16 / bits) {
+        unsigned word = 0;
+        for (int i = 0; i < 16 / bits; i++) {
+            word = (word << bits) | indexes[k + i];
+        }
+        bitwriter_put_bits(bw, word, 16);
+    }
+}
+
+static void write_block(TileCoder *tc, BitWriter *bw, int b, size_t offset, int *dc_pred,
+                        const HuffTable *dc_table, const HuffTable *ac_table) {
+    int size = tc->sizes[b];
+    SparseBlock block;
+    if (tc->tile_palettes) {
+        bitwriter_put_bits(bw, tc->palettes[b] != 0, 1);
+        if (tc->palettes[b]) {
+            write_palette(tc, bw, b, offset);
+            return;
+        }
+    }
+    if (tc->layout->flags & CODEC_FLAG_ADAPTIVE) {
+        bitwriter_put_bits(bw, tc->levels[b], 8);
+    }
+    stored_block(tc, b, offset, &block);
+    huffman_encode_sparse(bw, &block, size * size, &dc_pred[size_class(size)], dc_table, ac_table);
+}
+
+// Write a quadtree region: a split flag per node larger than 4x4, leaves in Z order
+static void write_partition(TileCoder *tc, BitWriter *bw, int size, int *b, size_t *offset, int *dc_pred,
+                            const HuffTable *dc_table, const HuffTable *ac_table) {
+    if (size > CODEC_MIN_BLOCK_SIZE) {
+        int split = tc->sizes[*b] < size;
+        bitwriter_put_bits(bw, (unsigned) split, 1);
+        if (split) {
+            for (int k = 0; k < 4; k++) {
+                write_partition(tc, bw, size / 2, b, offset, dc_pred, dc_table, ac_table);
+            }
+            return;
+        }
+    }
+
+    write_block(tc, bw, *b, *offset, dc_pred, dc_table, ac_table);
+    *offset += (size_t) size * size;
+    (*b)++;
+}
+
+/**
+ * Transform, quantize and entropy code one tile
+ * Segment layout: table mode byte (CODEC_TABLES_*, plus CODEC_TILE_PALETTE
+ * when any block is a palette), the optimized tables it names (DC before
+ * AC), then every block (or quadtree region) in raster order. DC predictors,
+ * one per transform size, and the previous palette are reset at the start
+ * of the tile.
+ */
+static void encode_tile(TileCoder *tc, const void *pixels, int tx, int ty, BitWriter *bw) {
+    const StreamLayout *layout = tc->layout;
+    int n = layout->block_size;
+    int quadtree = (layout->flags & CODEC_FLAG_QUADTREE) != 0;
+    int cols, rows;
+    tile_blocks(layout, tx, ty, &cols, &rows);
+
+    int b = 0;
+    size_t offset = 0;
+    size_t palette_blocks = tc->palette_blocks;
+    tc->value_count = 0;
+    if (quadtree) {
+        for (int by = 0; by < rows; by++) {
+            set_band(tc, tx, ty, by, cols);
+            load_band(tc, pixels, 1);
+            for (int bx = 0; bx < cols; bx++) {
+                int row = ty * layout->tile_height + by * n;
+                int col = tx * layout->tile_width + bx * n;
+                unsigned char leaves[CODEC_MAX_LEAVES];
+                int leaf_count = 0;
+                int next = 0;
+                if (tc->effort >= CODEC_EFFORT_FULL) {
+                    choose_partition(tc, n, row, col, leaves, &leaf_count);
+                } else {
+                    // No RD search: fixed 8x8 blocks
+                    leaf_count = (n / 8) * (n / 8);
+                    memset(leaves, 8, (size_t) leaf_count);
+                }
+                place_leaves(tc, n, row, col, leaves, &next, &b, &offset);
+            }
+            finish_block_row(tc);
+        }
+    } else {
+        // Blocks are transformed in traversal order but stored at their
+        // raster position, so the entropy pass below is unchanged
+        int span = band_height(tc, n);
+        for (int by0 = 0; by0 < rows; by0 += span) {
+            int band_rows = rows - by0 < span ? rows - by0 : span;
+            int count = band_order(cols, band_rows, span, tc->order);
+            set_band(tc, tx, ty, by0, cols);
+            load_band(tc, pixels, band_rows);
+            for (int k = 0; k < count; k++) {
+                int index = by0 * cols + tc->order[k];
+                int row = ty * layout->tile_height + (index / cols) * n;
+                int col = tx * layout->tile_width + (index % cols) * n;
+                size_t slot_offset = (size_t) index * n * n;
+                unsigned char level;
+                int colors = tc->palettes
+                             ? choose_palette(layout, band_sample(tc, row, col), n * n,
+                                              tc->palette_colors + (size_t) index * CODEC_PALETTE_COLORS,
+                                              tc->palette_indexes + slot_offset)
+                             : 0;
+                if (tc->palettes) {
+                    tc->palettes[index] = (unsigned char) colors;
+                }
+                if (colors) {
+                    // Few enough colors: no transform at all, and coded exactly
+                    commit_palette_block(tc, n, &index, &slot_offset);
+                    tc->palette_blocks++;
+                } else {
+                    transform_block(tc, n, row, col, &level);
+                    append_block(tc, n, level, &index, &slot_offset);
+                }
+                if ((k + 1) % cols == 0) {
+                    finish_block_row(tc);
+                }
+            }
+        }
+        b = rows * cols;
+    }
+    int block_count = b;
+    tc->tile_palettes = tc->palette_blocks > palette_blocks;
+
+    int mode = CODEC_TABLES_DEFAULT;
+    HuffTable optimized_dc, optimized_ac;
+    int dc_pred[CODEC_SIZE_CLASSES] = {0};
+
+    if ((layout->flags & CODEC_FLAG_OPTIMIZE_HUFFMAN) && tc->effort > CODEC_EFFORT_DEFAULT_TABLES) {
+        unsigned dc_freq[HUFF_DC_SYMBOLS] = {0};
+        unsigned ac_freq[HUFF_AC_SYMBOLS] = {0};
+        offset = 0;
+        for (b = 0; b < block_count; b++) {
+            int size = tc->sizes[b];
+            if (!tc->palettes || !tc->palettes[b]) {
+                SparseBlock block;
+                stored_block(tc, b, offset, &block);
+                huffman_count_sparse(&block, size * size, &dc_pred[size_class(size)], dc_freq, ac_freq);
+            }
+            offset += (size_t) size * size;
+        }
+
+        // Price each table on the histograms just counted, a carried table
+        // adding its own bytes, and keep the mode with the smallest tile
+        size_t default_dc_bits = huffman_estimate_bits(&tc->default_dc, dc_freq, HUFF_DC_SYMBOLS);
+        size_t default_ac_bits = huffman_estimate_bits(&tc->default_ac, ac_freq, HUFF_AC_SYMBOLS);
+        int dc_optimized = optimized_table_bits(&optimized_dc, dc_freq, HUFF_DC_SYMBOLS, default_dc_bits) <
+                           default_dc_bits;
+        int ac_optimized = optimized_table_bits(&optimized_ac, ac_freq, HUFF_AC_SYMBOLS, default_ac_bits) <
+                           default_ac_bits;
+        if (dc_optimized && ac_optimized) {
+            mode = CODEC_TABLES_OPTIMIZED;
+        } else if (dc_optimized) {
+            mode = CODEC_TABLES_OPTIMIZED_DC;
+        } else if (ac_optimized) {
+            mode = CODEC_TABLES_OPTIMIZED_AC;
+        }
+    }
+
+    const HuffTable *dc_table = &tc->default_dc;
+    const HuffTable *ac_table = &tc->default_ac;
+    bitwriter_put_bits(bw, (unsigned) mode | (tc->tile_palettes ? CODEC_TILE_PALETTE : 0), 8);
+    if (mode == CODEC_TABLES_OPTIMIZED || mode == CODEC_TABLES_OPTIMIZED_DC) {
+        dc_table = &optimized_dc;
+        write_huffman_table(bw, dc_table);
+    }
+    if (mode == CODEC_TABLES_OPTIMIZED || mode == CODEC_TABLES_OPTIMIZED_AC) {
+        ac_table = &optimized_ac;
+        write_huffman_table(bw, ac_table);
+    }
+    tc->table_modes[mode]++;
+
+    memset(dc_pred, 0, sizeof(dc_pred));
+    tc->last_count = 0;
+    b = 0;
+    offset = 0;
+    while (b < block_count) {
+        if (quadtree) {
+            write_partition(tc, bw, n, &b, &offset, dc_pred, dc_table, ac_table);
+        } else {
+            write_block(tc, bw, b, offset, dc_pred, dc_table, ac_table);
+            offset += (size_t) n * n;
+            b++;
+        }
+    }
+    bitwriter_align(bw);
+}
+
+// Top-left corner holding every coefficient up to zigzag position last
+static int nonzero_extent(const QuantContext *quant, int last) {
+    return quant->zigzag_extent[last];
+}
+
+// Row pointers of the size x size block stored at coeffs
+static void block_rows(double *coeffs, int size, double **rows) {
+    for (int i = 0; i < size; i++) {
+        rows[i] = coeffs + (size_t) i * size;
+    }
+}
+
+// Entropy decode one block's level and dequantized coefficients into the zeroed block at coeffs
+static int read_block(TileCoder *tc, BitReader *br, int size, double *coeffs, unsigned char *level,
+                      unsigned char *extent, int *dc_pred, const HuffTable *dc_table, const HuffTable *ac_table) {
+    int c = size_class(size);
+    *level = 0;
+    if (tc->layout->flags & CODEC_FLAG_ADAPTIVE) {
+        *level = (unsigned char) bitreader_get_bits(br, 8);
+    }
+    double variance = (tc->layout->flags & CODEC_FLAG_ADAPTIVE) ? level_to_variance(*level) : 0.0;
+
+    double *rows[CODEC_MAX_BLOCK_SIZE];
+    int last;
+    block_rows(coeffs, size, rows);
+    if (!huffman_decode_dequantize(br, tc->quant[c], variance, rows, &dc_pred[c], dc_table, ac_table, &last)) {
+        return 0;
+    }
+
+    *extent = (unsigned char) nonzero_extent(tc->quant[c], last);
+    return 1;
+}
+
+/**
+ * Read the palette of block b into the palette store
+ *
+ * @return 0 if the block reuses colors before the tile has any, or an index names a missing color
+ */
+static int read_palette(TileCoder *tc, BitReader *br, int size, int b, size_t offset) {
+    int depth = tc->layout->bit_depth;
+    short *colors = tc->palette_colors + (size_t) b * CODEC_PALETTE_COLORS;
+    int count;
+    if (bitreader_get_bits(br, 1)) {
+        count = tc->last_count;
+        if (count == 0) {
+            return 0;
+        }
+    } else {
+        count = (int) bitreader_get_bits(br, 2) + 1;
+        for (int i = 0; i < count; i++) {
+            tc->last_colors[i] = (short) ((int) bitreader_get_bits(br, depth) - (1 << (depth - 1)));
+        }
+        tc->last_count = count;
+    }
+    memcpy(colors, tc->last_colors, (size_t) count * sizeof(short));
+    tc->palettes[b] = (unsigned char) count;
+    int bits = palette_index_bits(count);
+
+    unsigned char *indexes = tc->palette_indexes + offset;
+    int samples = size * size;
+    if (bits == 0) {
+        memset(indexes, 0, (size_t) samples);
+        return 1;
+    }
+    unsigned mask = (1u << bits) - 1;
+    unsigned invalid = 0;
+    for (int k = 0; k < samples; k += 16 / bits) {
+        unsigned word = bitreader_get_bits(br, 16);
+        for (int i = 16 / bits - 1; i >= 0; i--) {
+            unsigned index = word & mask;
+            invalid |= index >= (unsigned) count;
+            indexes[k + i] = (unsigned char) index;
+            word >>= bits;
+        }
+    }
+    return !invalid;
+}
+
+/**
+ * Read the mode bit of a block when the stream has palettes, and the palette
+ * itself for a palette block (stored as block b at zigzag slot offset)
+ *
+ * @return 1 for a palette block, 0 for a transform block, -1 if the palette is corrupt
+ */
+static int read_block_mode(TileCoder *tc, BitReader *br, int size, int b, size_t offset) {
+    if (!tc->palettes) {
+        return 0;
+    }
+    tc->palettes[b] = 0;
+    if (!tc->tile_palettes || !bitreader_get_bits(br, 1)) {
+        return 0;
+    }
+    return read_palette(tc, br, size, b, offset) ? 1 : -1;
+}
+
+// Table fill of a palette block from the palette store into the band
+static void fill_palette(TileCoder *tc, const TileCoder *store, int size, int row, int col, int b, size_t offset) {
+    int n = tc->layout->block_size;
+    const short *colors = store->palette_colors + (size_t) b * CODEC_PALETTE_COLORS;
+    const unsigned char *indexes = store->palette_indexes + offset;
+    short *dst = band_sample(tc, row, col);
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            dst[(size_t) i * n + j] = colors[indexes[i * size + j]];
+        }
+    }
+}
+
+// Inverse transform and store one decoded block, then zero its coefficients again
+static void reconstruct_block(TileCoder *tc, double *coeffs, unsigned char extent, int size, int row, int col) {
+    double *rows[CODEC_MAX_BLOCK_SIZE];
+    block_rows(coeffs, size, rows);
+    dct_inverse_sparse(tc->dct[size_class(size)], rows, tc->block, extent);
+    store_block(tc, size, row, col);
+    for (int i = 0; i < extent; i++) {
+        memset(rows[i], 0, extent * sizeof(double));
+    }
+}
+
+static int decode_block(TileCoder *tc, BitReader *br, int size, int row, int col,
+                        int *dc_pred, const HuffTable *dc_table, const HuffTable *ac_table) {
+    unsigned char level, extent;
+    int palette = read_block_mode(tc, br, size, 0, 0);
+    if (palette) {
+        if (palette > 0) {
+            fill_palette(tc, tc, size, row, col, 0, 0);
+        }
+        return palette > 0;
+    }
+    if (!read_block(tc, br, size, tc->dequantized, &level, &extent, dc_pred, dc_table, ac_table)) {
+        return 0;
+    }
+    reconstruct_block(tc, tc->dequantized, extent, size, row, col);
+    return 1;
+}
+
+static int decode_partition(TileCoder *tc, BitReader *br, int size, int row, int col,
+                            int *dc_pred, const HuffTable *dc_table, const HuffTable *ac_table) {
+    if (size > CODEC_MIN_BLOCK_SIZE && bitreader_get_bits(br, 1)) {
+        int half = size / 2;
+        for (int k = 0; k < 4; k++) {
+            if (!decode_partition(tc, br, half, row + (k / 2) * half, col + (k % 2) * half,
+                                  dc_pred, dc_table, ac_table)) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    return decode_block(tc, br, size, row, col, dc_pred, dc_table, ac_table);
+}
+
+// Read a tile's table mode, pointing dc_table / ac_table at the tables its blocks use
+static int read_tile_tables(TileCoder *tc, BitReader *br, HuffTable *optimized_dc, HuffTable *optimized_ac,
+                            const HuffTable **dc_table, const HuffTable **ac_table) {
+    unsigned mode = bitreader_get_bits(br, 8);
+    *dc_table = &tc->default_dc;
+    *ac_table = &tc->default_ac;
+    tc->tile_palettes = (mode & CODEC_TILE_PALETTE) != 0;
+    mode &= ~(unsigned) CODEC_TILE_PALETTE;
+    if (mode >= CODEC_TABLES_MODES || (tc->tile_palettes && !tc->palettes)) {
+        return 0;
+    }
+    if (mode == CODEC_TABLES_OPTIMIZED || mode == CODEC_TABLES_OPTIMIZED_DC) {
+        if (!read_huffman_table(br, optimized_dc)) {
+            return 0;
+        }
+        *dc_table = optimized_dc;
+    }
+    if (mode == CODEC_TABLES_OPTIMIZED || mode == CODEC_TABLES_OPTIMIZED_AC) {
+        if (!read_huffman_table(br, optimized_ac)) {
+            return 0;
+        }
+        *ac_table = optimized_ac;
+    }
+    return 1;
+}
+
+static int decode_tile(TileCoder *tc, const unsigned char *segment, size_t length,
+                       int tx, int ty, void *pixels) {
+    const StreamLayout *layout = tc->layout;
+    int n = layout->block_size;
+    int quadtree = (layout->flags & CODEC_FLAG_QUADTREE) != 0;
+    int cols, rows;
+    tile_blocks(layout, tx, ty, &cols, &rows);
+
+    BitReader br;
+    bitreader_init(&br, segment, length);
+
+    const HuffTable *dc_table, *ac_table;
+    HuffTable optimized_dc, optimized_ac;
+    if (!read_tile_tables(tc, &br, &optimized_dc, &optimized_ac, &dc_table, &ac_table)) {
+        return 0;
+    }
+    tc->last_count = 0;
+
+    int dc_pred[CODEC_SIZE_CLASSES] = {0};
+    int span = quadtree ? 1 : band_height(tc, n);
+    if (span == 1) {
+        for (int by = 0; by < rows; by++) {
+            set_band(tc, tx, ty, by, cols);
+            for (int bx = 0; bx < cols; bx++) {
+                int row = ty * layout->tile_height + by * n;
+                int col = tx * layout->tile_width + bx * n;
+                int ok = quadtree
+                         ? decode_partition(tc, &br, n, row, col, dc_pred, dc_table, ac_table)
+                         : decode_block(tc, &br, n, row, col, dc_pred, dc_table, ac_table);
+                if (!ok) {
+                    return 0;
+                }
+            }
+            store_band(tc, pixels, 1);
+        }
+        return br.pos <= length;
+    }
+
+    // Entropy decode a band of blocks in stream order, then reconstruct it
+    // in traversal order
+    size_t coeff_count = (size_t) n * n;
+    for (int by0 = 0; by0 < rows; by0 += span) {
+        int band_rows = rows - by0 < span ? rows - by0 : span;
+        int band_blocks = band_rows * cols;
+        for (int i = 0; i < band_blocks; i++) {
+            int palette = read_block_mode(tc, &br, n, i, i * coeff_count);
+            if (palette < 0 ||
+                (!palette && !read_block(tc, &br, n, tc->dequantized + i * coeff_count, &tc->levels[i],
+                                         &tc->extents[i], dc_pred, dc_table, ac_table))) {
+                return 0;
+            }
+        }
+
+        int count = band_order(cols, band_rows, span, tc->order);
+        set_band(tc, tx, ty, by0, cols);
+        for (int k = 0; k < count; k++) {
+            int i = tc->order[k];
+            int row = ty * layout->tile_height + (by0 + i / cols) * n;
+            int col = tx * layout->tile_width + (i % cols) * n;
+            if (tc->palettes && tc->palettes[i]) {
+                fill_palette(tc, tc, n, row, col, i, i * coeff_count);
+            } else {
+                reconstruct_block(tc, tc->dequantized + i * coeff_count, tc->extents[i], n, row, col);
+            }
+        }
+        store_band(tc, pixels, band_rows);
+    }
+
+    return br.pos <= length;
+}
+
+static void scan_stats_init(ScanStats *stats, const StreamLayout *layout) {
+    int n = layout->block_size;
+    stats->layout = layout;
+    stats->dct = (layout->flags & CODEC_FLAG_APPROX_DCT) ? dct_init_approximate(n) : dct_init(n);
+    stats->quant = quant_init(n, layout->quality, (layout->flags & CODEC_FLAG_ADAPTIVE) != 0);
+    if (layout->bit_depth > 8) {
+        quant_set_bit_depth(stats->quant, layout->bit_depth);
+    }
+    if (stats->dct->approximate) {
+        quant_apply_transform_scale(stats->quant, stats->dct->row_norms);
+    }
+    stats->block = alloc_array(n, n);
+    stats->coeffs = alloc_array(n, n);
+    stats->quantized = alloc_int_array(n, n);
+    stats->row_blocks = (short*)malloc((size_t) layout->padded_width * n * sizeof(short));
+    if (!stats->row_blocks) {
+        fprintf(stderr, "Memory allocation failed when creating scan statistics\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(stats->counts, 0, sizeof(stats->counts));
+}
+
+/**
+ * Count the nonzero positions of one block row
+ * rows points at the row's first image line and holds valid_rows lines;
+ * the rest of the block row replicates the last one, as the encoder does.
+ */
+static void scan_stats_add_row(ScanStats *stats, const void *rows, int valid_rows) {
+    const StreamLayout *layout = stats->layout;
+    int n = layout->block_size;
+    int cols = layout->padded_width / n;
+    double scale = depth_scale(layout);
+    if (layout->bit_depth > 8) {
+        blockify16((const unsigned short *) rows, (size_t) layout->width, layout->width, valid_rows,
+                   layout->bit_depth, n, cols, 1, stats->row_blocks);
+    } else {
+        blockify((const unsigned char *) rows, (size_t) layout->width, layout->width, valid_rows, n, cols, 1,
+                 stats->row_blocks);
+    }
+
+    for (int bx = 0; bx < cols; bx++) {
+        const short *src = stats->row_blocks + (size_t) bx * n * n;
+        short colors[CODEC_PALETTE_COLORS];
+        if ((layout->flags & CODEC_FLAG_PALETTE) && choose_palette(layout, src, n * n, colors, NULL)) {
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                stats->block[i][j] = (double) src[i * n + j];
+            }
+        }
+        dct_forward(stats->dct, stats->block, stats->coeffs);
+        double variance = stats->quant->adaptive
+                          ? level_to_variance(variance_to_level(calculate_block_variance(stats->block, n) /
+                                                                (scale * scale)))
+                          : 0.0;
+        quantize(stats->quant, stats->coeffs, stats->quantized, variance);
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                stats->counts[i * n + j] += stats->quantized[i][j] != 0;
+            }
+        }
+    }
+}
+
+/**
+ * Structure to rank one coefficient position for the scan order
+ */
+typedef struct {
+    unsigned long long count; // Times the position was nonzero
+    int rank;                 // Zigzag position, which breaks ties
+    unsigned short index;     // Natural index
+} ScanRank;
+
+static int compare_scan_rank(const void *a, const void *b) {
+    const ScanRank *x = (const ScanRank *) a;
+    const ScanRank *y = (const ScanRank *) b;
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+    return x->rank - y->rank;
+}
+
+/**
+ * Set the layout's scan order from the gathered statistics, then free them
+ * DC stays first (it is coded as a difference); the AC positions follow
+ * from most to least often nonzero, so the end-of-block symbol comes early
+ * and zero runs are short. Only positions seen nonzero are listed; the
+ * rest keep zigzag order, which keeps the table small for large blocks.
+ */
+static void scan_stats_finish(ScanStats *stats, StreamLayout *layout) {
+    int n = layout->block_size;
+    ScanRank ranks[CODEC_MAX_BLOCK_SIZE * CODEC_MAX_BLOCK_SIZE];
+    for (int k = 0; k < n * n; k++) {
+        ranks[k].index = (unsigned short) (stats->quant->zigzag_row[k] * n + stats->quant->zigzag_col[k]);
+        ranks[k].count = stats->counts[ranks[k].index];
+        ranks[k].rank = k;
+    }
+    qsort(ranks + 1, (size_t) n * n - 1, sizeof(ScanRank), compare_scan_rank);
+    layout->scan_count = 0;
+    while (layout->scan_count < n * n - 1 && ranks[layout->scan_count + 1].count > 0) {
+        layout->scan[layout->scan_count] = ranks[layout->scan_count + 1].index;
+        layout->scan_count++;
+    }
+
+    dct_free(stats->dct);
+    quant_free(stats->quant);
+    free_array(stats->block, n);
+    free_array(stats->coeffs, n);
+    free_int_array(stats->quantized, n);
+    free(stats->row_blocks);
+}
+
+// Derive the adaptive scan order of an in-memory image from a sample of its block rows
+static void choose_scan_order(StreamLayout *layout, const void *pixels) {
+    if (!(layout->flags & CODEC_FLAG_ADAPTIVE_SCAN)) {
+        return;
+    }
+
+    ScanStats stats;
+    int n = layout->block_size;
+    scan_stats_init(&stats, layout);
+    for (int by = 0; by < layout->padded_height / n; by += CODEC_SCAN_SAMPLE) {
+        size_t start = (size_t) by * n * layout->width * sample_bytes(layout);
+        scan_stats_add_row(&stats, (const unsigned char *) pixels + start, layout->height - by * n);
+    }
+    scan_stats_finish(&stats, layout);
+}
+
+/**
+ * Write a complete stream; tiles whose dirty flag is clear are copied from
+ * old_stream instead of being re-encoded (dirty == NULL encodes every tile).
+ * A positive budget_ms enables effort shedding; stats may be NULL. With a
+ * non-NULL output the stream goes into that buffer, and NULL is returned
+ * if it does not fit.
+ */
+static unsigned char* write_stream(const StreamLayout *layout, const void *pixels,
+                                   const unsigned char *dirty, const unsigned char *old_stream,
+                                   double budget_ms, CodecEncodeStats *stats,
+                                   unsigned char *output, size_t capacity, size_t *out_size) {
+    double start_ms = now_ms();
+    size_t index_size = (size_t) layout->tile_count * CODEC_INDEX_ENTRY_SIZE;
+    size_t payload_start = (size_t) payload_offset(layout);
+    BitWriter bw;
+    if (output) {
+        bitwriter_init_buffer(&bw, output, capacity);
+    } else {
+        bitwriter_init(&bw, payload_start + (size_t) layout->width * layout->height / 4);
+    }
+
+    unsigned char header[CODEC_HEADER_SIZE];
+    write_header(header, layout);
+    bitwriter_put_bytes(&bw, header, CODEC_HEADER_SIZE);
+
+    // Index is patched once the tile sizes are known
+    unsigned char *zeros = (unsigned char*)calloc(index_size > 0 ? index_size : 1, 1);
+    bitwriter_put_bytes(&bw, zeros, index_size);
+    free(zeros);
+
+    if (layout->flags & CODEC_FLAG_ADAPTIVE_SCAN) {
+        unsigned char scan_table[2 * CODEC_MAX_BLOCK_SIZE * CODEC_MAX_BLOCK_SIZE];
+        write_scan_table(scan_table, layout);
+        bitwriter_put_bytes(&bw, scan_table, scan_table_size(layout));
+    }
+
+    TileCoder tc;
+    int need_coder = dirty == NULL;
+    for (int t = 0; !need_coder && t < layout->tile_count; t++) {
+        need_coder = dirty[t];
+    }
+    if (need_coder) {
+        tile_coder_init(&tc, layout);
+        tc.budget_ms = budget_ms;
+        tc.start_ms = start_ms;
+    }
+
+    for (int t = 0; t < layout->tile_count; t++) {
+        size_t start = bw.size;
+        if (dirty == NULL || dirty[t]) {
+            encode_tile(&tc, pixels, t % layout->tiles_x, t / layout->tiles_x, &bw);
+        } else {
+            size_t length;
+            const unsigned char *segment = tile_segment(old_stream, layout, t, &length);
+            bitwriter_put_bytes(&bw, segment, length);
+        }
+
+        if (bw.overflow) {
+            break;
+        }
+        unsigned char *entry = bw.data + CODEC_HEADER_SIZE + (size_t) t * CODEC_INDEX_ENTRY_SIZE;
+        put_u64(entry, (unsigned long long) (start - payload_start));
+        put_u32(entry + 8, (unsigned long) (bw.size - start));
+    }
+
+    if (stats) {
+        stats->effort = need_coder ? tc.effort : CODEC_EFFORT_FULL;
+        stats->elapsed_ms = now_ms() - start_ms;
+        stats->degraded_rows = need_coder ? tc.degraded_rows : 0;
+        stats->total_rows = need_coder ? tc.rows_total : 0;
+        for (int m = 0; m < CODEC_TABLES_MODES; m++) {
+            stats->table_modes[m] = need_coder ? tc.table_modes[m] : 0;
+        }
+        stats->palette_blocks = need_coder ? tc.palette_blocks : 0;
+    }
+    if (need_coder) {
+        tile_coder_free(&tc);
+    }
+
+    if (bw.overflow) {
+        fprintf(stderr, "Output buffer too small for the encoded stream\n");
+        return NULL;
+    }
+    *out_size = bw.size;
+    return bw.data;
+}
+
+unsigned char* codec_encode(const unsigned char *pixels, int width, int height,
+                            const CodecParams *params, size_t *out_size) {
+    return codec_encode_with_stats(pixels, width, height, params, NULL, out_size);
+}
+
+unsigned char* codec_encode_with_stats(const unsigned char *pixels, int width, int height,
+                                       const CodecParams *params, CodecEncodeStats *stats, size_t *out_size) {
+    StreamLayout layout;
+    if (!layout_from_params(&layout, width, height, params)) {
+        return NULL;
+    }
+    choose_scan_order(&layout, pixels);
+    return write_stream(&layout, pixels, NULL, NULL, params->time_budget_ms, stats, NULL, 0, out_size);
+}
+
+size_t codec_encode_into(const unsigned char *pixels, int width, int height, const CodecParams *params,
+                         unsigned char *output, size_t capacity) {
+    StreamLayout layout;
+    size_t size = 0;
+    if (!layout_from_params(&layout, width, height, params)) {
+        return 0;
+    }
+    choose_scan_order(&layout, pixels);
+    if (!write_stream(&layout, pixels, NULL, NULL, params->time_budget_ms, NULL, output, capacity, &size)) {
+        return 0;
+    }
+    return size;
+}
+
+unsigned char* codec_encode16(const unsigned short *pixels, int width, int height, int bit_depth,
+                              const CodecParams *params, size_t *out_size) {
+    StreamLayout layout;
+    if (bit_depth <= 8 || bit_depth > CODEC_MAX_BIT_DEPTH) {
+        fprintf(stderr, "Invalid codec parameters: bit depth %d\n", bit_depth);
+        return NULL;
+    }
+    if (!layout_from_params(&layout, width, height, params)) {
+        return NULL;
+    }
+    layout.bit_depth = bit_depth;
+    choose_scan_order(&layout, pixels);
+    return write_stream(&layout, pixels, NULL, NULL, params->time_budget_ms, NULL, NULL, 0, out_size);
+}
+
+/**
+ * Most bits one block can take: the level byte, the longest DC code with
+ * the largest difference category, then every AC coefficient as a nonzero
+ * symbol with the largest category. A ZRL or EOB symbol stands for at
+ * least one zero coefficient and is never longer, so runs cannot do worse.
+ */
+static size_t max_block_bits(int size, int adaptive) {
+    size_t dc_bits = HUFF_MAX_CODE_LEN + magnitude_category(2 * ENTROPY_MAX_COEFF);
+    size_t ac_bits = HUFF_MAX_CODE_LEN + magnitude_category(ENTROPY_MAX_COEFF);
+    return (adaptive ? 8 : 0) + dc_bits + ac_bits * (size_t) (size * size - 1);
+}
+
+// Most bits a quadtree node can take: its split flag plus the worse of a leaf and four children
+static size_t max_region_bits(int size, int adaptive) {
+    size_t leaf = max_block_bits(size, adaptive);
+    if (size == CODEC_MIN_BLOCK_SIZE) {
+        return leaf;
+    }
+    size_t split = 4 * max_region_bits(size / 2, adaptive);
+    return 1 + (split > leaf ? split : leaf);
+}
+
+// Most bytes a tile segment of cols x rows blocks (or regions) can take; 0 on overflow
+static size_t max_tile_bytes(const StreamLayout *layout, int cols, int rows) {
+    int adaptive = (layout->flags & CODEC_FLAG_ADAPTIVE) != 0;
+    size_t unit_bits = (layout->flags & CODEC_FLAG_QUADTREE)
+                       ? max_region_bits(layout->block_size, adaptive)
+                       : max_block_bits(layout->block_size, adaptive);
+    // The mode bit; a palette block (at most 67 + 2 bits per sample) is
+    // always shorter than the transform bound
+    if (layout->flags & CODEC_FLAG_PALETTE) {
+        unit_bits++;
+    }
+    size_t tables = (layout->flags & CODEC_FLAG_OPTIMIZE_HUFFMAN)
+                    ? 2 * HUFF_MAX_CODE_LEN + HUFF_DC_SYMBOLS + HUFF_AC_SYMBOLS
+                    : 0;
+    size_t units = (size_t) cols * (size_t) rows;
+    if (units > (SIZE_MAX - 7) / unit_bits) {
+        return 0;
+    }
+    return 1 + tables + (units * unit_bits + 7) / 8;
+}
+
+size_t codec_max_compressed_size(int width, int height, const CodecParams *params) {
+    StreamLayout layout;
+    if (!layout_from_params(&layout, width, height, params)) {
+        return 0;
+    }
+
+    // Tiles come in at most four shapes: interior, right column, bottom row and corner
+    int full_cols, full_rows, last_cols, last_rows;
+    tile_blocks(&layout, 0, 0, &full_cols, &full_rows);
+    tile_blocks(&layout, layout.tiles_x - 1, layout.tiles_y - 1, &last_cols, &last_rows);
+    size_t counts[4] = {(size_t) (layout.tiles_x - 1) * (size_t) (layout.tiles_y - 1),
+                        (size_t) (layout.tiles_y - 1), (size_t) (layout.tiles_x - 1), 1};
+    size_t shapes[4] = {max_tile_bytes(&layout, full_cols, full_rows), max_tile_bytes(&layout, last_cols, full_rows),
+                        max_tile_bytes(&layout, full_cols, last_rows), max_tile_bytes(&layout, last_cols, last_rows)};
+
+    // The scan order depends on the pixels, so count a full table
+    layout.scan_count = layout.block_size * layout.block_size - 1;
+    size_t total = (size_t) payload_offset(&layout);
+    for (int k = 0; k < 4; k++) {
+        if (counts[k] == 0) continue;
+        if (shapes[k] == 0 || shapes[k] > (SIZE_MAX - total) / counts[k]) {
+            return 0;
+        }
+        total += counts[k] * shapes[k];
+    }
+    return total;
+}
+
+// Read exactly size bytes at offset, retrying short reads
+static int read_fully(int fd, unsigned char *buffer, size_t size, unsigned long long offset) {
+    while (size > 0) {
+        ssize_t got = pread(fd, buffer, size, (off_t) offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return 0;
+        buffer += got;
+        size -= (size_t) got;
+        offset += (unsigned long long) got;
+    }
+    return 1;
+}
+
+// Write exactly size bytes at offset, retrying short writes
+static int write_fully(int fd, const unsigned char *buffer, size_t size, unsigned long long offset) {
+    while (size > 0) {
+        ssize_t put = pwrite(fd, buffer, size, (off_t) offset);
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return 0;
+        buffer += put;
+        size -= (size_t) put;
+        offset += (unsigned long long) put;
+    }
+    return 1;
+}
+
+int codec_encode_file(const char *input_path, unsigned long long input_offset, int width, int height,
+                      const CodecParams *params, const char *output_path, unsigned long long *out_size) {
+    StreamLayout layout;
+    if (params->tile_size <= 0) {
+        fprintf(stderr, "Out-of-core encoding needs a positive tile size\n");
+        return 0;
+    }
+    if (!layout_from_params(&layout, width, height, params)) {
+        return 0;
+    }
+
+    int input = open(input_path, O_RDONLY);
+    if (input < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", input_path, strerror(errno));
+        return 0;
+    }
+    int output = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output < 0) {
+        fprintf(stderr, "Cannot create %s: %s\n", output_path, strerror(errno));
+        close(input);
+        return 0;
+    }
+
+    // One tile row of input and one tile row of index entries are all that is buffered
+    size_t index_row_size = (size_t) layout.tiles_x * CODEC_INDEX_ENTRY_SIZE;
+    unsigned char *strip = (unsigned char*)malloc((size_t) layout.tile_height * layout.width);
+    unsigned char *index_row = (unsigned char*)malloc(index_row_size);
+    if (!strip || !index_row) {
+        fprintf(stderr, "Memory allocation failed when creating strip buffers\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The adaptive scan order must be in place before any tile is coded, so
+    // its sample of block rows is read in a pass of its own
+    int ok = 1;
+    if (layout.flags & CODEC_FLAG_ADAPTIVE_SCAN) {
+        ScanStats stats;
+        int n = layout.block_size;
+        scan_stats_init(&stats, &layout);
+        for (int by = 0; ok && by < layout.padded_height / n; by += CODEC_SCAN_SAMPLE) {
+            int valid_rows = layout.height - by * n < n ? layout.height - by * n : n;
+            ok = read_fully(input, strip, (size_t) valid_rows * layout.width,
+                            input_offset + (unsigned long long) by * n * layout.width);
+            if (ok) {
+                scan_stats_add_row(&stats, strip, valid_rows);
+            }
+        }
+        scan_stats_finish(&stats, &layout);
+
+        unsigned char scan_table[2 * CODEC_MAX_BLOCK_SIZE * CODEC_MAX_BLOCK_SIZE];
+        write_scan_table(scan_table, &layout);
+        ok = ok && write_fully(output, scan_table, scan_table_size(&layout),
+                               CODEC_HEADER_SIZE + (unsigned long long) layout.tile_count * CODEC_INDEX_ENTRY_SIZE);
+    }
+
+    unsigned char header[CODEC_HEADER_SIZE];
+    write_header(header, &layout);
+    ok = ok && write_fully(output, header, CODEC_HEADER_SIZE, 0);
+
+    TileCoder tc;
+    tile_coder_init(&tc, &layout);
+    tc.budget_ms = params->time_budget_ms;
+    tc.start_ms = now_ms();
+    BitWriter bw;
+    bitwriter_init(&bw, (size_t) layout.tile_width * layout.tile_height / 4 + 64);
+
+    // Segments follow the index, which is filled in one tile row at a time
+    unsigned long long payload_start = payload_offset(&layout);
+    unsigned long long position = payload_start;
+    for (int ty = 0; ok && ty < layout.tiles_y; ty++) {
+        int y0 = ty * layout.tile_height;
+        int strip_rows = layout.height - y0 < layout.tile_height ? layout.height - y0 : layout.tile_height;
+        ok = read_fully(input, strip, (size_t) strip_rows * layout.width,
+                        input_offset + (unsigned long long) y0 * layout.width);
+        tc.first_row = y0;
+
+        for (int tx = 0; ok && tx < layout.tiles_x; tx++) {
+            bw.size = 0;
+            encode_tile(&tc, strip, tx, ty, &bw);
+            ok = write_fully(output, bw.data, bw.size, position);
+
+            unsigned char *entry = index_row + (size_t) tx * CODEC_INDEX_ENTRY_SIZE;
+            put_u64(entry, position - payload_start);
+            put_u32(entry + 8, (unsigned long) bw.size);
+            position += bw.size;
+        }
+        ok = ok && write_fully(output, index_row, index_row_size,
+                               CODEC_HEADER_SIZE + (unsigned long long) ty * index_row_size);
+    }
+
+    if (close(output) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Out-of-core encode of %s stopped: input too short or I/O error\n", input_path);
+    }
+    close(input);
+    tile_coder_free(&tc);
+    free(bw.data);
+    free(strip);
+    free(index_row);
+
+    if (ok && out_size) {
+        *out_size = position;
+    }
+    return ok;
+}
+
+// Transform every block of the image once
+static void coeff_cache_init(CoeffCache *cache, const unsigned char *pixels, const StreamLayout *layout) {
+    int n = layout->block_size;
+    int cols = layout->padded_width / n;
+    int rows = layout->padded_height / n;
+
+    cache->block_size = n;
+    cache->block_count = (size_t) cols * rows;
+    cache->adaptive = (layout->flags & CODEC_FLAG_ADAPTIVE) != 0;
+    cache->dct = (layout->flags & CODEC_FLAG_APPROX_DCT) ? dct_init_approximate(n) : dct_init(n);
+    cache->coeffs = (double*)alloc_large((size_t) cache->block_count * n * n * sizeof(double));
+    cache->variances = (double*)alloc_large((size_t) cache->block_count * sizeof(double));
+
+    double **block = alloc_array(n, n);
+    double **coeffs = alloc_array(n, n);
+    short *row_blocks = (short*)malloc((size_t) layout->padded_width * n * sizeof(short));
+    if (!row_blocks) {
+        fprintf(stderr, "Memory allocation failed when creating coefficient cache\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int by = 0; by < rows; by++) {
+        blockify(pixels + (size_t) by * n * layout->width, (size_t) layout->width, layout->width,
+                 layout->height - by * n, n, cols, 1, row_blocks);
+        for (int bx = 0; bx < cols; bx++) {
+            size_t b = (size_t) by * cols + bx;
+            double *dst = cache->coeffs + b * n * n;
+            const short *src = row_blocks + (size_t) bx * n * n;
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    block[i][j] = (double) src[i * n + j];
+                }
+            }
+            dct_forward(cache->dct, block, coeffs);
+            for (int i = 0; i < n; i++) {
+                memcpy(dst + (size_t) i * n, coeffs[i], n * sizeof(double));
+            }
+            cache->variances[b] = cache->adaptive
+                                  ? level_to_variance(variance_to_level(calculate_block_variance(block, n)))
+                                  : 0.0;
+        }
+    }
+    free_array(block, n);
+    free_array(coeffs, n);
+    free(row_blocks);
+}
+
+static void coeff_cache_free(CoeffCache *cache) {
+    dct_free(cache->dct);
+    free_large(cache->coeffs);
+    free_large(cache->variances);
+}
+
+// DCT-domain estimate of the target metric at one quality factor, without any IDCT
+static double estimate_quality(const CoeffCache *cache, int quality, int metric) {
+    int n = cache->block_size;
+    QuantContext *quant = quant_init(n, quality, cache->adaptive);
+    if (cache->dct->approximate) {
+        quant_apply_transform_scale(quant, cache->dct->row_norms);
+    }
+
+    double **coeffs = alloc_array(n, n);
+    double **recon = alloc_array(n, n);
+    int **quantized = alloc_int_array(n, n);
+    double total = 0.0;
+
+    for (size_t b = 0; b < cache->block_count; b++) {
+        const double *src = cache->coeffs + b * n * n;
+        for (int i = 0; i < n; i++) {
+            memcpy(coeffs[i], src + (size_t) i * n, n * sizeof(double));
+        }
+        quantize(quant, coeffs, quantized, cache->variances[b]);
+        dequantize(quant, quantized, recon, cache->variances[b]);
+        total += metric == CODEC_TARGET_SSIM
+                 ? dct_domain_ssim(cache->dct, coeffs, recon)
+                 : dct_domain_sse(cache->dct, coeffs, recon);
+    }
+
+    free_array(coeffs, n);
+    free_array(recon, n);
+    free_int_array(quantized, n);
+    quant_free(quant);
+
+    if (metric == CODEC_TARGET_SSIM) {
+        return total / (double) cache->block_count;
+    }
+    // Rounding the reconstruction to 8 bits adds uniform noise of variance 1/12
+    size_t count = cache->block_count * n * n;
+    return dct_domain_psnr(total + count / 12.0, count);
+}
+
+// Encode at one quality factor and measure the decoded result on pixels
+static unsigned char* encode_and_measure(const unsigned char *pixels, int width, int height,
+                                         const CodecParams *params, int quality, int metric,
+                                         double *achieved, size_t *size) {
+    CodecParams candidate = *params;
+    candidate.quality = quality;
+    unsigned char *stream = codec_encode(pixels, width, height, &candidate, size);
+
+    int decoded_width, decoded_height;
+    unsigned char *decoded = codec_decode(stream, *size, &decoded_width, &decoded_height);
+    *achieved = metric == CODEC_TARGET_SSIM
+                ? plane_ssim(pixels, decoded, width, height)
+                : plane_psnr(pixels, decoded, (size_t) width * height);
+    free(decoded);
+    return stream;
+}
+
+unsigned char* codec_encode_target(const unsigned char *pixels, int width, int height,
+                                   const CodecParams *params, const CodecTarget *target,
+                                   CodecTargetResult *result, size_t *out_size) {
+    StreamLayout layout;
+    if (!layout_from_params(&layout, width, height, params)) {
+        return NULL;
+    }
+    if (target->metric != CODEC_TARGET_PSNR && target->metric != CODEC_TARGET_SSIM) {
+        fprintf(stderr, "Invalid quality target\n");
+        return NULL;
+    }
+
+    // Quadtree partitions depend on the quality, so estimate with fixed 8x8 blocks
+    CodecParams estimate_params = *params;
+    if (params->quadtree) {
+        estimate_params.quadtree = 0;
+        estimate_params.block_size = 8;
+        layout_from_params(&layout, width, height, &estimate_params);
+    }
+
+    CoeffCache cache;
+    coeff_cache_init(&cache, pixels, &layout);
+
+    // Lowest quality whose estimate meets the target; the metrics grow with quality
+    CodecTargetResult stats = {0, 0.0, 0, 0};
+    int low = 1;
+    int high = 100;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        stats.estimates++;
+        if (estimate_quality(&cache, mid, target->metric) >= target->threshold) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    coeff_cache_free(&cache);
+
+    int quality = low;
+    double achieved;
+    size_t size;
+    unsigned char *stream = encode_and_measure(pixels, width, height, params, quality,
+                                               target->metric, &achieved, &size);
+    stats.encodes++;
+
+    // Full encodes settle the estimate: gallop away from it (down if it
+    // passed, up if it was optimistic) until a passing and a failing quality
+    // are neighbours, bisecting once both sides are bracketed. fail = 0 and
+    // pass = 101 stand for sides not yet found; quality 100 is kept if
+    // nothing passes.
+    int pass = achieved >= target->threshold ? quality : 101;
+    int fail = achieved >= target->threshold ? 0 : quality;
+    int step = 1;
+    while (fail + 1 < pass) {
+        int mid;
+        if (pass > 100) {
+            mid = fail + step < 100 ? fail + step : 100;
+        } else if (fail < 1) {
+            mid = pass - step > 1 ? pass - step : 1;
+        } else {
+            mid = (fail + pass) / 2;
+        }
+        double candidate_achieved;
+        size_t candidate_size;
+        unsigned char *candidate = encode_and_measure(pixels, width, height, params, mid,
+                                                      target->metric, &candidate_achieved, &candidate_size);
+        stats.encodes++;
+        step *= 2;
+        if (candidate_achieved >= target->threshold || mid == 100) {
+            free(stream);
+            stream = candidate;
+            size = candidate_size;
+            achieved = candidate_achieved;
+            pass = mid;
+        } else {
+            free(candidate);
+            fail = mid;
+        }
+    }
+    quality = pass > 100 ? quality : pass;
+
+    stats.quality = quality;
+    stats.achieved = achieved;
+    if (result) {
+        *result = stats;
+    }
+    *out_size = size;
+    return stream;
+}
+
+int codec_stream_info(const unsigned char *stream, size_t size, int *width, int *height) {
+    StreamLayout layout;
+    if (!read_header(stream, size, &layout)) {
+        return 0;
+    }
+    *width = layout.width;
+    *height = layout.height;
+    return 1;
+}
+
+// Refuse a stream whose samples do not fit the byte planes of the 8-bit entry points
+static int byte_samples(const StreamLayout *layout) {
+    if (layout->bit_depth > 8) {
+        fprintf(stderr, "Stream holds %d-bit samples (see codec_decode16)\n", layout->bit_depth);
+        return 0;
+    }
+    return 1;
+}
+
+// Decode every tile of a parsed stream into a new plane of the layout's sample type
+static void* decode_stream(const unsigned char *stream, const StreamLayout *layout) {
+    void *pixels = malloc((size_t) layout->width * layout->height * sample_bytes(layout));
+    if (!pixels) {
+        fprintf(stderr, "Memory allocation failed when creating decoded image\n");
+        exit(EXIT_FAILURE);
+    }
+
+    TileCoder tc;
+    tile_coder_init(&tc, layout);
+
+    for (int t = 0; t < layout->tile_count; t++) {
+        size_t length;
+        const unsigned char *segment = tile_segment(stream, layout, t, &length);
+        if (!decode_tile(&tc, segment, length, t % layout->tiles_x, t / layout->tiles_x, pixels)) {
+            fprintf(stderr, "Corrupt tile %d in stream\n", t);
+            tile_coder_free(&tc);
+            free(pixels);
+            return NULL;
+        }
+    }
+
+    tile_coder_free(&tc);
+    return pixels;
+}
+
+unsigned char* codec_decode(const unsigned char *stream, size_t size, int *width, int *height) {
+    StreamLayout layout;
+    if (!read_header(stream, size, &layout) || !byte_samples(&layout)) {
+        return NULL;
+    }
+
+    unsigned char *pixels = (unsigned char*)decode_stream(stream, &layout);
+    if (pixels) {
+        *width = layout.width;
+        *height = layout.height;
+    }
+    return pixels;
+}
+
+unsigned short* codec_decode16(const unsigned char *stream, size_t size, int *width, int *height,
+                               int *bit_depth) {
+    StreamLayout layout;
+    if (!read_header(stream, size, &layout)) {
+        return NULL;
+    }
+
+    void *decoded = decode_stream(stream, &layout);
+    if (!decoded) {
+        return NULL;
+    }
+
+    // 8-bit streams decode into bytes and are widened in place, from the end
+    unsigned short *pixels = (unsigned short*)decoded;
+    if (layout.bit_depth == 8) {
+        size_t count = (size_t) layout.width * layout.height;
+        pixels = (unsigned short*)realloc(decoded, count * sizeof(unsigned short));
+        if (!pixels) {
+            fprintf(stderr, "Memory allocation failed when creating decoded image\n");
+            exit(EXIT_FAILURE);
+        }
+        const unsigned char *bytes = (const unsigned char *) pixels;
+        for (size_t k = count; k-- > 0;) {
+            pixels[k] = bytes[k];
+        }
+    }
+
+    *width = layout.width;
+    *height = layout.height;
+    *bit_depth = layout.bit_depth;
+    return pixels;
+}
+
+/**
+ * Resize the coefficient store of a tile coder to hold a whole stream
+ * (used by the entropy thread of codec_decode_parallel)
+ */
+static void tile_coder_reserve(TileCoder *tc, size_t coeff_count, size_t max_blocks) {
+    free_large(tc->nonzero);
+    free_large(tc->values);
+    free(tc->value_offsets);
+    free(tc->sizes);
+    free(tc->levels);
+    if (tc->palettes) {
+        free(tc->palettes);
+        free(tc->palette_colors);
+        free_large(tc->palette_indexes);
+        tile_coder_alloc_palettes(tc, coeff_count, max_blocks);
+    }
+    tc->nonzero = (unsigned long long*)alloc_large((coeff_count + 63) / 64 * sizeof(unsigned long long));
+    tc->values = (int*)alloc_large(coeff_count * sizeof(int));
+    tc->value_offsets = (size_t*)malloc(max_blocks * sizeof(size_t));
+    tc->sizes = (unsigned char*)malloc(max_blocks);
+    tc->levels = (unsigned char*)malloc(max_blocks);
+    if (!tc->value_offsets || !tc->sizes || !tc->levels) {
+        fprintf(stderr, "Memory allocation failed when creating the coefficient store\n");
+        exit(EXIT_FAILURE);
+    }
+    tc->value_count = 0;
+}
+
+// Entropy decode one block into the end of the coefficient store
+static int read_stored_block(TileCoder *tc, BitReader *br, int size, int *b, size_t *offset,
+                             int *dc_pred, const HuffTable *dc_table, const HuffTable *ac_table) {
+    int palette = read_block_mode(tc, br, size, *b, *offset);
+    if (palette) {
+        if (palette > 0) {
+            commit_palette_block(tc, size, b, offset);
+        }
+        return palette > 0;
+    }
+
+    unsigned char level = 0;
+    if (tc->layout->flags & CODEC_FLAG_ADAPTIVE) {
+        level = (unsigned char) bitreader_get_bits(br, 8);
+    }
+
+    SparseBlock block;
+    block.values = tc->values + tc->value_count;
+    if (!huffman_decode_sparse(br, &block, size * size, &dc_pred[size_class(size)], dc_table, ac_table)) {
+        return 0;
+    }
+    commit_block(tc, size, level, &block, b, offset);
+    return 1;
+}
+
+static int read_stored_partition(TileCoder *tc, BitReader *br, int size, int *b, size_t *offset,
+                                 int *dc_pred, const HuffTable *dc_table, const HuffTable *ac_table) {
+    if (size > CODEC_MIN_BLOCK_SIZE && bitreader_get_bits(br, 1)) {
+        for (int k = 0; k < 4; k++) {
+            if (!read_stored_partition(tc, br, size / 2, b, offset, dc_pred, dc_table, ac_table)) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    return read_stored_block(tc, br, size, b, offset, dc_pred, dc_table, ac_table);
+}
+
+/**
+ * Entropy decode tile t into the queue's store, publishing each block row
+ * as soon as it is complete. Rows start on a fresh bitmap word, so a worker
+ * reading a published row never shares a word with one being written.
+ */
+static int read_tile_rows(RowQueue *queue, const unsigned char *segment, size_t length, int t,
+                          size_t *row, int *b, size_t *offset) {
+    TileCoder *tc = queue->store;
+    const StreamLayout *layout = queue->layout;
+    int n = layout->block_size;
+    int quadtree = (layout->flags & CODEC_FLAG_QUADTREE) != 0;
+    int cols, rows;
+    tile_blocks(layout, t % layout->tiles_x, t / layout->tiles_x, &cols, &rows);
+
+    BitReader br;
+    bitreader_init(&br, segment, length);
+    const HuffTable *dc_table, *ac_table;
+    HuffTable optimized_dc, optimized_ac;
+    if (!read_tile_tables(tc, &br, &optimized_dc, &optimized_ac, &dc_table, &ac_table)) {
+        return 0;
+    }
+    tc->last_count = 0;
+
+    int dc_pred[CODEC_SIZE_CLASSES] = {0};
+    for (int by = 0; by < rows; by++) {
+        size_t r = (*row)++;
+        queue->row_tiles[r] = t;
+        queue->row_indices[r] = by;
+        queue->row_blocks[r] = *b;
+        queue->row_offsets[r] = *offset;
+        for (int bx = 0; bx < cols; bx++) {
+            int ok = quadtree
+                     ? read_stored_partition(tc, &br, n, b, offset, dc_pred, dc_table, ac_table)
+                     : read_stored_block(tc, &br, n, b, offset, dc_pred, dc_table, ac_table);
+            if (!ok) {
+                return 0;
+            }
+        }
+        *offset = (*offset + 63) / 64 * 64;
+        __atomic_store_n(&queue->published, r + 1, __ATOMIC_RELEASE);
+    }
+    return br.pos <= length;
+}
+
+// Dequantize, inverse transform and place one stored block
+static void reconstruct_stored(TileCoder *tc, const TileCoder *store, int size, int row, int col,
+                               int b, size_t offset) {
+    if (store->palettes && store->palettes[b]) {
+        fill_palette(tc, store, size, row, col, b, offset);
+        return;
+    }
+    int c = size_class(size);
+    double variance = (tc->layout->flags & CODEC_FLAG_ADAPTIVE) ? level_to_variance(store->levels[b]) : 0.0;
+    SparseBlock block;
+    stored_block(store, b, offset, &block);
+    int last = dequantize_sparse(tc->quant[c], &block, tc->coeffs, variance);
+    dct_inverse_sparse(tc->dct[c], tc->coeffs, tc->block, nonzero_extent(tc->quant[c], last));
+    store_block(tc, size, row, col);
+}
+
+static void reconstruct_stored_partition(TileCoder *tc, const TileCoder *store, int size, int row, int col,
+                                         int *b, size_t *offset) {
+    if (store->sizes[*b] < size) {
+        int half = size / 2;
+        for (int k = 0; k < 4; k++) {
+            reconstruct_stored_partition(tc, store, half, row + (k / 2) * half, col + (k % 2) * half, b, offset);
+        }
+        return;
+    }
+    reconstruct_stored(tc, store, size, row, col, *b, *offset);
+    *offset += (size_t) size * size;
+    (*b)++;
+}
+
+// Reconstruct published rows until every row is claimed or a tile turns out corrupt
+static void reconstruct_rows(RowQueue *queue) {
+    const StreamLayout *layout = queue->layout;
+    int n = layout->block_size;
+    int quadtree = (layout->flags & CODEC_FLAG_QUADTREE) != 0;
+    TileCoder tc;
+    tile_coder_init(&tc, layout);
+
+    for (;;) {
+        size_t r = __atomic_fetch_add(&queue->next_row, 1, __ATOMIC_RELAXED);
+        if (r >= queue->row_count) {
+            break;
+        }
+        while (__atomic_load_n(&queue->published, __ATOMIC_ACQUIRE) <= r &&
+               !__atomic_load_n(&queue->failed, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+        }
+        if (__atomic_load_n(&queue->failed, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        int t = queue->row_tiles[r];
+        int tx = t % layout->tiles_x;
+        int ty = t / layout->tiles_x;
+        int cols, rows;
+        tile_blocks(layout, tx, ty, &cols, &rows);
+        int b = queue->row_blocks[r];
+        size_t offset = queue->row_offsets[r];
+        int by = queue->row_indices[r];
+        set_band(&tc, tx, ty, by, cols);
+        for (int bx = 0; bx < cols; bx++) {
+            int row = ty * layout->tile_height + by * n;
+            int col = tx * layout->tile_width + bx * n;
+            if (quadtree) {
+                reconstruct_stored_partition(&tc, queue->store, n, row, col, &b, &offset);
+            } else {
+                reconstruct_stored(&tc, queue->store, n, row, col, b++, offset);
+                offset += (size_t) n * n;
+            }
+        }
+        store_band(&tc, queue->pixels, 1);
+    }
+
+    tile_coder_free(&tc);
+}
+
+static void* reconstruct_main(void *arg) {
+    reconstruct_rows((RowQueue*) arg);
+    return NULL;
+}
+
+unsigned char* codec_decode_parallel(const unsigned char *stream, size_t size, int threads,
+                                     int *width, int *height) {
+    if (threads < 1) {
+        return codec_decode(stream, size, width, height);
+    }
+
+    StreamLayout layout;
+    if (!read_header(stream, size, &layout) || !byte_samples(&layout)) {
+        return NULL;
+    }
+
+    RowQueue queue;
+    size_t coeff_count = (size_t) layout.padded_width * layout.padded_height;
+    int quadtree = (layout.flags & CODEC_FLAG_QUADTREE) != 0;
+    int min_size = quadtree ? CODEC_MIN_BLOCK_SIZE : layout.block_size;
+    queue.row_count = 0;
+    for (int t = 0; t < layout.tile_count; t++) {
+        int cols, rows;
+        tile_blocks(&layout, t % layout.tiles_x, t / layout.tiles_x, &cols, &rows);
+        queue.row_count += (size_t) rows;
+    }
+
+    queue.layout = &layout;
+    queue.published = 0;
+    queue.next_row = 0;
+    queue.failed = 0;
+    queue.pixels = (unsigned char*)malloc((size_t) layout.width * layout.height);
+    queue.row_tiles = (int*)malloc(queue.row_count * sizeof(int) + 1);
+    queue.row_indices = (int*)malloc(queue.row_count * sizeof(int) + 1);
+    queue.row_blocks = (int*)malloc(queue.row_count * sizeof(int) + 1);
+    queue.row_offsets = (size_t*)malloc(queue.row_count * sizeof(size_t) + 1);
+    pthread_t *workers = (pthread_t*)malloc((size_t) threads * sizeof(pthread_t));
+    if (!queue.pixels || !queue.row_tiles || !queue.row_indices || !queue.row_blocks || !queue.row_offsets || !workers) {
+        fprintf(stderr, "Memory allocation failed when creating decoder queues\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Each row may pad its slots up to a whole bitmap word
+    TileCoder store;
+    tile_coder_init(&store, &layout);
+    tile_coder_reserve(&store, coeff_count + queue.row_count * 64, coeff_count / ((size_t) min_size * min_size));
+    queue.store = &store;
+
+    // Threads that cannot be created are done without: this thread reconstructs rows too
+    int started = 0;
+    while (started < threads && pthread_create(&workers[started], NULL, reconstruct_main, &queue) == 0) {
+        started++;
+    }
+
+    // This thread entropy decodes, then joins the reconstruction
+    size_t row = 0;
+    int b = 0;
+    size_t offset = 0;
+    int corrupt = -1;
+    for (int t = 0; t < layout.tile_count && corrupt < 0; t++) {
+        size_t length;
+        const unsigned char *segment = tile_segment(stream, &layout, t, &length);
+        if (!read_tile_rows(&queue, segment, length, t, &row, &b, &offset)) {
+            corrupt = t;
+            __atomic_store_n(&queue.failed, 1, __ATOMIC_RELEASE);
+        }
+    }
+    if (corrupt < 0) {
+        reconstruct_rows(&queue);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+    free(queue.row_tiles);
+    free(queue.row_indices);
+    free(queue.row_blocks);
+    free(queue.row_offsets);
+    tile_coder_free(&store);
+    if (corrupt >= 0) {
+        fprintf(stderr, "Corrupt tile %d in stream\n", corrupt);
+        free(queue.pixels);
+        return NULL;
+    }
+
+    *width = layout.width;
+    *height = layout.height;
+    return queue.pixels;
+}
+
+unsigned char* codec_reencode_dirty(const unsigned char *stream, size_t size, const unsigned char *pixels,
+                                    const CodecRect *rects, int rect_count, size_t *out_size) {
+    StreamLayout layout;
+    if (!read_header(stream, size, &layout) || !byte_samples(&layout)) {
+        return NULL;
+    }
+
+    unsigned char *dirty = (unsigned char*)calloc(layout.tile_count, 1);
+    if (!dirty) {
+        fprintf(stderr, "Memory allocation failed when creating dirty tile map\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Mark every tile that a (clipped) rectangle overlaps; far edges are summed
+    // in long long so rectangles reaching past INT_MAX clip instead of wrapping
+    for (int r = 0; r < rect_count; r++) {
+        int x0 = rects[r].x < 0 ? 0 : rects[r].x;
+        int y0 = rects[r].y < 0 ? 0 : rects[r].y;
+        long long far_x = (long long) rects[r].x + rects[r].width;
+        long long far_y = (long long) rects[r].y + rects[r].height;
+        int x1 = far_x > layout.width ? layout.width : (int) far_x;
+        int y1 = far_y > layout.height ? layout.height : (int) far_y;
+        if (x0 >= x1 || y0 >= y1) continue;
+
+        for (int ty = y0 / layout.tile_height; ty <= (y1 - 1) / layout.tile_height; ty++) {
+            for (int tx = x0 / layout.tile_width; tx <= (x1 - 1) / layout.tile_width; tx++) {
+                dirty[ty * layout.tiles_x + tx] = 1;
+            }
+        }
+    }
+
+    // The adaptive scan order is sampled from the whole image, so an edit can change it;
+    // every tile is then re-coded with the new order, as a fresh encode would be
+    StreamLayout fresh = layout;
+    choose_scan_order(&fresh, pixels);
+    int rescan = fresh.scan_count != layout.scan_count ||
+                 memcmp(fresh.scan, layout.scan, (size_t) layout.scan_count * sizeof(layout.scan[0])) != 0;
+
+    unsigned char *result = write_stream(&fresh, pixels, rescan ? NULL : dirty, stream, 0.0, NULL, NULL, 0,
+                                         out_size);
+    free(dirty);
+    return result;
+}
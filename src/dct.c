@@ -4,6 +4,43 @@
  */
 #include <dct.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Default kernel per block size 4, 8, 16 and 32
+static int default_kernels[4] = {DCT_KERNEL_MATRIX, DCT_KERNEL_MATRIX, DCT_KERNEL_MATRIX, DCT_KERNEL_MATRIX};
+
+static int kernel_slot(int block_size) {
+    switch (block_size) {
+        case 4: return 0;
+        case 8: return 1;
+        case 16: return 2;
+        case 32: return 3;
+        default: return -1;
+    }
+}
+
+int dct_kernel_available(int kernel) {
+#if defined(__SSE2__)
+    return kernel >= 0 && kernel < DCT_KERNEL_COUNT;
+#else
+    return kernel == DCT_KERNEL_MATRIX || kernel == DCT_KERNEL_FACTORIZED;
+#endif
+}
+
+void dct_set_default_kernel(int block_size, int kernel) {
+    int slot = kernel_slot(block_size);
+    if (slot >= 0 && dct_kernel_available(kernel)) {
+        default_kernels[slot] = kernel;
+    }
+}
+
+int dct_default_kernel(int block_size) {
+    int slot = kernel_slot(block_size);
+    return slot >= 0 ? default_kernels[slot] : DCT_KERNEL_MATRIX;
+}
+
 DCTContext *dct_init(int block_size) {
     DCTContext *ctx = (DCTContext *) malloc(sizeof(DCTContext));
     if (!ctx) {
@@ -14,6 +51,16 @@ DCTContext *dct_init(int block_size) {
     ctx->block_size = block_size;
     ctx->dct_matrix = alloc_array(block_size, block_size);
     ctx->transposed_dct = alloc_array(block_size, block_size);
+    ctx->approximate = 0;
+    ctx->kernel = dct_default_kernel(block_size);
+    ctx->row_norms = (double *) malloc(block_size * sizeof(double));
+    if (!ctx->row_norms) {
+        fprintf(stderr, "Memory allocation failed, when creating new context\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < block_size; ++i) {
+        ctx->row_norms[i] = 1.0;
+    }
 
     // computing
     for (int i = 0; i < block_size; ++i) {
@@ -40,79 +87,384 @@ DCTContext *dct_init(int block_size) {
 }
 
 
+DCTContext *dct_init_approximate(int block_size) {
+    DCTContext *ctx = dct_init(block_size);
+
+    // Squared row norms of the integer bases
+    static const double norms4[4] = {4, 10, 4, 10};
+    static const double norms8[8] = {8, 6, 4, 6, 8, 6, 4, 6};
+
+    if (block_size == 4 || block_size == 8) {
+        const double *norms = block_size == 4 ? norms4 : norms8;
+        ctx->approximate = 1;
+        for (int i = 0; i < block_size; ++i) {
+            ctx->row_norms[i] = sqrt(norms[i]);
+        }
+    }
+
+    return ctx;
+}
+
+
 void dct_free(DCTContext *ctx) {
     if (ctx) {
         free_array(ctx->dct_matrix, ctx->block_size);
         free_array(ctx->transposed_dct, ctx->block_size);
+        free(ctx->row_norms);
         free(ctx);
     }
 }
 
 
-void dct_forward(DCTContext *ctx, double **input, double **output) {
+// 4-point integer transform: rows (1,1,1,1), (2,1,-1,-2), (1,-1,-1,1), (1,-2,2,-1)
+static void approx_forward_4(const double *x, double *y) {
+    double a0 = x[0] + x[3];
+    double a1 = x[1] + x[2];
+    double a2 = x[1] - x[2];
+    double a3 = x[0] - x[3];
+
+    y[0] = a0 + a1;
+    y[2] = a0 - a1;
+    y[1] = a3 + a3 + a2;
+    y[3] = a3 - a2 - a2;
+}
+
+static void approx_inverse_4(const double *y, double *x) {
+    double e0 = y[0] + y[2];
+    double e1 = y[0] - y[2];
+    double o0 = y[1] + y[1] + y[3];
+    double o1 = y[1] - y[3] - y[3];
+
+    x[0] = e0 + o0;
+    x[3] = e0 - o0;
+    x[1] = e1 + o1;
+    x[2] = e1 - o1;
+}
+
+// 8-point Cintra-Bayer transform, even/odd butterfly (22 additions)
+static void approx_forward_8(const double *x, double *y) {
+    double a0 = x[0] + x[7];
+    double a1 = x[1] + x[6];
+    double a2 = x[2] + x[5];
+    double a3 = x[3] + x[4];
+    double a4 = x[3] - x[4];
+    double a5 = x[2] - x[5];
+    double a6 = x[1] - x[6];
+    double a7 = x[0] - x[7];
+
+    y[0] = a0 + a1 + a2 + a3;
+    y[2] = a0 - a3;
+    y[4] = a0 - a1 - a2 + a3;
+    y[6] = a2 - a1;
+
+    y[1] = a7 + a6 + a5;
+    y[3] = a7 - a5 - a4;
+    y[5] = a7 - a6 + a4;
+    y[7] = a5 - a6 - a4;
+}
+
+static void approx_inverse_8(const double *y, double *x) {
+    double a0 = y[0] + y[2] + y[4];
+    double a1 = y[0] - y[4] - y[6];
+    double a2 = y[0] - y[4] + y[6];
+    double a3 = y[0] - y[2] + y[4];
+
+    double b7 = y[1] + y[3] + y[5];
+    double b6 = y[1] - y[5] - y[7];
+    double b5 = y[1] - y[3] + y[7];
+    double b4 = y[5] - y[3] - y[7];
+
+    x[0] = a0 + b7;
+    x[7] = a0 - b7;
+    x[1] = a1 + b6;
+    x[6] = a1 - b6;
+    x[2] = a2 + b5;
+    x[5] = a2 - b5;
+    x[3] = a3 + b4;
+    x[4] = a3 - b4;
+}
+
+// Separable 2D pass of an approximate kernel: rows first, then columns
+static void approx_transform_2d(DCTContext *ctx, double **input, double **output, int inverse) {
     int size = ctx->block_size;
-    double **temp = alloc_array(size, size);
+    double temp[8][8];
+    double column[8];
+    double result[8];
+    void (*kernel)(const double *, double *);
 
-    // First perform DCT across rows: temp = input * DCT^T
+    if (size == 4) {
+        kernel = inverse ? approx_inverse_4 : approx_forward_4;
+    } else {
+        kernel = inverse ? approx_inverse_8 : approx_forward_8;
+    }
+
+    for (int i = 0; i < size; i++) {
+        kernel(input[i], temp[i]);
+    }
+
+    for (int j = 0; j < size; j++) {
+        for (int i = 0; i < size; i++) {
+            column[i] = temp[i][j];
+        }
+        kernel(column, result);
+        for (int i = 0; i < size; i++) {
+            output[i][j] = result[i];
+        }
+    }
+}
+
+
+// c = a * b for square matrices
+static void matrix_multiply(double **a, double **b, double **c, int size) {
     for (int i = 0; i < size; i++) {
         for (int j = 0; j < size; j++) {
-            temp[i][j] = 0.0;
+            c[i][j] = 0.0;
             for (int k = 0; k < size; k++) {
-                temp[i][j] += input[i][k] * ctx->transposed_dct[k][j];
+                c[i][j] += a[i][k] * b[k][j];
             }
         }
     }
+}
 
-    // Then perform DCT across columns: output = DCT * temp
+#if defined(__SSE2__)
+// c = a * b, two columns of c per step; same summation order as matrix_multiply
+static void matrix_multiply_sse2(double **a, double **b, double **c, int size) {
     for (int i = 0; i < size; i++) {
-        for (int j = 0; j < size; j++) {
-            output[i][j] = 0.0;
+        for (int j = 0; j < size; j += 2) {
+            __m128d sum = _mm_setzero_pd();
             for (int k = 0; k < size; k++) {
-                output[i][j] += ctx->dct_matrix[i][k] * temp[k][j];
+                sum = _mm_add_pd(sum, _mm_mul_pd(_mm_set1_pd(a[i][k]), _mm_loadu_pd(&b[k][j])));
             }
+            _mm_storeu_pd(&c[i][j], sum);
         }
     }
+}
+#endif
 
-    free_array(temp, size);
+/**
+ * 1D exact DCT of a strided vector using the even/odd symmetry of the basis
+ * (C[u][n-1-j] = (-1)^u C[u][j]), so each output needs n/2 multiplications
+ */
+static void factorized_forward_1d(double **matrix, const double *x, int x_stride,
+                                  double *y, int y_stride, int size) {
+    int half = size / 2;
+    double sums[16], diffs[16];
+    for (int j = 0; j < half; j++) {
+        sums[j] = x[j * x_stride] + x[(size - 1 - j) * x_stride];
+        diffs[j] = x[j * x_stride] - x[(size - 1 - j) * x_stride];
+    }
+    for (int u = 0; u < size; u++) {
+        const double *half_row = (u % 2 == 0) ? sums : diffs;
+        double value = 0.0;
+        for (int j = 0; j < half; j++) {
+            value += matrix[u][j] * half_row[j];
+        }
+        y[u * y_stride] = value;
+    }
 }
 
+// Only the first count inputs are read; the rest are taken as zero
+static void factorized_inverse_1d(double **matrix, const double *y, int y_stride,
+                                  double *x, int x_stride, int size, int count) {
+    int half = size / 2;
+    for (int j = 0; j < half; j++) {
+        double even = 0.0, odd = 0.0;
+        for (int u = 0; u < count; u += 2) {
+            even += matrix[u][j] * y[u * y_stride];
+            if (u + 1 < count) {
+                odd += matrix[u + 1][j] * y[(u + 1) * y_stride];
+            }
+        }
+        x[j * x_stride] = even + odd;
+        x[(size - 1 - j) * x_stride] = even - odd;
+    }
+}
 
-void dct_inverse(DCTContext *ctx, double **input, double **output) {
+// Separable 2D factorized transform: rows into scratch, then columns into output
+static void factorized_transform_2d(const DCTContext *ctx, double **input, double **output, int inverse) {
     int size = ctx->block_size;
-    double **temp = alloc_array(size, size);
+    double scratch[32][32];
+    double column[32], result[32];
 
-    // First perform IDCT across columns: temp = DCT^T * input
     for (int i = 0; i < size; i++) {
+        if (inverse) {
+            factorized_inverse_1d(ctx->dct_matrix, input[i], 1, scratch[i], 1, size, size);
+        } else {
+            factorized_forward_1d(ctx->dct_matrix, input[i], 1, scratch[i], 1, size);
+        }
+    }
+
+    for (int j = 0; j < size; j++) {
+        for (int i = 0; i < size; i++) {
+            column[i] = scratch[i][j];
+        }
+        if (inverse) {
+            factorized_inverse_1d(ctx->dct_matrix, column, 1, result, 1, size, size);
+        } else {
+            factorized_forward_1d(ctx->dct_matrix, column, 1, result, 1, size);
+        }
+        for (int i = 0; i < size; i++) {
+            output[i][j] = result[i];
+        }
+    }
+}
+
+// Intermediate block of one transform call, so transforms only read the
+// context: on the stack up to DCT_STACK_SIZE, allocated per call beyond it
+#define DCT_STACK_SIZE 32
+
+typedef struct {
+    double data[DCT_STACK_SIZE][DCT_STACK_SIZE];
+    double *stack_rows[DCT_STACK_SIZE];
+    double **rows;
+    int size;
+} Scratch;
+
+static double **scratch_init(Scratch *scratch, int size) {
+    scratch->size = size;
+    if (size > DCT_STACK_SIZE) {
+        scratch->rows = alloc_array(size, size);
+        return scratch->rows;
+    }
+    for (int i = 0; i < size; i++) {
+        scratch->stack_rows[i] = scratch->data[i];
+    }
+    scratch->rows = scratch->stack_rows;
+    return scratch->rows;
+}
+
+static void scratch_free(Scratch *scratch) {
+    if (scratch->size > DCT_STACK_SIZE) {
+        free_array(scratch->rows, scratch->size);
+    }
+}
+
+// Kernel for the matrix passes, falling back to the scalar product
+static void (*matrix_kernel(const DCTContext *ctx))(double **, double **, double **, int) {
+#if defined(__SSE2__)
+    if (ctx->kernel == DCT_KERNEL_SSE2 && ctx->block_size % 2 == 0) {
+        return matrix_multiply_sse2;
+    }
+#else
+    (void) ctx;
+#endif
+    return matrix_multiply;
+}
+
+// Factorized kernel handles even sizes up to 32
+static int use_factorized(const DCTContext *ctx) {
+    return ctx->kernel == DCT_KERNEL_FACTORIZED && ctx->block_size % 2 == 0 && ctx->block_size <= 32;
+}
+
+
+void dct_forward(DCTContext *ctx, double **input, double **output) {
+    if (ctx->approximate) {
+        approx_transform_2d(ctx, input, output, 0);
+        return;
+    }
+    if (use_factorized(ctx)) {
+        factorized_transform_2d(ctx, input, output, 0);
+        return;
+    }
+
+    void (*multiply)(double **, double **, double **, int) = matrix_kernel(ctx);
+    Scratch scratch;
+    double **temp = scratch_init(&scratch, ctx->block_size);
+
+    // First perform DCT across rows: temp = input * DCT^T
+    multiply(input, ctx->transposed_dct, temp, ctx->block_size);
+
+    // Then perform DCT across columns: output = DCT * temp
+    multiply(ctx->dct_matrix, temp, output, ctx->block_size);
+    scratch_free(&scratch);
+}
+
+
+void dct_inverse(DCTContext *ctx, double **input, double **output) {
+    if (ctx->approximate) {
+        approx_transform_2d(ctx, input, output, 1);
+        return;
+    }
+    if (use_factorized(ctx)) {
+        factorized_transform_2d(ctx, input, output, 1);
+        return;
+    }
+
+    void (*multiply)(double **, double **, double **, int) = matrix_kernel(ctx);
+    Scratch scratch;
+    double **temp = scratch_init(&scratch, ctx->block_size);
+
+    // First perform IDCT across columns: temp = DCT^T * input
+    multiply(ctx->transposed_dct, input, temp, ctx->block_size);
+
+    // Then perform IDCT across rows: output = temp * DCT
+    multiply(temp, ctx->dct_matrix, output, ctx->block_size);
+    scratch_free(&scratch);
+}
+
+void dct_inverse_sparse(DCTContext *ctx, double **input, double **output, int extent) {
+    int size = ctx->block_size;
+    if (ctx->approximate || extent >= size) {
+        dct_inverse(ctx, input, output);
+        return;
+    }
+    if (extent < 1) {
+        extent = 1;
+    }
+
+    // Terms dropped below are products with zero coefficients, so each sum
+    // keeps the order and the value the full transform gives it
+    if (use_factorized(ctx)) {
+        double scratch[32][32];
+        double column[32], result[32];
+        for (int i = 0; i < extent; i++) {
+            factorized_inverse_1d(ctx->dct_matrix, input[i], 1, scratch[i], 1, size, extent);
+        }
         for (int j = 0; j < size; j++) {
-            temp[i][j] = 0.0;
-            for (int k = 0; k < size; k++) {
-                temp[i][j] += ctx->transposed_dct[i][k] * input[k][j];
+            for (int i = 0; i < extent; i++) {
+                column[i] = scratch[i][j];
+            }
+            factorized_inverse_1d(ctx->dct_matrix, column, 1, result, 1, size, extent);
+            for (int i = 0; i < size; i++) {
+                output[i][j] = result[i];
             }
         }
+        return;
     }
 
-    // Then perform IDCT across rows: output = temp * DCT
+    // temp = DCT^T * input over the first extent columns, then output = temp * DCT
+    Scratch scratch;
+    double **temp = scratch_init(&scratch, size);
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < extent; j++) {
+            double sum = 0.0;
+            for (int k = 0; k < extent; k++) {
+                sum += ctx->transposed_dct[i][k] * input[k][j];
+            }
+            temp[i][j] = sum;
+        }
+    }
     for (int i = 0; i < size; i++) {
         for (int j = 0; j < size; j++) {
-            output[i][j] = 0.0;
-            for (int k = 0; k < size; k++) {
-                output[i][j] += temp[i][k] * ctx->dct_matrix[k][j];
+            double sum = 0.0;
+            for (int k = 0; k < extent; k++) {
+                sum += temp[i][k] * ctx->dct_matrix[k][j];
             }
+            output[i][j] = sum;
         }
     }
-
-    free_array(temp, size);
+    scratch_free(&scratch);
 }
 
-
 // func to create and init block from pixels
-double **create_block_from_pixels(unsigned char *pixels, int width, int row_start, int col_start, int block_size) {
+double **create_block_from_pixels(const unsigned char *pixels, size_t width, size_t row_start, size_t col_start,
+                                  int block_size) {
     double **block = alloc_array(block_size, block_size);
 
     for (int i = 0; i < block_size; ++i) {
+        const unsigned char *line = pixels + (row_start + (size_t) i) * width + col_start;
         for (int j = 0; j < block_size; ++j) {
-            int pixel_index = (row_start + i) * width + (col_start + j);
-            block[i][j] = (double) pixels[pixel_index] - 128.0;
+            block[i][j] = (double) line[j] - 128.0;
         }
     }
 
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <utils.h>
 
 #define INITIAL_CAPACITY 64
@@ -399,3 +400,669 @@ int get_encoded_size(EntropyContext *ctx) {
 }
 
 
+
+
+// Standard JPEG luminance tables (ITU T.81 Annex K.3), used as the frequency
+// model for the default tables
+static const unsigned char std_dc_luma_bits[HUFF_MAX_CODE_LEN + 1] = {
+    0, 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0
+};
+static const unsigned char std_dc_luma_values[] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
+};
+static const unsigned char std_ac_luma_bits[HUFF_MAX_CODE_LEN + 1] = {
+    0, 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d
+};
+static const unsigned char std_ac_luma_values[] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+    0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+    0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+    0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+    0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+    0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+    0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+    0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+#define HUFF_EOB 0x00
+#define HUFF_ZRL 0xF0
+
+// Record the depth of every leaf of a Huffman tree
+static void assign_code_lengths(HuffNode *node, int depth, int *lengths) {
+    if (node == NULL) return;
+
+    if (node->left == NULL && node->right == NULL) {
+        lengths[node->symbol] = depth > 0 ? depth : 1;
+        return;
+    }
+
+    assign_code_lengths(node->left, depth + 1, lengths);
+    assign_code_lengths(node->right, depth + 1, lengths);
+}
+
+// Derive the encoder and decoder lookups from bits/values (ITU T.81 Annex C and F.2.2.3)
+static void derive_huffman_lookups(HuffTable *table) {
+    memset(table->lengths, 0, sizeof(table->lengths));
+    memset(table->codes, 0, sizeof(table->codes));
+
+    int code = 0;
+    int k = 0;
+    for (int len = 1; len <= HUFF_MAX_CODE_LEN; len++) {
+        if (table->bits[len] == 0) {
+            table->max_code[len] = -1;
+            table->val_offset[len] = 0;
+        } else {
+            table->val_offset[len] = k - code;
+            for (int i = 0; i < table->bits[len]; i++) {
+                table->codes[table->values[k]] = (unsigned short) code;
+                table->lengths[table->values[k]] = (unsigned char) len;
+                code++;
+                k++;
+            }
+            table->max_code[len] = code - 1;
+        }
+        code <<= 1;
+    }
+    table->max_code[HUFF_MAX_CODE_LEN + 1] = 0x7FFFFFFF;
+}
+
+void build_canonical_huffman_table(HuffTable *table, const unsigned *freq, int symbol_count) {
+    // One extra pseudo-symbol with the lowest frequency reserves the all-ones code
+    int reserved = symbol_count;
+    int *lengths = (int*)calloc(symbol_count + 1, sizeof(int));
+    PriorityQueue *pq = pq_create(symbol_count + 1);
+
+    for (int i = 0; i < symbol_count; i++) {
+        if (freq[i] > 0) {
+            pq_push(pq, create_huff_node(i, freq[i]));
+        }
+    }
+    pq_push(pq, create_huff_node(reserved, 0));
+
+    while (pq->size > 1) {
+        HuffNode *left = pq_pop(pq);
+        HuffNode *right = pq_pop(pq);
+
+        HuffNode *parent = create_huff_node(-1, left->frequency + right->frequency);
+        parent->left = left;
+        parent->right = right;
+
+        pq_push(pq, parent);
+    }
+
+    HuffNode *root = pq_pop(pq);
+    assign_code_lengths(root, 0, lengths);
+    free_huffman_tree(root);
+    pq_free(pq);
+
+    // Histogram of code lengths (a tree over 257 leaves is at most 256 deep)
+    int count_by_len[HUFF_AC_SYMBOLS + 2] = {0};
+    int max_len = 0;
+    for (int i = 0; i <= symbol_count; i++) {
+        if (lengths[i] > 0) {
+            count_by_len[lengths[i]]++;
+            if (lengths[i] > max_len) max_len = lengths[i];
+        }
+    }
+
+    // Limit code lengths to 16 bits (ITU T.81 Annex K.3, Figure K.3)
+    for (int i = max_len; i > HUFF_MAX_CODE_LEN; i--) {
+        while (count_by_len[i] > 0) {
+            int j = i - 2;
+            while (count_by_len[j] == 0) j--;
+            count_by_len[i] -= 2;
+            count_by_len[i - 1]++;
+            count_by_len[j + 1] += 2;
+            count_by_len[j]--;
+        }
+    }
+
+    // Drop the reserved code, which is always one of the longest
+    int longest = HUFF_MAX_CODE_LEN;
+    while (longest > 0 && count_by_len[longest] == 0) longest--;
+    if (longest > 0) count_by_len[longest]--;
+
+    memset(table->bits, 0, sizeof(table->bits));
+    for (int len = 1; len <= HUFF_MAX_CODE_LEN; len++) {
+        table->bits[len] = (unsigned char) count_by_len[len];
+    }
+
+    // Symbols sorted by their unlimited code length, then by value
+    table->value_count = 0;
+    for (int len = 1; len <= max_len; len++) {
+        for (int i = 0; i < symbol_count; i++) {
+            if (lengths[i] == len) {
+                table->values[table->value_count++] = (unsigned char) i;
+            }
+        }
+    }
+
+    derive_huffman_lookups(table);
+    free(lengths);
+}
+
+void build_default_huffman_table(HuffTable *table, int is_dc) {
+    const unsigned char *bits = is_dc ? std_dc_luma_bits : std_ac_luma_bits;
+    const unsigned char *values = is_dc ? std_dc_luma_values : std_ac_luma_values;
+    int symbol_count = is_dc ? HUFF_DC_SYMBOLS : HUFF_AC_SYMBOLS;
+    unsigned freq[HUFF_AC_SYMBOLS];
+
+    // Every codable symbol gets a small weight so categories beyond the
+    // JPEG tables (larger blocks, quality 100) stay representable
+    for (int i = 0; i < symbol_count; i++) {
+        int category = is_dc ? i : (i & 0x0F);
+        int codable = is_dc || category != 0 || i == HUFF_EOB || i == HUFF_ZRL;
+        freq[i] = codable ? 1 : 0;
+    }
+
+    int k = 0;
+    for (int len = 1; len <= HUFF_MAX_CODE_LEN; len++) {
+        for (int i = 0; i < bits[len]; i++) {
+            freq[values[k++]] = 1u << (HUFF_MAX_CODE_LEN + 1 - len);
+        }
+    }
+
+    build_canonical_huffman_table(table, freq, symbol_count);
+}
+
+int load_huffman_table(HuffTable *table, const unsigned char *bits, const unsigned char *values) {
+    int total = 0;
+    long code_space = 1;
+
+    table->bits[0] = 0;
+    for (int len = 1; len <= HUFF_MAX_CODE_LEN; len++) {
+        code_space <<= 1;
+        code_space -= bits[len];
+        if (code_space < 0) {
+            return 0;
+        }
+        total += bits[len];
+        table->bits[len] = bits[len];
+    }
+    if (total > HUFF_AC_SYMBOLS) {
+        return 0;
+    }
+
+    table->value_count = total;
+    memcpy(table->values, values, total);
+    derive_huffman_lookups(table);
+    return 1;
+}
+
+void bitwriter_init(BitWriter *bw, size_t initial_capacity) {
+    if (initial_capacity < INITIAL_CAPACITY) {
+        initial_capacity = INITIAL_CAPACITY;
+    }
+    bw->data = (unsigned char*)malloc(initial_capacity);
+    if (!bw->data) {
+        fprintf(stderr, "Memory allocation failed when creating bit writer\n");
+        exit(EXIT_FAILURE);
+    }
+    bw->size = 0;
+    bw->capacity = initial_capacity;
+    bw->accumulator = 0;
+    bw->bit_count = 0;
+    bw->fixed = 0;
+    bw->overflow = 0;
+}
+
+void bitwriter_init_buffer(BitWriter *bw, unsigned char *buffer, size_t capacity) {
+    bw->data = buffer;
+    bw->size = 0;
+    bw->capacity = capacity;
+    bw->accumulator = 0;
+    bw->bit_count = 0;
+    bw->fixed = 1;
+    bw->overflow = 0;
+}
+
+// Make room for count more bytes; 0 if a fixed buffer is too small
+static int bitwriter_reserve(BitWriter *bw, size_t count) {
+    if (bw->size + count <= bw->capacity) return 1;
+    if (bw->fixed) {
+        bw->overflow = 1;
+        return 0;
+    }
+
+    while (bw->size + count > bw->capacity) {
+        bw->capacity *= 2;
+    }
+    bw->data = (unsigned char*)realloc(bw->data, bw->capacity);
+    if (!bw->data) {
+        fprintf(stderr, "Memory allocation failed when growing bit writer\n");
+        exit(EXIT_FAILURE);
+    }
+    return 1;
+}
+
+void bitwriter_put_bits(BitWriter *bw, unsigned bits, int count) {
+    if (count == 0) return;
+
+    bw->accumulator = (bw->accumulator << count) | (bits & ((1u << count) - 1));
+    bw->bit_count += count;
+
+    if (bw->bit_count >= 8) {
+        // Reserve exactly the whole bytes pending, so a fixed buffer can be filled to the last byte
+        int fits = bitwriter_reserve(bw, (size_t) (bw->bit_count >> 3));
+        while (bw->bit_count >= 8) {
+            bw->bit_count -= 8;
+            if (fits) bw->data[bw->size++] = (unsigned char) (bw->accumulator >> bw->bit_count);
+        }
+        bw->accumulator &= (1u << bw->bit_count) - 1;
+    }
+}
+
+void bitwriter_align(BitWriter *bw) {
+    if (bw->bit_count > 0) {
+        bitwriter_put_bits(bw, 0x7F, 8 - bw->bit_count);
+    }
+}
+
+void bitwriter_put_bytes(BitWriter *bw, const unsigned char *bytes, size_t count) {
+    if (!bitwriter_reserve(bw, count)) return;
+    memcpy(bw->data + bw->size, bytes, count);
+    bw->size += count;
+}
+
+void bitreader_init(BitReader *br, const unsigned char *data, size_t size) {
+    br->data = data;
+    br->size = size;
+    br->pos = 0;
+    br->accumulator = 0;
+    br->bit_count = 0;
+}
+
+unsigned bitreader_get_bits(BitReader *br, int count) {
+    if (count == 0) return 0;
+
+    while (br->bit_count < count) {
+        unsigned byte = br->pos < br->size ? br->data[br->pos] : 0;
+        br->pos++;
+        br->accumulator = (br->accumulator << 8) | byte;
+        br->bit_count += 8;
+    }
+
+    br->bit_count -= count;
+    unsigned bits = (br->accumulator >> br->bit_count) & ((1u << count) - 1);
+    br->accumulator &= (1u << br->bit_count) - 1;
+    return bits;
+}
+
+void range_probs_init(unsigned short *probs, size_t count) {
+    for (size_t i = 0; i < count; i++) probs[i] = RANGE_PROB_INIT;
+}
+
+void range_encoder_init(RangeEncoder *rc, BitWriter *bw) {
+    rc->bw = bw;
+    rc->low = 0;
+    rc->range = 0xFFFFFFFFu;
+    rc->cache = 0;
+    rc->pending = 1;
+}
+
+// Move the top byte of low out, resolving a carry into the bytes still held back
+static void range_shift_low(RangeEncoder *rc) {
+    if ((unsigned) rc->low < 0xFF000000u || (rc->low >> 32) != 0) {
+        unsigned carry = (unsigned) (rc->low >> 32);
+        unsigned byte = rc->cache;
+        do {
+            bitwriter_put_bits(rc->bw, (byte + carry) & 0xFF, 8);
+            byte = 0xFF;
+        } while (--rc->pending != 0);
+        rc->cache = (unsigned char) (rc->low >> 24);
+    }
+    rc->pending++;
+    rc->low = (rc->low & 0x00FFFFFFu) << 8;
+}
+
+void range_encode_bit(RangeEncoder *rc, unsigned short *prob, int bit) {
+    unsigned bound = (rc->range >> RANGE_PROB_BITS) * *prob;
+    if (!bit) {
+        rc->range = bound;
+        *prob += ((1 << RANGE_PROB_BITS) - *prob) >> RANGE_PROB_SHIFT;
+    } else {
+        rc->low += bound;
+        rc->range -= bound;
+        *prob -= *prob >> RANGE_PROB_SHIFT;
+    }
+    while (rc->range < (1u << 24)) {
+        rc->range <<= 8;
+        range_shift_low(rc);
+    }
+}
+
+void range_encoder_finish(RangeEncoder *rc) {
+    for (int i = 0; i < 5; i++) {
+        range_shift_low(rc);
+    }
+}
+
+static unsigned range_next_byte(RangeDecoder *rc) {
+    unsigned byte = rc->pos < rc->size ? rc->data[rc->pos] : 0;
+    rc->pos++;
+    return byte;
+}
+
+void range_decoder_init(RangeDecoder *rc, const unsigned char *data, size_t size) {
+    rc->data = data;
+    rc->size = size;
+    rc->pos = 0;
+    rc->range = 0xFFFFFFFFu;
+    rc->code = 0;
+    // The first byte is always the encoder's empty cache
+    for (int i = 0; i < 5; i++) {
+        rc->code = (rc->code << 8) | range_next_byte(rc);
+    }
+}
+
+int range_decode_bit(RangeDecoder *rc, unsigned short *prob) {
+    unsigned bound = (rc->range >> RANGE_PROB_BITS) * *prob;
+    int bit;
+    if (rc->code < bound) {
+        rc->range = bound;
+        *prob += ((1 << RANGE_PROB_BITS) - *prob) >> RANGE_PROB_SHIFT;
+        bit = 0;
+    } else {
+        rc->code -= bound;
+        rc->range -= bound;
+        *prob -= *prob >> RANGE_PROB_SHIFT;
+        bit = 1;
+    }
+    while (rc->range < (1u << 24)) {
+        rc->range <<= 8;
+        rc->code = (rc->code << 8) | range_next_byte(rc);
+    }
+    return bit;
+}
+
+size_t huffman_estimate_bits(const HuffTable *table, const unsigned *freq, int symbol_count) {
+    size_t bits = 0;
+    for (int i = 0; i < symbol_count; i++) {
+        if (freq[i] && !table->lengths[i]) {
+            return SIZE_MAX;
+        }
+        bits += (size_t) freq[i] * table->lengths[i];
+    }
+    return bits;
+}
+
+int magnitude_category(int value) {
+    unsigned magnitude = (unsigned) abs(value);
+    int category = 0;
+    while (magnitude) {
+        category++;
+        magnitude >>= 1;
+    }
+    return category;
+}
+
+// Write a Huffman symbol followed by the category bits of its value
+static void put_symbol_and_value(BitWriter *bw, const HuffTable *table, int symbol, int value, int category) {
+    bitwriter_put_bits(bw, table->codes[symbol], table->lengths[symbol]);
+    if (category > 0) {
+        // Negative values are sent as value - 1 in category bits (one's complement)
+        unsigned bits = value >= 0 ? (unsigned) value : (unsigned) (value - 1);
+        bitwriter_put_bits(bw, bits, category);
+    }
+}
+
+// Read one Huffman symbol, -1 if the code is invalid
+static int decode_symbol(BitReader *br, const HuffTable *table) {
+    int code = (int) bitreader_get_bits(br, 1);
+    int len = 1;
+
+    while (code > table->max_code[len]) {
+        code = (code << 1) | (int) bitreader_get_bits(br, 1);
+        len++;
+        if (len > HUFF_MAX_CODE_LEN) {
+            return -1;
+        }
+    }
+
+    return table->values[code + table->val_offset[len]];
+}
+
+// Undo the one's-complement category coding
+static int extend_value(unsigned bits, int category) {
+    if (category == 0) return 0;
+    if (bits < (1u << (category - 1))) {
+        return (int) bits - (1 << category) + 1;
+    }
+    return (int) bits;
+}
+
+void huffman_count_block(const int *zigzag, int coeff_count, int *dc_pred, unsigned *dc_freq, unsigned *ac_freq) {
+    dc_freq[magnitude_category(zigzag[0] - *dc_pred)]++;
+    *dc_pred = zigzag[0];
+
+    int run = 0;
+    for (int k = 1; k < coeff_count; k++) {
+        if (zigzag[k] == 0) {
+            run++;
+            continue;
+        }
+        while (run > 15) {
+            ac_freq[HUFF_ZRL]++;
+            run -= 16;
+        }
+        ac_freq[(run << 4) | magnitude_category(zigzag[k])]++;
+        run = 0;
+    }
+    if (run > 0) {
+        ac_freq[HUFF_EOB]++;
+    }
+}
+
+void huffman_count_sparse(const SparseBlock *block, int coeff_count, int *dc_pred, unsigned *dc_freq,
+                          unsigned *ac_freq) {
+    int index = 0;
+    int dc = (block->bitmap[0] & 1) ? block->values[index++] : 0;
+    dc_freq[magnitude_category(dc - *dc_pred)]++;
+    *dc_pred = dc;
+
+    int last = 0;
+    for (int w = 0; w < (coeff_count + 63) / 64; w++) {
+        unsigned long long bits = w == 0 ? block->bitmap[0] & ~1ULL : block->bitmap[w];
+        for (; bits; bits &= bits - 1) {
+            int k = w * 64 + sparse_lowest_bit(bits);
+            int run = k - last - 1;
+            while (run > 15) {
+                ac_freq[HUFF_ZRL]++;
+                run -= 16;
+            }
+            ac_freq[(run << 4) | magnitude_category(block->values[index++])]++;
+            last = k;
+        }
+    }
+    if (last < coeff_count - 1) {
+        ac_freq[HUFF_EOB]++;
+    }
+}
+
+void huffman_encode_sparse(BitWriter *bw, const SparseBlock *block, int coeff_count, int *dc_pred,
+                           const HuffTable *dc_table, const HuffTable *ac_table) {
+    int index = 0;
+    int dc = (block->bitmap[0] & 1) ? block->values[index++] : 0;
+    int diff = dc - *dc_pred;
+    int category = magnitude_category(diff);
+    put_symbol_and_value(bw, dc_table, category, diff, category);
+    *dc_pred = dc;
+
+    int last = 0;
+    for (int w = 0; w < (coeff_count + 63) / 64; w++) {
+        unsigned long long bits = w == 0 ? block->bitmap[0] & ~1ULL : block->bitmap[w];
+        for (; bits; bits &= bits - 1) {
+            int k = w * 64 + sparse_lowest_bit(bits);
+            int value = block->values[index++];
+            int run = k - last - 1;
+            while (run > 15) {
+                put_symbol_and_value(bw, ac_table, HUFF_ZRL, 0, 0);
+                run -= 16;
+            }
+            category = magnitude_category(value);
+            put_symbol_and_value(bw, ac_table, (run << 4) | category, value, category);
+            last = k;
+        }
+    }
+    if (last < coeff_count - 1) {
+        put_symbol_and_value(bw, ac_table, HUFF_EOB, 0, 0);
+    }
+}
+
+void huffman_encode_block(BitWriter *bw, const int *zigzag, int coeff_count, int *dc_pred,
+                          const HuffTable *dc_table, const HuffTable *ac_table) {
+    int diff = zigzag[0] - *dc_pred;
+    int category = magnitude_category(diff);
+    put_symbol_and_value(bw, dc_table, category, diff, category);
+    *dc_pred = zigzag[0];
+
+    int run = 0;
+    for (int k = 1; k < coeff_count; k++) {
+        if (zigzag[k] == 0) {
+            run++;
+            continue;
+        }
+        while (run > 15) {
+            put_symbol_and_value(bw, ac_table, HUFF_ZRL, 0, 0);
+            run -= 16;
+        }
+        category = magnitude_category(zigzag[k]);
+        put_symbol_and_value(bw, ac_table, (run << 4) | category, zigzag[k], category);
+        run = 0;
+    }
+    if (run > 0) {
+        put_symbol_and_value(bw, ac_table, HUFF_EOB, 0, 0);
+    }
+}
+
+int huffman_decode_block(BitReader *br, int *zigzag, int coeff_count, int *dc_pred,
+                         const HuffTable *dc_table, const HuffTable *ac_table) {
+    memset(zigzag, 0, coeff_count * sizeof(int));
+
+    int category = decode_symbol(br, dc_table);
+    if (category < 0 || category >= HUFF_DC_SYMBOLS) {
+        return 0;
+    }
+    *dc_pred += extend_value(bitreader_get_bits(br, category), category);
+    zigzag[0] = *dc_pred;
+
+    int k = 1;
+    while (k < coeff_count) {
+        int symbol = decode_symbol(br, ac_table);
+        if (symbol < 0) {
+            return 0;
+        }
+        if (symbol == HUFF_EOB) {
+            break;
+        }
+
+        int run = symbol >> 4;
+        category = symbol & 0x0F;
+        k += run;
+        if (k >= coeff_count) {
+            return 0;
+        }
+        if (category > 0) {
+            zigzag[k] = extend_value(bitreader_get_bits(br, category), category);
+        }
+        k++;
+    }
+
+    return 1;
+}
+
+int huffman_decode_sparse(BitReader *br, SparseBlock *block, int coeff_count, int *dc_pred,
+                          const HuffTable *dc_table, const HuffTable *ac_table) {
+    memset(block->bitmap, 0, (size_t) ((coeff_count + 63) / 64) * sizeof(unsigned long long));
+    block->count = 0;
+
+    int category = decode_symbol(br, dc_table);
+    if (category < 0 || category >= HUFF_DC_SYMBOLS) {
+        return 0;
+    }
+    *dc_pred += extend_value(bitreader_get_bits(br, category), category);
+    if (*dc_pred != 0) {
+        block->bitmap[0] = 1;
+        block->values[block->count++] = *dc_pred;
+    }
+
+    int k = 1;
+    while (k < coeff_count) {
+        int symbol = decode_symbol(br, ac_table);
+        if (symbol < 0) {
+            return 0;
+        }
+        if (symbol == HUFF_EOB) {
+            break;
+        }
+
+        k += symbol >> 4;
+        category = symbol & 0x0F;
+        if (k >= coeff_count) {
+            return 0;
+        }
+        if (category > 0) {
+            block->bitmap[k >> 6] |= 1ULL << (k & 63);
+            block->values[block->count++] = extend_value(bitreader_get_bits(br, category), category);
+        }
+        k++;
+    }
+
+    return 1;
+}
+
+int huffman_decode_dequantize(BitReader *br, QuantContext *quant, double block_variance, double **dct_coeffs,
+                              int *dc_pred, const HuffTable *dc_table, const HuffTable *ac_table, int *last) {
+    int coeff_count = quant->block_size * quant->block_size;
+    double **steps = quant->dequant_matrix;
+    double scale = dequant_block_scale(quant, block_variance);
+    *last = 0;
+
+    int category = decode_symbol(br, dc_table);
+    if (category < 0 || category >= HUFF_DC_SYMBOLS) {
+        return 0;
+    }
+    *dc_pred += extend_value(bitreader_get_bits(br, category), category);
+    dct_coeffs[0][0] = *dc_pred / steps[0][0];
+
+    // Same division as dequantize, applied only where a value was decoded;
+    // the AC steps are scaled exactly as adjust_matrix_for_block scales them
+    int k = 1;
+    while (k < coeff_count) {
+        int symbol = decode_symbol(br, ac_table);
+        if (symbol < 0) {
+            return 0;
+        }
+        if (symbol == HUFF_EOB) {
+            break;
+        }
+
+        k += symbol >> 4;
+        category = symbol & 0x0F;
+        if (k >= coeff_count) {
+            return 0;
+        }
+        if (category > 0) {
+            int i = quant->zigzag_row[k];
+            int j = quant->zigzag_col[k];
+            dct_coeffs[i][j] = extend_value(bitreader_get_bits(br, category), category) / (steps[i][j] * scale);
+            *last = k;
+        }
+        k++;
+    }
+
+    return 1;
+}
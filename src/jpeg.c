@@ -0,0 +1,1088 @@
+/**
+ * jpeg.c - Implementation file for baseline JPEG (JFIF) export and recompression
+ * Part of Adaptive DCT Image Compressor
+ */
+#include <math.h>
+#include <jpeg.h>
+#include <blockify.h>
+
+#define JPEG_COEFFS (JPEG_BLOCK_SIZE * JPEG_BLOCK_SIZE)
+#define JPEG_DC_SYMBOLS 12          // DC categories 0-11 of 8-bit samples
+#define JPEG_MAX_MCU_BLOCKS 10      // Most blocks an interleaved MCU may hold
+#define JPEG_MAX_CATEGORY 15        // Largest magnitude category of a recompressed DC residual
+#define JPEG_COUNT_CONTEXTS 11      // Classes of a nonzero AC count (count_class)
+#define JPEG_LEFT_CONTEXTS 8        // Classes of the nonzero AC coefficients still to come (left_class)
+#define JPEG_BAND_CONTEXTS 8        // Classes of a zigzag position (band_class)
+#define JPEG_NEIGHBOUR_CONTEXTS 4   // Classes of the neighbours' magnitude at a position
+
+// Marker codes (second byte after 0xFF)
+#define JPEG_SOI 0xD8
+#define JPEG_EOI 0xD9
+#define JPEG_SOF0 0xC0
+#define JPEG_SOF1 0xC1
+#define JPEG_DHT 0xC4
+#define JPEG_SOS 0xDA
+#define JPEG_DQT 0xDB
+#define JPEG_DRI 0xDD
+#define JPEG_APP0 0xE0
+#define JPEG_RST0 0xD0
+
+/**
+ * Structure to hold one frame component and its quantized coefficients
+ */
+typedef struct {
+    int id;
+    int h;                                   // Horizontal sampling factor
+    int v;                                   // Vertical sampling factor
+    int quant_id;                            // DQT table named by SOF
+    int cols;                                // Block grid, padded to whole MCUs
+    int rows;
+    int coded_cols;                          // Blocks its scan codes (whole MCUs only when interleaved)
+    int coded_rows;
+    int scanned;                             // A scan has coded the component
+    unsigned short quant[JPEG_COEFFS];       // Steps in zigzag order, as defined when its scan started
+    short *coeffs;                           // Quantized coefficients, 64 per block in zigzag order
+} JpegComponent;
+
+/**
+ * Structure to hold one scan: its components, the tables in force and where its data lies
+ */
+typedef struct {
+    int count;                               // Components in the scan
+    int components[JPEG_MAX_COMPONENTS];     // Frame index of each
+    int restart_interval;                    // MCUs per restart interval, 0 if none
+    HuffTable dc[JPEG_MAX_COMPONENTS];       // Tables of each component, copied at SOS
+    HuffTable ac[JPEG_MAX_COMPONENTS];
+    size_t offset;                           // Entropy-coded data, from the end of SOS
+    size_t length;                           //   to the next marker other than RSTn
+} JpegScan;
+
+/**
+ * Structure to hold what a file's markers describe, and its coefficients once read
+ */
+typedef struct {
+    int width;
+    int height;
+    int component_count;
+    int max_h;
+    int max_v;
+    int mcu_cols;                            // MCUs of an interleaved scan
+    int mcu_rows;
+    JpegComponent components[JPEG_MAX_COMPONENTS];
+    int scan_count;
+    JpegScan scans[JPEG_MAX_COMPONENTS];     // Baseline codes each component in exactly one scan
+    int restart_interval;
+    unsigned short quant[4][JPEG_COEFFS];
+    int quant_defined[4];
+    HuffTable dc[4];
+    HuffTable ac[4];
+    int dc_defined[4];
+    int ac_defined[4];
+} JpegFrame;
+
+// Copy entropy-coded bytes, following every 0xFF with a stuffed 0x00
+static void put_stuffed(BitWriter *bw, const unsigned char *bytes, size_t count) {
+    size_t start = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (bytes[i] == 0xFF) {
+            bitwriter_put_bytes(bw, bytes + start, i + 1 - start);
+            bitwriter_put_bits(bw, 0x00, 8);
+            start = i + 1;
+        }
+    }
+    bitwriter_put_bytes(bw, bytes + start, count - start);
+}
+
+static void put_u16(BitWriter *bw, unsigned value) {
+    bitwriter_put_bits(bw, (value >> 8) & 0xFF, 8);
+    bitwriter_put_bits(bw, value & 0xFF, 8);
+}
+
+static void put_marker(BitWriter *bw, int marker) {
+    bitwriter_put_bits(bw, 0xFF, 8);
+    bitwriter_put_bits(bw, (unsigned) marker, 8);
+}
+
+static unsigned get_u16(const unsigned char *bytes) {
+    return ((unsigned) bytes[0] << 8) | bytes[1];
+}
+
+// DHT entry: class and id, code counts of lengths 1-16, then the symbols
+static void put_huffman_table(BitWriter *bw, int table_class, const HuffTable *table) {
+    bitwriter_put_bits(bw, (unsigned) table_class << 4, 8);
+    bitwriter_put_bytes(bw, table->bits + 1, HUFF_MAX_CODE_LEN);
+    bitwriter_put_bytes(bw, table->values, (size_t) table->value_count);
+}
+
+// Whole-number steps of the codec's 8x8 table at a quality, in zigzag order
+static void jpeg_steps(const QuantContext *quant, unsigned short *steps) {
+    for (int k = 0; k < JPEG_COEFFS; k++) {
+        long step = lround(quant->quant_matrix[quant->zigzag_row[k]][quant->zigzag_col[k]]);
+        steps[k] = (unsigned short) (step < 1 ? 1 : (step > 255 ? 255 : step));
+    }
+}
+
+// Transform and quantize one level-shifted block into clamped zigzag levels
+static void quantize_block(DCTContext *dct, QuantContext *quant, const short *samples, double **block,
+                           double **coeffs, SparseBlock *sparse, short *levels) {
+    for (int i = 0; i < JPEG_BLOCK_SIZE; i++) {
+        for (int j = 0; j < JPEG_BLOCK_SIZE; j++) {
+            block[i][j] = samples[i * JPEG_BLOCK_SIZE + j];
+        }
+    }
+    dct_forward(dct, block, coeffs);
+    quantize_sparse(quant, coeffs, sparse, 0.0);
+
+    memset(levels, 0, JPEG_COEFFS * sizeof(short));
+    int index = 0;
+    for (int k = 0; k < JPEG_COEFFS; k++) {
+        if (sparse->bitmap[0] & (1ULL << k)) {
+            int value = sparse->values[index++];
+            if (k > 0) {
+                value = value < -JPEG_MAX_AC_LEVEL ? -JPEG_MAX_AC_LEVEL
+                                                  : (value > JPEG_MAX_AC_LEVEL ? JPEG_MAX_AC_LEVEL : value);
+            }
+            levels[k] = (short) value;
+        }
+    }
+}
+
+unsigned char* jpeg_encode(const unsigned char *pixels, int width, int height, int quality, size_t *out_size) {
+    if (!pixels || width < 1 || height < 1 || width > JPEG_MAX_DIMENSION || height > JPEG_MAX_DIMENSION) {
+        fprintf(stderr, "Invalid JPEG parameters\n");
+        return NULL;
+    }
+    quality = quality < 1 ? 1 : (quality > 100 ? 100 : quality);
+
+    QuantContext *quant = quant_init(JPEG_BLOCK_SIZE, quality, 0);
+    unsigned short steps[JPEG_COEFFS];
+    jpeg_steps(quant, steps);
+    quant_set_steps(quant, steps);
+    DCTContext *dct = dct_init(JPEG_BLOCK_SIZE);
+
+    int cols = (width + JPEG_BLOCK_SIZE - 1) / JPEG_BLOCK_SIZE;
+    int rows = (height + JPEG_BLOCK_SIZE - 1) / JPEG_BLOCK_SIZE;
+    size_t block_count = (size_t) cols * rows;
+    short *samples = (short*)malloc((size_t) cols * JPEG_COEFFS * sizeof(short));
+    short *levels = (short*)malloc(block_count * JPEG_COEFFS * sizeof(short));
+    int sparse_values[JPEG_COEFFS];
+    SparseBlock sparse;
+    sparse.values = sparse_values;
+    if (!samples || !levels) {
+        fprintf(stderr, "Memory allocation failed when encoding JPEG\n");
+        exit(EXIT_FAILURE);
+    }
+    double **block = alloc_array(JPEG_BLOCK_SIZE, JPEG_BLOCK_SIZE);
+    double **coeffs = alloc_array(JPEG_BLOCK_SIZE, JPEG_BLOCK_SIZE);
+
+    // Quantize every block and count its symbols for the optimized tables
+    unsigned dc_freq[HUFF_DC_SYMBOLS] = {0};
+    unsigned ac_freq[HUFF_AC_SYMBOLS] = {0};
+    int zigzag[JPEG_COEFFS];
+    int dc_pred = 0;
+    for (int by = 0; by < rows; by++) {
+        blockify(pixels + (size_t) by * JPEG_BLOCK_SIZE * width, (size_t) width, width,
+                 height - by * JPEG_BLOCK_SIZE, JPEG_BLOCK_SIZE, cols, 1, samples);
+        for (int bx = 0; bx < cols; bx++) {
+            short *out = levels + ((size_t) by * cols + bx) * JPEG_COEFFS;
+            quantize_block(dct, quant, samples + (size_t) bx * JPEG_COEFFS, block, coeffs, &sparse, out);
+            for (int k = 0; k < JPEG_COEFFS; k++) zigzag[k] = out[k];
+            huffman_count_block(zigzag, JPEG_COEFFS, &dc_pred, dc_freq, ac_freq);
+        }
+    }
+    free(samples);
+    free_array(block, JPEG_BLOCK_SIZE);
+    free_array(coeffs, JPEG_BLOCK_SIZE);
+    dct_free(dct);
+    quant_free(quant);
+
+    HuffTable dc_table, ac_table;
+    build_canonical_huffman_table(&dc_table, dc_freq, JPEG_DC_SYMBOLS);
+    build_canonical_huffman_table(&ac_table, ac_freq, HUFF_AC_SYMBOLS);
+
+    // Entropy-coded scan, padded with 1 bits as the standard asks
+    BitWriter scan;
+    bitwriter_init(&scan, block_count * 8);
+    dc_pred = 0;
+    for (size_t b = 0; b < block_count; b++) {
+        for (int k = 0; k < JPEG_COEFFS; k++) zigzag[k] = levels[b * JPEG_COEFFS + k];
+        huffman_encode_block(&scan, zigzag, JPEG_COEFFS, &dc_pred, &dc_table, &ac_table);
+    }
+    bitwriter_align(&scan);
+    free(levels);
+
+    BitWriter bw;
+    bitwriter_init(&bw, scan.size + scan.size / 64 + 1024);
+    put_marker(&bw, JPEG_SOI);
+
+    static const unsigned char jfif[14] = {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+    put_marker(&bw, JPEG_APP0);
+    put_u16(&bw, 2 + sizeof(jfif));
+    bitwriter_put_bytes(&bw, jfif, sizeof(jfif));
+
+    put_marker(&bw, JPEG_DQT);
+    put_u16(&bw, 2 + 1 + JPEG_COEFFS);
+    bitwriter_put_bits(&bw, 0, 8);
+    for (int k = 0; k < JPEG_COEFFS; k++) bitwriter_put_bits(&bw, steps[k], 8);
+
+    put_marker(&bw, JPEG_SOF0);
+    put_u16(&bw, 2 + 6 + 3);
+    bitwriter_put_bits(&bw, 8, 8);
+    put_u16(&bw, (unsigned) height);
+    put_u16(&bw, (unsigned) width);
+    bitwriter_put_bits(&bw, 1, 8);
+    bitwriter_put_bits(&bw, 1, 8);
+    bitwriter_put_bits(&bw, 0x11, 8);
+    bitwriter_put_bits(&bw, 0, 8);
+
+    put_marker(&bw, JPEG_DHT);
+    put_u16(&bw, (unsigned) (2 + 2 * (1 + HUFF_MAX_CODE_LEN) + dc_table.value_count + ac_table.value_count));
+    put_huffman_table(&bw, 0, &dc_table);
+    put_huffman_table(&bw, 1, &ac_table);
+
+    put_marker(&bw, JPEG_SOS);
+    put_u16(&bw, 2 + 1 + 2 + 3);
+    bitwriter_put_bits(&bw, 1, 8);
+    bitwriter_put_bits(&bw, 1, 8);
+    bitwriter_put_bits(&bw, 0x00, 8);
+    bitwriter_put_bits(&bw, 0, 8);
+    bitwriter_put_bits(&bw, JPEG_COEFFS - 1, 8);
+    bitwriter_put_bits(&bw, 0, 8);
+
+    // A 0xFF byte in the scan would read as a marker, so each gets a 0x00 after it
+    put_stuffed(&bw, scan.data, scan.size);
+    free(scan.data);
+
+    put_marker(&bw, JPEG_EOI);
+    *out_size = bw.size;
+    return bw.data;
+}
+
+
+static void put_le64(unsigned char *p, unsigned long long value) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char) (value >> (8 * i));
+}
+
+static unsigned long long get_le64(const unsigned char *p) {
+    unsigned long long value = 0;
+    for (int i = 0; i < 8; i++) value |= (unsigned long long) p[i] << (8 * i);
+    return value;
+}
+
+static void put_le32(unsigned char *p, unsigned long value) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char) (value >> (8 * i));
+}
+
+static unsigned long get_le32(const unsigned char *p) {
+    unsigned long value = 0;
+    for (int i = 0; i < 4; i++) value |= (unsigned long) p[i] << (8 * i);
+    return value;
+}
+
+// CRC-32 (IEEE 802.3, as in zlib and PNG); the table is rebuilt per call so nothing is shared
+static unsigned long crc32_bytes(const unsigned char *data, size_t size) {
+    unsigned long table[256];
+    for (unsigned long n = 0; n < 256; n++) {
+        unsigned long c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+        }
+        table[n] = c;
+    }
+    unsigned long crc = 0xFFFFFFFFUL;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFUL;
+}
+
+static JpegFrame* alloc_frame(void) {
+    JpegFrame *frame = (JpegFrame*)calloc(1, sizeof(JpegFrame));
+    if (!frame) {
+        fprintf(stderr, "Memory allocation failed when reading JPEG\n");
+        exit(EXIT_FAILURE);
+    }
+    return frame;
+}
+
+static void free_frame(JpegFrame *frame) {
+    for (int c = 0; c < frame->component_count; c++) {
+        free(frame->components[c].coeffs);
+    }
+    free(frame);
+}
+
+// One DHT entry (class and id, code counts of lengths 1-16, symbols); returns its size, or 0 if it is invalid
+static size_t read_huffman_entry(const unsigned char *p, size_t available, HuffTable *table) {
+    if (available < 1 + HUFF_MAX_CODE_LEN) {
+        return 0;
+    }
+    unsigned char bits[HUFF_MAX_CODE_LEN + 1];
+    size_t count = 0;
+    bits[0] = 0;
+    for (int len = 1; len <= HUFF_MAX_CODE_LEN; len++) {
+        bits[len] = p[len];
+        count += bits[len];
+    }
+    if (available < 1 + HUFF_MAX_CODE_LEN + count || !load_huffman_table(table, bits, p + 1 + HUFF_MAX_CODE_LEN)) {
+        return 0;
+    }
+    return 1 + HUFF_MAX_CODE_LEN + count;
+}
+
+// Block grids of every component once SOF is read; budget bounds the blocks a frame may declare
+static int setup_components(JpegFrame *frame, size_t budget) {
+    frame->max_h = 1;
+    frame->max_v = 1;
+    for (int c = 0; c < frame->component_count; c++) {
+        if (frame->components[c].h > frame->max_h) frame->max_h = frame->components[c].h;
+        if (frame->components[c].v > frame->max_v) frame->max_v = frame->components[c].v;
+    }
+    frame->mcu_cols = (frame->width + JPEG_BLOCK_SIZE * frame->max_h - 1) / (JPEG_BLOCK_SIZE * frame->max_h);
+    frame->mcu_rows = (frame->height + JPEG_BLOCK_SIZE * frame->max_v - 1) / (JPEG_BLOCK_SIZE * frame->max_v);
+
+    // Every coded block takes at least two bits (a DC code and an EOB), so a short file cannot hold a huge frame
+    size_t total = 0;
+    for (int c = 0; c < frame->component_count; c++) {
+        JpegComponent *component = &frame->components[c];
+        int width = (frame->width * component->h + frame->max_h - 1) / frame->max_h;
+        int height = (frame->height * component->v + frame->max_v - 1) / frame->max_v;
+        component->cols = frame->mcu_cols * component->h;
+        component->rows = frame->mcu_rows * component->v;
+        component->coded_cols = (width + JPEG_BLOCK_SIZE - 1) / JPEG_BLOCK_SIZE;
+        component->coded_rows = (height + JPEG_BLOCK_SIZE - 1) / JPEG_BLOCK_SIZE;
+        total += (size_t) component->cols * component->rows;
+    }
+    if (total > budget * 8 + 1024) {
+        fprintf(stderr, "Invalid JPEG: frame larger than its data\n");
+        return 0;
+    }
+
+    for (int c = 0; c < frame->component_count; c++) {
+        JpegComponent *component = &frame->components[c];
+        component->coeffs = (short*)calloc((size_t) component->cols * component->rows * JPEG_COEFFS, sizeof(short));
+        if (!component->coeffs) {
+            fprintf(stderr, "Memory allocation failed when reading JPEG\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return 1;
+}
+
+// MCU grid of a scan: one block per MCU when it holds a single component
+static void scan_mcus(const JpegFrame *frame, const JpegScan *scan, int *mcu_cols, int *mcu_rows) {
+    if (scan->count == 1) {
+        *mcu_cols = frame->components[scan->components[0]].coded_cols;
+        *mcu_rows = frame->components[scan->components[0]].coded_rows;
+    } else {
+        *mcu_cols = frame->mcu_cols;
+        *mcu_rows = frame->mcu_rows;
+    }
+}
+
+// Blocks of one MCU in coding order and the scan slot of each; returns their number
+static int mcu_blocks(JpegFrame *frame, const JpegScan *scan, size_t mcu, int mcu_cols, short **blocks, int *slots) {
+    int mx = (int) (mcu % (size_t) mcu_cols);
+    int my = (int) (mcu / (size_t) mcu_cols);
+    if (scan->count == 1) {
+        JpegComponent *component = &frame->components[scan->components[0]];
+        blocks[0] = component->coeffs + ((size_t) my * component->cols + mx) * JPEG_COEFFS;
+        slots[0] = 0;
+        return 1;
+    }
+
+    int count = 0;
+    for (int s = 0; s < scan->count; s++) {
+        JpegComponent *component = &frame->components[scan->components[s]];
+        for (int v = 0; v < component->v; v++) {
+            for (int h = 0; h < component->h; h++) {
+                size_t row = (size_t) my * component->v + v;
+                size_t col = (size_t) mx * component->h + h;
+                blocks[count] = component->coeffs + (row * component->cols + col) * JPEG_COEFFS;
+                slots[count++] = s;
+            }
+        }
+    }
+    return count;
+}
+
+// End of a scan's entropy-coded data: the first marker other than a stuffed zero or RSTn
+static size_t scan_end(const unsigned char *data, size_t size, size_t pos) {
+    while (pos + 1 < size) {
+        if (data[pos] == 0xFF && data[pos + 1] != 0x00 &&
+            (data[pos + 1] < JPEG_RST0 || data[pos + 1] >= JPEG_RST0 + 8)) {
+            return pos;
+        }
+        pos += data[pos] == 0xFF ? 2 : 1;
+    }
+    return size;
+}
+
+// Copy one restart interval of the scan without its stuffed bytes; returns where the next marker starts
+static size_t unstuff_interval(const unsigned char *scan, size_t size, size_t pos, unsigned char *out,
+                               size_t *out_size) {
+    size_t count = 0;
+    while (pos < size) {
+        if (scan[pos] != 0xFF) {
+            out[count++] = scan[pos++];
+        } else if (pos + 1 < size && scan[pos + 1] == 0x00) {
+            out[count++] = 0xFF;
+            pos += 2;
+        } else {
+            break;
+        }
+    }
+    *out_size = count;
+    return pos;
+}
+
+// Read the quantized coefficients of a scan, checking the RSTn sequence between intervals
+static int decode_scan(JpegFrame *frame, const JpegScan *scan, const unsigned char *data) {
+    int mcu_cols, mcu_rows;
+    scan_mcus(frame, scan, &mcu_cols, &mcu_rows);
+    size_t mcu_count = (size_t) mcu_cols * mcu_rows;
+    size_t interval = scan->restart_interval ? (size_t) scan->restart_interval : mcu_count;
+    unsigned char *unstuffed = (unsigned char*)malloc(scan->length + 1);
+    if (!unstuffed) {
+        fprintf(stderr, "Memory allocation failed when reading JPEG\n");
+        exit(EXIT_FAILURE);
+    }
+
+    short *blocks[JPEG_MAX_MCU_BLOCKS];
+    int slots[JPEG_MAX_MCU_BLOCKS];
+    int zigzag[JPEG_COEFFS];
+    int dc_pred[JPEG_MAX_COMPONENTS] = {0};
+    BitReader br;
+    size_t length = 0;
+    size_t pos = scan->offset;
+    size_t end = scan->offset + scan->length;
+    int ok = 1;
+    for (size_t m = 0; ok && m < mcu_count; m++) {
+        // Each interval starts byte-aligned with fresh DC predictions, after RST0-RST7 in turn
+        if (m % interval == 0) {
+            if (m > 0) {
+                ok = br.pos <= length && pos + 1 < end &&
+                     data[pos + 1] == JPEG_RST0 + (int) ((m / interval - 1) % 8);
+                pos += 2;
+            }
+            if (!ok) break;
+            pos = unstuff_interval(data, end, pos, unstuffed, &length);
+            bitreader_init(&br, unstuffed, length);
+            memset(dc_pred, 0, sizeof(dc_pred));
+        }
+
+        int count = mcu_blocks(frame, scan, m, mcu_cols, blocks, slots);
+        for (int b = 0; ok && b < count; b++) {
+            int s = slots[b];
+            ok = huffman_decode_block(&br, zigzag, JPEG_COEFFS, &dc_pred[s], &scan->dc[s], &scan->ac[s]);
+            for (int k = 0; ok && k < JPEG_COEFFS; k++) {
+                ok = zigzag[k] >= -QUANT_MAX_LEVEL && zigzag[k] <= QUANT_MAX_LEVEL;
+                blocks[b][k] = (short) zigzag[k];
+            }
+        }
+    }
+    ok = ok && br.pos <= length;
+    free(unstuffed);
+    if (!ok) {
+        fprintf(stderr, "Invalid JPEG: damaged scan\n");
+    }
+    return ok;
+}
+
+// Code a scan's coefficients as a baseline encoder does, padding each interval with 1 bits before its RSTn
+static void encode_scan(JpegFrame *frame, const JpegScan *scan, BitWriter *out) {
+    int mcu_cols, mcu_rows;
+    scan_mcus(frame, scan, &mcu_cols, &mcu_rows);
+    size_t mcu_count = (size_t) mcu_cols * mcu_rows;
+    size_t interval = scan->restart_interval ? (size_t) scan->restart_interval : mcu_count;
+
+    BitWriter bits;
+    bitwriter_init(&bits, mcu_count * 8);
+    short *blocks[JPEG_MAX_MCU_BLOCKS];
+    int slots[JPEG_MAX_MCU_BLOCKS];
+    int zigzag[JPEG_COEFFS];
+    int dc_pred[JPEG_MAX_COMPONENTS] = {0};
+    size_t start = 0;
+    for (size_t m = 0; m < mcu_count; m++) {
+        if (m > 0 && m % interval == 0) {
+            bitwriter_align(&bits);
+            put_stuffed(out, bits.data + start, bits.size - start);
+            put_marker(out, JPEG_RST0 + (int) ((m / interval - 1) % 8));
+            start = bits.size;
+            memset(dc_pred, 0, sizeof(dc_pred));
+        }
+
+        int count = mcu_blocks(frame, scan, m, mcu_cols, blocks, slots);
+        for (int b = 0; b < count; b++) {
+            for (int k = 0; k < JPEG_COEFFS; k++) zigzag[k] = blocks[b][k];
+            huffman_encode_block(&bits, zigzag, JPEG_COEFFS, &dc_pred[slots[b]], &scan->dc[slots[b]],
+                                 &scan->ac[slots[b]]);
+        }
+    }
+    bitwriter_align(&bits);
+    put_stuffed(out, bits.data + start, bits.size - start);
+    free(bits.data);
+}
+
+// Start a scan from its SOS segment, copying the tables its components use
+static int begin_scan(JpegFrame *frame, const unsigned char *segment, size_t remaining) {
+    int count = remaining > 0 ? segment[0] : 0;
+    if (frame->component_count == 0 || frame->scan_count == JPEG_MAX_COMPONENTS || count < 1 ||
+        count > frame->component_count || remaining != (size_t) (1 + 2 * count + 3) ||
+        segment[1 + 2 * count] != 0 || segment[2 + 2 * count] != JPEG_COEFFS - 1 || segment[3 + 2 * count] != 0) {
+        fprintf(stderr, "Unsupported JPEG: only baseline sequential scans are read\n");
+        return 0;
+    }
+
+    JpegScan *scan = &frame->scans[frame->scan_count];
+    scan->count = count;
+    scan->restart_interval = frame->restart_interval;
+    int units = 0;
+    for (int s = 0; s < count; s++) {
+        int id = segment[1 + 2 * s];
+        int dc_id = segment[2 + 2 * s] >> 4;
+        int ac_id = segment[2 + 2 * s] & 0x0F;
+        int c = 0;
+        while (c < frame->component_count && frame->components[c].id != id) c++;
+
+        // Baseline codes each component once, with tables defined before its scan
+        if (c == frame->component_count || frame->components[c].scanned || dc_id > 3 || ac_id > 3 ||
+            !frame->dc_defined[dc_id] || !frame->ac_defined[ac_id] ||
+            !frame->quant_defined[frame->components[c].quant_id]) {
+            fprintf(stderr, "Invalid JPEG: bad SOS\n");
+            return 0;
+        }
+        JpegComponent *component = &frame->components[c];
+        component->scanned = 1;
+        memcpy(component->quant, frame->quant[component->quant_id], sizeof(component->quant));
+        if (count > 1) {
+            component->coded_cols = component->cols;
+            component->coded_rows = component->rows;
+        }
+        units += component->h * component->v;
+        scan->components[s] = c;
+        scan->dc[s] = frame->dc[dc_id];
+        scan->ac[s] = frame->ac[ac_id];
+    }
+    if (count > 1 && units > JPEG_MAX_MCU_BLOCKS) {
+        fprintf(stderr, "Invalid JPEG: MCU holds more than %d blocks\n", JPEG_MAX_MCU_BLOCKS);
+        return 0;
+    }
+    frame->scan_count++;
+    return 1;
+}
+
+/**
+ * Walk the markers of a file up to EOI, reading each scan's coefficients when decode is set
+ * budget bounds the blocks SOF may declare; end is set just past EOI.
+ */
+static int parse_jpeg(const unsigned char *data, size_t size, JpegFrame *frame, int decode, size_t budget,
+                      size_t *end) {
+    if (size < 4 || data[0] != 0xFF || data[1] != JPEG_SOI) {
+        fprintf(stderr, "Invalid JPEG: missing SOI\n");
+        return 0;
+    }
+
+    size_t pos = 2;
+    for (;;) {
+        // Any number of 0xFF fill bytes may precede a marker
+        if (pos >= size || data[pos] != 0xFF) {
+            fprintf(stderr, "Invalid JPEG: expected a marker\n");
+            return 0;
+        }
+        while (pos < size && data[pos] == 0xFF) pos++;
+        if (pos >= size) {
+            fprintf(stderr, "Invalid JPEG: truncated marker\n");
+            return 0;
+        }
+        int marker = data[pos++];
+        if (marker == JPEG_EOI) {
+            for (int c = 0; c < frame->component_count; c++) {
+                if (!frame->components[c].scanned) {
+                    fprintf(stderr, "Invalid JPEG: component without a scan\n");
+                    return 0;
+                }
+            }
+            if (frame->scan_count == 0) {
+                fprintf(stderr, "Invalid JPEG: no scan\n");
+                return 0;
+            }
+            *end = pos;
+            return 1;
+        }
+        if (pos + 2 > size) {
+            fprintf(stderr, "Invalid JPEG: truncated marker\n");
+            return 0;
+        }
+        size_t length = get_u16(data + pos);
+        if (length < 2 || pos + length > size) {
+            fprintf(stderr, "Invalid JPEG: bad segment length\n");
+            return 0;
+        }
+        const unsigned char *segment = data + pos + 2;
+        size_t remaining = length - 2;
+        pos += length;
+
+        if (marker == JPEG_DQT) {
+            while (remaining > 0) {
+                int precision = segment[0] >> 4;
+                int id = segment[0] & 0x0F;
+                size_t bytes = precision ? 2 * JPEG_COEFFS : JPEG_COEFFS;
+                if (precision > 1 || id > 3 || remaining < 1 + bytes) {
+                    fprintf(stderr, "Invalid JPEG: bad DQT\n");
+                    return 0;
+                }
+                for (int k = 0; k < JPEG_COEFFS; k++) {
+                    frame->quant[id][k] = (unsigned short) (precision ? get_u16(segment + 1 + 2 * k)
+                                                                      : segment[1 + k]);
+                    if (frame->quant[id][k] == 0) {
+                        fprintf(stderr, "Invalid JPEG: bad DQT\n");
+                        return 0;
+                    }
+                }
+                frame->quant_defined[id] = 1;
+                segment += 1 + bytes;
+                remaining -= 1 + bytes;
+            }
+        } else if (marker == JPEG_DHT) {
+            while (remaining > 0) {
+                int table_class = segment[0] >> 4;
+                int id = segment[0] & 0x0F;
+                size_t used = table_class > 1 || id > 3 ? 0
+                              : read_huffman_entry(segment, remaining, table_class ? &frame->ac[id] : &frame->dc[id]);
+                if (!used) {
+                    fprintf(stderr, "Invalid JPEG: bad DHT\n");
+                    return 0;
+                }
+                if (table_class) {
+                    frame->ac_defined[id] = 1;
+                } else {
+                    frame->dc_defined[id] = 1;
+                }
+                segment += used;
+                remaining -= used;
+            }
+        } else if (marker == JPEG_DRI) {
+            if (remaining != 2) {
+                fprintf(stderr, "Invalid JPEG: bad DRI\n");
+                return 0;
+            }
+            frame->restart_interval = (int) get_u16(segment);
+        } else if (marker == JPEG_SOF0 || marker == JPEG_SOF1) {
+            int count = remaining >= 6 ? segment[5] : 0;
+            if (remaining < 6 || segment[0] != 8 || count < 1 || count > JPEG_MAX_COMPONENTS ||
+                remaining != (size_t) (6 + 3 * count) || frame->component_count) {
+                fprintf(stderr, "Unsupported JPEG: only 8-bit frames of 1 to %d components are read\n",
+                        JPEG_MAX_COMPONENTS);
+                return 0;
+            }
+            frame->height = (int) get_u16(segment + 1);
+            frame->width = (int) get_u16(segment + 3);
+            frame->component_count = count;
+            for (int c = 0; c < count; c++) {
+                JpegComponent *component = &frame->components[c];
+                component->id = segment[6 + 3 * c];
+                component->h = segment[7 + 3 * c] >> 4;
+                component->v = segment[7 + 3 * c] & 0x0F;
+                component->quant_id = segment[8 + 3 * c];
+                int duplicate = 0;
+                for (int other = 0; other < c; other++) {
+                    duplicate |= frame->components[other].id == component->id;
+                }
+                if (duplicate || component->h < 1 || component->h > 4 || component->v < 1 || component->v > 4 ||
+                    component->quant_id > 3) {
+                    fprintf(stderr, "Invalid JPEG: bad SOF\n");
+                    return 0;
+                }
+            }
+            if (frame->width < 1 || frame->height < 1) {
+                fprintf(stderr, "Invalid JPEG: bad SOF\n");
+                return 0;
+            }
+            if (!setup_components(frame, budget)) {
+                return 0;
+            }
+        } else if ((marker >= 0xC2 && marker <= 0xCF && marker != JPEG_DHT && marker != 0xC8) ||
+                   marker == 0xDC) {
+            fprintf(stderr, "Unsupported JPEG: only baseline sequential Huffman files are read\n");
+            return 0;
+        } else if (marker == JPEG_SOS) {
+            if (!begin_scan(frame, segment, remaining)) {
+                return 0;
+            }
+            JpegScan *scan = &frame->scans[frame->scan_count - 1];
+            scan->offset = pos;
+            scan->length = scan_end(data, size, pos) - pos;
+            if (decode && !decode_scan(frame, scan, data)) {
+                return 0;
+            }
+            pos += scan->length;
+        } else if (marker == JPEG_SOI || (marker >= JPEG_RST0 && marker < JPEG_RST0 + 8)) {
+            fprintf(stderr, "Invalid JPEG: unexpected marker\n");
+            return 0;
+        }
+        // APPn, COM and other segments carry nothing the decoder needs
+    }
+}
+
+unsigned char* jpeg_decode(const unsigned char *data, size_t size, int *width, int *height) {
+    JpegFrame *frame = alloc_frame();
+    size_t end;
+    if (!data || !parse_jpeg(data, size, frame, 1, size, &end)) {
+        free_frame(frame);
+        return NULL;
+    }
+    if (frame->component_count != 1) {
+        fprintf(stderr, "Unsupported JPEG: only single-component files decode to a plane\n");
+        free_frame(frame);
+        return NULL;
+    }
+
+    const JpegComponent *component = &frame->components[0];
+    int w = frame->width;
+    int h = frame->height;
+    int cols = component->coded_cols;
+    QuantContext *quant = quant_init(JPEG_BLOCK_SIZE, 50, 0);
+    quant_set_steps(quant, component->quant);
+    DCTContext *dct = dct_init(JPEG_BLOCK_SIZE);
+    double **coeffs = alloc_array(JPEG_BLOCK_SIZE, JPEG_BLOCK_SIZE);
+    double **block = alloc_array(JPEG_BLOCK_SIZE, JPEG_BLOCK_SIZE);
+    unsigned char *pixels = (unsigned char*)malloc((size_t) w * h);
+    short *samples = (short*)malloc((size_t) cols * JPEG_COEFFS * sizeof(short));
+    if (!pixels || !samples) {
+        fprintf(stderr, "Memory allocation failed when decoding JPEG\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int by = 0; by < component->coded_rows; by++) {
+        for (int bx = 0; bx < cols; bx++) {
+            // Dequantize into natural order, then invert only the corner that can be nonzero
+            const short *levels = component->coeffs + ((size_t) by * component->cols + bx) * JPEG_COEFFS;
+            int last = 0;
+            for (int k = 0; k < JPEG_COEFFS; k++) {
+                if (levels[k]) {
+                    int i = quant->zigzag_row[k];
+                    int j = quant->zigzag_col[k];
+                    coeffs[i][j] = levels[k] * quant->quant_matrix[i][j];
+                    last = k;
+                }
+            }
+            int extent = quant->zigzag_extent[last];
+            dct_inverse_sparse(dct, coeffs, block, extent);
+            for (int i = 0; i < extent; i++) {
+                memset(coeffs[i], 0, extent * sizeof(double));
+            }
+
+            short *out = samples + (size_t) bx * JPEG_COEFFS;
+            for (int i = 0; i < JPEG_BLOCK_SIZE; i++) {
+                for (int j = 0; j < JPEG_BLOCK_SIZE; j++) {
+                    double value = round(block[i][j]);
+                    out[i * JPEG_BLOCK_SIZE + j] = (short) (value < -1024 ? -1024 : (value > 1024 ? 1024 : value));
+                }
+            }
+        }
+        unblockify(samples, JPEG_BLOCK_SIZE, cols, 1, pixels + (size_t) by * JPEG_BLOCK_SIZE * w, (size_t) w, w,
+                   h - by * JPEG_BLOCK_SIZE);
+    }
+
+    free(samples);
+    free_array(coeffs, JPEG_BLOCK_SIZE);
+    free_array(block, JPEG_BLOCK_SIZE);
+    dct_free(dct);
+    quant_free(quant);
+    free_frame(frame);
+    *width = w;
+    *height = h;
+    return pixels;
+}
+
+// DC predicted from the left, upper and upper-left blocks by the median edge detector
+static int predict_dc(const JpegComponent *component, int bx, int by) {
+    size_t index = (size_t) by * component->cols + bx;
+    if (by == 0) {
+        return bx ? component->coeffs[(index - 1) * JPEG_COEFFS] : 0;
+    }
+    int above = component->coeffs[(index - component->cols) * JPEG_COEFFS];
+    if (bx == 0) {
+        return above;
+    }
+    int left = component->coeffs[(index - 1) * JPEG_COEFFS];
+    int corner = component->coeffs[(index - component->cols - 1) * JPEG_COEFFS];
+    int low = left < above ? left : above;
+    int high = left < above ? above : left;
+    if (corner >= high) return low;
+    if (corner <= low) return high;
+    return left + above - corner;
+}
+
+// Nonzero AC coefficients of a block
+static int nonzero_ac(const short *levels) {
+    int count = 0;
+    for (int k = 1; k < JPEG_COEFFS; k++) count += levels[k] != 0;
+    return count;
+}
+
+/**
+ * Structure to hold the adaptive probabilities of one component's coefficients
+ */
+typedef struct {
+    unsigned short count[JPEG_COUNT_CONTEXTS][JPEG_COEFFS];     // Binary tree over the 6-bit nonzero AC count
+    unsigned short dc_zero[JPEG_COUNT_CONTEXTS];
+    unsigned short dc_sign[JPEG_COUNT_CONTEXTS];
+    unsigned short dc_category[JPEG_COUNT_CONTEXTS][JPEG_MAX_CATEGORY];
+    unsigned short dc_bits[JPEG_MAX_CATEGORY + 1][JPEG_MAX_CATEGORY];
+    unsigned short nonzero[JPEG_COEFFS][JPEG_LEFT_CONTEXTS][JPEG_NEIGHBOUR_CONTEXTS];
+    unsigned short sign[JPEG_COEFFS];
+    unsigned short category[JPEG_BAND_CONTEXTS][JPEG_NEIGHBOUR_CONTEXTS][JPEG_MAX_CATEGORY];
+    unsigned short bits[JPEG_MAX_CATEGORY + 1][JPEG_MAX_CATEGORY];
+} CoefficientModel;
+
+/**
+ * Structure to run the same modeling code for recompression and restoring
+ * Exactly one of encoder and decoder is set.
+ */
+typedef struct {
+    RangeEncoder *encoder;
+    RangeDecoder *decoder;
+    int ok;                                  // Cleared when a decoded value is out of range
+} CoefficientCoder;
+
+// Class of a nonzero AC count (0-63), finer where counts are common
+static const unsigned char count_class[JPEG_COEFFS] = {
+    0, 1, 2, 3, 4, 5, 5, 6, 6, 6, 7, 7, 7, 7, 7, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 10,
+    10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+    10, 10, 10, 10
+};
+
+// Class of the nonzero AC coefficients a block still has to code (1-63)
+static const unsigned char left_class[JPEG_COEFFS] = {
+    0, 0, 1, 2, 3, 3, 4, 4, 4, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7
+};
+
+// Class of a zigzag position, coarser towards high frequencies
+static const unsigned char band_class[JPEG_COEFFS] = {
+    0, 0, 1, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7
+};
+
+// Encode bit, or decode and return one
+static int code_bit(CoefficientCoder *coder, unsigned short *prob, int bit) {
+    if (coder->encoder) {
+        range_encode_bit(coder->encoder, prob, bit);
+        return bit;
+    }
+    return range_decode_bit(coder->decoder, prob);
+}
+
+// Magnitude as unary category decisions, then the bits below its leading one
+static int code_magnitude(CoefficientCoder *coder, unsigned short *category_probs,
+                          unsigned short (*bit_probs)[JPEG_MAX_CATEGORY], int max_category, int magnitude) {
+    int category = magnitude_category(magnitude);
+    int c = 1;
+    while (c < max_category && code_bit(coder, &category_probs[c - 1], category > c)) {
+        c++;
+    }
+    int value = 1;
+    for (int b = c - 2; b >= 0; b--) {
+        value = (value << 1) | code_bit(coder, &bit_probs[c][c - 2 - b], (magnitude >> b) & 1);
+    }
+    return value;
+}
+
+// Nonzero AC count expected from the left and upper neighbours
+static int predict_count(const short *left, const short *above) {
+    if (left && above) return (nonzero_ac(left) + nonzero_ac(above) + 1) / 2;
+    if (left) return nonzero_ac(left);
+    if (above) return nonzero_ac(above);
+    return 0;
+}
+
+/**
+ * Code one block's levels (read when encoding, written when decoding): its
+ * nonzero AC count, the DC residual after median prediction, then each AC
+ * coefficient's nonzero flag, sign and magnitude until the count is used up.
+ * Contexts come from the neighbours' coefficients at the same position.
+ */
+static void code_block(CoefficientCoder *coder, CoefficientModel *model, const JpegComponent *component,
+                       int bx, int by, short *levels) {
+    size_t index = (size_t) by * component->cols + bx;
+    const short *left = bx > 0 ? component->coeffs + (index - 1) * JPEG_COEFFS : NULL;
+    const short *above = by > 0 ? component->coeffs + (index - component->cols) * JPEG_COEFFS : NULL;
+
+    int count = coder->encoder ? nonzero_ac(levels) : 0;
+    unsigned short *count_probs = model->count[count_class[predict_count(left, above)]];
+    int node = 1;
+    for (int b = 5; b >= 0; b--) {
+        node = (node << 1) | code_bit(coder, &count_probs[node], (count >> b) & 1);
+    }
+    count = node - JPEG_COEFFS;
+
+    int context = count_class[count];
+    int prediction = predict_dc(component, bx, by);
+    int residual = levels[0] - prediction;
+    if (code_bit(coder, &model->dc_zero[context], residual != 0)) {
+        int negative = code_bit(coder, &model->dc_sign[context], residual < 0);
+        int magnitude = code_magnitude(coder, model->dc_category[context], model->dc_bits, JPEG_MAX_CATEGORY,
+                                       abs(residual));
+        residual = negative ? -magnitude : magnitude;
+    } else {
+        residual = 0;
+    }
+    int dc = prediction + residual;
+
+    int remaining = count;
+    for (int k = 1; k < JPEG_COEFFS; k++) {
+        int value = 0;
+        if (remaining > 0) {
+            int neighbour = (left ? abs(left[k]) : 0) + (above ? abs(above[k]) : 0);
+            if (!left || !above) neighbour *= 2;
+            int near = neighbour == 0 ? 0 : (neighbour <= 2 ? 1 : (neighbour <= 5 ? 2 : 3));
+
+            // Once the nonzero coefficients fill every position left, their flags are implied
+            int nonzero = remaining == JPEG_COEFFS - k ||
+                          code_bit(coder, &model->nonzero[k][left_class[remaining]][near], levels[k] != 0);
+            if (nonzero) {
+                int negative = code_bit(coder, &model->sign[k], levels[k] < 0);
+                int magnitude = code_magnitude(coder, model->category[band_class[k]][near], model->bits, JPEG_MAX_CATEGORY - 1,
+                                               abs(levels[k]));
+                value = negative ? -magnitude : magnitude;
+                remaining--;
+            }
+        }
+        if (coder->decoder) {
+            coder->ok &= value >= -QUANT_MAX_LEVEL && value <= QUANT_MAX_LEVEL;
+            levels[k] = (short) value;
+        }
+    }
+    if (coder->decoder) {
+        coder->ok &= dc >= -QUANT_MAX_LEVEL && dc <= QUANT_MAX_LEVEL;
+        levels[0] = (short) dc;
+    }
+}
+
+// Run code_block over every coded block of every component, each with its own model
+static void code_coefficients(CoefficientCoder *coder, JpegFrame *frame) {
+    CoefficientModel *model = (CoefficientModel*)malloc(sizeof(CoefficientModel));
+    if (!model) {
+        fprintf(stderr, "Memory allocation failed when recompressing JPEG\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int c = 0; coder->ok && c < frame->component_count; c++) {
+        JpegComponent *component = &frame->components[c];
+        range_probs_init((unsigned short*) model, sizeof(CoefficientModel) / sizeof(unsigned short));
+        for (int by = 0; by < component->coded_rows; by++) {
+            for (int bx = 0; bx < component->coded_cols; bx++) {
+                short *levels = component->coeffs + ((size_t) by * component->cols + bx) * JPEG_COEFFS;
+                code_block(coder, model, component, bx, by, levels);
+            }
+        }
+    }
+    free(model);
+}
+
+static void encode_coefficients(JpegFrame *frame, BitWriter *bw) {
+    RangeEncoder encoder;
+    range_encoder_init(&encoder, bw);
+    CoefficientCoder coder = {&encoder, NULL, 1};
+    code_coefficients(&coder, frame);
+    range_encoder_finish(&encoder);
+}
+
+static int decode_coefficients(JpegFrame *frame, const unsigned char *payload, size_t size) {
+    RangeDecoder decoder;
+    range_decoder_init(&decoder, payload, size);
+    CoefficientCoder coder = {NULL, &decoder, 1};
+    code_coefficients(&coder, frame);
+    return coder.ok && decoder.pos <= size;
+}
+
+unsigned char* jpeg_recompress(const unsigned char *data, size_t size, size_t *out_size) {
+    JpegFrame *frame = alloc_frame();
+    size_t end;
+    if (!data || !parse_jpeg(data, size, frame, 1, size, &end)) {
+        free_frame(frame);
+        return NULL;
+    }
+
+    // Everything but the entropy-coded data is kept verbatim, trailing bytes included
+    size_t verbatim_size = size;
+    for (int s = 0; s < frame->scan_count; s++) {
+        verbatim_size -= frame->scans[s].length;
+    }
+    unsigned char header[JPEG_RECOMPRESSED_HEADER_SIZE] = {'A', 'D', 'J', 'R', JPEG_RECOMPRESSED_VERSION, 0, 0, 0};
+    put_le64(header + 8, size);
+    put_le64(header + 16, verbatim_size);
+    put_le32(header + 24, crc32_bytes(data, size));
+
+    BitWriter bw;
+    bitwriter_init(&bw, size);
+    bitwriter_put_bytes(&bw, header, sizeof(header));
+    size_t pos = 0;
+    for (int s = 0; s < frame->scan_count; s++) {
+        bitwriter_put_bytes(&bw, data + pos, frame->scans[s].offset - pos);
+        pos = frame->scans[s].offset + frame->scans[s].length;
+    }
+    bitwriter_put_bytes(&bw, data + pos, size - pos);
+    encode_coefficients(frame, &bw);
+    free_frame(frame);
+
+    // Files whose scans a baseline encoder would not write bit for bit (0-bit padding, say) are refused
+    size_t restored_size = 0;
+    unsigned char *restored = jpeg_restore(bw.data, bw.size, &restored_size);
+    int exact = restored && restored_size == size && memcmp(restored, data, size) == 0;
+    free(restored);
+    if (!exact) {
+        fprintf(stderr, "Unsupported JPEG: its scans cannot be reproduced exactly\n");
+        free(bw.data);
+        return NULL;
+    }
+    *out_size = bw.size;
+    return bw.data;
+}
+
+unsigned char* jpeg_restore(const unsigned char *data, size_t size, size_t *out_size) {
+    if (!data || size < JPEG_RECOMPRESSED_HEADER_SIZE || memcmp(data, "ADJR", 4) != 0 ||
+        data[4] != JPEG_RECOMPRESSED_VERSION ||
+        get_le64(data + 16) > size - JPEG_RECOMPRESSED_HEADER_SIZE) {
+        fprintf(stderr, "Invalid recompressed JPEG header\n");
+        return NULL;
+    }
+    unsigned long long original_size = get_le64(data + 8);
+    size_t verbatim_size = (size_t) get_le64(data + 16);
+    const unsigned char *verbatim = data + JPEG_RECOMPRESSED_HEADER_SIZE;
+    const unsigned char *payload = verbatim + verbatim_size;
+    size_t payload_size = size - JPEG_RECOMPRESSED_HEADER_SIZE - verbatim_size;
+
+    // A block takes at least 7 adaptive decisions of at least 1/100 bit each (about 110 blocks a byte)
+    JpegFrame *frame = alloc_frame();
+    size_t end;
+    if (!parse_jpeg(verbatim, verbatim_size, frame, 0, payload_size * 32, &end) ||
+        !decode_coefficients(frame, payload, payload_size)) {
+        fprintf(stderr, "Invalid recompressed JPEG\n");
+        free_frame(frame);
+        return NULL;
+    }
+
+    // Regenerated scans go back where they were cut out
+    BitWriter bw;
+    bitwriter_init(&bw, verbatim_size + payload_size * 2);
+    size_t pos = 0;
+    for (int s = 0; s < frame->scan_count; s++) {
+        const JpegScan *scan = &frame->scans[s];
+        bitwriter_put_bytes(&bw, verbatim + pos, scan->offset - pos);
+        encode_scan(frame, scan, &bw);
+        pos = scan->offset + scan->length;
+    }
+    bitwriter_put_bytes(&bw, verbatim + pos, verbatim_size - pos);
+    free_frame(frame);
+
+    // Damage the coder does not notice still changes the bytes, and the checksum
+    if (bw.size != original_size || crc32_bytes(bw.data, bw.size) != get_le32(data + 24)) {
+        fprintf(stderr, "Invalid recompressed JPEG\n");
+        free(bw.data);
+        return NULL;
+    }
+    *out_size = bw.size;
+    return bw.data;
+}
@@ -0,0 +1,307 @@
+/**
+ * metrics.c - Implementation file for image quality metrics
+ * Part of Adaptive DCT Image Compressor
+ */
+#include <metrics.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// SSIM stabilizing constants for 8-bit data: (0.01 * 255)^2 and (0.03 * 255)^2
+#define SSIM_C1 6.5025
+#define SSIM_C2 58.5225
+#define MS_SSIM_SCALES 5
+
+static const double ms_ssim_weights[MS_SSIM_SCALES] = {0.0448, 0.2856, 0.3001, 0.2363, 0.1333};
+
+/**
+ * Structure to hold the sums over one 4x4 block that SSIM needs
+ */
+typedef struct {
+    int sum_a;               // Sum of a
+    int sum_b;               // Sum of b
+    int sum_sq;              // Sum of a^2 + b^2
+    int sum_ab;              // Sum of a * b
+} BlockSums;
+
+double plane_mse(const unsigned char *a, const unsigned char *b, size_t count) {
+    unsigned long long total = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    while (i + 16 <= count) {
+        // Each 32-bit lane gains at most 2 * 255^2 per step, so flush well before overflow
+        __m128i acc = _mm_setzero_si128();
+        size_t end = i + 16 * 4096 < count ? i + 16 * 4096 : count;
+        for (; i + 16 <= end; i += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i *) (b + i));
+            __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+            __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+        }
+        unsigned lanes[4];
+        _mm_storeu_si128((__m128i *) lanes, acc);
+        total += (unsigned long long) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+
+    for (; i < count; i++) {
+        int diff = (int) a[i] - (int) b[i];
+        total += (unsigned long long) (diff * diff);
+    }
+
+    return count > 0 ? (double) total / (double) count : 0.0;
+}
+
+double mse_to_psnr(double mse) {
+    if (mse <= 0.0) {
+        return METRICS_MAX_PSNR;
+    }
+    double psnr = 10.0 * log10(255.0 * 255.0 / mse);
+    return psnr > METRICS_MAX_PSNR ? METRICS_MAX_PSNR : psnr;
+}
+
+double plane_psnr(const unsigned char *a, const unsigned char *b, size_t count) {
+    return mse_to_psnr(plane_mse(a, b, count));
+}
+
+// Sums over the 4x4 block whose top-left sample is a[0] / b[0]
+static void block_sums_4x4(const unsigned char *a, const unsigned char *b, int stride, BlockSums *sums) {
+#if defined(__SSE2__)
+    // Gather the 16 samples of each block into one register
+    int rows_a[4], rows_b[4];
+    for (int i = 0; i < 4; i++) {
+        memcpy(&rows_a[i], a + (size_t) i * stride, 4);
+        memcpy(&rows_b[i], b + (size_t) i * stride, 4);
+    }
+    const __m128i zero = _mm_setzero_si128();
+    __m128i va = _mm_loadu_si128((const __m128i *) rows_a);
+    __m128i vb = _mm_loadu_si128((const __m128i *) rows_b);
+
+    __m128i sad_a = _mm_sad_epu8(va, zero);
+    __m128i sad_b = _mm_sad_epu8(vb, zero);
+
+    __m128i a_lo = _mm_unpacklo_epi8(va, zero);
+    __m128i a_hi = _mm_unpackhi_epi8(va, zero);
+    __m128i b_lo = _mm_unpacklo_epi8(vb, zero);
+    __m128i b_hi = _mm_unpackhi_epi8(vb, zero);
+    __m128i sq = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(a_lo, a_lo), _mm_madd_epi16(a_hi, a_hi)),
+                               _mm_add_epi32(_mm_madd_epi16(b_lo, b_lo), _mm_madd_epi16(b_hi, b_hi)));
+    __m128i ab = _mm_add_epi32(_mm_madd_epi16(a_lo, b_lo), _mm_madd_epi16(a_hi, b_hi));
+
+    int lanes[4];
+    sums->sum_a = _mm_cvtsi128_si32(sad_a) + _mm_cvtsi128_si32(_mm_srli_si128(sad_a, 8));
+    sums->sum_b = _mm_cvtsi128_si32(sad_b) + _mm_cvtsi128_si32(_mm_srli_si128(sad_b, 8));
+    _mm_storeu_si128((__m128i *) lanes, sq);
+    sums->sum_sq = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_si128((__m128i *) lanes, ab);
+    sums->sum_ab = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+    sums->sum_a = sums->sum_b = sums->sum_sq = sums->sum_ab = 0;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            int va = a[(size_t) i * stride + j];
+            int vb = b[(size_t) i * stride + j];
+            sums->sum_a += va;
+            sums->sum_b += vb;
+            sums->sum_sq += va * va + vb * vb;
+            sums->sum_ab += va * vb;
+        }
+    }
+#endif
+}
+
+// SSIM and its contrast-structure term for one window from its sums
+static void window_ssim(double sum_a, double sum_b, double sum_sq, double sum_ab, double count,
+                        double *ssim, double *cs) {
+    double mean_a = sum_a / count;
+    double mean_b = sum_b / count;
+    double variances = sum_sq / count - mean_a * mean_a - mean_b * mean_b;
+    double covariance = sum_ab / count - mean_a * mean_b;
+
+    *cs = (2.0 * covariance + SSIM_C2) / (variances + SSIM_C2);
+    *ssim = (2.0 * mean_a * mean_b + SSIM_C1) / (mean_a * mean_a + mean_b * mean_b + SSIM_C1) * *cs;
+}
+
+// Mean SSIM and mean contrast-structure term over 8x8 windows on a 4-pixel grid
+static void ssim_stats(const unsigned char *a, const unsigned char *b, int width, int height,
+                       double *mean_ssim, double *mean_cs) {
+    if (width < 8 || height < 8) {
+        // Too small for the window grid: one window over the whole plane
+        double sum_a = 0, sum_b = 0, sum_sq = 0, sum_ab = 0;
+        for (size_t i = 0; i < (size_t) width * height; i++) {
+            sum_a += a[i];
+            sum_b += b[i];
+            sum_sq += (double) a[i] * a[i] + (double) b[i] * b[i];
+            sum_ab += (double) a[i] * b[i];
+        }
+        window_ssim(sum_a, sum_b, sum_sq, sum_ab, (double) width * height, mean_ssim, mean_cs);
+        return;
+    }
+
+    int blocks_x = width / 4;
+    int blocks_y = height / 4;
+    BlockSums *sums = (BlockSums *) malloc((size_t) blocks_x * blocks_y * sizeof(BlockSums));
+    if (!sums) {
+        fprintf(stderr, "Memory allocation failed when computing SSIM\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = 0; bx < blocks_x; bx++) {
+            size_t offset = (size_t) by * 4 * width + (size_t) bx * 4;
+            block_sums_4x4(a + offset, b + offset, width, &sums[(size_t) by * blocks_x + bx]);
+        }
+    }
+
+    double total_ssim = 0.0;
+    double total_cs = 0.0;
+    for (int by = 0; by + 1 < blocks_y; by++) {
+        for (int bx = 0; bx + 1 < blocks_x; bx++) {
+            const BlockSums *s00 = &sums[(size_t) by * blocks_x + bx];
+            const BlockSums *s01 = s00 + 1;
+            const BlockSums *s10 = s00 + blocks_x;
+            const BlockSums *s11 = s10 + 1;
+            double ssim, cs;
+            window_ssim(s00->sum_a + s01->sum_a + s10->sum_a + s11->sum_a,
+                        s00->sum_b + s01->sum_b + s10->sum_b + s11->sum_b,
+                        (double) s00->sum_sq + s01->sum_sq + s10->sum_sq + s11->sum_sq,
+                        (double) s00->sum_ab + s01->sum_ab + s10->sum_ab + s11->sum_ab,
+                        64.0, &ssim, &cs);
+            total_ssim += ssim;
+            total_cs += cs;
+        }
+    }
+
+    double windows = (double) (blocks_x - 1) * (blocks_y - 1);
+    *mean_ssim = total_ssim / windows;
+    *mean_cs = total_cs / windows;
+    free(sums);
+}
+
+double plane_ssim(const unsigned char *a, const unsigned char *b, int width, int height) {
+    double ssim, cs;
+    ssim_stats(a, b, width, height, &ssim, &cs);
+    return ssim;
+}
+
+// Halve a plane in both directions by 2x2 averaging
+static unsigned char* downsample_2x(const unsigned char *plane, int width, int height) {
+    int half_width = width / 2;
+    int half_height = height / 2;
+    unsigned char *half = (unsigned char *) malloc((size_t) half_width * half_height);
+    if (!half) {
+        fprintf(stderr, "Memory allocation failed when computing MS-SSIM\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < half_height; i++) {
+        const unsigned char *top = plane + (size_t) 2 * i * width;
+        const unsigned char *bottom = top + width;
+        for (int j = 0; j < half_width; j++) {
+            half[(size_t) i * half_width + j] =
+                (unsigned char) ((top[2 * j] + top[2 * j + 1] + bottom[2 * j] + bottom[2 * j + 1] + 2) / 4);
+        }
+    }
+
+    return half;
+}
+
+double plane_ms_ssim(const unsigned char *a, const unsigned char *b, int width, int height) {
+    int scales = 1;
+    while (scales < MS_SSIM_SCALES && (width >> scales) >= 8 && (height >> scales) >= 8) {
+        scales++;
+    }
+
+    double weight_total = 0.0;
+    for (int s = 0; s < scales; s++) {
+        weight_total += ms_ssim_weights[s];
+    }
+
+    const unsigned char *level_a = a;
+    const unsigned char *level_b = b;
+    unsigned char *owned_a = NULL;
+    unsigned char *owned_b = NULL;
+    double result = 1.0;
+
+    for (int s = 0; s < scales; s++) {
+        double ssim, cs;
+        ssim_stats(level_a, level_b, width, height, &ssim, &cs);
+
+        // Luminance only counts at the coarsest scale
+        double term = s == scales - 1 ? ssim : cs;
+        result *= pow(term > 0.0 ? term : 0.0, ms_ssim_weights[s] / weight_total);
+
+        if (s < scales - 1) {
+            unsigned char *next_a = downsample_2x(level_a, width, height);
+            unsigned char *next_b = downsample_2x(level_b, width, height);
+            free(owned_a);
+            free(owned_b);
+            level_a = owned_a = next_a;
+            level_b = owned_b = next_b;
+            width /= 2;
+            height /= 2;
+        }
+    }
+
+    free(owned_a);
+    free(owned_b);
+    return result;
+}
+
+double dct_domain_sse(DCTContext *ctx, double **original, double **dequantized) {
+    int size = ctx->block_size;
+    double sse = 0.0;
+
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            // Bring both sides back to the orthonormal scale (no-op for the exact DCT)
+            double scale = ctx->row_norms[i] * ctx->row_norms[j];
+            double error = original[i][j] / scale - dequantized[i][j] * scale;
+            sse += error * error;
+        }
+    }
+
+    return sse;
+}
+
+double dct_domain_ssim(DCTContext *ctx, double **original, double **dequantized) {
+    int size = ctx->block_size;
+    double sum_sq = 0.0;
+    double sum_ab = 0.0;
+    double dc_a = 0.0;
+    double dc_b = 0.0;
+
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            double scale = ctx->row_norms[i] * ctx->row_norms[j];
+            double a = original[i][j] / scale;
+            double b = dequantized[i][j] * scale;
+            if (i == 0 && j == 0) {
+                dc_a = a;
+                dc_b = b;
+            } else {
+                sum_sq += a * a + b * b;
+                sum_ab += a * b;
+            }
+        }
+    }
+
+    // The orthonormal DC coefficient is size * mean; AC energy is count * variance
+    double count = (double) size * size;
+    double mean_a = dc_a / size + 128.0;
+    double mean_b = dc_b / size + 128.0;
+    double ssim, cs;
+    window_ssim(mean_a * count, mean_b * count,
+                sum_sq + (mean_a * mean_a + mean_b * mean_b) * count,
+                sum_ab + mean_a * mean_b * count, count, &ssim, &cs);
+    return ssim;
+}
+
+double dct_domain_psnr(double sse, size_t count) {
+    return count > 0 ? mse_to_psnr(sse / (double) count) : METRICS_MAX_PSNR;
+}
@@ -0,0 +1,402 @@
+/**
+ * pack.c - Implementation file for multi-image pack files
+ * Part of Adaptive DCT Image Compressor
+ */
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pack.h>
+
+static const unsigned char pack_magic[4] = {'A', 'D', 'P', 'K'};
+
+/**
+ * Structure to hold an entry while a writer is open
+ */
+typedef struct {
+    PackEntry entry;
+    size_t sequence;             // Order of addition, so the newest of equal ids wins
+} WriterEntry;
+
+struct PackWriter {
+    int fd;
+    WriterEntry *entries;
+    size_t count;
+    size_t capacity;
+    size_t added;                // Entries added since the writer was opened
+    unsigned long long end;      // Where the next stream goes
+};
+
+struct PackReader {
+    unsigned char *map;
+    size_t size;
+    size_t count;
+    const unsigned char *index;
+    unsigned long long index_offset;
+};
+
+static void put_u32(unsigned char *p, unsigned long value) {
+    p[0] = (unsigned char) (value & 0xFF);
+    p[1] = (unsigned char) ((value >> 8) & 0xFF);
+    p[2] = (unsigned char) ((value >> 16) & 0xFF);
+    p[3] = (unsigned char) ((value >> 24) & 0xFF);
+}
+
+static unsigned long get_u32(const unsigned char *p) {
+    return (unsigned long) p[0] | ((unsigned long) p[1] << 8) | ((unsigned long) p[2] << 16) |
+           ((unsigned long) p[3] << 24);
+}
+
+static void put_u64(unsigned char *p, unsigned long long value) {
+    put_u32(p, (unsigned long) (value & 0xFFFFFFFFu));
+    put_u32(p + 4, (unsigned long) (value >> 32));
+}
+
+static unsigned long long get_u64(const unsigned char *p) {
+    return (unsigned long long) get_u32(p) | ((unsigned long long) get_u32(p + 4) << 32);
+}
+
+static void write_pack_header(unsigned char *p, unsigned long long count, unsigned long long index_offset) {
+    memset(p, 0, PACK_HEADER_SIZE);
+    memcpy(p, pack_magic, 4);
+    p[4] = PACK_VERSION;
+    put_u64(p + 8, count);
+    put_u64(p + 16, index_offset);
+}
+
+// Check the header against the file size; sets the entry count and index offset
+static int read_pack_header(const unsigned char *p, unsigned long long file_size,
+                            unsigned long long *count, unsigned long long *index_offset) {
+    if (file_size < PACK_HEADER_SIZE || memcmp(p, pack_magic, 4) != 0 || p[4] != PACK_VERSION) {
+        fprintf(stderr, "Invalid pack header\n");
+        return 0;
+    }
+
+    *count = get_u64(p + 8);
+    *index_offset = get_u64(p + 16);
+    if (*index_offset < PACK_HEADER_SIZE || *index_offset > file_size ||
+        *count > (file_size - *index_offset) / PACK_ENTRY_SIZE || *count > SIZE_MAX / sizeof(WriterEntry)) {
+        fprintf(stderr, "Invalid pack index\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Decode an index entry; it must describe a stream between the header and the index
+static int read_entry(const unsigned char *p, unsigned long long index_offset, PackEntry *entry) {
+    entry->id = get_u64(p);
+    entry->offset = get_u64(p + 8);
+    entry->length = get_u64(p + 16);
+    unsigned long width = get_u32(p + 24);
+    unsigned long height = get_u32(p + 28);
+    if (entry->offset < PACK_HEADER_SIZE || entry->offset > index_offset ||
+        entry->length > index_offset - entry->offset || entry->length > SIZE_MAX ||
+        width == 0 || height == 0 || width > INT_MAX || height > INT_MAX) {
+        return 0;
+    }
+    entry->width = (int) width;
+    entry->height = (int) height;
+    return 1;
+}
+
+static void write_entry(unsigned char *p, const PackEntry *entry) {
+    put_u64(p, entry->id);
+    put_u64(p + 8, entry->offset);
+    put_u64(p + 16, entry->length);
+    put_u32(p + 24, (unsigned long) entry->width);
+    put_u32(p + 28, (unsigned long) entry->height);
+}
+
+static int pread_fully(int fd, unsigned char *buffer, size_t size, unsigned long long offset) {
+    while (size > 0) {
+        ssize_t n = pread(fd, buffer, size, (off_t) offset);
+        if (n <= 0) return 0;
+        buffer += n;
+        size -= (size_t) n;
+        offset += (unsigned long long) n;
+    }
+    return 1;
+}
+
+static int pwrite_fully(int fd, const unsigned char *buffer, size_t size, unsigned long long offset) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, buffer, size, (off_t) offset);
+        if (n <= 0) return 0;
+        buffer += n;
+        size -= (size_t) n;
+        offset += (unsigned long long) n;
+    }
+    return 1;
+}
+
+static void free_writer(PackWriter *writer) {
+    close(writer->fd);
+    free(writer->entries);
+    free(writer);
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const WriterEntry *x = (const WriterEntry*) a;
+    const WriterEntry *y = (const WriterEntry*) b;
+    if (x->entry.id != y->entry.id) return x->entry.id < y->entry.id ? -1 : 1;
+    return x->sequence < y->sequence ? -1 : (x->sequence > y->sequence);
+}
+
+PackWriter* pack_writer_open(const char *path) {
+    PackWriter *writer = (PackWriter*)calloc(1, sizeof(PackWriter));
+    if (!writer) {
+        fprintf(stderr, "Memory allocation failed when creating pack writer\n");
+        exit(EXIT_FAILURE);
+    }
+    writer->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (writer->fd < 0) {
+        fprintf(stderr, "Cannot open pack %s\n", path);
+        free(writer);
+        return NULL;
+    }
+
+    struct stat st;
+    unsigned char header[PACK_HEADER_SIZE];
+    if (fstat(writer->fd, &st) != 0) {
+        free_writer(writer);
+        return NULL;
+    }
+
+    // A new pack starts as a valid empty one, so an interrupted first session leaves it readable
+    if (st.st_size == 0) {
+        write_pack_header(header, 0, PACK_HEADER_SIZE);
+        writer->end = PACK_HEADER_SIZE;
+        if (!pwrite_fully(writer->fd, header, PACK_HEADER_SIZE, 0)) {
+            free_writer(writer);
+            return NULL;
+        }
+        return writer;
+    }
+
+    unsigned long long file_size = (unsigned long long) st.st_size;
+    unsigned long long count, index_offset;
+    if (file_size < PACK_HEADER_SIZE || !pread_fully(writer->fd, header, PACK_HEADER_SIZE, 0) ||
+        !read_pack_header(header, file_size, &count, &index_offset)) {
+        free_writer(writer);
+        return NULL;
+    }
+
+    // Load the current index; new streams go after it
+    unsigned char *index = (unsigned char*)malloc(count > 0 ? (size_t) count * PACK_ENTRY_SIZE : 1);
+    writer->capacity = count > 0 ? (size_t) count : 16;
+    writer->entries = (WriterEntry*)malloc(writer->capacity * sizeof(WriterEntry));
+    if (!index || !writer->entries) {
+        fprintf(stderr, "Memory allocation failed when loading pack index\n");
+        exit(EXIT_FAILURE);
+    }
+    int ok = pread_fully(writer->fd, index, (size_t) count * PACK_ENTRY_SIZE, index_offset);
+    for (size_t i = 0; ok && i < count; i++) {
+        ok = read_entry(index + i * PACK_ENTRY_SIZE, index_offset, &writer->entries[i].entry);
+        writer->entries[i].sequence = i;
+    }
+    free(index);
+    if (!ok) {
+        fprintf(stderr, "Invalid pack index\n");
+        free_writer(writer);
+        return NULL;
+    }
+    writer->count = (size_t) count;
+    writer->end = file_size;
+    return writer;
+}
+
+int pack_writer_add(PackWriter *writer, unsigned long long id, const unsigned char *stream, size_t size) {
+    int width, height;
+    if (!codec_stream_info(stream, size, &width, &height)) {
+        return 0;
+    }
+    if (!pwrite_fully(writer->fd, stream, size, writer->end)) {
+        fprintf(stderr, "Cannot write to pack\n");
+        return 0;
+    }
+
+    if (writer->count == writer->capacity) {
+        writer->capacity = writer->capacity > 0 ? writer->capacity * 2 : 16;
+        writer->entries = (WriterEntry*)realloc(writer->entries, writer->capacity * sizeof(WriterEntry));
+        if (!writer->entries) {
+            fprintf(stderr, "Memory allocation failed when growing pack index\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    WriterEntry *slot = &writer->entries[writer->count];
+    slot->entry.id = id;
+    slot->entry.offset = writer->end;
+    slot->entry.length = size;
+    slot->entry.width = width;
+    slot->entry.height = height;
+    slot->sequence = writer->count;
+    writer->count++;
+    writer->added++;
+    writer->end += size;
+    return 1;
+}
+
+int pack_writer_close(PackWriter *writer) {
+    if (writer->added == 0) {
+        free_writer(writer);
+        return 1;
+    }
+
+    // Sort by id, keeping only the newest entry of each id
+    qsort(writer->entries, writer->count, sizeof(WriterEntry), compare_entries);
+    size_t live = 0;
+    for (size_t i = 0; i < writer->count; i++) {
+        if (i + 1 < writer->count && writer->entries[i + 1].entry.id == writer->entries[i].entry.id) continue;
+        writer->entries[live++] = writer->entries[i];
+    }
+
+    unsigned char *index = (unsigned char*)malloc(live * PACK_ENTRY_SIZE);
+    if (!index) {
+        fprintf(stderr, "Memory allocation failed when writing pack index\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < live; i++) {
+        write_entry(index + i * PACK_ENTRY_SIZE, &writer->entries[i].entry);
+    }
+
+    // Streams and index must be durable before the header points at them
+    unsigned char header[PACK_HEADER_SIZE];
+    write_pack_header(header, live, writer->end);
+    int ok = pwrite_fully(writer->fd, index, live * PACK_ENTRY_SIZE, writer->end) && fsync(writer->fd) == 0 &&
+             pwrite_fully(writer->fd, header, PACK_HEADER_SIZE, 0) && fsync(writer->fd) == 0;
+    if (!ok) {
+        fprintf(stderr, "Cannot write pack index\n");
+    }
+
+    free(index);
+    free_writer(writer);
+    return ok;
+}
+
+int pack_compact(const char *path) {
+    PackReader *reader = pack_open(path);
+    if (!reader) {
+        return 0;
+    }
+
+    size_t path_length = strlen(path);
+    char *temp_path = (char*)malloc(path_length + sizeof(".compact"));
+    if (!temp_path) {
+        fprintf(stderr, "Memory allocation failed when compacting pack\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(temp_path, path, path_length);
+    memcpy(temp_path + path_length, ".compact", sizeof(".compact"));
+    unlink(temp_path);
+
+    PackWriter *writer = pack_writer_open(temp_path);
+    int ok = writer != NULL;
+    for (size_t i = 0; ok && i < reader->count; i++) {
+        PackEntry entry;
+        ok = pack_entry_at(reader, i, &entry) &&
+             pack_writer_add(writer, entry.id, pack_stream(reader, &entry), (size_t) entry.length);
+    }
+    if (writer) {
+        ok = pack_writer_close(writer) && ok;
+    }
+    ok = ok && rename(temp_path, path) == 0;
+    if (!ok) {
+        unlink(temp_path);
+    }
+
+    free(temp_path);
+    pack_close(reader);
+    return ok;
+}
+
+PackReader* pack_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open pack %s\n", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < PACK_HEADER_SIZE) {
+        fprintf(stderr, "Invalid pack header\n");
+        close(fd);
+        return NULL;
+    }
+
+    // The mapping outlives the descriptor
+    size_t size = (size_t) st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Cannot map pack %s\n", path);
+        return NULL;
+    }
+    madvise(map, size, MADV_RANDOM);
+
+    unsigned long long count, index_offset;
+    if (!read_pack_header((const unsigned char*) map, size, &count, &index_offset)) {
+        munmap(map, size);
+        return NULL;
+    }
+
+    PackReader *reader = (PackReader*)malloc(sizeof(PackReader));
+    if (!reader) {
+        fprintf(stderr, "Memory allocation failed when creating pack reader\n");
+        exit(EXIT_FAILURE);
+    }
+    reader->map = (unsigned char*) map;
+    reader->size = size;
+    reader->count = (size_t) count;
+    reader->index = reader->map + index_offset;
+    reader->index_offset = index_offset;
+    return reader;
+}
+
+void pack_close(PackReader *reader) {
+    if (!reader) return;
+    munmap(reader->map, reader->size);
+    free(reader);
+}
+
+size_t pack_count(const PackReader *reader) {
+    return reader->count;
+}
+
+int pack_entry_at(const PackReader *reader, size_t index, PackEntry *entry) {
+    if (index >= reader->count) {
+        return 0;
+    }
+    return read_entry(reader->index + index * PACK_ENTRY_SIZE, reader->index_offset, entry);
+}
+
+int pack_find(const PackReader *reader, unsigned long long id, PackEntry *entry) {
+    size_t low = 0;
+    size_t high = reader->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        unsigned long long key = get_u64(reader->index + mid * PACK_ENTRY_SIZE);
+        if (key == id) {
+            return pack_entry_at(reader, mid, entry);
+        }
+        if (key < id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return 0;
+}
+
+const unsigned char* pack_stream(const PackReader *reader, const PackEntry *entry) {
+    return reader->map + entry->offset;
+}
+
+unsigned char* pack_decode(const PackReader *reader, unsigned long long id, int *width, int *height) {
+    PackEntry entry;
+    if (!pack_find(reader, id, &entry)) {
+        return NULL;
+    }
+    return codec_decode(pack_stream(reader, &entry), (size_t) entry.length, width, height);
+}
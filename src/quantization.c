@@ -16,6 +16,126 @@ static const int std_jpeg_luma_quant[8][8] = {
         {72, 92, 95, 98, 112, 100, 103, 99}
 };
 
+// Default kernel per block size 4, 8, 16 and 32
+static int default_kernels[4] = {QUANT_KERNEL_DIVIDE, QUANT_KERNEL_DIVIDE, QUANT_KERNEL_DIVIDE, QUANT_KERNEL_DIVIDE};
+
+static int kernel_slot(int block_size) {
+    switch (block_size) {
+        case 4: return 0;
+        case 8: return 1;
+        case 16: return 2;
+        case 32: return 3;
+        default: return -1;
+    }
+}
+
+void quant_set_default_kernel(int block_size, int kernel) {
+    int slot = kernel_slot(block_size);
+    if (slot >= 0 && kernel >= 0 && kernel < QUANT_KERNEL_COUNT) {
+        default_kernels[slot] = kernel;
+    }
+}
+
+int quant_default_kernel(int block_size) {
+    int slot = kernel_slot(block_size);
+    return slot >= 0 ? default_kernels[slot] : QUANT_KERNEL_DIVIDE;
+}
+
+// Keep the reciprocal steps in sync with the quantization matrix
+static void update_reciprocal_matrix(QuantContext *ctx) {
+    for (int i = 0; i < ctx->block_size; ++i) {
+        for (int j = 0; j < ctx->block_size; ++j) {
+            ctx->reciprocal_matrix[i][j] = 1.0 / ctx->quant_matrix[i][j];
+        }
+    }
+}
+
+// Corner size covering each scan position and every one before it
+static void update_zigzag_extent(QuantContext *ctx) {
+    int extent = 0;
+    for (int k = 0; k < ctx->block_size * ctx->block_size; k++) {
+        int row = ctx->zigzag_row[k] + 1;
+        int col = ctx->zigzag_col[k] + 1;
+        if (row > extent) extent = row;
+        if (col > extent) extent = col;
+        ctx->zigzag_extent[k] = (unsigned char) extent;
+    }
+}
+
+// Row and column of each zigzag position, in the order block_to_zigzag reads them
+static void fill_zigzag_order(int n, unsigned char *rows, unsigned char *cols) {
+    int index = 0;
+    for (int sum = 0; sum <= 2 * (n - 1); sum++) {
+        if (sum % 2 == 0) {
+            for (int i = (sum < n) ? sum : n - 1; i >= 0 && (sum - i) < n; i--) {
+                rows[index] = (unsigned char) i;
+                cols[index++] = (unsigned char) (sum - i);
+            }
+        } else {
+            for (int i = (sum < n) ? 0 : sum - n + 1; i < n && (sum - i) >= 0; i++) {
+                rows[index] = (unsigned char) i;
+                cols[index++] = (unsigned char) (sum - i);
+            }
+        }
+    }
+}
+
+static void build_zigzag_order(QuantContext *ctx) {
+    int n = ctx->block_size;
+    ctx->zigzag_row = (unsigned char *) malloc((size_t) n * n);
+    ctx->zigzag_col = (unsigned char *) malloc((size_t) n * n);
+    ctx->zigzag_extent = (unsigned char *) malloc((size_t) n * n);
+    if (!ctx->zigzag_row || !ctx->zigzag_col || !ctx->zigzag_extent) {
+        fprintf(stderr, "Memory allocation failed when creating zigzag order\n");
+        exit(EXIT_FAILURE);
+    }
+    fill_zigzag_order(n, ctx->zigzag_row, ctx->zigzag_col);
+    update_zigzag_extent(ctx);
+}
+
+int quant_valid_scan_order(const unsigned short *order, int count, int block_size) {
+    unsigned char seen[32 * 32] = {0};
+    if (block_size < 1 || block_size > 32 || count < 0 || count >= block_size * block_size) {
+        return 0;
+    }
+    for (int k = 0; k < count; k++) {
+        if (order[k] == 0 || order[k] >= block_size * block_size || seen[order[k]]) {
+            return 0;
+        }
+        seen[order[k]] = 1;
+    }
+    return 1;
+}
+
+int quant_set_scan_order(QuantContext *ctx, const unsigned short *order, int count) {
+    int n = ctx->block_size;
+    unsigned char rows[32 * 32];
+    unsigned char cols[32 * 32];
+    unsigned char listed[32 * 32] = {0};
+    if (!quant_valid_scan_order(order, count, n)) {
+        return 0;
+    }
+
+    // DC, then the listed positions, then the rest in zigzag order
+    fill_zigzag_order(n, rows, cols);
+    int index = 1;
+    for (int k = 0; k < count; k++) {
+        listed[order[k]] = 1;
+        ctx->zigzag_row[index] = (unsigned char) (order[k] / n);
+        ctx->zigzag_col[index++] = (unsigned char) (order[k] % n);
+    }
+    for (int k = 1; k < n * n; k++) {
+        if (!listed[rows[k] * n + cols[k]]) {
+            ctx->zigzag_row[index] = rows[k];
+            ctx->zigzag_col[index++] = cols[k];
+        }
+    }
+    ctx->zigzag_row[0] = 0;
+    ctx->zigzag_col[0] = 0;
+    update_zigzag_extent(ctx);
+    return 1;
+}
+
 QuantContext *quant_init(int block_size, int quality, int adaptive) {
     QuantContext *ctx = (QuantContext *) malloc(sizeof(QuantContext));
     if (!ctx) {
@@ -36,6 +156,10 @@ QuantContext *quant_init(int block_size, int quality, int adaptive) {
 
     ctx->quant_matrix = generate_quant_matrix(block_size, quality);
     ctx->dequant_matrix = generate_dequant_matrix(ctx->quant_matrix, block_size);
+    ctx->kernel = quant_default_kernel(block_size);
+    ctx->reciprocal_matrix = alloc_array(block_size, block_size);
+    update_reciprocal_matrix(ctx);
+    build_zigzag_order(ctx);
 
     return ctx;
 }
@@ -44,14 +168,29 @@ void quant_free(QuantContext *ctx) {
     if (ctx) {
         free_array(ctx->quant_matrix, ctx->block_size);
         free_array(ctx->dequant_matrix, ctx->block_size);
+        free_array(ctx->reciprocal_matrix, ctx->block_size);
+        free(ctx->zigzag_row);
+        free(ctx->zigzag_col);
+        free(ctx->zigzag_extent);
         free(ctx);
     }
 }
 
-double **generate_quant_matrix(int block_size, int quality) {
-    double **matrix = alloc_array(block_size, block_size);
+/**
+ * Fill a quantization matrix for samples of the given bit depth
+ * Steps grow with the sample range (2^(bit_depth - 8)), so a quality factor
+ * means the same relative precision at every depth. The smallest step keeps
+ * the largest coefficient a block of that depth can produce within
+ * QUANT_MAX_LEVEL; for 8-bit samples that floor is the usual 1.0.
+ */
+static void fill_quant_matrix(double **matrix, int block_size, int quality, int bit_depth) {
+    double depth_scale = (double) (1 << (bit_depth - 8));
+    double min_step = (double) (1 << (bit_depth - 1)) * block_size / QUANT_MAX_LEVEL;
     double scale_factor;
 
+    if (min_step < 1.0) {
+        min_step = 1.0;
+    }
     if (quality < 50) {
         scale_factor = 5000.0 / quality;
     } else {
@@ -59,43 +198,62 @@ double **generate_quant_matrix(int block_size, int quality) {
     }
     scale_factor /= 100.0;
 
-    // For standard 8x8 block, use JPEG table
-    if (block_size == 8) {
-        for (int i = 0; i < block_size; ++i) {
-            for (int j = 0; j < block_size; ++j) {
-                double value = std_jpeg_luma_quant[i][j] * scale_factor;
-
-                if (value < 1.0) {
-                    value = 1.0;
-                }
-                if (value > 255.0) {
-                    value = 255.0;
-                }
+    for (int i = 0; i < block_size; ++i) {
+        for (int j = 0; j < block_size; ++j) {
+            double value;
+            if (block_size == 8) {
+                // For standard 8x8 block, use JPEG table
+                value = std_jpeg_luma_quant[i][j] * scale_factor;
+            } else {
+                // For other block sizes, generate a custom matrix
+                // Higher frequencies (larger i+j) get larger values
+                double distance = sqrt((double) (i * i + j * j));
+                value = (1.0 + distance) * scale_factor * 8.0;
+            }
+            value *= depth_scale;
 
-                matrix[i][j] = value;
+            if (value < min_step) {
+                value = min_step;
+            }
+            if (value > 255.0 * depth_scale) {
+                value = 255.0 * depth_scale;
             }
+
+            matrix[i][j] = value;
         }
-    } else {
-        // For other block sizes, generate a custom matrix
-        // Higher frequencies (larger i+j) get larger values
-        for (int i = 0; i < block_size; ++i) {
-            for (int j = 0; j < block_size; ++j) {
-                double distance = sqrt((double) (i * i + j * j));
-                double value = (1.0 + distance) * scale_factor * 8.0;
+    }
+}
 
-                if (value < 1.0) {
-                    value = 1.0;
-                }
-                if (value > 255.0) {
-                    value = 255.0;
-                }
+double **generate_quant_matrix(int block_size, int quality) {
+    double **matrix = alloc_array(block_size, block_size);
+    fill_quant_matrix(matrix, block_size, quality, 8);
+    return matrix;
+}
 
-                matrix[i][j] = value;
-            }
+void quant_set_bit_depth(QuantContext *ctx, int bit_depth) {
+    if (bit_depth < 8 || bit_depth > QUANT_MAX_BIT_DEPTH) {
+        return;
+    }
+    fill_quant_matrix(ctx->quant_matrix, ctx->block_size, ctx->quality, bit_depth);
+    for (int i = 0; i < ctx->block_size; ++i) {
+        for (int j = 0; j < ctx->block_size; ++j) {
+            ctx->dequant_matrix[i][j] = 1.0 / ctx->quant_matrix[i][j];
         }
     }
+    update_reciprocal_matrix(ctx);
+}
 
-    return matrix;
+void quant_set_steps(QuantContext *ctx, const unsigned short *steps) {
+    int n = ctx->block_size;
+    unsigned char rows[32 * 32];
+    unsigned char cols[32 * 32];
+    fill_zigzag_order(n, rows, cols);
+    for (int k = 0; k < n * n; k++) {
+        double step = steps[k] > 0 ? (double) steps[k] : 1.0;
+        ctx->quant_matrix[rows[k]][cols[k]] = step;
+        ctx->dequant_matrix[rows[k]][cols[k]] = 1.0 / step;
+    }
+    update_reciprocal_matrix(ctx);
 }
 
 double **generate_dequant_matrix(double **quant_matrix, int block_size) {
@@ -110,9 +268,30 @@ double **generate_dequant_matrix(double **quant_matrix, int block_size) {
     return dequant;
 }
 
+void quant_apply_transform_scale(QuantContext *ctx, const double *row_norms) {
+    for (int i = 0; i < ctx->block_size; ++i) {
+        for (int j = 0; j < ctx->block_size; ++j) {
+            double scale = row_norms[i] * row_norms[j];
+            double step = ctx->quant_matrix[i][j];
+            ctx->quant_matrix[i][j] = step * scale;
+            ctx->dequant_matrix[i][j] = scale / step;
+        }
+    }
+    update_reciprocal_matrix(ctx);
+}
+
 void quantize(QuantContext *ctx, double **dct_coeffs, int **quant_coeffs, double block_variance) {
     double **matrix;
 
+    if (!ctx->adaptive && ctx->kernel == QUANT_KERNEL_RECIPROCAL) {
+        for (int i = 0; i < ctx->block_size; ++i) {
+            for (int j = 0; j < ctx->block_size; ++j) {
+                quant_coeffs[i][j] = (int) round(dct_coeffs[i][j] * ctx->reciprocal_matrix[i][j]);
+            }
+        }
+        return;
+    }
+
     if (ctx->adaptive) {
         matrix = adjust_matrix_for_block(ctx, block_variance, 1);
     } else {
@@ -130,6 +309,58 @@ void quantize(QuantContext *ctx, double **dct_coeffs, int **quant_coeffs, double
     }
 }
 
+void quantize_sparse(QuantContext *ctx, double **dct_coeffs, SparseBlock *sparse, double block_variance) {
+    int coeff_count = ctx->block_size * ctx->block_size;
+    double **matrix = NULL;
+    int reciprocal = !ctx->adaptive && ctx->kernel == QUANT_KERNEL_RECIPROCAL;
+    if (ctx->adaptive) {
+        matrix = adjust_matrix_for_block(ctx, block_variance, 1);
+    } else if (!reciprocal) {
+        matrix = ctx->quant_matrix;
+    }
+
+    // Same rounding as quantize, read in zigzag order; only nonzeros are written
+    memset(sparse->bitmap, 0, (size_t) ((coeff_count + 63) / 64) * sizeof(unsigned long long));
+    sparse->count = 0;
+    for (int k = 0; k < coeff_count; k++) {
+        int i = ctx->zigzag_row[k];
+        int j = ctx->zigzag_col[k];
+        int value = reciprocal ? (int) round(dct_coeffs[i][j] * ctx->reciprocal_matrix[i][j])
+                               : (int) round(dct_coeffs[i][j] / matrix[i][j]);
+        if (value != 0) {
+            sparse->bitmap[k >> 6] |= 1ULL << (k & 63);
+            sparse->values[sparse->count++] = value;
+        }
+    }
+
+    if (ctx->adaptive) {
+        free_array(matrix, ctx->block_size);
+    }
+}
+
+int dequantize_sparse(QuantContext *ctx, const SparseBlock *sparse, double **dct_coeffs, double block_variance) {
+    int n = ctx->block_size;
+    double scale = dequant_block_scale(ctx, block_variance);
+
+    for (int i = 0; i < n; ++i) {
+        memset(dct_coeffs[i], 0, n * sizeof(double));
+    }
+    // AC steps scaled as adjust_matrix_for_block scales them, without building the matrix
+    int index = 0;
+    int last = 0;
+    for (int w = 0; w < (n * n + 63) / 64; w++) {
+        for (unsigned long long bits = sparse->bitmap[w]; bits; bits &= bits - 1) {
+            int k = w * 64 + sparse_lowest_bit(bits);
+            int i = ctx->zigzag_row[k];
+            int j = ctx->zigzag_col[k];
+            double step = k == 0 ? ctx->dequant_matrix[0][0] : ctx->dequant_matrix[i][j] * scale;
+            dct_coeffs[i][j] = sparse->values[index++] / step;
+            last = k;
+        }
+    }
+    return last;
+}
+
 void dequantize(QuantContext *ctx, int **quant_coeffs, double **dct_coeffs, double block_variance) {
     double **matrix;
 
@@ -141,7 +372,8 @@ void dequantize(QuantContext *ctx, int **quant_coeffs, double **dct_coeffs, doub
 
     for (int i = 0; i < ctx->block_size; ++i) {
         for (int j = 0; j < ctx->block_size; ++j) {
-            dct_coeffs[i][j] = quant_coeffs[i][j] * (ctx->adaptive ? 1.0 / matrix[i][j] : matrix[i][j]);
+            // Both matrices hold reciprocal step sizes
+            dct_coeffs[i][j] = quant_coeffs[i][j] / matrix[i][j];
         }
     }
 
@@ -168,6 +400,20 @@ double calculate_block_variance(double **block, int block_size) {
     return variance;
 }
 
+// Scaling factor for the AC steps of a block of the given variance
+static double variance_scale(double variance, int is_quantize) {
+    // High variance (detail) = less quantization (smaller values)
+    // Low variance (flat areas) = more quantization (larger values)
+    double norm_variance = fmin(1.0, fmax(0.1, variance / 1000.0));
+
+    if (is_quantize) {
+        // For quantization: high variance -> lower scaling (preserve details)
+        return 2.0 - norm_variance; // 1.0 <-> 1.9
+    }
+    // For dequantization: inverse relationship
+    return 1.0 / (2.0 - norm_variance);
+}
+
 double **adjust_matrix_for_block(QuantContext *ctx, double variance, int is_quantize) {
     double **matrix = alloc_array(ctx->block_size, ctx->block_size);
     double **source;
@@ -177,21 +423,7 @@ double **adjust_matrix_for_block(QuantContext *ctx, double variance, int is_quan
         source = ctx->dequant_matrix;
     }
 
-    // Determine scaling factor based on variance
-    // High variance (detail) = less quantization (smaller values)
-    // Low variance (flat areas) = more quantization (larger values)
-    double scale;
-
-    // Normalizing matrix
-    double norm_variance = fmin(1.0, fmax(0.1, variance / 1000.0));
-
-    if (is_quantize) {
-        // For quantization: high variance -> lower scaling (preserve details)
-        scale = 2.0 - norm_variance; // 1.0 <-> 1.9
-    } else {
-        // For dequantization: inverse relationship
-        scale = 1.0 / (2.0 - norm_variance);
-    }
+    double scale = variance_scale(variance, is_quantize);
 
     for (int i = 0; i < ctx->block_size; ++i) {
         for (int j = 0; j < ctx->block_size; ++j) {
@@ -210,3 +442,6 @@ double **adjust_matrix_for_block(QuantContext *ctx, double variance, int is_quan
     return matrix;
 }
 
+double dequant_block_scale(const QuantContext *ctx, double block_variance) {
+    return ctx->adaptive ? variance_scale(block_variance, 0) : 1.0;
+}
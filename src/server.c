@@ -0,0 +1,657 @@
+/**
+ * server.c - Implementation file for the local encode/decode daemon
+ * Part of Adaptive DCT Image Compressor
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <server.h>
+
+#define SERVER_MAX_CONNECTIONS 64
+#define SERVER_REQUIRED_SEALS (F_SEAL_SHRINK | F_SEAL_WRITE) // A mapped payload can neither shrink nor change
+
+/**
+ * Structure to hold one client connection, shared by the I/O thread and
+ * every queued job from it; closed when the last reference goes away
+ */
+typedef struct {
+    int fd;                  // Connected socket
+    int refs;                // I/O thread reference plus queued jobs
+    pthread_mutex_t send_lock; // Serializes responses from different workers
+} Connection;
+
+/**
+ * Structure to hold a queued request
+ */
+typedef struct Job {
+    Connection *conn;        // Connection to answer on
+    ServerRequest request;   // Request header
+    int input_fd;            // Input payload descriptor (-1 if none)
+    double enqueue_ms;       // Time the request was read
+    struct Job *next;
+} Job;
+
+struct Server {
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    int listen_fd;
+    int wake_pipe[2];        // Wakes the I/O thread for shutdown
+    pthread_t io_thread;
+    pthread_t *workers;
+    int worker_count;
+    unsigned long long max_pixels; // Largest image a request may encode or decode
+
+    pthread_mutex_t lock;    // Protects everything below
+    pthread_cond_t ready;    // Signalled when jobs are queued or on shutdown
+    Job *head;
+    Job *tail;
+    int queued;              // Jobs in the queue
+    int idle;                // Workers waiting for jobs
+    int stopping;
+    ServerStats stats;
+    double total_ms;
+    double window[SERVER_LATENCY_WINDOW];
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Zero-length mappings are invalid, so empty payloads still map one byte
+static size_t mapped_length(size_t size) {
+    return size > 0 ? size : 1;
+}
+
+int shared_buffer_create(SharedBuffer *buffer, size_t size) {
+    buffer->fd = memfd_create("adct-payload", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    buffer->data = NULL;
+    buffer->size = size;
+    if (buffer->fd < 0) {
+        return 0;
+    }
+
+    if (ftruncate(buffer->fd, (off_t) mapped_length(size)) != 0) {
+        close(buffer->fd);
+        buffer->fd = -1;
+        return 0;
+    }
+    void *data = mmap(NULL, mapped_length(size), PROT_READ | PROT_WRITE, MAP_SHARED, buffer->fd, 0);
+    if (data == MAP_FAILED) {
+        close(buffer->fd);
+        buffer->fd = -1;
+        return 0;
+    }
+
+    buffer->data = (unsigned char*)data;
+    return 1;
+}
+
+int shared_buffer_seal(SharedBuffer *buffer) {
+    int seals = fcntl(buffer->fd, F_GET_SEALS);
+    if (seals < 0) {
+        return 0;
+    }
+    if ((seals & SERVER_REQUIRED_SEALS) == SERVER_REQUIRED_SEALS) {
+        return 1;
+    }
+
+    // F_SEAL_WRITE is refused while a writable mapping exists, so map again read-only
+    if (buffer->data) {
+        munmap(buffer->data, mapped_length(buffer->size));
+        buffer->data = NULL;
+    }
+    if (fcntl(buffer->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE) != 0) {
+        return 0;
+    }
+    void *data = mmap(NULL, mapped_length(buffer->size), PROT_READ, MAP_SHARED, buffer->fd, 0);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+    buffer->data = (unsigned char*)data;
+    return 1;
+}
+
+/**
+ * Map a received descriptor that must hold at least size bytes
+ * Only sealed buffers are mapped: a peer that could still shrink the file
+ * would fault every reader past the new end (SIGBUS).
+ */
+static int shared_buffer_map(SharedBuffer *buffer, int fd, size_t size) {
+    struct stat st;
+    buffer->fd = fd;
+    buffer->data = NULL;
+    buffer->size = size;
+    if (fd < 0 || fstat(fd, &st) != 0 || (unsigned long long) st.st_size < mapped_length(size)) {
+        return 0;
+    }
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & SERVER_REQUIRED_SEALS) != SERVER_REQUIRED_SEALS) {
+        return 0;
+    }
+
+    void *data = mmap(NULL, mapped_length(size), PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+
+    buffer->data = (unsigned char*)data;
+    return 1;
+}
+
+void shared_buffer_release(SharedBuffer *buffer) {
+    if (buffer->data) {
+        munmap(buffer->data, mapped_length(buffer->size));
+    }
+    if (buffer->fd >= 0) {
+        close(buffer->fd);
+    }
+    buffer->data = NULL;
+    buffer->fd = -1;
+    buffer->size = 0;
+}
+
+// Send one fixed-size message, optionally passing a descriptor
+static int send_message(int sock, const void *message, size_t length, int fd) {
+    struct iovec iov;
+    struct msghdr msg;
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = (void *) message;
+    iov.iov_len = length;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd >= 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == (ssize_t) length;
+}
+
+// Receive one fixed-size message and the descriptor passed with it (-1 if none)
+static int recv_message(int sock, void *message, size_t length, int *fd) {
+    struct iovec iov;
+    struct msghdr msg;
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = message;
+    iov.iov_len = length;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    ssize_t received;
+    do {
+        received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+
+    *fd = -1;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    if (received != (ssize_t) length || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+// Drop one reference to a connection (server lock held)
+static void release_connection(Connection *conn) {
+    if (--conn->refs == 0) {
+        close(conn->fd);
+        pthread_mutex_destroy(&conn->send_lock);
+        free(conn);
+    }
+}
+
+static void record_latency(Server *server, double latency_ms, int failed) {
+    ServerStats *stats = &server->stats;
+    server->window[stats->requests % SERVER_LATENCY_WINDOW] = latency_ms;
+    stats->requests++;
+    stats->errors += failed != 0;
+    server->total_ms += latency_ms;
+    if (latency_ms > stats->max_ms) {
+        stats->max_ms = latency_ms;
+    }
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+void server_get_stats(Server *server, ServerStats *stats) {
+    double sorted[SERVER_LATENCY_WINDOW];
+
+    pthread_mutex_lock(&server->lock);
+    *stats = server->stats;
+    size_t count = stats->requests < SERVER_LATENCY_WINDOW ? (size_t) stats->requests : SERVER_LATENCY_WINDOW;
+    memcpy(sorted, server->window, count * sizeof(double));
+    stats->mean_ms = stats->requests > 0 ? server->total_ms / (double) stats->requests : 0.0;
+    pthread_mutex_unlock(&server->lock);
+
+    qsort(sorted, count, sizeof(double), compare_doubles);
+    stats->p50_ms = count > 0 ? sorted[count / 2] : 0.0;
+    stats->p99_ms = count > 0 ? sorted[(count * 99) / 100] : 0.0;
+}
+
+/**
+ * Run the codec for one request, leaving the payload in output
+ * Encodes go straight into a shared buffer of codec_max_compressed_size
+ * bytes, trimmed to the stream afterwards; decodes make one copy of the
+ * decoded plane. Images above max_pixels are refused before the codec
+ * allocates anything for them.
+ */
+static void run_request(const ServerRequest *request, const SharedBuffer *input, unsigned long long max_pixels,
+                        ServerResponse *response, SharedBuffer *output) {
+    if (request->op == SERVER_OP_ENCODE) {
+        if (request->width <= 0 || request->height <= 0 ||
+            request->input_size != (unsigned long long) request->width * (unsigned long long) request->height ||
+            request->input_size > max_pixels) {
+            response->status = SERVER_ERROR_REQUEST;
+            return;
+        }
+        size_t bound = codec_max_compressed_size(request->width, request->height, &request->params);
+        if (bound == 0) {
+            response->status = SERVER_ERROR_CODEC;
+            return;
+        }
+        if (!shared_buffer_create(output, bound)) {
+            response->status = SERVER_ERROR_REQUEST;
+            return;
+        }
+        size_t size = codec_encode_into(input->data, request->width, request->height, &request->params,
+                                        output->data, bound);
+        if (size == 0) {
+            response->status = SERVER_ERROR_CODEC;
+            return;
+        }
+
+        // The file shrinks to the stream and is sealed, as the client only maps sealed buffers
+        munmap(output->data, bound);
+        output->data = NULL;
+        output->size = size;
+        if (ftruncate(output->fd, (off_t) size) != 0 || !shared_buffer_seal(output)) {
+            response->status = SERVER_ERROR_REQUEST;
+            return;
+        }
+        response->status = SERVER_OK;
+        response->output_size = size;
+        return;
+    }
+
+    int width, height;
+    if (!codec_stream_info(input->data, (size_t) request->input_size, &width, &height)) {
+        response->status = SERVER_ERROR_CODEC;
+        return;
+    }
+    if ((unsigned long long) width * (unsigned long long) height > max_pixels) {
+        response->status = SERVER_ERROR_REQUEST;
+        return;
+    }
+    unsigned char *pixels = codec_decode(input->data, (size_t) request->input_size, &width, &height);
+    if (!pixels) {
+        response->status = SERVER_ERROR_CODEC;
+        return;
+    }
+    size_t size = (size_t) width * height;
+    if (shared_buffer_create(output, size)) {
+        memcpy(output->data, pixels, size);
+    }
+    if (output->data && shared_buffer_seal(output)) {
+        response->status = SERVER_OK;
+        response->width = width;
+        response->height = height;
+        response->output_size = size;
+    } else {
+        response->status = SERVER_ERROR_REQUEST;
+    }
+    free(pixels);
+}
+
+static void process_job(Server *server, Job *job) {
+    double start_ms = now_ms();
+    ServerResponse response;
+    SharedBuffer input = {-1, NULL, 0};
+    SharedBuffer output = {-1, NULL, 0};
+
+    memset(&response, 0, sizeof(response));
+    response.id = job->request.id;
+    response.queue_ms = start_ms - job->enqueue_ms;
+
+    const ServerRequest *request = &job->request;
+    if (request->magic != SERVER_MAGIC) {
+        response.status = SERVER_ERROR_REQUEST;
+    } else if (request->op == SERVER_OP_STATS) {
+        server_get_stats(server, &response.stats);
+        response.status = SERVER_OK;
+    } else if ((request->op != SERVER_OP_ENCODE && request->op != SERVER_OP_DECODE) ||
+               !shared_buffer_map(&input, job->input_fd, (size_t) request->input_size)) {
+        response.status = SERVER_ERROR_REQUEST;
+    } else {
+        run_request(request, &input, server->max_pixels, &response, &output);
+    }
+    if (input.data) {
+        munmap(input.data, mapped_length(input.size));
+    }
+    if (job->input_fd >= 0) {
+        close(job->input_fd);
+    }
+
+    // Count the request before answering, so a client never sees stats that miss it
+    response.service_ms = now_ms() - start_ms;
+    if (request->op != SERVER_OP_STATS) {
+        pthread_mutex_lock(&server->lock);
+        record_latency(server, response.queue_ms + response.service_ms, response.status != SERVER_OK);
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    pthread_mutex_lock(&job->conn->send_lock);
+    send_message(job->conn->fd, &response, sizeof(response), response.status == SERVER_OK ? output.fd : -1);
+    pthread_mutex_unlock(&job->conn->send_lock);
+    shared_buffer_release(&output);
+
+    pthread_mutex_lock(&server->lock);
+    release_connection(job->conn);
+    pthread_mutex_unlock(&server->lock);
+}
+
+/**
+ * Worker: take jobs until shut down and drained
+ * A worker takes its share of the queue, at most SERVER_BATCH jobs, and
+ * leaves the rest to the idle workers, so a burst spreads over the pool
+ * instead of piling onto whichever worker wakes first.
+ */
+static void* worker_main(void *arg) {
+    Server *server = (Server *) arg;
+    Job *batch[SERVER_BATCH];
+
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (!server->head && !server->stopping) {
+            server->idle++;
+            pthread_cond_wait(&server->ready, &server->lock);
+            server->idle--;
+        }
+        int share = server->queued / (server->idle + 1);
+        share = share < 1 ? 1 : (share > SERVER_BATCH ? SERVER_BATCH : share);
+        int count = 0;
+        while (server->head && count < share) {
+            batch[count++] = server->head;
+            server->head = server->head->next;
+        }
+        server->queued -= count;
+        if (!server->head) {
+            server->tail = NULL;
+        }
+        int done = count == 0 && server->stopping;
+        pthread_mutex_unlock(&server->lock);
+
+        if (done) {
+            return NULL;
+        }
+        for (int i = 0; i < count; i++) {
+            process_job(server, batch[i]);
+            free(batch[i]);
+        }
+    }
+}
+
+static void enqueue_job(Server *server, Connection *conn, const ServerRequest *request, int input_fd) {
+    Job *job = (Job*)malloc(sizeof(Job));
+    if (!job) {
+        fprintf(stderr, "Memory allocation failed when queueing a request\n");
+        exit(EXIT_FAILURE);
+    }
+    job->conn = conn;
+    job->request = *request;
+    job->input_fd = input_fd;
+    job->enqueue_ms = now_ms();
+    job->next = NULL;
+
+    pthread_mutex_lock(&server->lock);
+    conn->refs++;
+    if (server->tail) {
+        server->tail->next = job;
+    } else {
+        server->head = job;
+    }
+    server->tail = job;
+    server->queued++;
+    pthread_cond_signal(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+}
+
+// I/O thread: accept connections and turn incoming messages into queued jobs
+static void* io_main(void *arg) {
+    Server *server = (Server *) arg;
+    Connection *conns[SERVER_MAX_CONNECTIONS];
+    struct pollfd fds[SERVER_MAX_CONNECTIONS + 2];
+    int conn_count = 0;
+
+    for (;;) {
+        fds[0].fd = server->wake_pipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = server->listen_fd;
+        fds[1].events = conn_count < SERVER_MAX_CONNECTIONS ? POLLIN : 0;
+        for (int i = 0; i < conn_count; i++) {
+            fds[i + 2].fd = conns[i]->fd;
+            fds[i + 2].events = POLLIN;
+        }
+
+        if (poll(fds, (nfds_t) conn_count + 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+
+        for (int i = conn_count - 1; i >= 0; i--) {
+            if (!fds[i + 2].revents) continue;
+
+            ServerRequest request;
+            int input_fd;
+            if (recv_message(conns[i]->fd, &request, sizeof(request), &input_fd)) {
+                enqueue_job(server, conns[i], &request, input_fd);
+            } else {
+                // Peer closed or sent garbage: drop the connection
+                pthread_mutex_lock(&server->lock);
+                release_connection(conns[i]);
+                pthread_mutex_unlock(&server->lock);
+                conns[i] = conns[--conn_count];
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            int fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                Connection *conn = (Connection*)malloc(sizeof(Connection));
+                if (!conn) {
+                    fprintf(stderr, "Memory allocation failed when accepting a connection\n");
+                    exit(EXIT_FAILURE);
+                }
+                conn->fd = fd;
+                conn->refs = 1;
+                pthread_mutex_init(&conn->send_lock, NULL);
+                conns[conn_count++] = conn;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&server->lock);
+    for (int i = 0; i < conn_count; i++) {
+        release_connection(conns[i]);
+    }
+    pthread_mutex_unlock(&server->lock);
+    return NULL;
+}
+
+// Let the first count workers drain the queue and exit
+static void stop_workers(Server *server, int count) {
+    pthread_mutex_lock(&server->lock);
+    server->stopping = 1;
+    pthread_cond_broadcast(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+    for (int i = 0; i < count; i++) {
+        pthread_join(server->workers[i], NULL);
+    }
+}
+
+static void free_server(Server *server) {
+    close(server->listen_fd);
+    close(server->wake_pipe[0]);
+    close(server->wake_pipe[1]);
+    unlink(server->path);
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->ready);
+    free(server->workers);
+    free(server);
+}
+
+Server* server_start(const char *socket_path, int workers, unsigned long long max_pixels) {
+    struct sockaddr_un addr;
+    if (strlen(socket_path) >= sizeof(addr.sun_path) || workers < 1) {
+        fprintf(stderr, "Invalid server parameters\n");
+        return NULL;
+    }
+
+    Server *server = (Server*)calloc(1, sizeof(Server));
+    if (!server) {
+        fprintf(stderr, "Memory allocation failed when creating server\n");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(server->path, sizeof(server->path), "%s", socket_path);
+    server->max_pixels = max_pixels > 0 ? max_pixels : SERVER_DEFAULT_MAX_PIXELS;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, socket_path, strlen(socket_path) + 1);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    unlink(socket_path);
+    if (server->listen_fd < 0 || bind(server->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(server->listen_fd, SERVER_MAX_CONNECTIONS) != 0 || pipe(server->wake_pipe) != 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", socket_path, strerror(errno));
+        if (server->listen_fd >= 0) close(server->listen_fd);
+        free(server);
+        return NULL;
+    }
+
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->ready, NULL);
+    server->worker_count = workers;
+    server->workers = (pthread_t*)malloc((size_t) workers * sizeof(pthread_t));
+    if (!server->workers) {
+        fprintf(stderr, "Memory allocation failed when creating server\n");
+        exit(EXIT_FAILURE);
+    }
+    int started = 0;
+    while (started < workers && pthread_create(&server->workers[started], NULL, worker_main, server) == 0) {
+        started++;
+    }
+    if (started < workers || pthread_create(&server->io_thread, NULL, io_main, server) != 0) {
+        fprintf(stderr, "Cannot start server threads\n");
+        stop_workers(server, started);
+        free_server(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+void server_stop(Server *server) {
+    // Stop reading new requests first, then let the workers drain the queue
+    ssize_t written;
+    do {
+        written = write(server->wake_pipe[1], "x", 1);
+    } while (written < 0 && errno == EINTR);
+    pthread_join(server->io_thread, NULL);
+
+    stop_workers(server, server->worker_count);
+    free_server(server);
+}
+
+int client_connect(const char *socket_path) {
+    struct sockaddr_un addr;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, socket_path, strlen(socket_path) + 1);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+int client_request(int fd, const ServerRequest *request, SharedBuffer *input,
+                   ServerResponse *response, SharedBuffer *output) {
+    int output_fd;
+    if (output) {
+        output->fd = -1;
+        output->data = NULL;
+        output->size = 0;
+    }
+
+    if ((input && !shared_buffer_seal(input)) ||
+        !send_message(fd, request, sizeof(*request), input ? input->fd : -1) ||
+        !recv_message(fd, response, sizeof(*response), &output_fd)) {
+        return 0;
+    }
+
+    if (output_fd >= 0) {
+        if (!output || !shared_buffer_map(output, output_fd, (size_t) response->output_size)) {
+            close(output_fd);
+            if (output) {
+                output->fd = -1;
+                output->size = 0;
+            }
+            return output == NULL;
+        }
+    }
+    return 1;
+}
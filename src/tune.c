@@ -0,0 +1,222 @@
+/**
+ * tune.c - Implementation file for the startup kernel autotuner
+ * Part of Adaptive DCT Image Compressor
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include <tune.h>
+
+#define TUNE_BLOCKS 16          // Distinct blocks cycled through by each measurement
+#define TUNE_PIXELS 65536       // Pixels transformed per timed run
+#define TUNE_RUNS 3             // Timed runs per kernel; the best one counts
+
+static const int tune_sizes[TUNE_SIZE_COUNT] = {4, 8, 16, 32};
+
+// Kernels that reproduce the reference kernel bit for bit (the SSE2 DCT keeps
+// the matrix kernel's summation order). Only these are picked automatically,
+// so a profile changes speed but never the encoded or decoded bytes.
+static int dct_kernel_exact(int kernel) {
+    return kernel == DCT_KERNEL_MATRIX || kernel == DCT_KERNEL_SSE2;
+}
+
+static int quant_kernel_exact(int kernel) {
+    return kernel == QUANT_KERNEL_DIVIDE;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+void tune_cpu_model(char *buffer, size_t size) {
+    char line[256];
+    FILE *file = fopen("/proc/cpuinfo", "r");
+
+    snprintf(buffer, size, "unknown");
+    if (!file) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, "model name", 10) == 0) {
+            char *value = strchr(line, ':');
+            if (value) {
+                value++;
+                while (*value == ' ' || *value == '\t') value++;
+                value[strcspn(value, "\r\n")] = '\0';
+                snprintf(buffer, size, "%s", value);
+            }
+            break;
+        }
+    }
+
+    fclose(file);
+}
+
+// Best time per block of a forward + inverse transform with one kernel
+static double time_dct_kernel(int size, int kernel, double ***blocks, double **coeffs) {
+    DCTContext *ctx = dct_init(size);
+    ctx->kernel = kernel;
+    int iterations = TUNE_PIXELS / (size * size);
+    double best = 1e30;
+
+    for (int run = 0; run < TUNE_RUNS; run++) {
+        double start = now_ns();
+        for (int it = 0; it < iterations; it++) {
+            double **block = blocks[it % TUNE_BLOCKS];
+            dct_forward(ctx, block, coeffs);
+            dct_inverse(ctx, coeffs, block);
+        }
+        double elapsed = (now_ns() - start) / iterations;
+        if (elapsed < best) best = elapsed;
+    }
+
+    dct_free(ctx);
+    return best;
+}
+
+// Best time per block of static quantization with one kernel
+static double time_quant_kernel(int size, int kernel, double ***blocks, int **quantized) {
+    QuantContext *ctx = quant_init(size, 75, 0);
+    ctx->kernel = kernel;
+    int iterations = TUNE_PIXELS / (size * size);
+    double best = 1e30;
+
+    for (int run = 0; run < TUNE_RUNS; run++) {
+        double start = now_ns();
+        for (int it = 0; it < iterations; it++) {
+            quantize(ctx, blocks[it % TUNE_BLOCKS], quantized, 0.0);
+        }
+        double elapsed = (now_ns() - start) / iterations;
+        if (elapsed < best) best = elapsed;
+    }
+
+    quant_free(ctx);
+    return best;
+}
+
+void tune_measure(TuneProfile *profile) {
+    unsigned seed = 2024;
+
+    memset(profile, 0, sizeof(*profile));
+    tune_cpu_model(profile->cpu_model, sizeof(profile->cpu_model));
+
+    for (int s = 0; s < TUNE_SIZE_COUNT; s++) {
+        int size = tune_sizes[s];
+        double **blocks[TUNE_BLOCKS];
+        double **coeffs = alloc_array(size, size);
+        int **quantized = alloc_int_array(size, size);
+
+        for (int b = 0; b < TUNE_BLOCKS; b++) {
+            blocks[b] = alloc_array(size, size);
+            for (int i = 0; i < size; i++) {
+                for (int j = 0; j < size; j++) {
+                    seed = seed * 1103515245u + 12345u;
+                    blocks[b][i][j] = (double) ((seed >> 16) % 256) - 128.0;
+                }
+            }
+        }
+
+        profile->dct_kernel[s] = DCT_KERNEL_MATRIX;
+        for (int k = 0; k < DCT_KERNEL_COUNT; k++) {
+            if (!dct_kernel_available(k)) continue;
+            profile->dct_ns[s][k] = time_dct_kernel(size, k, blocks, coeffs);
+            if (dct_kernel_exact(k) && profile->dct_ns[s][k] < profile->dct_ns[s][profile->dct_kernel[s]]) {
+                profile->dct_kernel[s] = k;
+            }
+        }
+
+        profile->quant_kernel[s] = QUANT_KERNEL_DIVIDE;
+        for (int k = 0; k < QUANT_KERNEL_COUNT; k++) {
+            profile->quant_ns[s][k] = time_quant_kernel(size, k, blocks, quantized);
+            if (quant_kernel_exact(k) && profile->quant_ns[s][k] < profile->quant_ns[s][profile->quant_kernel[s]]) {
+                profile->quant_kernel[s] = k;
+            }
+        }
+
+        for (int b = 0; b < TUNE_BLOCKS; b++) {
+            free_array(blocks[b], size);
+        }
+        free_array(coeffs, size);
+        free_int_array(quantized, size);
+    }
+}
+
+void tune_apply(const TuneProfile *profile) {
+    for (int s = 0; s < TUNE_SIZE_COUNT; s++) {
+        dct_set_default_kernel(tune_sizes[s], profile->dct_kernel[s]);
+        quant_set_default_kernel(tune_sizes[s], profile->quant_kernel[s]);
+    }
+}
+
+int tune_save(const TuneProfile *profile, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Cannot write tuning profile %s\n", path);
+        return 0;
+    }
+
+    fprintf(file, "adct-tune %d\n", TUNE_PROFILE_VERSION);
+    fprintf(file, "cpu %s\n", profile->cpu_model);
+    for (int s = 0; s < TUNE_SIZE_COUNT; s++) {
+        fprintf(file, "size %d dct %d quant %d\n", tune_sizes[s], profile->dct_kernel[s], profile->quant_kernel[s]);
+    }
+
+    return fclose(file) == 0;
+}
+
+int tune_load(TuneProfile *profile, const char *path) {
+    char line[256];
+    int version = 0;
+    int sizes_seen = 0;
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+
+    memset(profile, 0, sizeof(*profile));
+    if (!fgets(line, sizeof(line), file) || sscanf(line, "adct-tune %d", &version) != 1 ||
+        version != TUNE_PROFILE_VERSION) {
+        fclose(file);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        int size, dct_kernel, quant_kernel;
+        if (strncmp(line, "cpu ", 4) == 0) {
+            line[strcspn(line, "\r\n")] = '\0';
+            snprintf(profile->cpu_model, sizeof(profile->cpu_model), "%.*s", TUNE_CPU_MODEL_LENGTH - 1, line + 4);
+        } else if (sscanf(line, "size %d dct %d quant %d", &size, &dct_kernel, &quant_kernel) == 3) {
+            for (int s = 0; s < TUNE_SIZE_COUNT; s++) {
+                if (tune_sizes[s] == size && dct_kernel_available(dct_kernel) &&
+                    quant_kernel >= 0 && quant_kernel < QUANT_KERNEL_COUNT) {
+                    profile->dct_kernel[s] = dct_kernel;
+                    profile->quant_kernel[s] = quant_kernel;
+                    sizes_seen |= 1 << s;
+                }
+            }
+        }
+    }
+
+    fclose(file);
+    return sizes_seen == (1 << TUNE_SIZE_COUNT) - 1 && profile->cpu_model[0] != '\0';
+}
+
+int tune_init(const char *path, TuneProfile *profile) {
+    TuneProfile local;
+    char cpu_model[TUNE_CPU_MODEL_LENGTH];
+    if (!profile) {
+        profile = &local;
+    }
+
+    tune_cpu_model(cpu_model, sizeof(cpu_model));
+    int loaded = tune_load(profile, path) && strcmp(profile->cpu_model, cpu_model) == 0;
+    if (!loaded) {
+        tune_measure(profile);
+        tune_save(profile, path);
+    }
+
+    tune_apply(profile);
+    return loaded;
+}
@@ -2,8 +2,24 @@
  * util.c - Implementation of utility functions for memory allocation and management
  * Part of Adaptive DCT Image Compressor
  */
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <sys/mman.h>
 #include <utils.h>
 
+#define HUGE_PAGE_SIZE ((size_t) 2 << 20) // x86-64 / arm64 PMD page size
+#define LARGE_ALIGNMENT 64                // Cache line alignment of returned buffers
+
+/**
+ * Bookkeeping stored just before every alloc_large buffer
+ */
+typedef struct {
+    void *base;              // Start of the malloc block or mapping
+    size_t length;           // Mapping length, 0 for malloc blocks
+} LargeHeader;
+
+static int large_pages_mode = LARGE_PAGES_NONE;
+
 // Allocate 2D double array
 double **alloc_array(int rows, int cols) {
     double **new_array = (double **) malloc(rows * sizeof(double *));
@@ -60,3 +76,80 @@ void free_int_array(int **array, int rows) {
     free(array);
 }
 
+
+void set_large_pages(int mode) {
+    large_pages_mode = mode;
+}
+
+int large_pages(void) {
+    return large_pages_mode;
+}
+
+// Round size up to a whole number of huge pages
+static size_t huge_round(size_t size) {
+    return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+// Huge-page aligned anonymous mapping, or NULL when the kernel refuses
+static void* map_huge(size_t length, int explicit_pages) {
+#if defined(MAP_HUGETLB)
+    if (explicit_pages) {
+        void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED) return base;
+    }
+#else
+    (void) explicit_pages;
+#endif
+
+#if defined(MADV_HUGEPAGE)
+    // Over-map by one huge page and trim, so the range starts on a huge page boundary
+    unsigned char *raw = (unsigned char*) mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+    unsigned char *base = (unsigned char*) (((uintptr_t) raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t) (HUGE_PAGE_SIZE - 1));
+    if (base > raw) munmap(raw, (size_t) (base - raw));
+    munmap(base + length, (size_t) (raw + HUGE_PAGE_SIZE - base));
+    madvise(base, length, MADV_HUGEPAGE);
+    return base;
+#else
+    (void) length;
+    return NULL;
+#endif
+}
+
+// Allocate a large buffer, using huge pages when enabled
+void* alloc_large(size_t size) {
+    if (large_pages_mode != LARGE_PAGES_NONE && size >= LARGE_ALLOC_THRESHOLD) {
+        size_t length = huge_round(size + LARGE_ALIGNMENT);
+        unsigned char *base = (unsigned char*) map_huge(length, large_pages_mode == LARGE_PAGES_EXPLICIT);
+        if (base) {
+            LargeHeader *header = (LargeHeader*) (base + LARGE_ALIGNMENT - sizeof(LargeHeader));
+            header->base = base;
+            header->length = length;
+            return base + LARGE_ALIGNMENT;
+        }
+    }
+
+    unsigned char *base = (unsigned char*) malloc(size + LARGE_ALIGNMENT + sizeof(LargeHeader));
+    if (!base) {
+        fprintf(stderr, "Memory allocation failed, when creating large buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    unsigned char *ptr = (unsigned char*) (((uintptr_t) base + sizeof(LargeHeader) + LARGE_ALIGNMENT - 1)
+                                           & ~(uintptr_t) (LARGE_ALIGNMENT - 1));
+    LargeHeader *header = (LargeHeader*) (ptr - sizeof(LargeHeader));
+    header->base = base;
+    header->length = 0;
+    return ptr;
+}
+
+// Free a buffer from alloc_large
+void free_large(void *ptr) {
+    if (!ptr) return;
+    LargeHeader *header = (LargeHeader*) ((unsigned char*) ptr - sizeof(LargeHeader));
+    if (header->length > 0) {
+        munmap(header->base, header->length);
+    } else {
+        free(header->base);
+    }
+}
@@ -0,0 +1,256 @@
+/**
+ * test_adct.cpp - Test file for the header-only C++ interface
+ * Part of Adaptive DCT Image Compressor
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "../include/adct.hpp"
+
+static_assert(adct::SupportedBlockSize<8> && !adct::SupportedBlockSize<12>);
+static_assert(sizeof(adct::BlockView<double, 8>) == sizeof(double *) + sizeof(std::size_t));
+
+// Fill an image with a smooth gradient plus a little texture
+void fill_test_image(unsigned char *pixels, int width, int height) {
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            double value = 128.0 + 60.0 * sin(i / 9.0) * cos(j / 13.0) + (rand() % 16) - 8;
+            pixels[i * width + j] = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+    }
+}
+
+// Test that strided views over a caller plane give exactly the C results
+template <int N>
+bool check_block_views() {
+    const int width = 4 * N;
+    const int height = 3 * N;
+    std::vector<unsigned char> pixels(width * height);
+    fill_test_image(pixels.data(), width, height);
+    std::vector<double> plane(width * height);
+    for (int i = 0; i < width * height; i++) {
+        plane[i] = pixels[i] - 128.0;
+    }
+
+    adct::Encoder<N> encoder(60);
+    adct::Decoder<N> decoder(60);
+    std::vector<double> coeffs(width * height);
+    std::vector<int> quantized(width * height);
+    std::vector<double> restored(width * height);
+
+    // Transform every block in place in the caller's planes
+    for (int br = 0; br < height / N; br++) {
+        for (int bc = 0; bc < width / N; bc++) {
+            auto pixel_view = adct::BlockView<const double, N>::in_plane(plane.data(), width, br, bc);
+            auto coeff_view = adct::BlockView<double, N>::in_plane(coeffs.data(), width, br, bc);
+            auto quant_view = adct::BlockView<int, N>::in_plane(quantized.data(), width, br, bc);
+            auto out_view = adct::BlockView<double, N>::in_plane(restored.data(), width, br, bc);
+            encoder.transform(pixel_view, coeff_view);
+            encoder.quantize(coeff_view, quant_view);
+            decoder.dequantize(quant_view, coeff_view);
+            decoder.inverse(coeff_view, out_view);
+        }
+    }
+
+    // Same blocks through the C API with copied double** blocks
+    DCTContext *dct = dct_init(N);
+    QuantContext *quant = quant_init(N, 60, 0);
+    double **block = alloc_array(N, N);
+    double **coeff_block = alloc_array(N, N);
+    double **out_block = alloc_array(N, N);
+    int **quant_block = alloc_int_array(N, N);
+    bool match = true;
+    for (int br = 0; br < height / N; br++) {
+        for (int bc = 0; bc < width / N; bc++) {
+            for (int i = 0; i < N; i++) {
+                for (int j = 0; j < N; j++) {
+                    block[i][j] = plane[(br * N + i) * width + bc * N + j];
+                }
+            }
+            dct_forward(dct, block, coeff_block);
+            quantize(quant, coeff_block, quant_block, 0.0);
+            dequantize(quant, quant_block, coeff_block, 0.0);
+            dct_inverse(dct, coeff_block, out_block);
+            for (int i = 0; i < N; i++) {
+                for (int j = 0; j < N; j++) {
+                    int index = (br * N + i) * width + bc * N + j;
+                    match = match && quantized[index] == quant_block[i][j] && restored[index] == out_block[i][j];
+                }
+            }
+        }
+    }
+
+    free_array(block, N);
+    free_array(coeff_block, N);
+    free_array(out_block, N);
+    free_int_array(quant_block, N);
+    dct_free(dct);
+    quant_free(quant);
+    return match;
+}
+
+void test_block_views(void) {
+    printf("=== Testing Block Views ===\n");
+
+    bool ok4 = check_block_views<4>();
+    bool ok8 = check_block_views<8>();
+    bool ok16 = check_block_views<16>();
+    bool ok32 = check_block_views<32>();
+    printf("4x4 %d, 8x8 %d, 16x16 %d, 32x32 %d\n", ok4, ok8, ok16, ok32);
+
+    // A packed std::array converts to a block view directly
+    std::array<double, 64> packed{};
+    packed[0] = 64.0;
+    std::array<double, 64> out{};
+    adct::Encoder<8> encoder;
+    encoder.transform(adct::BlockView<double, 8>(std::span<double, 64>(packed)), adct::BlockView<double, 8>(out.data()));
+    bool packed_ok = fabs(out[0] - 8.0) < 1e-9;
+
+    if (ok4 && ok8 && ok16 && ok32 && packed_ok) {
+        printf("Block view test PASSED!\n\n");
+    } else {
+        printf("Block view test FAILED!\n\n");
+    }
+}
+
+// Test that threads can share one encoder and decoder, and that the
+// transforms follow the matrix kernel whatever kernel is the default
+void test_shared_transforms(void) {
+    printf("=== Testing Shared Transforms ===\n");
+
+    const int N = 8;
+    const int blocks = 256;
+    std::vector<double> plane(blocks * N * N);
+    for (std::size_t i = 0; i < plane.size(); i++) {
+        plane[i] = (rand() % 256) - 128.0;
+    }
+
+    // Reference results from the C matrix kernel
+    dct_set_default_kernel(N, DCT_KERNEL_MATRIX);
+    DCTContext *dct = dct_init(N);
+    double **block = alloc_array(N, N);
+    double **coeff_block = alloc_array(N, N);
+    double **out_block = alloc_array(N, N);
+    std::vector<double> expected_coeffs(plane.size());
+    std::vector<double> expected_pixels(plane.size());
+    for (int b = 0; b < blocks; b++) {
+        for (int i = 0; i < N; i++) {
+            for (int j = 0; j < N; j++) {
+                block[i][j] = plane[b * N * N + i * N + j];
+            }
+        }
+        dct_forward(dct, block, coeff_block);
+        dct_inverse(dct, coeff_block, out_block);
+        for (int i = 0; i < N; i++) {
+            for (int j = 0; j < N; j++) {
+                expected_coeffs[b * N * N + i * N + j] = coeff_block[i][j];
+                expected_pixels[b * N * N + i * N + j] = out_block[i][j];
+            }
+        }
+    }
+    free_array(block, N);
+    free_array(coeff_block, N);
+    free_array(out_block, N);
+    dct_free(dct);
+
+    // Encoder and decoder built while another kernel is the default
+    dct_set_default_kernel(N, DCT_KERNEL_FACTORIZED);
+    const adct::Encoder<N> encoder;
+    const adct::Decoder<N> decoder;
+    dct_set_default_kernel(N, DCT_KERNEL_MATRIX);
+
+    // Four threads run every block through the shared pair, in place
+    const int thread_count = 4;
+    std::vector<std::vector<double>> coeffs(thread_count, std::vector<double>(plane.size()));
+    std::vector<std::vector<double>> pixels(thread_count, std::vector<double>(plane.size()));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.emplace_back([&, t] {
+            for (int round = 0; round < 20; round++) {
+                for (int b = 0; b < blocks; b++) {
+                    adct::BlockView<double, N> coeff_view(coeffs[t].data() + b * N * N);
+                    adct::BlockView<double, N> pixel_view(pixels[t].data() + b * N * N);
+                    std::copy_n(plane.begin() + b * N * N, N * N, pixels[t].begin() + b * N * N);
+                    encoder.transform(pixel_view, pixel_view);
+                    std::copy_n(pixels[t].begin() + b * N * N, N * N, coeffs[t].begin() + b * N * N);
+                    decoder.inverse(coeff_view, pixel_view);
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    bool match = true;
+    for (int t = 0; t < thread_count; t++) {
+        match = match && coeffs[t] == expected_coeffs && pixels[t] == expected_pixels;
+    }
+    printf("%d threads x %d blocks, exact match %d\n", thread_count, blocks, match);
+
+    if (match) {
+        printf("Shared transforms test PASSED!\n\n");
+    } else {
+        printf("Shared transforms test FAILED!\n\n");
+    }
+}
+
+// Test that whole-image encode/decode matches the C codec and owns its results
+void test_codec(void) {
+    printf("=== Testing Encoder / Decoder ===\n");
+
+    int width = 100;
+    int height = 70;
+    std::vector<unsigned char> pixels(width * height);
+    fill_test_image(pixels.data(), width, height);
+
+    CodecParams params = codec_default_params();
+    params.block_size = 16;
+    size_t c_size;
+    unsigned char *c_stream = codec_encode(pixels.data(), width, height, &params, &c_size);
+    int c_width, c_height;
+    unsigned char *c_pixels = codec_decode(c_stream, c_size, &c_width, &c_height);
+
+    adct::Encoder<16> encoder(params.quality);
+    adct::Decoder<16> decoder(params.quality);
+    adct::Stream stream = encoder.encode({pixels, width, height});
+    adct::Image image = decoder.decode(stream.bytes());
+
+    bool same_stream = stream && stream.size() == c_size && memcmp(stream.data(), c_stream, c_size) == 0;
+    bool same_image = image && image.width() == c_width && image.height() == c_height &&
+                      memcmp(image.data(), c_pixels, image.size()) == 0;
+
+    // Invalid input yields empty results rather than errors
+    adct::Stream short_input = encoder.encode({std::span<const unsigned char>(pixels).first(10), width, height});
+    unsigned char garbage[16] = {0};
+    adct::Image bad_stream = decoder.decode(garbage);
+    bool empty_on_error = !short_input && !bad_stream && bad_stream.width() == 0;
+
+    printf("Stream %zu bytes (C %zu), same stream %d, same image %d, empty on error %d\n",
+           stream.size(), c_size, same_stream, same_image, empty_on_error);
+    free(c_stream);
+    free(c_pixels);
+
+    if (same_stream && same_image && empty_on_error) {
+        printf("Encoder / Decoder test PASSED!\n\n");
+    } else {
+        printf("Encoder / Decoder test FAILED!\n\n");
+    }
+}
+
+int main(void) {
+    printf("======================================\n");
+    printf("     C++ Interface Tests\n");
+    printf("======================================\n\n");
+
+    test_block_views();
+    test_shared_transforms();
+    test_codec();
+
+    printf("All tests completed!\n");
+    return 0;
+}
@@ -0,0 +1,227 @@
+/**
+ * test_blockify.c - Test file for raster / block-major reordering
+ * Part of Adaptive DCT Image Compressor
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/blockify.h"
+
+// Straightforward per-sample reference for blockify
+static void reference_blockify(const unsigned char *plane, size_t stride, int width, int height,
+                               int n, int cols, int rows, short *blocks) {
+    for (int by = 0; by < rows; by++) {
+        for (int bx = 0; bx < cols; bx++) {
+            short *block = blocks + ((size_t) by * cols + bx) * n * n;
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    int r = by * n + i < height ? by * n + i : height - 1;
+                    int c = bx * n + j < width ? bx * n + j : width - 1;
+                    block[i * n + j] = (short) (plane[(size_t) r * stride + c] - 128);
+                }
+            }
+        }
+    }
+}
+
+// Test blockify against the reference, including edge replication and a wider stride
+void test_blockify(void) {
+    printf("=== Testing Blockify ===\n");
+
+    int sizes[4] = {4, 8, 16, 32};
+    int widths[3] = {64, 37, 5};
+    int heights[2] = {32, 21};
+    size_t stride = 80;
+    unsigned char *plane = (unsigned char*)malloc(stride * 64);
+    for (size_t i = 0; i < stride * 64; i++) {
+        plane[i] = (unsigned char) ((i * 37 + (i >> 5)) & 0xFF);
+    }
+
+    int ok = 1;
+    for (int s = 0; s < 4; s++) {
+        for (int w = 0; w < 3; w++) {
+            for (int h = 0; h < 2; h++) {
+                int n = sizes[s];
+                int cols = (widths[w] + n - 1) / n;
+                int rows = (heights[h] + n - 1) / n;
+                size_t count = (size_t) cols * rows * n * n;
+                short *expected = (short*)malloc(count * sizeof(short));
+                short *actual = (short*)malloc(count * sizeof(short));
+
+                reference_blockify(plane, stride, widths[w], heights[h], n, cols, rows, expected);
+                blockify(plane, stride, widths[w], heights[h], n, cols, rows, actual);
+                if (memcmp(expected, actual, count * sizeof(short)) != 0) {
+                    printf("Mismatch: block %d, width %d, height %d\n", n, widths[w], heights[h]);
+                    ok = 0;
+                }
+
+                free(expected);
+                free(actual);
+            }
+        }
+    }
+    free(plane);
+
+    if (ok) {
+        printf("Blockify test PASSED!\n\n");
+    } else {
+        printf("Blockify test FAILED!\n\n");
+    }
+}
+
+// Test that unblockify inverts blockify, crops at the edges and saturates
+void test_unblockify(void) {
+    printf("=== Testing Unblockify ===\n");
+
+    int sizes[4] = {4, 8, 16, 32};
+    int width = 45;
+    int height = 27;
+    size_t stride = 48;
+    unsigned char *plane = (unsigned char*)malloc(stride * 64);
+    unsigned char *restored = (unsigned char*)malloc(stride * 64);
+    for (size_t i = 0; i < stride * 64; i++) {
+        plane[i] = (unsigned char) ((i * 91 + 13) & 0xFF);
+    }
+
+    int ok = 1;
+    for (int s = 0; s < 4; s++) {
+        int n = sizes[s];
+        int cols = (width + n - 1) / n;
+        int rows = (height + n - 1) / n;
+        short *blocks = (short*)malloc((size_t) cols * rows * n * n * sizeof(short));
+
+        // Round trip; bytes outside the width x height region stay untouched
+        memset(restored, 0xAA, stride * 64);
+        blockify(plane, stride, width, height, n, cols, rows, blocks);
+        unblockify(blocks, n, cols, rows, restored, stride, width, height);
+        for (int i = 0; i < 64; i++) {
+            for (size_t j = 0; j < stride; j++) {
+                unsigned char expected = (i < height && (int) j < width) ? plane[i * stride + j] : 0xAA;
+                if (restored[i * stride + j] != expected) ok = 0;
+            }
+        }
+
+        // Out-of-range samples clamp to 0 and 255
+        for (size_t k = 0; k < (size_t) cols * rows * n * n; k++) {
+            blocks[k] = (short) (k % 2 ? 30000 : -30000);
+        }
+        unblockify(blocks, n, cols, rows, restored, stride, width, height);
+        for (int i = 0; i < height; i++) {
+            for (int j = 0; j < width; j++) {
+                int c = j % n;
+                int r = i % n;
+                unsigned char expected = ((r * n + c) % 2) ? 255 : 0;
+                if (restored[i * stride + j] != expected) ok = 0;
+            }
+        }
+
+        if (!ok) {
+            printf("Mismatch at block size %d\n", n);
+            break;
+        }
+        free(blocks);
+    }
+    free(plane);
+    free(restored);
+
+    if (ok) {
+        printf("Unblockify test PASSED!\n\n");
+    } else {
+        printf("Unblockify test FAILED!\n\n");
+    }
+}
+
+// Test the 16-bit variants against per-sample loops, with edge replication and saturation
+void test_blockify16(void) {
+    printf("=== Testing 16-bit Blockify ===\n");
+
+    int sizes[4] = {4, 8, 16, 32};
+    int depths[3] = {10, 12, 16};
+    int width = 45;
+    int height = 27;
+    size_t stride = 53;
+    unsigned short *plane = (unsigned short*)malloc(stride * 64 * sizeof(unsigned short));
+    unsigned short *restored = (unsigned short*)malloc(stride * 64 * sizeof(unsigned short));
+
+    int ok = 1;
+    for (int d = 0; d < 3; d++) {
+        int depth = depths[d];
+        int bias = 1 << (depth - 1);
+        int max = (1 << depth) - 1;
+        for (size_t i = 0; i < stride * 64; i++) {
+            plane[i] = (unsigned short) ((i * 7919 + 13) & max);
+        }
+        plane[0] = 0;
+        plane[1] = (unsigned short) max;
+
+        for (int s = 0; s < 4; s++) {
+            int n = sizes[s];
+            int cols = (width + n - 1) / n;
+            int rows = (height + n - 1) / n;
+            size_t count = (size_t) cols * rows * n * n;
+            short *blocks = (short*)malloc(count * sizeof(short));
+            blockify16(plane, stride, width, height, depth, n, cols, rows, blocks);
+            for (int by = 0; by < rows; by++) {
+                for (int bx = 0; bx < cols; bx++) {
+                    for (int i = 0; i < n; i++) {
+                        for (int j = 0; j < n; j++) {
+                            int r = by * n + i < height ? by * n + i : height - 1;
+                            int c = bx * n + j < width ? bx * n + j : width - 1;
+                            short expected = (short) (plane[(size_t) r * stride + c] - bias);
+                            if (blocks[((size_t) by * cols + bx) * n * n + (size_t) i * n + j] != expected) ok = 0;
+                        }
+                    }
+                }
+            }
+
+            // Round trip leaves the rest of the plane alone
+            for (size_t i = 0; i < stride * 64; i++) restored[i] = 0xAAAA;
+            unblockify16(blocks, n, cols, rows, depth, restored, stride, width, height);
+            for (int i = 0; i < 64; i++) {
+                for (size_t j = 0; j < stride; j++) {
+                    unsigned short expected = (i < height && (int) j < width) ? plane[i * stride + j] : 0xAAAA;
+                    if (restored[i * stride + j] != expected) ok = 0;
+                }
+            }
+
+            // Out-of-range samples clamp to 0 and the largest sample
+            for (size_t k = 0; k < count; k++) {
+                blocks[k] = (short) (k % 2 ? 32767 : -32768);
+            }
+            unblockify16(blocks, n, cols, rows, depth, restored, stride, width, height);
+            for (int i = 0; i < height; i++) {
+                for (int j = 0; j < width; j++) {
+                    unsigned short expected = (unsigned short) ((((i % n) * n + j % n) % 2) ? max : 0);
+                    if (restored[i * stride + j] != expected) ok = 0;
+                }
+            }
+            free(blocks);
+
+            if (!ok) {
+                printf("Mismatch at block size %d, depth %d\n", n, depth);
+                break;
+            }
+        }
+    }
+    free(plane);
+    free(restored);
+
+    if (ok) {
+        printf("16-bit blockify test PASSED!\n\n");
+    } else {
+        printf("16-bit blockify test FAILED!\n\n");
+    }
+}
+
+int main(void) {
+    printf("======================================\n");
+    printf("     Blockify Tests\n");
+    printf("======================================\n\n");
+
+    test_blockify();
+    test_unblockify();
+    test_blockify16();
+
+    printf("All tests completed!\n");
+    return 0;
+}
@@ -0,0 +1,1124 @@
+/**
+ * test_codec.c - Test file for the plane-level image codec
+ * Part of Adaptive DCT Image Compressor
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+#include <utils.h>
+#include "../include/codec.h"
+
+// Fill an image with a smooth gradient plus a little texture
+void fill_test_image(unsigned char *pixels, int width, int height) {
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            double value = 128.0 + 60.0 * sin(i / 9.0) * cos(j / 13.0) + (rand() % 16) - 8;
+            pixels[i * width + j] = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+    }
+}
+
+// Test encode/decode round trip across block sizes and settings
+void test_round_trip(void) {
+    printf("=== Testing Codec Round Trip ===\n");
+
+    int width = 100;
+    int height = 75;
+    unsigned char *pixels = (unsigned char*)malloc(width * height);
+    fill_test_image(pixels, width, height);
+
+    int block_sizes[] = {4, 8, 16, 32};
+    for (int i = 0; i < 4; i++) {
+        for (int mode = 0; mode < 3; mode++) {
+            CodecParams params = codec_default_params();
+            params.block_size = block_sizes[i];
+            params.adaptive = mode == 1;
+            params.optimize_huffman = mode != 1;
+            params.approximate_dct = mode == 2;
+            params.tile_size = 32;
+
+            size_t size;
+            unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+
+            int decoded_width, decoded_height;
+            unsigned char *decoded = codec_decode(stream, size, &decoded_width, &decoded_height);
+
+            double psnr = decoded ? plane_psnr(pixels, decoded, (size_t) width * height) : 0.0;
+            printf("Block %2d, adaptive %d, approximate %d: %6zu bytes, %.2f bpp, PSNR %.2f dB\n",
+                   block_sizes[i], params.adaptive, params.approximate_dct,
+                   size, size * 8.0 / (width * height), psnr);
+
+            if (decoded && decoded_width == width && decoded_height == height && psnr > 28.0) {
+                printf("Round trip test PASSED!\n");
+            } else {
+                printf("Round trip test FAILED!\n");
+            }
+
+            free(stream);
+            free(decoded);
+        }
+    }
+    printf("\n");
+
+    free(pixels);
+}
+
+// Test that dirty-rectangle re-encoding matches a full encode of the new image
+void test_dirty_reencode(void) {
+    printf("=== Testing Dirty Rectangle Re-encode ===\n");
+
+    int width = 200;
+    int height = 150;
+    unsigned char *pixels = (unsigned char*)malloc(width * height);
+    fill_test_image(pixels, width, height);
+
+    CodecParams params = codec_default_params();
+    params.tile_size = 64;
+
+    size_t old_size;
+    unsigned char *old_stream = codec_encode(pixels, width, height, &params, &old_size);
+
+    // Paint two rectangles, one crossing a tile boundary
+    CodecRect rects[2] = {{10, 10, 20, 15}, {120, 50, 30, 40}};
+    for (int r = 0; r < 2; r++) {
+        for (int i = rects[r].y; i < rects[r].y + rects[r].height; i++) {
+            for (int j = rects[r].x; j < rects[r].x + rects[r].width; j++) {
+                pixels[i * width + j] = (unsigned char) (255 - pixels[i * width + j]);
+            }
+        }
+    }
+
+    size_t new_size;
+    unsigned char *new_stream = codec_reencode_dirty(old_stream, old_size, pixels, rects, 2, &new_size);
+
+    size_t full_size;
+    unsigned char *full_stream = codec_encode(pixels, width, height, &params, &full_size);
+
+    printf("Old stream: %zu bytes, spliced: %zu bytes, full re-encode: %zu bytes\n",
+           old_size, new_size, full_size);
+
+    if (new_stream && new_size == full_size && memcmp(new_stream, full_stream, full_size) == 0) {
+        printf("Dirty re-encode test PASSED! Spliced stream matches full encode.\n");
+    } else {
+        printf("Dirty re-encode test FAILED! Spliced stream differs from full encode.\n");
+    }
+
+    int decoded_width, decoded_height;
+    unsigned char *decoded = codec_decode(new_stream, new_size, &decoded_width, &decoded_height);
+    double psnr = decoded ? plane_psnr(pixels, decoded, (size_t) width * height) : 0.0;
+    printf("Spliced stream PSNR: %.2f dB\n", psnr);
+    if (psnr > 28.0) {
+        printf("Spliced decode test PASSED!\n");
+    } else {
+        printf("Spliced decode test FAILED!\n");
+    }
+
+    // A rectangle running to INT_MAX clips to the image edge instead of wrapping
+    CodecRect corner = {150, 100, INT_MAX, INT_MAX};
+    for (int i = corner.y; i < height; i++) {
+        for (int j = corner.x; j < width; j++) {
+            pixels[i * width + j] = (unsigned char) (255 - pixels[i * width + j]);
+        }
+    }
+    size_t corner_size;
+    unsigned char *corner_stream = codec_reencode_dirty(new_stream, new_size, pixels, &corner, 1, &corner_size);
+    size_t corner_full_size;
+    unsigned char *corner_full = codec_encode(pixels, width, height, &params, &corner_full_size);
+    if (corner_stream && corner_size == corner_full_size && memcmp(corner_stream, corner_full, corner_size) == 0) {
+        printf("Oversized rectangle test PASSED!\n\n");
+    } else {
+        printf("Oversized rectangle test FAILED!\n\n");
+    }
+
+    free(pixels);
+    free(old_stream);
+    free(new_stream);
+    free(full_stream);
+    free(decoded);
+    free(corner_stream);
+    free(corner_full);
+}
+
+// Test quadtree block-size selection on an image mixing flat, smooth and busy areas
+void test_quadtree(void) {
+    printf("=== Testing Quadtree Block Sizes ===\n");
+
+    int width = 128;
+    int height = 96;
+    unsigned char *pixels = (unsigned char*)malloc(width * height);
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            double value;
+            if (j < 64) {
+                value = 90.0 + 0.5 * i;                          // Smooth ramp
+            } else if (i < 48) {
+                value = ((i / 4 + j / 4) % 2) ? 40.0 : 210.0;    // Sharp checkerboard
+            } else {
+                value = 128.0 + 50.0 * sin(j / 2.0) + (rand() % 20);
+            }
+            pixels[i * width + j] = (unsigned char) (value > 255 ? 255 : value);
+        }
+    }
+
+    CodecParams params = codec_default_params();
+    size_t fixed_size;
+    unsigned char *fixed_stream = codec_encode(pixels, width, height, &params, &fixed_size);
+
+    params.quadtree = 1;
+    size_t size;
+    unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+
+    int decoded_width, decoded_height;
+    unsigned char *decoded = codec_decode(stream, size, &decoded_width, &decoded_height);
+    double psnr = decoded ? plane_psnr(pixels, decoded, (size_t) width * height) : 0.0;
+
+    printf("Fixed 8x8: %zu bytes, quadtree: %zu bytes, quadtree PSNR %.2f dB\n", fixed_size, size, psnr);
+
+    if (decoded && psnr > 28.0) {
+        printf("Quadtree round trip test PASSED!\n\n");
+    } else {
+        printf("Quadtree round trip test FAILED!\n\n");
+    }
+
+    free(pixels);
+    free(fixed_stream);
+    free(stream);
+    free(decoded);
+}
+
+// Test that target-quality encoding meets its floor at a smaller size than needed
+// Metric of a plain encode/decode at one quality
+static double measure_quality(const unsigned char *pixels, int width, int height, CodecParams params,
+                              int quality, int metric) {
+    params.quality = quality;
+    size_t size;
+    unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+    int decoded_width, decoded_height;
+    unsigned char *decoded = codec_decode(stream, size, &decoded_width, &decoded_height);
+    double value = metric == CODEC_TARGET_SSIM ? plane_ssim(pixels, decoded, width, height)
+                                               : plane_psnr(pixels, decoded, (size_t) width * height);
+    free(stream);
+    free(decoded);
+    return value;
+}
+
+void test_target_quality(void) {
+    printf("=== Testing Target Quality ===\n");
+
+    int width = 160;
+    int height = 120;
+    unsigned char *pixels = (unsigned char*)malloc(width * height);
+    fill_test_image(pixels, width, height);
+
+    // A smooth plane where the 8x8 estimate is pessimistic for quadtree
+    // encodes, so the search has to come down from it
+    int smooth_width = 256;
+    int smooth_height = 256;
+    unsigned char *smooth = (unsigned char*)malloc(smooth_width * smooth_height);
+    for (int i = 0; i < smooth_height; i++) {
+        for (int j = 0; j < smooth_width; j++) {
+            smooth[i * smooth_width + j] = (unsigned char) (128 + 60 * sin(i / 20.0) * cos(j / 25.0));
+        }
+    }
+
+    CodecTarget targets[5] = {{CODEC_TARGET_PSNR, 36.0}, {CODEC_TARGET_PSNR, 30.0}, {CODEC_TARGET_SSIM, 0.95},
+                              {CODEC_TARGET_PSNR, 30.0}, {CODEC_TARGET_SSIM, 0.93}};
+    for (int t = 0; t < 5; t++) {
+        for (int quadtree = 0; quadtree < 2; quadtree++) {
+            CodecParams params = codec_default_params();
+            params.quadtree = quadtree;
+            const unsigned char *image = t < 3 ? pixels : smooth;
+            int image_width = t < 3 ? width : smooth_width;
+            int image_height = t < 3 ? height : smooth_height;
+
+            CodecTargetResult result;
+            size_t size;
+            unsigned char *stream = codec_encode_target(image, image_width, image_height, &params, &targets[t],
+                                                        &result, &size);
+
+            int decoded_width, decoded_height;
+            unsigned char *decoded = codec_decode(stream, size, &decoded_width, &decoded_height);
+            double measured = targets[t].metric == CODEC_TARGET_SSIM
+                              ? plane_ssim(image, decoded, image_width, image_height)
+                              : plane_psnr(image, decoded, (size_t) image_width * image_height);
+
+            // The next lower quality must miss the target
+            int lowest = result.quality == 1 ||
+                         measure_quality(image, image_width, image_height, params, result.quality - 1,
+                                         targets[t].metric) < targets[t].threshold;
+
+            printf("%s >= %.2f, quadtree %d: quality %d, %zu bytes, achieved %.4f (%d estimates, %d encodes)\n",
+                   targets[t].metric == CODEC_TARGET_SSIM ? "SSIM" : "PSNR", targets[t].threshold, quadtree,
+                   result.quality, size, measured, result.estimates, result.encodes);
+
+            if (measured >= targets[t].threshold && fabs(measured - result.achieved) < 1e-9 &&
+                result.quality < 100 && lowest) {
+                printf("Target quality test PASSED!\n");
+            } else {
+                printf("Target quality test FAILED!\n");
+            }
+
+            free(stream);
+            free(decoded);
+        }
+    }
+    printf("\n");
+
+    free(pixels);
+    free(smooth);
+}
+
+// Test that a time budget sheds effort but still produces a valid stream
+void test_deadline(void) {
+    printf("=== Testing Encode Deadline ===\n");
+
+    int width = 256;
+    int height = 192;
+    unsigned char *pixels = (unsigned char*)malloc(width * height);
+    fill_test_image(pixels, width, height);
+
+    CodecParams params = codec_default_params();
+    params.quadtree = 1;
+    params.adaptive = 1;
+
+    double budgets[2] = {0.0, 1e-6};
+    int expected[2] = {CODEC_EFFORT_FULL, CODEC_EFFORT_STATIC_QUANT};
+    for (int i = 0; i < 2; i++) {
+        params.time_budget_ms = budgets[i];
+        CodecEncodeStats stats;
+        size_t size;
+        unsigned char *stream = codec_encode_with_stats(pixels, width, height, &params, &stats, &size);
+
+        int decoded_width, decoded_height;
+        unsigned char *decoded = codec_decode(stream, size, &decoded_width, &decoded_height);
+        double psnr = decoded ? plane_psnr(pixels, decoded, (size_t) width * height) : 0.0;
+
+        printf("Budget %g ms: effort %d, %zu of %zu rows degraded, %.2f ms, %zu bytes, PSNR %.2f dB\n",
+               budgets[i], stats.effort, stats.degraded_rows, stats.total_rows, stats.elapsed_ms, size, psnr);
+
+        if (decoded && stats.effort == expected[i] && psnr > 28.0) {
+            printf("Deadline test PASSED!\n");
+        } else {
+            printf("Deadline test FAILED!\n");
+        }
+
+        free(stream);
+        free(decoded);
+    }
+    printf("\n");
+
+    free(pixels);
+}
+
+static int toggling;
+
+// Flip the traversal order until told to stop
+static void* toggle_traversal(void *arg) {
+    (void) arg;
+    for (int k = 0; __atomic_load_n(&toggling, __ATOMIC_ACQUIRE); k++) {
+        codec_set_traversal(k % 2 ? CODEC_TRAVERSAL_MORTON : CODEC_TRAVERSAL_RASTER);
+    }
+    return NULL;
+}
+
+// Test that Morton traversal changes neither the stream nor the decoded pixels
+void test_traversal(void) {
+    printf("=== Testing Block Traversal Order ===\n");
+
+    int width = 300;
+    int height = 170;
+    unsigned char *pixels = (unsigned char*)malloc(width * height);
+    fill_test_image(pixels, width, height);
+
+    int block_sizes[] = {4, 8, 16, 32};
+    int tile_sizes[] = {0, 96};
+    int ok = 1;
+    for (int i = 0; i < 4; i++) {
+        for (int t = 0; t < 2; t++) {
+            CodecParams params = codec_default_params();
+            params.block_size = block_sizes[i];
+            params.tile_size = tile_sizes[t];
+            params.adaptive = i % 2;
+
+            size_t raster_size, morton_size;
+            codec_set_traversal(CODEC_TRAVERSAL_RASTER);
+            unsigned char *raster = codec_encode(pixels, width, height, &params, &raster_size);
+            codec_set_traversal(CODEC_TRAVERSAL_MORTON);
+            unsigned char *morton = codec_encode(pixels, width, height, &params, &morton_size);
+
+            int w, h;
+            unsigned char *morton_decoded = codec_decode(raster, raster_size, &w, &h);
+            codec_set_traversal(CODEC_TRAVERSAL_RASTER);
+            unsigned char *raster_decoded = codec_decode(raster, raster_size, &w, &h);
+
+            int same_stream = raster_size == morton_size && memcmp(raster, morton, raster_size) == 0;
+            int same_pixels = raster_decoded && morton_decoded &&
+                              memcmp(raster_decoded, morton_decoded, (size_t) width * height) == 0;
+            if (!same_stream || !same_pixels) {
+                printf("Block %d, tile %d: same stream %d, same pixels %d\n",
+                       block_sizes[i], tile_sizes[t], same_stream, same_pixels);
+                ok = 0;
+            }
+
+            free(raster);
+            free(morton);
+            free(raster_decoded);
+            free(morton_decoded);
+        }
+    }
+
+    // Changing the order while other threads code leaves their output alone
+    CodecParams params = codec_default_params();
+    params.tile_size = 0;
+    size_t expected_size, size;
+    int w, h;
+    unsigned char *expected = codec_encode(pixels, width, height, &params, &expected_size);
+    unsigned char *expected_pixels = codec_decode(expected, expected_size, &w, &h);
+    pthread_t toggler;
+    __atomic_store_n(&toggling, 1, __ATOMIC_RELEASE);
+    pthread_create(&toggler, NULL, toggle_traversal, NULL);
+    for (int r = 0; r < 4 && ok; r++) {
+        unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+        unsigned char *decoded = codec_decode_parallel(expected, expected_size, 2, &w, &h);
+        ok = stream && decoded && size == expected_size && memcmp(stream, expected, size) == 0 &&
+             memcmp(decoded, expected_pixels, (size_t) width * height) == 0;
+        free(stream);
+        free(decoded);
+    }
+    __atomic_store_n(&toggling, 0, __ATOMIC_RELEASE);
+    pthread_join(toggler, NULL);
+    codec_set_traversal(CODEC_TRAVERSAL_RASTER);
+    free(expected);
+    free(expected_pixels);
+
+    if (ok && codec_traversal() == CODEC_TRAVERSAL_RASTER) {
+        printf("Traversal test PASSED!\n\n");
+    } else {
+        printf("Traversal test FAILED!\n\n");
+    }
+
+    free(pixels);
+}
+
+// Test the worst-case size bound and encoding into a caller buffer
+void test_encode_into(void) {
+    printf("=== Testing Output Bound / Encode Into ===\n");
+
+    // Full-range noise is close to the worst case for the entropy coder
+    int width = 203;
+    int height = 117;
+    unsigned char *pixels = (unsigned char*)malloc((size_t) width * height);
+    for (int i = 0; i < width * height; i++) {
+        pixels[i] = (unsigned char) (rand() & 0xFF);
+    }
+
+    int ok = 1;
+    double worst_ratio = 0.0;
+    for (int config = 0; config < 8; config++) {
+        CodecParams params = codec_default_params();
+        params.quality = 100;
+        params.block_size = 4 << (config % 4);
+        params.adaptive = config % 2;
+        params.optimize_huffman = config < 4;
+        params.quadtree = config == 7;
+        params.tile_size = config % 3 == 0 ? 0 : 64;
+
+        size_t bound = codec_max_compressed_size(width, height, &params);
+        size_t size;
+        unsigned char *expected = codec_encode(pixels, width, height, &params, &size);
+        unsigned char *output = (unsigned char*)malloc(bound);
+
+        // Exactly-sized buffers work, one byte less is refused
+        size_t into = codec_encode_into(pixels, width, height, &params, output, bound);
+        int same = expected && into == size && memcmp(output, expected, size) == 0;
+        size_t exact = codec_encode_into(pixels, width, height, &params, output, size);
+        same = same && memcmp(output, expected, size) == 0;
+        size_t short_by_one = codec_encode_into(pixels, width, height, &params, output, size - 1);
+        if (!same || size > bound || exact != size || short_by_one != 0) {
+            printf("Config %d: size %zu, bound %zu, into %zu, exact %zu\n", config, size, bound, into, exact);
+            ok = 0;
+        }
+        if ((double) size / bound > worst_ratio) worst_ratio = (double) size / bound;
+
+        free(expected);
+        free(output);
+    }
+
+    // Invalid parameters have no bound
+    CodecParams bad = codec_default_params();
+    bad.block_size = 12;
+    int invalid = codec_max_compressed_size(width, height, &bad) == 0 &&
+                  codec_encode_into(pixels, width, height, &bad, pixels, 1) == 0;
+    printf("Largest stream / bound: %.2f, invalid parameters rejected %d\n", worst_ratio, invalid);
+    free(pixels);
+
+    if (ok && invalid) {
+        printf("Encode into test PASSED!\n\n");
+    } else {
+        printf("Encode into test FAILED!\n\n");
+    }
+}
+
+// Test that huge-page backed buffers change nothing but where memory comes from
+void test_large_pages(void) {
+    printf("=== Testing Huge-Page Buffers ===\n");
+
+    // One untiled plane, so the tile coefficient buffer crosses LARGE_ALLOC_THRESHOLD
+    int width = 1100;
+    int height = 1000;
+    unsigned char *pixels = (unsigned char*)malloc((size_t) width * height);
+    fill_test_image(pixels, width, height);
+    CodecParams params = codec_default_params();
+    params.tile_size = 0;
+
+    size_t reference_size;
+    unsigned char *reference = codec_encode(pixels, width, height, &params, &reference_size);
+    int modes[2] = {LARGE_PAGES_TRANSPARENT, LARGE_PAGES_EXPLICIT};
+    int ok = reference != NULL;
+    for (int m = 0; m < 2; m++) {
+        set_large_pages(modes[m]);
+
+        // Buffers on both sides of the threshold are aligned and fully writable
+        size_t sizes[2] = {1000, LARGE_ALLOC_THRESHOLD + 12345};
+        for (int s = 0; s < 2; s++) {
+            unsigned char *buffer = (unsigned char*)alloc_large(sizes[s]);
+            memset(buffer, 0x5A, sizes[s]);
+            if (((size_t) buffer % 64) != 0 || buffer[sizes[s] - 1] != 0x5A) ok = 0;
+            free_large(buffer);
+        }
+        free_large(NULL);
+
+        size_t size;
+        unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+        int w, h;
+        unsigned char *decoded = codec_decode(stream, size, &w, &h);
+        int same = stream && size == reference_size && memcmp(stream, reference, size) == 0 && decoded;
+        if (!same) {
+            printf("Mode %d: stream differs from the malloc-backed encoder\n", modes[m]);
+            ok = 0;
+        }
+        free(stream);
+        free(decoded);
+    }
+    set_large_pages(LARGE_PAGES_NONE);
+
+    if (ok && large_pages() == LARGE_PAGES_NONE) {
+        printf("Huge-page buffer test PASSED!\n\n");
+    } else {
+        printf("Huge-page buffer test FAILED!\n\n");
+    }
+
+    free(reference);
+    free(pixels);
+}
+
+// Test that strip-wise encoding from a file matches the in-memory encoder
+void test_encode_file(void) {
+    printf("=== Testing Out-of-Core Encoding ===\n");
+
+    int width = 333;
+    int height = 201;
+    const char *prefix = "P5 333 201 255\n";
+    size_t prefix_size = strlen(prefix);
+    unsigned char *pixels = (unsigned char*)malloc(width * height);
+    fill_test_image(pixels, width, height);
+
+    FILE *file = fopen("test_codec_input.pgm", "wb");
+    fwrite(prefix, 1, prefix_size, file);
+    fwrite(pixels, 1, (size_t) width * height, file);
+    fclose(file);
+
+    int ok = 1;
+    for (int mode = 0; mode < 2; mode++) {
+        CodecParams params = codec_default_params();
+        params.tile_size = 96;
+        params.quadtree = mode;
+        params.adaptive = mode;
+
+        size_t size;
+        unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+        unsigned long long file_size = 0;
+        int encoded = codec_encode_file("test_codec_input.pgm", prefix_size, width, height, &params,
+                                        "test_codec_output.adct", &file_size);
+
+        unsigned char *written = (unsigned char*)malloc(size);
+        file = fopen("test_codec_output.adct", "rb");
+        size_t read = file ? fread(written, 1, size, file) : 0;
+        int at_end = file && fgetc(file) == EOF;
+        if (file) fclose(file);
+
+        int same = encoded && file_size == size && read == size && at_end && memcmp(stream, written, size) == 0;
+        printf("%s: %zu bytes in memory, %llu bytes from file, identical %d\n",
+               mode ? "Quadtree" : "Fixed blocks", size, file_size, same);
+        ok = ok && same;
+        free(stream);
+        free(written);
+    }
+
+    // Missing tiles, short input and a tile count past 32 bits are all refused
+    CodecParams params = codec_default_params();
+    params.tile_size = 0;
+    int untiled = !codec_encode_file("test_codec_input.pgm", prefix_size, width, height, &params,
+                                     "test_codec_output.adct", NULL);
+    params.tile_size = 64;
+    int short_input = !codec_encode_file("test_codec_input.pgm", prefix_size, width, height + 64, &params,
+                                         "test_codec_output.adct", NULL);
+    params.block_size = 4;
+    params.tile_size = 4;
+    size_t huge_size;
+    int too_many_tiles = codec_encode(pixels, 0x7FFFFF00, 0x10000, &params, &huge_size) == NULL;
+    printf("Untiled rejected %d, short input rejected %d, tile overflow rejected %d\n",
+           untiled, short_input, too_many_tiles);
+
+    remove("test_codec_input.pgm");
+    remove("test_codec_output.adct");
+    free(pixels);
+
+    if (ok && untiled && short_input && too_many_tiles) {
+        printf("Out-of-core test PASSED!\n\n");
+    } else {
+        printf("Out-of-core test FAILED!\n\n");
+    }
+}
+
+// Test that the two-phase parallel decoder reproduces the serial decoder exactly
+void test_parallel_decode(void) {
+    printf("=== Testing Parallel Decode ===\n");
+
+    int width = 203;
+    int height = 117;
+    unsigned char *pixels = (unsigned char*)malloc((size_t) width * height);
+    fill_test_image(pixels, width, height);
+
+    int ok = 1;
+    for (int config = 0; config < 10; config++) {
+        CodecParams params = codec_default_params();
+        params.block_size = 4 << (config % 4);
+        params.adaptive = config % 3 == 1;
+        params.quadtree = config == 8;
+        params.approximate_dct = config == 5;
+        params.tile_size = config % 2 ? 0 : 48;
+        codec_set_traversal(config == 9 ? CODEC_TRAVERSAL_MORTON : CODEC_TRAVERSAL_RASTER);
+
+        size_t size;
+        unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+        int expected_width, expected_height;
+        unsigned char *expected = codec_decode(stream, size, &expected_width, &expected_height);
+        for (int threads = 0; threads <= 4; threads++) {
+            int decoded_width = 0, decoded_height = 0;
+            unsigned char *decoded = codec_decode_parallel(stream, size, threads, &decoded_width, &decoded_height);
+            if (!decoded || decoded_width != width || decoded_height != height ||
+                memcmp(decoded, expected, (size_t) width * height) != 0) {
+                printf("Config %d, %d threads: output differs from codec_decode\n", config, threads);
+                ok = 0;
+            }
+            free(decoded);
+        }
+
+        // A damaged last tile is refused, as by the serial decoder
+        memset(stream + size - size / 8, 0xFF, size / 16);
+        int width_out, height_out;
+        unsigned char *serial = codec_decode(stream, size, &width_out, &height_out);
+        unsigned char *parallel = codec_decode_parallel(stream, size, 3, &width_out, &height_out);
+        if ((serial == NULL) != (parallel == NULL) ||
+            (serial && memcmp(serial, parallel, (size_t) width * height) != 0)) {
+            printf("Config %d: damaged stream handled differently\n", config);
+            ok = 0;
+        }
+
+        free(serial);
+        free(parallel);
+        free(expected);
+        free(stream);
+    }
+    codec_set_traversal(CODEC_TRAVERSAL_RASTER);
+    free(pixels);
+
+    if (ok) {
+        printf("Parallel decode test PASSED!\n\n");
+    } else {
+        printf("Parallel decode test FAILED!\n\n");
+    }
+}
+
+// Test that an adaptive scan order changes only the entropy coding: every
+// path decodes to the zigzag result, and directional content codes smaller
+void test_adaptive_scan(void) {
+    printf("=== Testing Adaptive Scan Order ===\n");
+
+    // Vertical stripes put the energy of every block in its first row of coefficients
+    int width = 190;
+    int height = 133;
+    unsigned char *pixels = (unsigned char*)malloc((size_t) width * height);
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            double value = 128.0 + 70.0 * sin(j * 1.3) + 20.0 * cos(j / 5.0) + (rand() % 6) - 3 + i / 20;
+            pixels[i * width + j] = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+    }
+
+    int ok = 1;
+    for (int config = 0; config < 6; config++) {
+        CodecParams params = codec_default_params();
+        params.block_size = 4 << (config % 4);
+        params.adaptive = config == 4;
+        params.approximate_dct = config == 5;
+        params.tile_size = config % 2 ? 0 : 64;
+
+        size_t plain_size, scan_size;
+        unsigned char *plain = codec_encode(pixels, width, height, &params, &plain_size);
+        params.adaptive_scan = 1;
+        unsigned char *scanned = codec_encode(pixels, width, height, &params, &scan_size);
+
+        int w, h;
+        unsigned char *expected = codec_decode(plain, plain_size, &w, &h);
+        unsigned char *decoded = codec_decode(scanned, scan_size, &w, &h);
+        unsigned char *parallel = codec_decode_parallel(scanned, scan_size, 3, &w, &h);
+        int same = expected && decoded && parallel &&
+                   memcmp(expected, decoded, (size_t) width * height) == 0 &&
+                   memcmp(expected, parallel, (size_t) width * height) == 0;
+
+        printf("Block %2d, adaptive %d, approximate %d: zigzag %6zu bytes, adaptive scan %6zu bytes, same pixels %d\n",
+               params.block_size, params.adaptive, params.approximate_dct, plain_size, scan_size, same);
+        ok = ok && same && scan_size < plain_size;
+
+        free(plain);
+        free(scanned);
+        free(expected);
+        free(decoded);
+        free(parallel);
+    }
+
+    // Out-of-core encoding derives the same order from the same sample
+    CodecParams params = codec_default_params();
+    params.adaptive_scan = 1;
+    params.tile_size = 48;
+    size_t size;
+    unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+    FILE *file = fopen("test_codec_input.raw", "wb");
+    fwrite(pixels, 1, (size_t) width * height, file);
+    fclose(file);
+    unsigned long long file_size = 0;
+    int encoded = codec_encode_file("test_codec_input.raw", 0, width, height, &params,
+                                    "test_codec_output.adct", &file_size);
+    unsigned char *written = (unsigned char*)malloc(size);
+    file = fopen("test_codec_output.adct", "rb");
+    size_t read = file ? fread(written, 1, size, file) : 0;
+    if (file) fclose(file);
+    int file_same = encoded && file_size == size && read == size && memcmp(stream, written, size) == 0;
+    remove("test_codec_input.raw");
+    remove("test_codec_output.adct");
+    free(written);
+
+    // Dirty re-encodes match a full encode, both for a small edit and for one
+    // large enough to change the sampled scan order
+    CodecRect rects[2] = {{30, 20, 60, 40}, {0, 0, width, height * 3 / 4}};
+    int dirty_same = 1;
+    unsigned char *current = stream;
+    size_t current_size = size;
+    for (int r = 0; r < 2; r++) {
+        for (int i = rects[r].y; i < rects[r].y + rects[r].height; i++) {
+            for (int j = rects[r].x; j < rects[r].x + rects[r].width; j++) {
+                pixels[i * width + j] = (unsigned char) (r ? (j & 8 ? 200 : 40) : i * j);
+            }
+        }
+        size_t patched_size, full_size;
+        unsigned char *patched = codec_reencode_dirty(current, current_size, pixels, &rects[r], 1, &patched_size);
+        unsigned char *full = codec_encode(pixels, width, height, &params, &full_size);
+        dirty_same = dirty_same && patched && patched_size == full_size && memcmp(patched, full, full_size) == 0;
+        if (current != stream) free(current);
+        current = patched;
+        current_size = patched_size;
+        free(full);
+    }
+    if (current != stream) free(current);
+    int w, h;
+
+    // A scan table that repeats a position is refused
+    size_t table = CODEC_HEADER_SIZE + (size_t) ((width + 47) / 48) * ((height + 47) / 48) * CODEC_INDEX_ENTRY_SIZE;
+    stream[table + 3] = stream[table + 2];
+    unsigned char *damaged = codec_decode(stream, size, &w, &h);
+
+    printf("Out-of-core identical %d, dirty re-encode matches %d, bad table refused %d\n",
+           file_same, dirty_same, damaged == NULL);
+
+    free(stream);
+    free(damaged);
+    free(pixels);
+
+    if (ok && file_same && dirty_same && damaged == NULL) {
+        printf("Adaptive scan test PASSED!\n\n");
+    } else {
+        printf("Adaptive scan test FAILED!\n\n");
+    }
+}
+
+// Test that per-tile table selection never loses to the default tables and
+// picks carried tables only where they pay for themselves
+void test_table_modes(void) {
+    printf("=== Testing Entropy Table Selection ===\n");
+
+    int width = 256;
+    int height = 192;
+    unsigned char *pixels = (unsigned char*)malloc((size_t) width * height);
+    fill_test_image(pixels, width, height);
+
+    int ok = 1;
+    int tile_sizes[4] = {16, 32, 64, 0};
+    size_t small_optimized = 0, large_optimized = 0;
+    for (int t = 0; t < 4; t++) {
+        CodecParams params = codec_default_params();
+        params.tile_size = tile_sizes[t];
+        params.optimize_huffman = 0;
+        size_t default_size;
+        unsigned char *default_stream = codec_encode(pixels, width, height, &params, &default_size);
+
+        params.optimize_huffman = 1;
+        CodecEncodeStats stats;
+        size_t size;
+        unsigned char *stream = codec_encode_with_stats(pixels, width, height, &params, &stats, &size);
+
+        int w, h;
+        unsigned char *expected = codec_decode(default_stream, default_size, &w, &h);
+        unsigned char *decoded = codec_decode(stream, size, &w, &h);
+        size_t tiles = 0;
+        for (int m = 0; m < CODEC_TABLES_MODES; m++) tiles += stats.table_modes[m];
+        size_t tile_edge = tile_sizes[t] ? (size_t) tile_sizes[t] : (size_t) width;
+        size_t expected_tiles = tile_sizes[t] ? ((width + tile_edge - 1) / tile_edge) * ((height + tile_edge - 1) / tile_edge) : 1;
+        int same = expected && decoded && memcmp(expected, decoded, (size_t) width * height) == 0;
+
+        printf("Tile %3d: default tables %6zu bytes, selected %6zu bytes, modes %zu/%zu/%zu/%zu\n",
+               tile_sizes[t], default_size, size, stats.table_modes[CODEC_TABLES_DEFAULT],
+               stats.table_modes[CODEC_TABLES_OPTIMIZED], stats.table_modes[CODEC_TABLES_OPTIMIZED_DC],
+               stats.table_modes[CODEC_TABLES_OPTIMIZED_AC]);
+        ok = ok && same && size <= default_size && tiles == expected_tiles;
+        if (t == 0) small_optimized = stats.table_modes[CODEC_TABLES_OPTIMIZED];
+        if (t == 3) large_optimized = stats.table_modes[CODEC_TABLES_OPTIMIZED];
+
+        // An unknown mode byte is refused
+        if (t == 3) {
+            stream[CODEC_HEADER_SIZE + CODEC_INDEX_ENTRY_SIZE] = CODEC_TABLES_MODES;
+            unsigned char *damaged = codec_decode(stream, size, &w, &h);
+            ok = ok && damaged == NULL;
+            free(damaged);
+        }
+
+        free(default_stream);
+        free(stream);
+        free(expected);
+        free(decoded);
+    }
+    free(pixels);
+
+    // Tiny tiles cannot carry two tables profitably; one large tile can
+    ok = ok && small_optimized == 0 && large_optimized == 1;
+    if (ok) {
+        printf("Table selection test PASSED!\n\n");
+    } else {
+        printf("Table selection test FAILED!\n\n");
+    }
+}
+
+// Test 10- to 16-bit planes: precision kept at quality 100, squashing to 8 bits beaten, depth checked
+void test_high_bit_depth(void) {
+    printf("=== Testing High Bit Depth ===\n");
+
+    int width = 157;
+    int height = 91;
+    size_t count = (size_t) width * height;
+    unsigned short *samples = (unsigned short*)malloc(count * sizeof(unsigned short));
+    unsigned char *squashed = (unsigned char*)malloc(count);
+    int depths[3] = {10, 12, 16};
+
+    int ok = 1;
+    for (int d = 0; d < 3; d++) {
+        int depth = depths[d];
+        int max = (1 << depth) - 1;
+        for (int i = 0; i < height; i++) {
+            for (int j = 0; j < width; j++) {
+                double value = 0.5 + 0.3 * sin(i / 9.0) * cos(j / 13.0) + 0.1 * sin(i * j / 50.0);
+                int sample = (int) (value * max);
+                samples[i * width + j] = (unsigned short) (sample < 0 ? 0 : (sample > max ? max : sample));
+                squashed[i * width + j] = (unsigned char) ((samples[i * width + j] * 255 + max / 2) / max);
+            }
+        }
+
+        for (int config = 0; config < 3; config++) {
+            CodecParams params = codec_default_params();
+            params.quality = 100;
+            params.adaptive = config == 1;
+            params.adaptive_scan = config == 1;
+            params.quadtree = config == 2;
+            size_t size, squashed_size;
+            int w, h, decoded_depth;
+            unsigned char *stream = codec_encode16(samples, width, height, depth, &params, &size);
+            unsigned short *decoded = codec_decode16(stream, size, &w, &h, &decoded_depth);
+            unsigned char *squashed_stream = codec_encode(squashed, width, height, &params, &squashed_size);
+            unsigned char *squashed_decoded = codec_decode(squashed_stream, squashed_size, &w, &h);
+
+            // Error in units of the deep samples, native against squashed to 8 bits and back
+            int native_error = 0, squashed_error = 0;
+            for (size_t k = 0; decoded && squashed_decoded && k < count; k++) {
+                int widened = (squashed_decoded[k] * max + 127) / 255;
+                if (abs(decoded[k] - samples[k]) > native_error) native_error = abs(decoded[k] - samples[k]);
+                if (abs(widened - samples[k]) > squashed_error) squashed_error = abs(widened - samples[k]);
+            }
+            printf("%2d-bit, config %d: %6zu bytes, max error %5d (squashed to 8 bits: %5d)\n",
+                   depth, config, size, native_error, squashed_error);
+            ok = ok && decoded && decoded_depth == depth && native_error * 4 < squashed_error;
+
+            // The 8-bit decoders refuse deep streams; a depth byte of 8 or less is invalid
+            unsigned char *bytes = codec_decode(stream, size, &w, &h);
+            unsigned char *parallel = codec_decode_parallel(stream, size, 2, &w, &h);
+            ok = ok && bytes == NULL && parallel == NULL;
+            stream[7] = 8;
+            unsigned short *bad_depth = codec_decode16(stream, size, &w, &h, &decoded_depth);
+            ok = ok && bad_depth == NULL;
+
+            free(stream);
+            free(decoded);
+            free(squashed_stream);
+            free(squashed_decoded);
+            free(bytes);
+            free(parallel);
+            free(bad_depth);
+        }
+    }
+
+    // 8-bit streams widen through codec_decode16; invalid depths are refused
+    CodecParams params = codec_default_params();
+    size_t size;
+    int w, h, depth;
+    unsigned char *stream = codec_encode(squashed, width, height, &params, &size);
+    unsigned char *bytes = codec_decode(stream, size, &w, &h);
+    unsigned short *widened = codec_decode16(stream, size, &w, &h, &depth);
+    for (size_t k = 0; bytes && widened && k < count; k++) {
+        if (widened[k] != bytes[k]) ok = 0;
+    }
+    ok = ok && bytes && widened && depth == 8 && codec_encode16(samples, width, height, 8, &params, &size) == NULL &&
+         codec_encode16(samples, width, height, 17, &params, &size) == NULL;
+    free(stream);
+    free(bytes);
+    free(widened);
+    free(samples);
+    free(squashed);
+
+    if (ok) {
+        printf("High bit depth test PASSED!\n\n");
+    } else {
+        printf("High bit depth test FAILED!\n\n");
+    }
+}
+
+// Draw a screen capture: two panel shades, a border and rows of text glyphs,
+// so no block of any size holds more than four distinct values
+void fill_screen_image(unsigned char *pixels, int width, int height) {
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            int panel = j > width / 3 && i > 12;
+            int border = (j == width / 3 && i > 12) || i == 12;
+            int glyph = (i % 12) < 8 && (j % 7) < 5 && ((i / 12) * 31 + (j / 7) * 17) % 5 != 0 &&
+                        ((i % 12) * 5 + (j % 7) + (i / 12) * 3 + (j / 7)) % 3 == 0;
+            pixels[i * width + j] = (unsigned char) (glyph ? 20 : (border ? 90 : (panel ? 200 : 240)));
+        }
+    }
+}
+
+// Test palette blocks: screen content codes exactly and smaller, mixed
+// content agrees across every decoder, and invalid combinations are refused
+void test_palette(void) {
+    printf("=== Testing Palette Blocks ===\n");
+
+    int width = 203;
+    int height = 141;
+    size_t count = (size_t) width * height;
+    unsigned char *pixels = (unsigned char*)malloc(count);
+    fill_screen_image(pixels, width, height);
+
+    int ok = 1;
+    for (int config = 0; config < 6; config++) {
+        CodecParams params = codec_default_params();
+        params.block_size = 4 << (config % 4);
+        params.adaptive = config == 4;
+        params.adaptive_scan = config == 5;
+        size_t plain_size, palette_size;
+        CodecEncodeStats stats;
+        unsigned char *plain = codec_encode(pixels, width, height, &params, &plain_size);
+        params.palette = 1;
+        unsigned char *stream = codec_encode_with_stats(pixels, width, height, &params, &stats, &palette_size);
+        size_t blocks = (size_t) ((width + params.block_size - 1) / params.block_size) *
+                        (size_t) ((height + params.block_size - 1) / params.block_size);
+
+        int w, h;
+        unsigned char *decoded = codec_decode(stream, palette_size, &w, &h);
+        unsigned char *parallel = codec_decode_parallel(stream, palette_size, 3, &w, &h);
+        int exact = decoded && parallel && memcmp(decoded, pixels, count) == 0 &&
+                    memcmp(parallel, pixels, count) == 0;
+        printf("Block %2d, adaptive %d, scan %d: transform %6zu bytes, palette %6zu bytes (%zu/%zu blocks), exact %d\n",
+               params.block_size, params.adaptive, params.adaptive_scan, plain_size, palette_size,
+               stats.palette_blocks, blocks, exact);
+        ok = ok && exact && palette_size < plain_size && stats.palette_blocks == blocks &&
+             palette_size <= codec_max_compressed_size(width, height, &params);
+
+        free(plain);
+        free(stream);
+        free(decoded);
+        free(parallel);
+    }
+
+    // Natural content below the text: both kinds of block in one tile
+    for (int i = height / 2; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            double value = 128.0 + 60.0 * sin(i / 9.0) * cos(j / 13.0) + (rand() % 16) - 8;
+            pixels[i * width + j] = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+    }
+    for (int config = 0; config < 4; config++) {
+        CodecParams params = codec_default_params();
+        params.palette = 1;
+        params.adaptive = config == 1;
+        params.tile_size = config == 2 ? 0 : 64;
+        params.optimize_huffman = config != 3;
+        size_t size;
+        CodecEncodeStats stats;
+        codec_set_traversal(config == 2 ? CODEC_TRAVERSAL_MORTON : CODEC_TRAVERSAL_RASTER);
+        unsigned char *stream = codec_encode_with_stats(pixels, width, height, &params, &stats, &size);
+        int w, h;
+        unsigned char *morton = codec_decode(stream, size, &w, &h);
+        codec_set_traversal(CODEC_TRAVERSAL_RASTER);
+        unsigned char *raster = codec_decode(stream, size, &w, &h);
+        unsigned char *parallel = codec_decode_parallel(stream, size, 4, &w, &h);
+
+        // Block rows wholly above the natural content are text only
+        int text_exact = raster && memcmp(raster, pixels, (size_t) (height / 2 / 8 * 8) * width) == 0;
+        int same = raster && morton && parallel && memcmp(raster, morton, count) == 0 &&
+                   memcmp(raster, parallel, count) == 0;
+        printf("Mixed, config %d: %6zu bytes, %zu palette blocks, text exact %d, decoders agree %d\n",
+               config, size, stats.palette_blocks, text_exact, same);
+        ok = ok && text_exact && same && stats.palette_blocks > 0;
+
+        free(stream);
+        free(morton);
+        free(raster);
+        free(parallel);
+    }
+
+    // Deep screen content is exact too
+    fill_screen_image(pixels, width, height);
+    unsigned short *samples = (unsigned short*)malloc(count * sizeof(unsigned short));
+    for (size_t k = 0; k < count; k++) {
+        samples[k] = (unsigned short) (pixels[k] * 4 + 3);
+    }
+    CodecParams params = codec_default_params();
+    params.palette = 1;
+    size_t size;
+    int w, h, depth;
+    unsigned char *stream = codec_encode16(samples, width, height, 10, &params, &size);
+    unsigned short *deep = codec_decode16(stream, size, &w, &h, &depth);
+    ok = ok && deep && depth == 10 && memcmp(deep, samples, count * sizeof(unsigned short)) == 0;
+    free(stream);
+    free(deep);
+    free(samples);
+
+    // Palettes are ignored with quadtree, and a header claiming both is refused
+    params = codec_default_params();
+    params.palette = 1;
+    params.quadtree = 1;
+    stream = codec_encode(pixels, width, height, &params, &size);
+    unsigned char *decoded = codec_decode(stream, size, &w, &h);
+    int quadtree_ok = decoded != NULL && !(stream[8] & CODEC_FLAG_PALETTE);
+    free(decoded);
+    stream[8] |= CODEC_FLAG_PALETTE;
+    decoded = codec_decode(stream, size, &w, &h);
+    quadtree_ok = quadtree_ok && decoded == NULL;
+    ok = ok && quadtree_ok;
+    free(stream);
+    free(decoded);
+    free(pixels);
+
+    if (ok) {
+        printf("Palette test PASSED!\n\n");
+    } else {
+        printf("Palette test FAILED!\n\n");
+    }
+}
+
+// Test that damaged streams are rejected instead of crashing
+void test_invalid_stream(void) {
+    printf("=== Testing Invalid Streams ===\n");
+
+    int width = 64;
+    int height = 64;
+    unsigned char *pixels = (unsigned char*)malloc(width * height);
+    fill_test_image(pixels, width, height);
+
+    CodecParams params = codec_default_params();
+    size_t size;
+    unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+
+    int decoded_width, decoded_height;
+    unsigned char *truncated = codec_decode(stream, CODEC_HEADER_SIZE + 4, &decoded_width, &decoded_height);
+
+    stream[0] = 'X';
+    unsigned char *bad_magic = codec_decode(stream, size, &decoded_width, &decoded_height);
+
+    // A tiny stream whose header claims a huge single-tile image is rejected
+    // before anything is sized from it, instead of exhausting memory
+    unsigned char tiny_pixels[16 * 16];
+    memset(tiny_pixels, 100, sizeof(tiny_pixels));
+    size_t tiny_size;
+    unsigned char *tiny = codec_encode(tiny_pixels, 16, 16, &params, &tiny_size);
+    int oversized_rejected = 1;
+    unsigned long claims[2] = {131072, 32768};
+    for (int c = 0; c < 2; c++) {
+        for (int field = 12; field < 28; field += 4) {
+            for (int k = 0; k < 4; k++) {
+                tiny[field + k] = (unsigned char) (claims[c] >> (8 * k));
+            }
+        }
+        unsigned char *oversized = codec_decode(tiny, tiny_size, &decoded_width, &decoded_height);
+        oversized_rejected = oversized_rejected && oversized == NULL;
+        free(oversized);
+    }
+    printf("Oversized header on a %zu-byte stream rejected: %d\n", tiny_size, oversized_rejected);
+
+    if (truncated == NULL && bad_magic == NULL && oversized_rejected) {
+        printf("Invalid stream test PASSED!\n\n");
+    } else {
+        printf("Invalid stream test FAILED!\n\n");
+    }
+
+    free(pixels);
+    free(stream);
+    free(truncated);
+    free(bad_magic);
+    free(tiny);
+}
+
+int main(void) {
+    printf("======================================\n");
+    printf("     Codec Tests\n");
+    printf("======================================\n\n");
+
+    test_round_trip();
+    test_dirty_reencode();
+    test_quadtree();
+    test_target_quality();
+    test_deadline();
+    test_traversal();
+    test_encode_file();
+    test_large_pages();
+    test_encode_into();
+    test_parallel_decode();
+    test_adaptive_scan();
+    test_table_modes();
+    test_high_bit_depth();
+    test_palette();
+    test_invalid_stream();
+
+    printf("All tests completed!\n");
+    return 0;
+}
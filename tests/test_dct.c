@@ -3,9 +3,13 @@
  * Part of Adaptive DCT Image Compressor
  */
 
+#include <pthread.h>
 #include "dct.h"
 #include <utils.h>
 
+#define SHARED_THREADS 4
+#define SHARED_BLOCKS 8
+
 /**
  * Calculate mean squared error between original and reconstructed blocks
  */
@@ -98,8 +102,282 @@ void test_dct(void) {
     dct_free(ctx);
 }
 
+/**
+ * Test function for the multiplierless approximate DCT
+ */
+void test_approximate_dct(void) {
+    printf("\n=== Testing Approximate DCT ===\n");
+
+    unsigned char pixel_block[64] = {
+            52, 55, 61, 66, 70, 61, 64, 73,
+            63, 59, 55, 90, 109, 85, 69, 72,
+            62, 59, 68, 113, 144, 104, 66, 73,
+            63, 58, 71, 122, 154, 106, 70, 69,
+            67, 61, 68, 104, 126, 88, 68, 70,
+            79, 65, 60, 70, 77, 68, 58, 75,
+            85, 71, 64, 59, 55, 61, 65, 83,
+            87, 79, 69, 68, 65, 76, 78, 94
+    };
+
+    int sizes[2] = {4, 8};
+    for (int s = 0; s < 2; s++) {
+        int n = sizes[s];
+        DCTContext *exact = dct_init(n);
+        DCTContext *approx = dct_init_approximate(n);
+
+        double **input_block = alloc_array(n, n);
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                input_block[i][j] = (double)pixel_block[i * 8 + j] - 128.0;
+            }
+        }
+
+        double **exact_coeffs = alloc_array(n, n);
+        double **approx_coeffs = alloc_array(n, n);
+        dct_forward(exact, input_block, exact_coeffs);
+        dct_forward(approx, input_block, approx_coeffs);
+
+        // Normalize the approximate coefficients and compare the energy compaction
+        double dot = 0.0, exact_energy = 0.0, approx_energy = 0.0;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                double scale = approx->row_norms[i] * approx->row_norms[j];
+                double normalized = approx_coeffs[i][j] / scale;
+                dot += normalized * exact_coeffs[i][j];
+                exact_energy += exact_coeffs[i][j] * exact_coeffs[i][j];
+                approx_energy += normalized * normalized;
+                // The inverse expects coefficients divided by the squared scale
+                approx_coeffs[i][j] = normalized / scale;
+            }
+        }
+        double correlation = dot / sqrt(exact_energy * approx_energy);
+
+        double **reconstructed = alloc_array(n, n);
+        dct_inverse(approx, approx_coeffs, reconstructed);
+
+        double mse = 0.0;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                double error = input_block[i][j] - reconstructed[i][j];
+                mse += error * error;
+            }
+        }
+        mse /= n * n;
+
+        printf("%dx%d: approximate=%d, correlation with exact DCT %.4f, round trip MSE %.6f\n",
+               n, n, approx->approximate, correlation, mse);
+        if (approx->approximate && correlation > 0.98 && mse < 0.01) {
+            printf("TEST PASSED: Approximate transform is invertible and close to the DCT\n");
+        } else {
+            printf("TEST FAILED: Approximate transform is inaccurate\n");
+        }
+
+        free_array(input_block, n);
+        free_array(exact_coeffs, n);
+        free_array(approx_coeffs, n);
+        free_array(reconstructed, n);
+        dct_free(exact);
+        dct_free(approx);
+    }
+}
+
+/**
+ * Test that every available kernel computes the same transform
+ */
+void test_dct_kernels(void) {
+    printf("\n=== Testing DCT Kernels ===\n");
+
+    int sizes[4] = {4, 8, 16, 32};
+    for (int s = 0; s < 4; s++) {
+        int n = sizes[s];
+        DCTContext *reference = dct_init(n);
+        reference->kernel = DCT_KERNEL_MATRIX;
+
+        double **input_block = alloc_array(n, n);
+        double **expected = alloc_array(n, n);
+        double **coeffs = alloc_array(n, n);
+        double **reconstructed = alloc_array(n, n);
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                input_block[i][j] = (double) (rand() % 256) - 128.0;
+            }
+        }
+        dct_forward(reference, input_block, expected);
+
+        for (int k = 0; k < DCT_KERNEL_COUNT; k++) {
+            if (!dct_kernel_available(k)) continue;
+            DCTContext *ctx = dct_init(n);
+            ctx->kernel = k;
+            dct_forward(ctx, input_block, coeffs);
+            dct_inverse(ctx, coeffs, reconstructed);
+
+            double coeff_error = 0.0, pixel_error = 0.0;
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    coeff_error = fmax(coeff_error, fabs(coeffs[i][j] - expected[i][j]));
+                    pixel_error = fmax(pixel_error, fabs(reconstructed[i][j] - input_block[i][j]));
+                }
+            }
+
+            if (coeff_error < 1e-9 && pixel_error < 1e-9) {
+                printf("TEST PASSED: %dx%d kernel %d matches the matrix transform\n", n, n, k);
+            } else {
+                printf("TEST FAILED: %dx%d kernel %d differs by %.3g (coefficients) / %.3g (pixels)\n",
+                       n, n, k, coeff_error, pixel_error);
+            }
+            dct_free(ctx);
+        }
+
+        free_array(input_block, n);
+        free_array(expected, n);
+        free_array(coeffs, n);
+        free_array(reconstructed, n);
+        dct_free(reference);
+    }
+}
+
+// Test that the sparse inverse reproduces the full inverse exactly, for every kernel
+void test_sparse_inverse(void) {
+    printf("\n=== Testing Sparse Inverse DCT ===\n");
+
+    int sizes[4] = {4, 8, 16, 32};
+    for (int s = 0; s < 4; s++) {
+        int n = sizes[s];
+        double **coeffs = alloc_array(n, n);
+        double **expected = alloc_array(n, n);
+        double **actual = alloc_array(n, n);
+
+        for (int k = 0; k < DCT_KERNEL_COUNT + 1; k++) {
+            // The extra pass covers approximate contexts, which fall back to the full transform
+            if (k < DCT_KERNEL_COUNT && !dct_kernel_available(k)) continue;
+            if (k == DCT_KERNEL_COUNT && n > 8) continue;
+            DCTContext *ctx = k < DCT_KERNEL_COUNT ? dct_init(n) : dct_init_approximate(n);
+            if (k < DCT_KERNEL_COUNT) ctx->kernel = k;
+
+            int mismatches = 0;
+            for (int extent = 1; extent <= n; extent++) {
+                for (int i = 0; i < n; i++) {
+                    for (int j = 0; j < n; j++) {
+                        coeffs[i][j] = (i < extent && j < extent) ? (rand() % 2001) / 10.0 - 100.0 : 0.0;
+                    }
+                }
+                dct_inverse(ctx, coeffs, expected);
+                dct_inverse_sparse(ctx, coeffs, actual, extent);
+                for (int i = 0; i < n; i++) {
+                    if (memcmp(expected[i], actual[i], n * sizeof(double)) != 0) mismatches++;
+                }
+            }
+
+            const char *label = k < DCT_KERNEL_COUNT ? "kernel" : "approximate";
+            if (mismatches == 0) {
+                printf("TEST PASSED: %dx%d %s %d sparse inverse is exact\n", n, n, label, k);
+            } else {
+                printf("TEST FAILED: %dx%d %s %d sparse inverse differs in %d rows\n", n, n, label, k, mismatches);
+            }
+            dct_free(ctx);
+        }
+
+        free_array(coeffs, n);
+        free_array(expected, n);
+        free_array(actual, n);
+    }
+}
+
+typedef struct {
+    DCTContext *ctx;
+    double ***inputs;
+    double ***expected;
+    int mismatches;
+} SharedJob;
+
+// Forward and inverse transform every block through the shared context
+static void *shared_transform(void *arg) {
+    SharedJob *job = (SharedJob *) arg;
+    int n = job->ctx->block_size;
+    double **coeffs = alloc_array(n, n);
+    double **pixels = alloc_array(n, n);
+    for (int round = 0; round < 2; round++) {
+        for (int b = 0; b < SHARED_BLOCKS; b++) {
+            dct_forward(job->ctx, job->inputs[b], coeffs);
+            dct_inverse_sparse(job->ctx, coeffs, pixels, n / 2);
+            dct_inverse(job->ctx, coeffs, pixels);
+            for (int i = 0; i < n; i++) {
+                if (memcmp(pixels[i], job->expected[b][i], n * sizeof(double)) != 0) job->mismatches++;
+            }
+        }
+    }
+    free_array(coeffs, n);
+    free_array(pixels, n);
+    return NULL;
+}
+
+// Test that threads sharing one context get the results a lone caller gets
+void test_shared_context(void) {
+    printf("\n=== Testing Shared DCT Context ===\n");
+
+    // 64 is past the stack intermediate, so the allocated one is covered too
+    int sizes[3] = {8, 32, 64};
+    for (int s = 0; s < 3; s++) {
+        int n = sizes[s];
+        for (int k = 0; k < DCT_KERNEL_COUNT; k++) {
+            if (!dct_kernel_available(k)) continue;
+            DCTContext *ctx = dct_init(n);
+            ctx->kernel = k;
+
+            double **inputs[SHARED_BLOCKS], **expected[SHARED_BLOCKS];
+            double **coeffs = alloc_array(n, n);
+            for (int b = 0; b < SHARED_BLOCKS; b++) {
+                inputs[b] = alloc_array(n, n);
+                expected[b] = alloc_array(n, n);
+                for (int i = 0; i < n; i++) {
+                    for (int j = 0; j < n; j++) {
+                        inputs[b][i][j] = (double) (rand() % 256) - 128.0;
+                    }
+                }
+                dct_forward(ctx, inputs[b], coeffs);
+                dct_inverse(ctx, coeffs, expected[b]);
+            }
+
+            pthread_t threads[SHARED_THREADS];
+            SharedJob jobs[SHARED_THREADS];
+            int started = 0;
+            for (int t = 0; t < SHARED_THREADS; t++) {
+                jobs[t].ctx = ctx;
+                jobs[t].inputs = inputs;
+                jobs[t].expected = expected;
+                jobs[t].mismatches = 0;
+                if (pthread_create(&threads[t], NULL, shared_transform, &jobs[t]) == 0) started++;
+            }
+            int mismatches = 0;
+            for (int t = 0; t < started; t++) {
+                pthread_join(threads[t], NULL);
+                mismatches += jobs[t].mismatches;
+            }
+
+            if (started == SHARED_THREADS && mismatches == 0) {
+                printf("TEST PASSED: %dx%d kernel %d gives the same results from %d threads\n",
+                       n, n, k, SHARED_THREADS);
+            } else {
+                printf("TEST FAILED: %dx%d kernel %d differs in %d rows across %d threads\n",
+                       n, n, k, mismatches, started);
+            }
+
+            for (int b = 0; b < SHARED_BLOCKS; b++) {
+                free_array(inputs[b], n);
+                free_array(expected[b], n);
+            }
+            free_array(coeffs, n);
+            dct_free(ctx);
+        }
+    }
+}
+
 int main(void) {
     test_dct();
+    test_approximate_dct();
+    test_dct_kernels();
+    test_sparse_inverse();
+    test_shared_context();
     printf("\nDCT implementation testing completed successfully.\n");
     return 0;
 }
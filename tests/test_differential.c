@@ -0,0 +1,533 @@
+/**
+ * test_differential.c - Differential test of the optimized kernels against the reference paths
+ * Part of Adaptive DCT Image Compressor
+ *
+ * Every input is a byte string that selects a block size, quality and
+ * options and supplies the samples, so the same checks serve as a unit test
+ * (random and adversarial inputs, see main) and as a libFuzzer target when
+ * built with -DADCT_FUZZER (see the fuzz recipe in the Justfile).
+ *
+ * Paths and the agreement required of them:
+ *   DCT kernels vs DCT_KERNEL_MATRIX      within 1e-9 (different summation order)
+ *   dct_inverse_sparse vs dct_inverse     bit-exact (exact kernels)
+ *   QUANT_KERNEL_RECIPROCAL vs divide     exact, except +-1 on exact .5 ties
+ *   quantize_sparse / dequantize_sparse   bit-exact against quantize / dequantize
+ *   sparse Huffman count / encode / decode and the fused decode
+ *                                         bit-exact against the dense block coder
+ *   sparse bitmaps vs run_length_encode   same (value, run) symbols
+ *   blockify / unblockify (SSE2)          bit-exact against a per-sample loop
+ *   codec_decode_parallel vs codec_decode same pixels, or both refuse
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <utils.h>
+#include "../include/dct.h"
+#include "../include/quantization.h"
+#include "../include/entropy.h"
+#include "../include/blockify.h"
+#include "../include/codec.h"
+
+#define DIFF_HEADER_BYTES 4       // Selector bytes in front of the samples
+#define DIFF_MAX_PIXELS 4096      // Largest image the stream check decodes
+#define DIFF_RANDOM_INPUTS 1500   // Random inputs run by main
+
+/**
+ * Structure to hold the options one input selects
+ */
+typedef struct {
+    int block_size;          // 4, 8, 16 or 32
+    int quality;             // 1-100
+    int adaptive;            // Adaptive quantization
+    int ties;                // Move every coefficient onto an exact .5 quantization tie
+    int stream;              // Run the codec stream check instead of the block checks
+    double variance;         // Block variance for adaptive quantization
+    const unsigned char *samples; // Sample bytes, cycled as needed
+    size_t sample_count;     // Number of sample bytes (0 = all zero)
+} DiffInput;
+
+static void parse_input(const unsigned char *data, size_t size, DiffInput *input) {
+    unsigned char header[DIFF_HEADER_BYTES] = {0};
+    memcpy(header, data, size < DIFF_HEADER_BYTES ? size : DIFF_HEADER_BYTES);
+    input->block_size = 4 << (header[0] & 3);
+    input->adaptive = (header[0] >> 2) & 1;
+    input->ties = (header[0] >> 3) & 1;
+    input->stream = (header[0] >> 7) & 1;
+    input->quality = 1 + header[1] % 100;
+    input->variance = header[2] * 8.0;
+    input->samples = size > DIFF_HEADER_BYTES ? data + DIFF_HEADER_BYTES : NULL;
+    input->sample_count = size > DIFF_HEADER_BYTES ? size - DIFF_HEADER_BYTES : 0;
+}
+
+static int sample(const DiffInput *input, size_t k) {
+    return input->sample_count ? input->samples[k % input->sample_count] : 0;
+}
+
+// Transform kernels against the matrix transform, and the sparse inverse against the full one
+static int check_dct(const DiffInput *input, double **block, double **coeffs) {
+    int n = input->block_size;
+    int failures = 0;
+    DCTContext *reference = dct_init(n);
+    reference->kernel = DCT_KERNEL_MATRIX;
+    double **expected = alloc_array(n, n);
+    double **actual = alloc_array(n, n);
+    double **restored = alloc_array(n, n);
+    dct_forward(reference, block, coeffs);
+
+    for (int k = 0; k < DCT_KERNEL_COUNT; k++) {
+        if (!dct_kernel_available(k)) continue;
+        DCTContext *ctx = dct_init(n);
+        ctx->kernel = k;
+        dct_forward(ctx, block, actual);
+        dct_inverse(ctx, coeffs, restored);
+        dct_inverse(reference, coeffs, expected);
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                if (fabs(actual[i][j] - coeffs[i][j]) > 1e-9 || fabs(restored[i][j] - expected[i][j]) > 1e-9) {
+                    failures++;
+                }
+            }
+        }
+
+        // Zero everything outside a corner; the sparse inverse must then match exactly
+        int extent = 1 + sample(input, 0) % n;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                actual[i][j] = i < extent && j < extent ? coeffs[i][j] : 0.0;
+            }
+        }
+        dct_inverse(ctx, actual, expected);
+        dct_inverse_sparse(ctx, actual, restored, extent);
+        for (int i = 0; i < n; i++) {
+            if (memcmp(expected[i], restored[i], n * sizeof(double)) != 0) failures++;
+        }
+        dct_free(ctx);
+    }
+
+    free_array(expected, n);
+    free_array(actual, n);
+    free_array(restored, n);
+    dct_free(reference);
+    if (failures) printf("DCT kernels disagree (%dx%d): %d values\n", n, n, failures);
+    return failures;
+}
+
+// Put every coefficient exactly halfway between two quantization levels
+static void move_to_ties(QuantContext *ctx, double **coeffs, double variance) {
+    int n = ctx->block_size;
+    double **steps = ctx->adaptive ? adjust_matrix_for_block(ctx, variance, 1) : ctx->quant_matrix;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            coeffs[i][j] = (floor(coeffs[i][j] / steps[i][j]) + 0.5) * steps[i][j];
+        }
+    }
+    if (ctx->adaptive) {
+        free_array(steps, n);
+    }
+}
+
+// Quantization kernels, sparse quantization and dequantization against the dense reference
+static int check_quantization(const DiffInput *input, QuantContext *ctx, double **coeffs, int **dense,
+                              SparseBlock *sparse) {
+    int n = input->block_size;
+    int failures = 0;
+    quantize(ctx, coeffs, dense, input->variance);
+
+    if (!ctx->adaptive) {
+        int **fast = alloc_int_array(n, n);
+        ctx->kernel = QUANT_KERNEL_RECIPROCAL;
+        quantize(ctx, coeffs, fast, input->variance);
+        ctx->kernel = QUANT_KERNEL_DIVIDE;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                double ratio = coeffs[i][j] / ctx->quant_matrix[i][j];
+                int tie = fabs(fabs(ratio - floor(ratio)) - 0.5) < 1e-9;
+                if (fast[i][j] != dense[i][j] && !(tie && abs(fast[i][j] - dense[i][j]) == 1)) failures++;
+            }
+        }
+        free_int_array(fast, n);
+    }
+
+    quantize_sparse(ctx, coeffs, sparse, input->variance);
+    int next = 0;
+    for (int k = 0; k < n * n; k++) {
+        int value = dense[ctx->zigzag_row[k]][ctx->zigzag_col[k]];
+        int flagged = (int) ((sparse->bitmap[k / 64] >> (k % 64)) & 1);
+        if (flagged != (value != 0) || (flagged && sparse->values[next++] != value)) failures++;
+    }
+    if (next != sparse->count) failures++;
+
+    double **expected = alloc_array(n, n);
+    double **actual = alloc_array(n, n);
+    dequantize(ctx, dense, expected, input->variance);
+    dequantize_sparse(ctx, sparse, actual, input->variance);
+    for (int i = 0; i < n; i++) {
+        if (memcmp(expected[i], actual[i], n * sizeof(double)) != 0) failures++;
+    }
+    free_array(expected, n);
+    free_array(actual, n);
+
+    if (failures) printf("Quantization paths disagree (%dx%d, q%d): %d values\n", n, n, input->quality, failures);
+    return failures;
+}
+
+// Compare the bitmap bits a block of coeff_count coefficients uses; the rest are unspecified
+static int same_bitmap(const SparseBlock *a, const SparseBlock *b, int coeff_count) {
+    for (int k = 0; k < coeff_count; k++) {
+        if (((a->bitmap[k / 64] ^ b->bitmap[k / 64]) >> (k % 64)) & 1) return 0;
+    }
+    return 1;
+}
+
+// Sparse entropy coding, the fused decode and the sparse inverse against the dense block coder
+static int check_entropy(const DiffInput *input, QuantContext *ctx, DCTContext *dct, int **dense,
+                         const SparseBlock *sparse) {
+    int n = input->block_size;
+    int count = n * n;
+    int failures = 0;
+    HuffTable dc_table, ac_table;
+    build_default_huffman_table(&dc_table, 1);
+    build_default_huffman_table(&ac_table, 0);
+    int *zigzag = (int*)malloc((size_t) count * sizeof(int));
+    for (int k = 0; k < count; k++) {
+        zigzag[k] = dense[ctx->zigzag_row[k]][ctx->zigzag_col[k]];
+    }
+
+    // Histograms, then the same block twice so the DC prediction is exercised
+    unsigned dense_dc[HUFF_DC_SYMBOLS] = {0}, dense_ac[HUFF_AC_SYMBOLS] = {0};
+    unsigned sparse_dc[HUFF_DC_SYMBOLS] = {0}, sparse_ac[HUFF_AC_SYMBOLS] = {0};
+    int dense_pred = sample(input, 1) - 128, sparse_pred = dense_pred;
+    huffman_count_block(zigzag, count, &dense_pred, dense_dc, dense_ac);
+    huffman_count_sparse(sparse, count, &sparse_pred, sparse_dc, sparse_ac);
+    if (memcmp(dense_dc, sparse_dc, sizeof(dense_dc)) != 0 || memcmp(dense_ac, sparse_ac, sizeof(dense_ac)) != 0 ||
+        dense_pred != sparse_pred) {
+        failures++;
+    }
+
+    BitWriter dense_bw, sparse_bw;
+    bitwriter_init(&dense_bw, 256);
+    bitwriter_init(&sparse_bw, 256);
+    int first_pred = sample(input, 1) - 128;
+    for (int pass = 0; pass < 2; pass++) {
+        dense_pred = pass == 0 ? first_pred : dense_pred;
+        sparse_pred = pass == 0 ? first_pred : sparse_pred;
+        huffman_encode_block(&dense_bw, zigzag, count, &dense_pred, &dc_table, &ac_table);
+        huffman_encode_sparse(&sparse_bw, sparse, count, &sparse_pred, &dc_table, &ac_table);
+    }
+    bitwriter_align(&dense_bw);
+    bitwriter_align(&sparse_bw);
+    if (dense_bw.size != sparse_bw.size || memcmp(dense_bw.data, sparse_bw.data, dense_bw.size) != 0) {
+        failures++;
+    }
+
+    // Decode both blocks along the dense, sparse and fused paths
+    BitReader dense_br, sparse_br, fused_br;
+    bitreader_init(&dense_br, dense_bw.data, dense_bw.size);
+    bitreader_init(&sparse_br, dense_bw.data, dense_bw.size);
+    bitreader_init(&fused_br, dense_bw.data, dense_bw.size);
+    int fused_pred = first_pred;
+    dense_pred = sparse_pred = first_pred;
+    int *decoded = (int*)malloc((size_t) count * sizeof(int));
+    int **decoded_block = alloc_int_array(n, n);
+    double **expected = alloc_array(n, n);
+    double **fused = alloc_array(n, n);
+    double **full = alloc_array(n, n);
+    double **partial = alloc_array(n, n);
+    SparseBlock decoded_sparse;
+    decoded_sparse.values = (int*)malloc((size_t) count * sizeof(int));
+    for (int pass = 0; pass < 2; pass++) {
+        int last = -1;
+        for (int i = 0; i < n; i++) {
+            memset(fused[i], 0, n * sizeof(double));
+        }
+        int ok = huffman_decode_block(&dense_br, decoded, count, &dense_pred, &dc_table, &ac_table) &&
+                 huffman_decode_sparse(&sparse_br, &decoded_sparse, count, &sparse_pred, &dc_table, &ac_table) &&
+                 huffman_decode_dequantize(&fused_br, ctx, input->variance, fused, &fused_pred, &dc_table,
+                                           &ac_table, &last);
+        if (!ok || memcmp(decoded, zigzag, (size_t) count * sizeof(int)) != 0 ||
+            decoded_sparse.count != sparse->count ||
+            !same_bitmap(&decoded_sparse, sparse, count) ||
+            memcmp(decoded_sparse.values, sparse->values, (size_t) sparse->count * sizeof(int)) != 0) {
+            failures++;
+            break;
+        }
+
+        for (int k = 0; k < count; k++) {
+            decoded_block[ctx->zigzag_row[k]][ctx->zigzag_col[k]] = decoded[k];
+        }
+        dequantize(ctx, decoded_block, expected, input->variance);
+        for (int i = 0; i < n; i++) {
+            if (memcmp(expected[i], fused[i], n * sizeof(double)) != 0) failures++;
+        }
+
+        // The extent of the last nonzero is all the sparse inverse needs
+        if (!dct->approximate) {
+            dct_inverse(dct, fused, full);
+            dct_inverse_sparse(dct, fused, partial, ctx->zigzag_extent[last]);
+            for (int i = 0; i < n; i++) {
+                if (memcmp(full[i], partial[i], n * sizeof(double)) != 0) failures++;
+            }
+        }
+    }
+
+    // The reference run-length coder sees the same runs as the sparse bitmap
+    EntropyContext *rle = entropy_init(0);
+    run_length_encode(rle, dense, n);
+    int symbol = 0;
+    int previous = -1;
+    for (int k = 0; k < count; k++) {
+        if (!((sparse->bitmap[k / 64] >> (k % 64)) & 1)) continue;
+        if (symbol >= rle->count || rle->symbols[symbol].value != zigzag[k] ||
+            rle->symbols[symbol].run_length != k - previous - 1) {
+            failures++;
+        }
+        symbol++;
+        previous = k;
+    }
+    if (previous != count - 1) {
+        if (symbol >= rle->count || rle->symbols[symbol].value != 0 ||
+            rle->symbols[symbol].run_length != count - 1 - previous) {
+            failures++;
+        }
+        symbol++;
+    }
+    if (symbol != rle->count) failures++;
+    entropy_free(rle);
+
+    free(decoded_sparse.values);
+    free(decoded);
+    free(zigzag);
+    free(dense_bw.data);
+    free(sparse_bw.data);
+    free_int_array(decoded_block, n);
+    free_array(expected, n);
+    free_array(fused, n);
+    free_array(full, n);
+    free_array(partial, n);
+    if (failures) printf("Entropy paths disagree (%dx%d, q%d): %d checks\n", n, n, input->quality, failures);
+    return failures;
+}
+
+// Vectorized blockify and unblockify against a per-sample loop, on a plane of any shape
+static int check_blockify(const DiffInput *input) {
+    int n = input->block_size;
+    int width = 1 + sample(input, 2) % 70;
+    int height = 1 + sample(input, 3) % 40;
+    size_t stride = (size_t) width + sample(input, 4) % 9;
+    int cols = (width + n - 1) / n;
+    int rows = (height + n - 1) / n;
+    size_t count = (size_t) cols * rows * n * n;
+    unsigned char *plane = (unsigned char*)malloc(stride * height);
+    unsigned char *restored = (unsigned char*)malloc(stride * height);
+    short *expected = (short*)malloc(count * sizeof(short));
+    short *actual = (short*)malloc(count * sizeof(short));
+    for (size_t k = 0; k < stride * height; k++) {
+        plane[k] = (unsigned char) sample(input, k + 5);
+    }
+
+    for (int by = 0; by < rows; by++) {
+        for (int bx = 0; bx < cols; bx++) {
+            short *block = expected + ((size_t) by * cols + bx) * n * n;
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    int r = by * n + i < height ? by * n + i : height - 1;
+                    int c = bx * n + j < width ? bx * n + j : width - 1;
+                    block[i * n + j] = (short) (plane[(size_t) r * stride + c] - 128);
+                }
+            }
+        }
+    }
+    blockify(plane, stride, width, height, n, cols, rows, actual);
+    int failures = memcmp(expected, actual, count * sizeof(short)) != 0;
+
+    memset(restored, 0, stride * height);
+    unblockify(actual, n, cols, rows, restored, stride, width, height);
+    for (int i = 0; i < height; i++) {
+        failures += memcmp(plane + (size_t) i * stride, restored + (size_t) i * stride, (size_t) width) != 0;
+    }
+
+    free(plane);
+    free(restored);
+    free(expected);
+    free(actual);
+    if (failures) printf("Blockify disagrees (%dx%d blocks, %dx%d plane)\n", n, n, width, height);
+    return failures;
+}
+
+/**
+ * Encode a small image built from the samples, damage a few stream bytes
+ * chosen by the input, and require the serial and parallel decoders to agree
+ */
+static int check_stream(const DiffInput *input) {
+    int width = 1 + sample(input, 0) % 64;
+    int height = 1 + sample(input, 1) % 64;
+    unsigned char *pixels = (unsigned char*)malloc((size_t) width * height);
+    for (size_t k = 0; k < (size_t) width * height; k++) {
+        pixels[k] = (unsigned char) sample(input, k + 8);
+    }
+
+    CodecParams params = codec_default_params();
+    params.block_size = input->block_size;
+    params.quality = input->quality;
+    params.adaptive = input->adaptive;
+    params.quadtree = input->ties && input->block_size == 32;
+    params.adaptive_scan = (sample(input, 2) & 1) != 0;
+    params.palette = (sample(input, 2) & 2) != 0;
+    params.tile_size = 8 * (sample(input, 3) % 5);
+    size_t size;
+    unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+    free(pixels);
+
+    int damage = sample(input, 4) % 4;
+    for (int d = 0; d < damage; d++) {
+        size_t position = ((size_t) sample(input, 5 + 2 * d) << 8 | (size_t) sample(input, 6 + 2 * d)) % size;
+        stream[position] ^= (unsigned char) (1 + sample(input, 7 + d) % 255);
+    }
+
+    int failures = 0;
+    int info_width, info_height;
+    if (codec_stream_info(stream, size, &info_width, &info_height) &&
+        (size_t) info_width * info_height <= DIFF_MAX_PIXELS) {
+        int serial_width = 0, serial_height = 0, parallel_width = 0, parallel_height = 0;
+        unsigned char *serial = codec_decode(stream, size, &serial_width, &serial_height);
+        unsigned char *parallel = codec_decode_parallel(stream, size, 2, &parallel_width, &parallel_height);
+        if ((serial == NULL) != (parallel == NULL) ||
+            (serial && (serial_width != parallel_width || serial_height != parallel_height ||
+                        memcmp(serial, parallel, (size_t) serial_width * serial_height) != 0))) {
+            failures++;
+            printf("Serial and parallel decoders disagree (%d damaged bytes)\n", damage);
+        }
+        free(serial);
+        free(parallel);
+    }
+    free(stream);
+    return failures;
+}
+
+// Run every check one input selects; returns the number of disagreements
+static int check_input(const unsigned char *data, size_t size) {
+    DiffInput input;
+    parse_input(data, size, &input);
+    if (input.stream) {
+        return check_stream(&input);
+    }
+
+    int n = input.block_size;
+    double **block = alloc_array(n, n);
+    double **coeffs = alloc_array(n, n);
+    int **dense = alloc_int_array(n, n);
+    SparseBlock sparse;
+    sparse.values = (int*)malloc((size_t) n * n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            block[i][j] = sample(&input, (size_t) i * n + j) - 128.0;
+        }
+    }
+
+    DCTContext *dct = dct_init(n);
+    QuantContext *quant = quant_init(n, input.quality, input.adaptive);
+    quant->kernel = QUANT_KERNEL_DIVIDE;
+    int failures = check_dct(&input, block, coeffs);
+    if (input.ties) {
+        move_to_ties(quant, coeffs, input.variance);
+    }
+    failures += check_quantization(&input, quant, coeffs, dense, &sparse);
+    failures += check_entropy(&input, quant, dct, dense, &sparse);
+    failures += check_blockify(&input);
+
+    dct_free(dct);
+    quant_free(quant);
+    free(sparse.values);
+    free_array(block, n);
+    free_array(coeffs, n);
+    free_int_array(dense, n);
+    return failures;
+}
+
+#ifdef ADCT_FUZZER
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size) {
+    if (check_input(data, size) != 0) {
+        abort();
+    }
+    return 0;
+}
+
+#else
+
+// Fill an input for one adversarial sample pattern
+static size_t adversarial_input(unsigned char *data, int pattern, int selector, int quality) {
+    int n = 4 << (selector & 3);
+    data[0] = (unsigned char) selector;
+    data[1] = (unsigned char) (quality - 1);
+    data[2] = (unsigned char) (pattern * 37);
+    data[3] = 0;
+    for (int k = 0; k < n * n; k++) {
+        int i = k / n;
+        int j = k % n;
+        unsigned char value;
+        switch (pattern) {
+            case 0: value = 0; break;                                   // Darkest flat block
+            case 1: value = 255; break;                                 // Brightest flat block
+            case 2: value = (i + j) % 2 ? 255 : 0; break;               // Checkerboard: all energy at the highest frequency
+            case 3: value = k == 0 ? 255 : 0; break;                    // Single impulse
+            case 4: value = j % 2 ? 255 : 0; break;                     // Vertical stripes
+            case 5: value = (unsigned char) (k * 255 / (n * n - 1)); break; // Ramp
+            default: value = (unsigned char) (rand() & 0xFF); break;    // Noise
+        }
+        data[DIFF_HEADER_BYTES + k] = value;
+    }
+    return DIFF_HEADER_BYTES + (size_t) n * n;
+}
+
+int main(void) {
+    printf("======================================\n");
+    printf("     Differential Kernel Tests\n");
+    printf("======================================\n\n");
+
+    unsigned char data[DIFF_HEADER_BYTES + 32 * 32];
+    int qualities[3] = {1, 50, 100};
+
+    // Extreme patterns through every block size, option and quality end
+    printf("=== Testing Adversarial Blocks ===\n");
+    int failures = 0;
+    int inputs = 0;
+    for (int pattern = 0; pattern < 7; pattern++) {
+        for (int selector = 0; selector < 16; selector++) {
+            for (int q = 0; q < 3; q++) {
+                size_t size = adversarial_input(data, pattern, selector, qualities[q]);
+                failures += check_input(data, size);
+                inputs++;
+            }
+        }
+    }
+    printf("%d inputs, %d disagreements\n", inputs, failures);
+    if (failures == 0) {
+        printf("Adversarial differential test PASSED!\n\n");
+    } else {
+        printf("Adversarial differential test FAILED!\n\n");
+    }
+
+    // Random inputs of random length, half of them through the stream check
+    printf("=== Testing Random Inputs ===\n");
+    failures = 0;
+    for (int r = 0; r < DIFF_RANDOM_INPUTS; r++) {
+        size_t size = (size_t) (rand() % (int) sizeof(data));
+        for (size_t k = 0; k < size; k++) {
+            data[k] = (unsigned char) (rand() & 0xFF);
+        }
+        failures += check_input(data, size);
+    }
+    printf("%d inputs, %d disagreements\n", DIFF_RANDOM_INPUTS, failures);
+    if (failures == 0) {
+        printf("Random differential test PASSED!\n\n");
+    } else {
+        printf("Random differential test FAILED!\n\n");
+    }
+
+    printf("All tests completed!\n");
+    return 0;
+}
+
+#endif
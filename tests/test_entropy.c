@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <stdint.h>
 #include <utils.h>
 #include "../include/entropy.h"
 #include "../include/dct.h"
@@ -404,6 +405,280 @@ void test_with_dct_coefficients(void) {
     entropy_free(entropy_ctx);
 }
 
+// Test that sparse blocks count and encode to the same symbols and bits as dense ones
+void test_sparse_block_coding(void) {
+    printf("=== Testing Sparse Block Coding ===\n");
+
+    HuffTable dc_table, ac_table;
+    build_default_huffman_table(&dc_table, 1);
+    build_default_huffman_table(&ac_table, 0);
+
+    int sizes[4] = {4, 8, 16, 32};
+    int ok = 1;
+    for (int s = 0; s < 4; s++) {
+        int n = sizes[s];
+        int count = n * n;
+        QuantContext *quant_ctx = quant_init(n, 40, 0);
+        double **coeffs = alloc_array(n, n);
+        int **dense = alloc_int_array(n, n);
+        int *zigzag = (int*)malloc((size_t) count * sizeof(int));
+        SparseBlock sparse;
+        sparse.values = (int*)malloc((size_t) count * sizeof(int));
+
+        BitWriter dense_bits, sparse_bits;
+        bitwriter_init(&dense_bits, 1024);
+        bitwriter_init(&sparse_bits, 1024);
+        unsigned dense_dc[HUFF_DC_SYMBOLS] = {0}, sparse_dc[HUFF_DC_SYMBOLS] = {0};
+        unsigned dense_ac[HUFF_AC_SYMBOLS] = {0}, sparse_ac[HUFF_AC_SYMBOLS] = {0};
+        int dense_pred[2] = {0, 0}, sparse_pred[2] = {0, 0};
+
+        // Blocks range from all-zero to dense, with long zero runs (ZRL) in between
+        int one_in[4] = {0, 12, 3, 1};
+        for (int trial = 0; trial < 40; trial++) {
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    int keep = one_in[trial % 4] > 0 && rand() % one_in[trial % 4] == 0;
+                    coeffs[i][j] = keep ? (rand() % 4000) / 2.0 - 1000.0 : 0.0;
+                }
+            }
+            quantize(quant_ctx, coeffs, dense, 0.0);
+            quantize_sparse(quant_ctx, coeffs, &sparse, 0.0);
+            block_to_zigzag(dense, zigzag, n);
+
+            huffman_count_block(zigzag, count, &dense_pred[0], dense_dc, dense_ac);
+            huffman_count_sparse(&sparse, count, &sparse_pred[0], sparse_dc, sparse_ac);
+            huffman_encode_block(&dense_bits, zigzag, count, &dense_pred[1], &dc_table, &ac_table);
+            huffman_encode_sparse(&sparse_bits, &sparse, count, &sparse_pred[1], &dc_table, &ac_table);
+        }
+        bitwriter_align(&dense_bits);
+        bitwriter_align(&sparse_bits);
+
+        int same = dense_bits.size == sparse_bits.size &&
+                   memcmp(dense_bits.data, sparse_bits.data, dense_bits.size) == 0 &&
+                   memcmp(dense_dc, sparse_dc, sizeof(dense_dc)) == 0 &&
+                   memcmp(dense_ac, sparse_ac, sizeof(dense_ac)) == 0 &&
+                   dense_pred[0] == sparse_pred[0] && dense_pred[1] == sparse_pred[1];
+        printf("%dx%d: %zu bytes dense, %zu bytes sparse\n", n, n, dense_bits.size, sparse_bits.size);
+        ok = ok && same;
+
+        free(dense_bits.data);
+        free(sparse_bits.data);
+        free(sparse.values);
+        free(zigzag);
+        free_int_array(dense, n);
+        free_array(coeffs, n);
+        quant_free(quant_ctx);
+    }
+
+    if (ok) {
+        printf("Sparse coding test PASSED! Streams and counts match dense coding.\n\n");
+    } else {
+        printf("Sparse coding test FAILED! Streams or counts differ.\n\n");
+    }
+}
+
+// Test that fused decoding and dequantization matches decode, zigzag_to_block and dequantize
+void test_fused_dequantization(void) {
+    printf("=== Testing Fused Decode and Dequantization ===\n");
+
+    HuffTable dc_table, ac_table;
+    build_default_huffman_table(&dc_table, 1);
+    build_default_huffman_table(&ac_table, 0);
+
+    int sizes[4] = {4, 8, 16, 32};
+    int ok = 1;
+    for (int s = 0; s < 4; s++) {
+        for (int adaptive = 0; adaptive < 2; adaptive++) {
+            int n = sizes[s];
+            int count = n * n;
+            int trials = 30;
+            QuantContext *quant_ctx = quant_init(n, 40, adaptive);
+            double **coeffs = alloc_array(n, n);
+            double **expected = alloc_array(n, n);
+            double **actual = alloc_array(n, n);
+            int **dense = alloc_int_array(n, n);
+            int *zigzag = (int*)malloc((size_t) count * sizeof(int));
+            int *lasts = (int*)malloc(trials * sizeof(int));
+
+            // Encode blocks of increasing density, remembering each one's last nonzero
+            BitWriter bw;
+            bitwriter_init(&bw, 1024);
+            int pred = 0;
+            for (int trial = 0; trial < trials; trial++) {
+                for (int i = 0; i < n; i++) {
+                    for (int j = 0; j < n; j++) {
+                        int keep = trial % 3 == 0 ? i + j == 0 : rand() % (trial % 3 == 1 ? 10 : 2) == 0;
+                        coeffs[i][j] = keep ? (rand() % 4000) / 2.0 - 1000.0 : 0.0;
+                    }
+                }
+                quantize(quant_ctx, coeffs, dense, trial * 100.0);
+                block_to_zigzag(dense, zigzag, n);
+                lasts[trial] = 0;
+                for (int k = 1; k < count; k++) {
+                    if (zigzag[k] != 0) lasts[trial] = k;
+                }
+                huffman_encode_block(&bw, zigzag, count, &pred, &dc_table, &ac_table);
+            }
+            bitwriter_align(&bw);
+
+            BitReader dense_reader, fused_reader;
+            bitreader_init(&dense_reader, bw.data, bw.size);
+            bitreader_init(&fused_reader, bw.data, bw.size);
+            int dense_pred = 0, fused_pred = 0;
+            for (int trial = 0; trial < trials && ok; trial++) {
+                int last = -1;
+                for (int i = 0; i < n; i++) {
+                    memset(actual[i], 0, n * sizeof(double));
+                }
+                ok = huffman_decode_block(&dense_reader, zigzag, count, &dense_pred, &dc_table, &ac_table) &&
+                     huffman_decode_dequantize(&fused_reader, quant_ctx, trial * 100.0, actual, &fused_pred,
+                                               &dc_table, &ac_table, &last);
+                zigzag_to_block(zigzag, dense, n);
+                dequantize(quant_ctx, dense, expected, trial * 100.0);
+                for (int i = 0; ok && i < n; i++) {
+                    ok = memcmp(expected[i], actual[i], n * sizeof(double)) == 0;
+                }
+                ok = ok && last == lasts[trial] && dense_pred == fused_pred;
+                if (!ok) {
+                    printf("Mismatch: %dx%d, adaptive %d, block %d\n", n, n, adaptive, trial);
+                }
+            }
+
+            free(bw.data);
+            free(lasts);
+            free(zigzag);
+            free_int_array(dense, n);
+            free_array(coeffs, n);
+            free_array(expected, n);
+            free_array(actual, n);
+            quant_free(quant_ctx);
+        }
+    }
+
+    if (ok) {
+        printf("Fused dequantization test PASSED! Coefficients and last positions match.\n\n");
+    } else {
+        printf("Fused dequantization test FAILED!\n\n");
+    }
+}
+
+// Test that table size estimates plus magnitude bits give the exact coded size
+void test_size_estimate(void) {
+    printf("=== Testing Coded Size Estimates ===\n");
+
+    int n = 8;
+    int count = n * n;
+    int blocks = 40;
+    int *zigzag = (int*)malloc((size_t) count * blocks * sizeof(int));
+    unsigned dc_freq[HUFF_DC_SYMBOLS] = {0};
+    unsigned ac_freq[HUFF_AC_SYMBOLS] = {0};
+    size_t magnitude_bits = 0;
+    int pred = 0;
+    for (int b = 0; b < blocks; b++) {
+        int *block = zigzag + (size_t) b * count;
+        for (int k = 0; k < count; k++) {
+            block[k] = rand() % (k < 10 ? 2 : 12) == 0 ? rand() % 201 - 100 : 0;
+            if (k > 0 && block[k] != 0) magnitude_bits += (size_t) magnitude_category(block[k]);
+        }
+        magnitude_bits += (size_t) magnitude_category(block[0] - pred);
+        huffman_count_block(block, count, &pred, dc_freq, ac_freq);
+    }
+
+    HuffTable default_dc, default_ac, optimized_dc, optimized_ac;
+    build_default_huffman_table(&default_dc, 1);
+    build_default_huffman_table(&default_ac, 0);
+    build_canonical_huffman_table(&optimized_dc, dc_freq, HUFF_DC_SYMBOLS);
+    build_canonical_huffman_table(&optimized_ac, ac_freq, HUFF_AC_SYMBOLS);
+
+    int ok = 1;
+    const HuffTable *dc_tables[2] = {&default_dc, &optimized_dc};
+    const HuffTable *ac_tables[2] = {&default_ac, &optimized_ac};
+    for (int t = 0; t < 2; t++) {
+        BitWriter bw;
+        bitwriter_init(&bw, 1024);
+        pred = 0;
+        for (int b = 0; b < blocks; b++) {
+            huffman_encode_block(&bw, zigzag + (size_t) b * count, count, &pred, dc_tables[t], ac_tables[t]);
+        }
+        size_t written = bw.size * 8 + (size_t) bw.bit_count;
+        size_t estimated = huffman_estimate_bits(dc_tables[t], dc_freq, HUFF_DC_SYMBOLS) +
+                           huffman_estimate_bits(ac_tables[t], ac_freq, HUFF_AC_SYMBOLS) + magnitude_bits;
+        printf("%s tables: %zu bits written, %zu estimated\n", t ? "Optimized" : "Default", written, estimated);
+        ok = ok && written == estimated;
+        free(bw.data);
+    }
+
+    // A symbol the table has no code for cannot be priced
+    unsigned missing[HUFF_AC_SYMBOLS] = {0};
+    for (int i = 0; i < HUFF_AC_SYMBOLS; i++) {
+        if (!optimized_ac.lengths[i]) {
+            missing[i] = 1;
+            break;
+        }
+    }
+    ok = ok && huffman_estimate_bits(&optimized_ac, missing, HUFF_AC_SYMBOLS) == SIZE_MAX;
+    free(zigzag);
+
+    if (ok) {
+        printf("Size estimate test PASSED!\n\n");
+    } else {
+        printf("Size estimate test FAILED!\n\n");
+    }
+}
+
+// Test that the range coder round-trips skewed and even bits, compresses skewed ones and detects truncation
+void test_range_coder(void) {
+    printf("=== Testing Range Coder ===\n");
+
+    int count = 20000;
+    int *bits = (int*)malloc((size_t) count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        // Context 0 is mostly zeros, context 1 is even, and runs of ones exercise carries
+        bits[i] = i % 2 ? rand() % 2 : (i % 1000 < 40 || rand() % 20 == 0);
+    }
+
+    unsigned short probs[2];
+    BitWriter bw;
+    bitwriter_init(&bw, 64);
+    bitwriter_put_bits(&bw, 0xA5, 8);
+    RangeEncoder encoder;
+    range_probs_init(probs, 2);
+    range_encoder_init(&encoder, &bw);
+    for (int i = 0; i < count; i++) {
+        range_encode_bit(&encoder, &probs[i % 2], bits[i]);
+    }
+    range_encoder_finish(&encoder);
+    size_t size = bw.size - 1;
+    printf("%d bits coded in %zu bytes\n", count, size);
+
+    // Even bits cost about one bit each, skewed ones far less
+    int ok = bw.data[0] == 0xA5 && size < (size_t) count * 3 / 4 / 8 && size > (size_t) count / 2 / 8;
+
+    RangeDecoder decoder;
+    range_probs_init(probs, 2);
+    range_decoder_init(&decoder, bw.data + 1, size);
+    for (int i = 0; ok && i < count; i++) {
+        ok = range_decode_bit(&decoder, &probs[i % 2]) == bits[i];
+    }
+    ok = ok && decoder.pos == size;
+
+    // Dropping the last bytes is seen once the decoder needs them
+    range_probs_init(probs, 2);
+    range_decoder_init(&decoder, bw.data + 1, size - 4);
+    for (int i = 0; i < count; i++) {
+        range_decode_bit(&decoder, &probs[i % 2]);
+    }
+    ok = ok && decoder.pos > decoder.size;
+    free(bw.data);
+    free(bits);
+
+    if (ok) {
+        printf("Range coder test PASSED!\n\n");
+    } else {
+        printf("Range coder test FAILED!\n\n");
+    }
+}
+
 int main(void) {
     printf("======================================\n");
     printf("     Entropy Coding Tests\n");
@@ -413,6 +688,10 @@ int main(void) {
     test_run_length_encoding();
     test_huffman_coding();
     test_with_dct_coefficients();
+    test_sparse_block_coding();
+    test_fused_dequantization();
+    test_size_estimate();
+    test_range_coder();
     
     printf("All tests completed!\n");
     return 0;
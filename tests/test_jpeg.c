@@ -0,0 +1,670 @@
+/**
+ * test_jpeg.c - Test file for baseline JPEG (JFIF) export
+ * Part of Adaptive DCT Image Compressor
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../include/jpeg.h"
+
+// With -DADCT_WITH_LIBJPEG (and -ljpeg) exported files are also decoded by
+// the system libjpeg, an implementation written independently of this one
+#ifdef ADCT_WITH_LIBJPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+
+// Natural-order position of each zigzag index (ITU-T T.81 Figure A.6)
+static const int ref_zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// Annex K luminance table, in zigzag order as DQT lists it
+static const int annex_k_luma[64] = {
+    16, 11, 12, 14, 12, 10, 16, 14, 13, 14, 18, 17, 16, 19, 24, 40,
+    26, 24, 22, 22, 24, 49, 35, 37, 29, 40, 58, 51, 61, 60, 57, 51,
+    56, 55, 64, 72, 92, 78, 64, 68, 87, 69, 55, 56, 80, 109, 81, 87,
+    95, 98, 103, 104, 103, 62, 77, 113, 121, 112, 100, 120, 92, 101, 103, 99
+};
+
+// A 20x12 grayscale file written by another encoder: no JFIF segment,
+// tables after DQT in a different order, and a restart interval of one block
+static const unsigned char foreign_jpeg[300] = {
+    0xFF, 0xD8, 0xFF, 0xDB, 0x00, 0x43, 0x00, 0x06, 0x04, 0x05, 0x06, 0x05, 0x04, 0x06, 0x06, 0x05,
+    0x06, 0x07, 0x07, 0x06, 0x08, 0x0A, 0x10, 0x0A, 0x0A, 0x09, 0x09, 0x0A, 0x14, 0x0E, 0x0F, 0x0C,
+    0x10, 0x17, 0x14, 0x18, 0x18, 0x17, 0x14, 0x16, 0x16, 0x1A, 0x1D, 0x25, 0x1F, 0x1A, 0x1B, 0x23,
+    0x1C, 0x16, 0x16, 0x20, 0x2C, 0x20, 0x23, 0x26, 0x27, 0x29, 0x2A, 0x29, 0x19, 0x1F, 0x2D, 0x30,
+    0x2D, 0x28, 0x30, 0x25, 0x28, 0x29, 0x28, 0xFF, 0xC0, 0x00, 0x0B, 0x08, 0x00, 0x0C, 0x00, 0x14,
+    0x01, 0x01, 0x11, 0x00, 0xFF, 0xC4, 0x00, 0x16, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x06, 0x07, 0xFF, 0xC4, 0x00, 0x2A,
+    0x10, 0x00, 0x02, 0x00, 0x04, 0x04, 0x05, 0x03, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x11, 0x00, 0x06, 0x12, 0x41, 0x07, 0x21, 0x31, 0xA1, 0xF0,
+    0x13, 0x51, 0x61, 0x22, 0x81, 0x91, 0xC1, 0xD1, 0xFF, 0xDD, 0x00, 0x04, 0x00, 0x01, 0xFF, 0xDA,
+    0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00, 0x5B, 0xA4, 0x65, 0xE8, 0x09, 0x2A, 0xBF, 0x44,
+    0x22, 0xE5, 0x3D, 0x81, 0x24, 0x91, 0xDA, 0xDE, 0x7C, 0x7F, 0xFF, 0xD0, 0x29, 0x4D, 0xCB, 0xB2,
+    0xE1, 0x55, 0x15, 0x61, 0x5C, 0xB2, 0xAD, 0xC5, 0x8E, 0xE3, 0x9D, 0xF6, 0xF3, 0xEF, 0xFF, 0xD1,
+    0xA1, 0xCB, 0x65, 0xF9, 0x61, 0x04, 0x72, 0x82, 0xBF, 0x1E, 0x98, 0x7E, 0xFE, 0x7E, 0xB1, 0xFF,
+    0xD2, 0x72, 0xA2, 0xC9, 0x40, 0x12, 0x27, 0x4A, 0xDA, 0xD0, 0xCF, 0x4D, 0xEE, 0x07, 0x5F, 0xCF,
+    0x6C, 0x7F, 0xFF, 0xD3, 0xB5, 0xD3, 0x24, 0x60, 0x18, 0x00, 0x04, 0xB2, 0xEA, 0x55, 0xB0, 0xE8,
+    0x46, 0xA3, 0xFC, 0xC7, 0xFF, 0xD4, 0x39, 0xC7, 0x4E, 0x2C, 0xD7, 0x38, 0x7B, 0x9A, 0xE4, 0x69,
+    0x54, 0x39, 0x3A, 0x5C, 0x49, 0x68, 0xF4, 0xF8, 0x73, 0x6C, 0x66, 0x61, 0xC4, 0x66, 0x0E, 0xCF,
+    0x11, 0x48, 0x1A, 0x5D, 0x45, 0xAC, 0x83, 0x6F, 0x7C, 0x7F, 0xFF, 0xD9
+};
+
+/**
+ * Structure to hold a decoder table built as Annex C and F.2.2.3 describe
+ */
+typedef struct {
+    int mincode[17];
+    int maxcode[17];
+    int valptr[17];
+    unsigned char huffval[256];
+    int defined;
+} RefTable;
+
+/**
+ * Structure to read scan bits, removing stuffed zero bytes
+ */
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+    int byte;
+    int count;
+} RefReader;
+
+static void ref_build_table(RefTable *table, const unsigned char *bits, const unsigned char *values, int total) {
+    int huffsize[257];
+    int huffcode[257];
+    int k = 0;
+    for (int l = 1; l <= 16; l++) {
+        for (int i = 0; i < bits[l - 1]; i++) huffsize[k++] = l;
+    }
+    huffsize[k] = 0;
+
+    int code = 0;
+    int size = huffsize[0];
+    k = 0;
+    while (huffsize[k]) {
+        while (huffsize[k] == size) huffcode[k++] = code++;
+        code <<= 1;
+        size++;
+    }
+
+    int j = 0;
+    for (int l = 1; l <= 16; l++) {
+        if (bits[l - 1] == 0) {
+            table->maxcode[l] = -1;
+        } else {
+            table->valptr[l] = j;
+            table->mincode[l] = huffcode[j];
+            j += bits[l - 1] - 1;
+            table->maxcode[l] = huffcode[j];
+            j++;
+        }
+    }
+    memcpy(table->huffval, values, (size_t) total);
+    table->defined = 1;
+}
+
+static int ref_bit(RefReader *r) {
+    if (r->count == 0) {
+        if (r->pos >= r->size) return -1;
+        r->byte = r->data[r->pos++];
+        if (r->byte == 0xFF) {
+            if (r->pos >= r->size || r->data[r->pos] != 0x00) return -1;
+            r->pos++;
+        }
+        r->count = 8;
+    }
+    r->count--;
+    return (r->byte >> r->count) & 1;
+}
+
+static int ref_receive(RefReader *r, int bits) {
+    int value = 0;
+    for (int i = 0; i < bits; i++) {
+        int bit = ref_bit(r);
+        if (bit < 0) return -100000;
+        value = (value << 1) | bit;
+    }
+    return value;
+}
+
+static int ref_decode(RefReader *r, const RefTable *table) {
+    int code = ref_bit(r);
+    int l = 1;
+    while (code >= 0 && code > table->maxcode[l]) {
+        if (++l > 16) return -1;
+        int bit = ref_bit(r);
+        code = bit < 0 ? -1 : (code << 1) | bit;
+    }
+    if (code < 0) return -1;
+    return table->huffval[table->valptr[l] + code - table->mincode[l]];
+}
+
+static int ref_extend(int value, int bits) {
+    return value < (1 << (bits - 1)) ? value - (1 << bits) + 1 : value;
+}
+
+// Straightforward baseline decoder for the grayscale files jpeg_encode writes
+static unsigned char* reference_decode(const unsigned char *data, size_t size, int *width, int *height) {
+    int quant[64] = {0};
+    RefTable dc = {{0}, {0}, {0}, {0}, 0};
+    RefTable ac = {{0}, {0}, {0}, {0}, 0};
+    int restart = 0;
+    *width = 0;
+    *height = 0;
+    size_t pos = 2;
+    while (pos + 4 <= size && data[pos] == 0xFF && data[pos + 1] != 0xDA) {
+        int marker = data[pos + 1];
+        size_t length = ((size_t) data[pos + 2] << 8) | data[pos + 3];
+        const unsigned char *segment = data + pos + 4;
+        if (marker == 0xDB) {
+            for (int k = 0; k < 64; k++) quant[ref_zigzag[k]] = segment[1 + k];
+        } else if (marker == 0xC0) {
+            *height = (segment[1] << 8) | segment[2];
+            *width = (segment[3] << 8) | segment[4];
+        } else if (marker == 0xDD) {
+            restart = (segment[0] << 8) | segment[1];
+        } else if (marker == 0xC4) {
+            size_t offset = 0;
+            while (offset < length - 2) {
+                int total = 0;
+                for (int l = 0; l < 16; l++) total += segment[offset + 1 + l];
+                ref_build_table(segment[offset] >> 4 ? &ac : &dc, segment + offset + 1,
+                                segment + offset + 17, total);
+                offset += 17 + (size_t) total;
+            }
+        }
+        pos += 2 + length;
+    }
+    if (pos + 4 > size || !*width || !*height || !dc.defined || !ac.defined) return NULL;
+    pos += 2 + (((size_t) data[pos + 2] << 8) | data[pos + 3]);
+
+    int cols = (*width + 7) / 8;
+    int rows = (*height + 7) / 8;
+    unsigned char *pixels = (unsigned char*)malloc((size_t) *width * *height);
+    RefReader r = {data, size, pos, 0, 0};
+    int pred = 0;
+    for (int b = 0; b < cols * rows; b++) {
+        if (restart && b > 0 && b % restart == 0) {
+            if (r.pos + 2 > size || data[r.pos] != 0xFF || data[r.pos + 1] != 0xD0 + (b / restart - 1) % 8) {
+                free(pixels);
+                return NULL;
+            }
+            r.pos += 2;
+            r.count = 0;
+            pred = 0;
+        }
+
+        // F.2.2.1 and F.2.2.2: DC difference, then AC run/size pairs
+        double coeffs[64] = {0};
+        int t = ref_decode(&r, &dc);
+        int diff = t > 0 ? ref_extend(ref_receive(&r, t), t) : 0;
+        if (t < 0 || diff < -4096) {
+            free(pixels);
+            return NULL;
+        }
+        pred += diff;
+        coeffs[0] = pred * quant[0];
+        for (int k = 1; k < 64; k++) {
+            int rs = ref_decode(&r, &ac);
+            if (rs < 0) {
+                free(pixels);
+                return NULL;
+            }
+            int run = rs >> 4;
+            int s = rs & 15;
+            if (s == 0) {
+                if (run != 15) break;
+                k += 15;
+                continue;
+            }
+            k += run;
+            if (k > 63) {
+                free(pixels);
+                return NULL;
+            }
+            coeffs[ref_zigzag[k]] = ref_extend(ref_receive(&r, s), s) * quant[ref_zigzag[k]];
+        }
+
+        // A.3.3 inverse DCT by its defining sum
+        int bx = b % cols;
+        int by = b / cols;
+        for (int y = 0; y < 8; y++) {
+            for (int x = 0; x < 8; x++) {
+                double sum = 0.0;
+                for (int v = 0; v < 8; v++) {
+                    for (int u = 0; u < 8; u++) {
+                        double cu = u ? 1.0 : 1.0 / sqrt(2.0);
+                        double cv = v ? 1.0 : 1.0 / sqrt(2.0);
+                        sum += cu * cv * coeffs[v * 8 + u] * cos((2 * x + 1) * u * PI / 16.0) *
+                               cos((2 * y + 1) * v * PI / 16.0);
+                    }
+                }
+                double value = round(sum / 4.0) + 128.0;
+                int row = by * 8 + y;
+                int col = bx * 8 + x;
+                if (row < *height && col < *width) {
+                    pixels[row * *width + col] = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+                }
+            }
+        }
+    }
+    return pixels;
+}
+
+#ifdef ADCT_WITH_LIBJPEG
+typedef struct {
+    struct jpeg_error_mgr base;
+    jmp_buf escape;
+} LibjpegErrors;
+
+// libjpeg's default handler exits the process; jump back and fail instead
+static void libjpeg_error_exit(j_common_ptr cinfo) {
+    longjmp(((LibjpegErrors *) cinfo->err)->escape, 1);
+}
+
+static void libjpeg_silent(j_common_ptr cinfo) {
+    (void) cinfo;
+}
+
+// Decode a grayscale file with libjpeg; NULL if libjpeg refuses it
+static unsigned char* libjpeg_decode(const unsigned char *data, size_t size, int *width, int *height) {
+    struct jpeg_decompress_struct cinfo;
+    LibjpegErrors errors;
+    unsigned char *volatile pixels = NULL;
+    cinfo.err = jpeg_std_error(&errors.base);
+    errors.base.error_exit = libjpeg_error_exit;
+    errors.base.output_message = libjpeg_silent;
+    if (setjmp(errors.escape)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(pixels);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *) data, (unsigned long) size);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_GRAYSCALE;
+    jpeg_start_decompress(&cinfo);
+    *width = (int) cinfo.output_width;
+    *height = (int) cinfo.output_height;
+    pixels = (unsigned char*)malloc((size_t) cinfo.output_width * cinfo.output_height);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = pixels + (size_t) cinfo.output_scanline * cinfo.output_width;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return pixels;
+}
+#endif
+
+// Fill an image with smooth shading, an edge and some texture
+static void fill_jpeg_image(unsigned char *pixels, int width, int height) {
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            double value = 110.0 + 70.0 * sin(i / 6.0) * cos(j / 9.0) + ((i * 31 + j * 17) % 23) - 11;
+            if (j > width / 2) value += 40.0;
+            pixels[i * width + j] = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+    }
+}
+
+static double psnr(const unsigned char *a, const unsigned char *b, size_t count) {
+    double mse = 0.0;
+    for (size_t i = 0; i < count; i++) mse += (double) (a[i] - b[i]) * (a[i] - b[i]);
+    mse /= (double) count;
+    return mse == 0.0 ? 99.0 : 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+static int max_difference(const unsigned char *a, const unsigned char *b, size_t count) {
+    int largest = 0;
+    for (size_t i = 0; i < count; i++) {
+        int d = abs(a[i] - b[i]);
+        if (d > largest) largest = d;
+    }
+    return largest;
+}
+
+// Test that exported files decode the same through our decoder and the reference one
+void test_jpeg_round_trip(void) {
+    printf("=== Testing JPEG Round Trip ===\n");
+
+    int sizes[4][2] = {{64, 48}, {37, 21}, {1, 1}, {9, 130}};
+    int qualities[4] = {5, 50, 90, 100};
+    int ok = 1;
+    for (int s = 0; s < 4; s++) {
+        for (int q = 0; q < 4; q++) {
+            int width = sizes[s][0];
+            int height = sizes[s][1];
+            size_t count = (size_t) width * height;
+            unsigned char *pixels = (unsigned char*)malloc(count);
+            fill_jpeg_image(pixels, width, height);
+
+            size_t size;
+            unsigned char *file = jpeg_encode(pixels, width, height, qualities[q], &size);
+            int w1 = 0, h1 = 0, w2 = 0, h2 = 0;
+            unsigned char *ours = jpeg_decode(file, size, &w1, &h1);
+            unsigned char *reference = reference_decode(file, size, &w2, &h2);
+            if (!ours || !reference || w1 != width || h1 != height || w2 != width || h2 != height) {
+                printf("Size %dx%d quality %d did not decode\n", width, height, qualities[q]);
+                ok = 0;
+            } else {
+                int difference = max_difference(ours, reference, count);
+#ifdef ADCT_WITH_LIBJPEG
+                int w3 = 0, h3 = 0;
+                unsigned char *system = libjpeg_decode(file, size, &w3, &h3);
+                int system_difference = system && w3 == width && h3 == height ? max_difference(ours, system, count)
+                                                                              : 256;
+                difference = system_difference > difference ? system_difference : difference;
+                free(system);
+#endif
+                double quality_psnr = psnr(pixels, ours, count);
+                double floor = qualities[q] >= 90 ? 35.0 : (qualities[q] >= 50 ? 30.0 : 22.0);
+                if (difference > 1 || quality_psnr < floor) {
+                    printf("Size %dx%d quality %d: decoders differ by %d, PSNR %.2f dB\n",
+                           width, height, qualities[q], difference, quality_psnr);
+                    ok = 0;
+                }
+            }
+            free(pixels);
+            free(file);
+            free(ours);
+            free(reference);
+        }
+    }
+
+    if (ok) {
+        printf("JPEG round trip test PASSED!\n\n");
+    } else {
+        printf("JPEG round trip test FAILED!\n\n");
+    }
+}
+
+// Test the marker layout, the DQT contents and byte stuffing of the scan
+void test_jpeg_markers(void) {
+    printf("=== Testing JPEG Markers ===\n");
+
+    int width = 96;
+    int height = 64;
+    unsigned char *pixels = (unsigned char*)malloc((size_t) width * height);
+    for (int i = 0; i < width * height; i++) pixels[i] = (unsigned char) ((i * 7919) >> 3);
+    size_t size;
+    unsigned char *file = jpeg_encode(pixels, width, height, 50, &size);
+
+    // SOI, APP0 JFIF, DQT, SOF0, DHT, SOS in that order
+    static const int expected[6] = {0xD8, 0xE0, 0xDB, 0xC0, 0xC4, 0xDA};
+    int ok = size > 4 && file[0] == 0xFF && file[size - 2] == 0xFF && file[size - 1] == 0xD9;
+    size_t pos = 2;
+    for (int m = 0; ok && m < 6; m++) {
+        if (m == 0) {
+            ok = file[1] == expected[0];
+            continue;
+        }
+        ok = file[pos] == 0xFF && file[pos + 1] == expected[m];
+        if (ok && m == 1) ok = memcmp(file + pos + 4, "JFIF", 5) == 0;
+        if (ok && m == 2) {
+            for (int k = 0; k < 64; k++) ok = ok && file[pos + 5 + k] == annex_k_luma[k];
+        }
+        if (ok && m == 3) ok = file[pos + 4] == 8 && file[pos + 9] == 1;
+        pos += 2 + (((size_t) file[pos + 2] << 8) | file[pos + 3]);
+    }
+
+    // Inside the scan every 0xFF is followed by a stuffed zero
+    int stuffed = 0;
+    for (size_t i = pos; ok && i + 2 < size; i++) {
+        if (file[i] == 0xFF) {
+            ok = file[i + 1] == 0x00;
+            stuffed++;
+            i++;
+        }
+    }
+    printf("%zu bytes, %d stuffed bytes\n", size, stuffed);
+    free(pixels);
+    free(file);
+
+    if (ok && stuffed > 0) {
+        printf("JPEG marker test PASSED!\n\n");
+    } else {
+        printf("JPEG marker test FAILED!\n\n");
+    }
+}
+
+// Test a file from another encoder, with restart markers
+void test_jpeg_foreign_file(void) {
+    printf("=== Testing Foreign JPEG File ===\n");
+
+    int w1 = 0, h1 = 0, w2 = 0, h2 = 0;
+    unsigned char *ours = jpeg_decode(foreign_jpeg, sizeof(foreign_jpeg), &w1, &h1);
+    unsigned char *reference = reference_decode(foreign_jpeg, sizeof(foreign_jpeg), &w2, &h2);
+    int ok = ours && reference && w1 == 20 && h1 == 12 && w2 == 20 && h2 == 12 &&
+             max_difference(ours, reference, 240) <= 1;
+#ifdef ADCT_WITH_LIBJPEG
+    int w3 = 0, h3 = 0;
+    unsigned char *system = libjpeg_decode(foreign_jpeg, sizeof(foreign_jpeg), &w3, &h3);
+    ok = ok && system && w3 == 20 && h3 == 12 && max_difference(ours, system, 240) <= 1;
+    free(system);
+#endif
+    if (ok) {
+        unsigned char source[240];
+        for (int i = 0; i < 12; i++) {
+            for (int j = 0; j < 20; j++) source[i * 20 + j] = (unsigned char) (40 + i * 9 + j * 5 + ((i * j) % 7) * 6);
+        }
+        printf("PSNR against the source: %.2f dB\n", psnr(source, ours, 240));
+        ok = psnr(source, ours, 240) > 30.0;
+    }
+    free(ours);
+    free(reference);
+
+    // Restart markers out of sequence are refused
+    unsigned char damaged[sizeof(foreign_jpeg)];
+    memcpy(damaged, foreign_jpeg, sizeof(foreign_jpeg));
+    for (size_t i = 0; i + 1 < sizeof(damaged); i++) {
+        if (damaged[i] == 0xFF && damaged[i + 1] == 0xD1) damaged[i + 1] = 0xD3;
+    }
+    int width, height;
+    ok = ok && jpeg_decode(damaged, sizeof(damaged), &width, &height) == NULL;
+
+    if (ok) {
+        printf("Foreign JPEG test PASSED!\n\n");
+    } else {
+        printf("Foreign JPEG test FAILED!\n\n");
+    }
+}
+
+// Test that invalid parameters and damaged or unsupported files are refused
+void test_jpeg_invalid(void) {
+    printf("=== Testing Invalid JPEG Input ===\n");
+
+    unsigned char pixels[64] = {0};
+    size_t size;
+    int ok = jpeg_encode(pixels, 0, 8, 50, &size) == NULL && jpeg_encode(pixels, 8, 70000, 50, &size) == NULL;
+
+    int width, height;
+    unsigned char *file = jpeg_encode(pixels, 8, 8, 50, &size);
+    unsigned char garbage[16] = {'n', 'o', 't', ' ', 'a', ' ', 'j', 'p', 'e', 'g'};
+    ok = ok && jpeg_decode(garbage, sizeof(garbage), &width, &height) == NULL;
+
+    // Every truncation is refused
+    for (size_t cut = 0; ok && cut < size - 2; cut++) {
+        unsigned char *decoded = jpeg_decode(file, cut, &width, &height);
+        ok = decoded == NULL;
+        free(decoded);
+    }
+
+    // Progressive and multi-component frames are not read
+    unsigned char *copy = (unsigned char*)malloc(size);
+    for (size_t i = 0; i + 1 < size; i++) {
+        if (file[i] == 0xFF && file[i + 1] == 0xC0) {
+            memcpy(copy, file, size);
+            copy[i + 1] = 0xC2;
+            ok = ok && jpeg_decode(copy, size, &width, &height) == NULL;
+            memcpy(copy, file, size);
+            copy[i + 9] = 3;
+            ok = ok && jpeg_decode(copy, size, &width, &height) == NULL;
+            break;
+        }
+    }
+    free(copy);
+    free(file);
+
+    if (ok) {
+        printf("Invalid JPEG test PASSED!\n\n");
+    } else {
+        printf("Invalid JPEG test FAILED!\n\n");
+    }
+}
+
+// Recompress and restore a file; returns the recompressed size, or 0 if the bytes did not come back
+static size_t recompressed_size(const unsigned char *file, size_t size) {
+    size_t packed_size = 0, restored_size = 0;
+    unsigned char *packed = jpeg_recompress(file, size, &packed_size);
+    unsigned char *restored = packed ? jpeg_restore(packed, packed_size, &restored_size) : NULL;
+    int exact = restored && restored_size == size && memcmp(restored, file, size) == 0;
+    free(packed);
+    free(restored);
+    return exact ? packed_size : 0;
+}
+
+// Turn a file of jpeg_encode into a three-component one with a non-interleaved scan per component
+static unsigned char* make_three_component(const unsigned char *file, size_t size, size_t *out_size) {
+    size_t sof = 0, sos = 0;
+    for (size_t i = 2; i + 1 < size && !sos; i += 2 + ((size_t) file[i + 2] << 8 | file[i + 3])) {
+        if (file[i + 1] == 0xC0) sof = i;
+        if (file[i + 1] == 0xDA) sos = i;
+    }
+    size_t scan = size - 2 - (sos + 10);
+    unsigned char *out = (unsigned char*)malloc(size + 2 * (scan + 10) + 6);
+    size_t pos = sof;
+    memcpy(out, file, sof);
+    memcpy(out + pos, file + sof, 10);
+    out[pos + 3] = 17;
+    out[pos + 9] = 3;
+    pos += 10;
+    for (int c = 1; c <= 3; c++) {
+        out[pos++] = (unsigned char) c;
+        out[pos++] = 0x11;
+        out[pos++] = 0;
+    }
+    memcpy(out + pos, file + sof + 13, sos - (sof + 13));
+    pos += sos - (sof + 13);
+    for (int c = 1; c <= 3; c++) {
+        memcpy(out + pos, file + sos, 10 + scan);
+        out[pos + 5] = (unsigned char) c;
+        pos += 10 + scan;
+    }
+    out[pos++] = 0xFF;
+    out[pos++] = 0xD9;
+    *out_size = pos;
+    return out;
+}
+
+// Test that recompression shrinks files, restores them byte for byte and refuses what it cannot redo
+void test_jpeg_recompress(void) {
+    printf("=== Testing JPEG Recompression ===\n");
+
+    int ok = 1;
+    int width = 160;
+    int height = 96;
+    unsigned char *pixels = (unsigned char*)malloc((size_t) width * height);
+    fill_jpeg_image(pixels, width, height);
+    size_t size;
+    unsigned char *file = NULL;
+    int qualities[3] = {25, 75, 95};
+    for (int q = 0; q < 3; q++) {
+        free(file);
+        file = jpeg_encode(pixels, width, height, qualities[q], &size);
+        size_t packed = recompressed_size(file, size);
+        printf("Quality %d: %zu -> %zu bytes\n", qualities[q], size, packed);
+        ok = ok && packed > 0 && packed < size;
+    }
+    free(pixels);
+
+    // Restart intervals, and three components in separate scans
+    ok = ok && recompressed_size(foreign_jpeg, sizeof(foreign_jpeg)) > 0;
+    size_t color_size;
+    unsigned char *color = make_three_component(file, size, &color_size);
+    int w, h;
+    size_t color_packed = recompressed_size(color, color_size);
+    printf("Three components: %zu -> %zu bytes\n", color_size, color_packed);
+    ok = ok && color_packed > 0 && color_packed < color_size && jpeg_decode(color, color_size, &w, &h) == NULL;
+    free(color);
+
+    // Damaged containers are refused: a bad magic, cut payloads and a wrong original size
+    size_t packed_size, restored_size;
+    unsigned char *packed = jpeg_recompress(file, size, &packed_size);
+    unsigned char *copy = (unsigned char*)malloc(packed_size);
+    memcpy(copy, packed, packed_size);
+    copy[0] = 'X';
+    ok = ok && jpeg_restore(copy, packed_size, &restored_size) == NULL;
+    for (size_t cut = 0; ok && cut < packed_size; cut += 1 + cut / 8) {
+        unsigned char *restored = jpeg_restore(packed, cut, &restored_size);
+        ok = restored == NULL;
+        free(restored);
+    }
+    memcpy(copy, packed, packed_size);
+    copy[8]++;
+    ok = ok && jpeg_restore(copy, packed_size, &restored_size) == NULL;
+
+    // Single bit flips anywhere either fail to restore or give back the original exactly
+    int silent = 0;
+    for (int trial = 0; trial < 2000; trial++) {
+        memcpy(copy, packed, packed_size);
+        size_t bit = (size_t) rand() % (packed_size * 8);
+        copy[bit / 8] ^= (unsigned char) (1 << (bit % 8));
+        unsigned char *restored = jpeg_restore(copy, packed_size, &restored_size);
+        silent += restored && (restored_size != size || memcmp(restored, file, size) != 0);
+        free(restored);
+    }
+    printf("Bit flips restored into different bytes: %d of 2000\n", silent);
+    ok = ok && silent == 0;
+    free(copy);
+    free(packed);
+
+    // Progressive frames and scans padded with zero bits are left alone
+    copy = (unsigned char*)malloc(size);
+    for (size_t i = 0; i + 1 < size; i++) {
+        if (file[i] == 0xFF && file[i + 1] == 0xC0) {
+            memcpy(copy, file, size);
+            copy[i + 1] = 0xC2;
+            ok = ok && jpeg_recompress(copy, size, &packed_size) == NULL;
+            break;
+        }
+    }
+    memcpy(copy, file, size);
+    copy[size - 3] &= 0xFE;
+    ok = ok && (copy[size - 3] == file[size - 3] || jpeg_recompress(copy, size, &packed_size) == NULL);
+    free(copy);
+    free(file);
+
+    if (ok) {
+        printf("JPEG recompression test PASSED!\n\n");
+    } else {
+        printf("JPEG recompression test FAILED!\n\n");
+    }
+}
+
+int main(void) {
+    printf("======================================\n");
+    printf("     JPEG Export Tests\n");
+    printf("======================================\n\n");
+#ifdef ADCT_WITH_LIBJPEG
+    printf("Cross-checking decodes with libjpeg %d\n\n", JPEG_LIB_VERSION);
+#endif
+
+    test_jpeg_round_trip();
+    test_jpeg_markers();
+    test_jpeg_foreign_file();
+    test_jpeg_invalid();
+    test_jpeg_recompress();
+
+    printf("All tests completed!\n");
+    return 0;
+}
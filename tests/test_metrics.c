@@ -0,0 +1,219 @@
+/**
+ * test_metrics.c - Test file for image quality metrics
+ * Part of Adaptive DCT Image Compressor
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <utils.h>
+#include <quantization.h>
+#include "../include/metrics.h"
+
+// Smooth test pattern with some detail
+void fill_pattern(unsigned char *pixels, int width, int height) {
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            double value = 128.0 + 70.0 * sin(i / 7.0) * cos(j / 11.0) + 20.0 * sin((i + j) / 2.0);
+            pixels[i * width + j] = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+    }
+}
+
+// Copy with uniform noise of the given amplitude
+void add_noise(const unsigned char *src, unsigned char *dst, int count, int amplitude) {
+    for (int i = 0; i < count; i++) {
+        int value = src[i] + (amplitude > 0 ? rand() % (2 * amplitude + 1) - amplitude : 0);
+        dst[i] = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+    }
+}
+
+// Test that identical planes score perfectly
+void test_identical(void) {
+    printf("=== Testing Identical Planes ===\n");
+
+    int width = 67;
+    int height = 45;
+    unsigned char *pixels = (unsigned char*)malloc(width * height);
+    fill_pattern(pixels, width, height);
+
+    double psnr = plane_psnr(pixels, pixels, (size_t) width * height);
+    double ssim = plane_ssim(pixels, pixels, width, height);
+    double ms_ssim = plane_ms_ssim(pixels, pixels, width, height);
+    printf("PSNR %.2f dB, SSIM %.6f, MS-SSIM %.6f\n", psnr, ssim, ms_ssim);
+
+    if (psnr == METRICS_MAX_PSNR && fabs(ssim - 1.0) < 1e-9 && fabs(ms_ssim - 1.0) < 1e-9) {
+        printf("Identical planes test PASSED!\n\n");
+    } else {
+        printf("Identical planes test FAILED!\n\n");
+    }
+
+    free(pixels);
+}
+
+// Test that the SIMD MSE matches a plain loop, including odd tail lengths
+void test_mse(void) {
+    printf("=== Testing MSE ===\n");
+
+    int count = 100003;
+    unsigned char *a = (unsigned char*)malloc(count);
+    unsigned char *b = (unsigned char*)malloc(count);
+    for (int i = 0; i < count; i++) {
+        a[i] = (unsigned char) (rand() % 256);
+        b[i] = (unsigned char) (rand() % 256);
+    }
+
+    double expected = 0.0;
+    for (int i = 0; i < count; i++) {
+        double error = (double) a[i] - (double) b[i];
+        expected += error * error;
+    }
+    expected /= count;
+
+    double mse = plane_mse(a, b, count);
+    printf("MSE %.4f, reference %.4f\n", mse, expected);
+
+    if (fabs(mse - expected) < 1e-6) {
+        printf("MSE test PASSED!\n\n");
+    } else {
+        printf("MSE test FAILED!\n\n");
+    }
+
+    free(a);
+    free(b);
+}
+
+// Test that SSIM and MS-SSIM fall as more noise is added
+void test_ssim_ordering(void) {
+    printf("=== Testing SSIM Ordering ===\n");
+
+    int width = 128;
+    int height = 96;
+    int count = width * height;
+    unsigned char *pixels = (unsigned char*)malloc(count);
+    unsigned char *noisy = (unsigned char*)malloc(count);
+    fill_pattern(pixels, width, height);
+
+    int amplitudes[3] = {2, 10, 40};
+    double previous_ssim = 1.0;
+    double previous_ms_ssim = 1.0;
+    int ordered = 1;
+    for (int i = 0; i < 3; i++) {
+        add_noise(pixels, noisy, count, amplitudes[i]);
+        double ssim = plane_ssim(pixels, noisy, width, height);
+        double ms_ssim = plane_ms_ssim(pixels, noisy, width, height);
+        printf("Noise +/-%2d: PSNR %.2f dB, SSIM %.4f, MS-SSIM %.4f\n", amplitudes[i],
+               plane_psnr(pixels, noisy, count), ssim, ms_ssim);
+
+        if (!(ssim < previous_ssim && ms_ssim < previous_ms_ssim)) {
+            ordered = 0;
+        }
+        previous_ssim = ssim;
+        previous_ms_ssim = ms_ssim;
+    }
+
+    if (ordered) {
+        printf("SSIM ordering test PASSED!\n\n");
+    } else {
+        printf("SSIM ordering test FAILED!\n\n");
+    }
+
+    free(pixels);
+    free(noisy);
+}
+
+// Test that the DCT-domain error equals the pixel-domain error of the reconstruction
+void test_dct_domain(void) {
+    printf("=== Testing DCT-Domain PSNR ===\n");
+
+    int sizes[3] = {8, 4, 8};
+    for (int t = 0; t < 3; t++) {
+        int n = sizes[t];
+        int approximate = t > 0;
+        DCTContext *dct = approximate ? dct_init_approximate(n) : dct_init(n);
+        QuantContext *quant = quant_init(n, 50, 0);
+        if (approximate) {
+            quant_apply_transform_scale(quant, dct->row_norms);
+        }
+
+        double **block = alloc_array(n, n);
+        double **coeffs = alloc_array(n, n);
+        double **recon = alloc_array(n, n);
+        double **pixels = alloc_array(n, n);
+        int **quantized = alloc_int_array(n, n);
+
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                block[i][j] = 60.0 * sin(i * 0.9 + j * 0.4) + (rand() % 21) - 10;
+            }
+        }
+
+        dct_forward(dct, block, coeffs);
+        quantize(quant, coeffs, quantized, 0.0);
+        dequantize(quant, quantized, recon, 0.0);
+        double sse = dct_domain_sse(dct, coeffs, recon);
+        double ssim = dct_domain_ssim(dct, coeffs, recon);
+        dct_inverse(dct, recon, pixels);
+
+        // Pixel-domain error and single-window SSIM of the reconstruction
+        double pixel_sse = 0.0;
+        double mean_a = 0.0, mean_b = 0.0;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                double error = block[i][j] - pixels[i][j];
+                pixel_sse += error * error;
+                mean_a += block[i][j] + 128.0;
+                mean_b += pixels[i][j] + 128.0;
+            }
+        }
+        mean_a /= n * n;
+        mean_b /= n * n;
+        double var_a = 0.0, var_b = 0.0, cov = 0.0;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                double da = block[i][j] + 128.0 - mean_a;
+                double db = pixels[i][j] + 128.0 - mean_b;
+                var_a += da * da;
+                var_b += db * db;
+                cov += da * db;
+            }
+        }
+        var_a /= n * n;
+        var_b /= n * n;
+        cov /= n * n;
+        double pixel_ssim = (2 * mean_a * mean_b + 6.5025) * (2 * cov + 58.5225) /
+                            ((mean_a * mean_a + mean_b * mean_b + 6.5025) * (var_a + var_b + 58.5225));
+
+        printf("%dx%d %s: DCT-domain %.2f dB SSIM %.4f, pixel-domain %.2f dB SSIM %.4f\n", n, n,
+               approximate ? "approximate" : "exact", dct_domain_psnr(sse, n * n), ssim,
+               dct_domain_psnr(pixel_sse, n * n), pixel_ssim);
+
+        if (fabs(sse - pixel_sse) <= 1e-6 * (pixel_sse + 1.0) && fabs(ssim - pixel_ssim) < 1e-9) {
+            printf("DCT-domain test PASSED!\n");
+        } else {
+            printf("DCT-domain test FAILED!\n");
+        }
+
+        free_array(block, n);
+        free_array(coeffs, n);
+        free_array(recon, n);
+        free_array(pixels, n);
+        free_int_array(quantized, n);
+        quant_free(quant);
+        dct_free(dct);
+    }
+    printf("\n");
+}
+
+int main(void) {
+    printf("======================================\n");
+    printf("     Metrics Tests\n");
+    printf("======================================\n\n");
+
+    test_identical();
+    test_mse();
+    test_ssim_ordering();
+    test_dct_domain();
+
+    printf("All tests completed!\n");
+    return 0;
+}
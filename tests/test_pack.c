@@ -0,0 +1,200 @@
+/**
+ * test_pack.c - Test file for multi-image pack files
+ * Part of Adaptive DCT Image Compressor
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../include/pack.h"
+
+#define TEST_PACK_PATH "test_pack.adpk"
+#define TEST_IMAGES 40
+
+// Fill an image with a pattern that depends on a seed
+void fill_test_image(unsigned char *pixels, int width, int height, int seed) {
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            double value = 128.0 + 60.0 * sin((i + seed) / 7.0) * cos((j - seed) / 11.0) + (seed * 13 % 32) - 16;
+            pixels[i * width + j] = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+    }
+}
+
+// Encode a small image whose size and content depend on the seed
+unsigned char* encode_test_image(int seed, int *width, int *height, size_t *size) {
+    *width = 16 + (seed * 7) % 41;
+    *height = 12 + (seed * 5) % 29;
+    unsigned char *pixels = (unsigned char*)malloc((size_t) *width * *height);
+    fill_test_image(pixels, *width, *height, seed);
+    CodecParams params = codec_default_params();
+    unsigned char *stream = codec_encode(pixels, *width, *height, &params, size);
+    free(pixels);
+    return stream;
+}
+
+// Check that every id in [0, TEST_IMAGES) decodes to the image of the expected seed
+int check_pack(const PackReader *reader, int replaced_seed_offset, int replaced_below) {
+    int ok = pack_count(reader) == TEST_IMAGES;
+    for (int k = 0; k < TEST_IMAGES; k++) {
+        int seed = k < replaced_below ? k + replaced_seed_offset : k;
+        int width, height;
+        size_t size;
+        unsigned char *stream = encode_test_image(seed, &width, &height, &size);
+        unsigned char *expected = codec_decode(stream, size, &width, &height);
+
+        // Ids were added in a scattered order; the lookup must find each one
+        unsigned long long id = (unsigned long long) k * 1000003ull;
+        PackEntry entry;
+        int decoded_width, decoded_height;
+        unsigned char *decoded = pack_decode(reader, id, &decoded_width, &decoded_height);
+        if (!pack_find(reader, id, &entry) || entry.length != size || entry.width != width ||
+            memcmp(pack_stream(reader, &entry), stream, size) != 0 || !decoded ||
+            decoded_width != width || decoded_height != height ||
+            memcmp(decoded, expected, (size_t) width * height) != 0) {
+            printf("Entry %d does not match\n", k);
+            ok = 0;
+        }
+
+        free(stream);
+        free(expected);
+        free(decoded);
+    }
+
+    // Missing ids and positions
+    PackEntry entry;
+    ok = ok && !pack_find(reader, 5, &entry) && !pack_entry_at(reader, TEST_IMAGES, &entry);
+    return ok;
+}
+
+// Write a pack in one session, append replacements in another, then compact
+void test_pack_round_trip(void) {
+    printf("=== Testing Pack Write / Append / Compact ===\n");
+
+    remove(TEST_PACK_PATH);
+    PackWriter *writer = pack_writer_open(TEST_PACK_PATH);
+    int ok = writer != NULL;
+    for (int i = 0; ok && i < TEST_IMAGES; i++) {
+        int k = (i * 17) % TEST_IMAGES;
+        int width, height;
+        size_t size;
+        unsigned char *stream = encode_test_image(k, &width, &height, &size);
+        ok = pack_writer_add(writer, (unsigned long long) k * 1000003ull, stream, size);
+        free(stream);
+    }
+    ok = ok && pack_writer_close(writer);
+
+    PackReader *reader = pack_open(TEST_PACK_PATH);
+    int first_ok = ok && reader && check_pack(reader, 0, 0);
+    pack_close(reader);
+
+    // Second session replaces the first ten ids
+    writer = pack_writer_open(TEST_PACK_PATH);
+    ok = writer != NULL;
+    for (int k = 0; ok && k < 10; k++) {
+        int width, height;
+        size_t size;
+        unsigned char *stream = encode_test_image(k + 100, &width, &height, &size);
+        ok = pack_writer_add(writer, (unsigned long long) k * 1000003ull, stream, size);
+        free(stream);
+    }
+
+    // Invalid streams are refused without touching the pack
+    unsigned char garbage[64] = {0};
+    int refused = ok && !pack_writer_add(writer, 7, garbage, sizeof(garbage));
+    ok = ok && pack_writer_close(writer);
+
+    FILE *file = fopen(TEST_PACK_PATH, "rb");
+    fseek(file, 0, SEEK_END);
+    long appended_size = ftell(file);
+    fclose(file);
+
+    reader = pack_open(TEST_PACK_PATH);
+    int append_ok = ok && refused && reader && check_pack(reader, 100, 10);
+    pack_close(reader);
+
+    // Compaction drops the replaced streams and the old index
+    int compact_ok = pack_compact(TEST_PACK_PATH);
+    file = fopen(TEST_PACK_PATH, "rb");
+    fseek(file, 0, SEEK_END);
+    long compacted_size = ftell(file);
+    fclose(file);
+    reader = pack_open(TEST_PACK_PATH);
+    compact_ok = compact_ok && compacted_size < appended_size && reader && check_pack(reader, 100, 10);
+    pack_close(reader);
+
+    printf("First session %d, append %d, compact %d (%ld -> %ld bytes)\n",
+           first_ok, append_ok, compact_ok, appended_size, compacted_size);
+    remove(TEST_PACK_PATH);
+
+    if (first_ok && append_ok && compact_ok) {
+        printf("Pack round trip test PASSED!\n\n");
+    } else {
+        printf("Pack round trip test FAILED!\n\n");
+    }
+}
+
+// Test that damaged packs are refused
+void test_invalid_pack(void) {
+    printf("=== Testing Invalid Packs ===\n");
+
+    // Not a pack at all
+    FILE *file = fopen(TEST_PACK_PATH, "wb");
+    fputs("not a pack file, just some text padding it out", file);
+    fclose(file);
+    int not_pack = pack_open(TEST_PACK_PATH) == NULL && pack_writer_open(TEST_PACK_PATH) == NULL;
+
+    // A valid pack whose index runs past the end of the file
+    remove(TEST_PACK_PATH);
+    PackWriter *writer = pack_writer_open(TEST_PACK_PATH);
+    int width, height;
+    size_t size;
+    unsigned char *stream = encode_test_image(3, &width, &height, &size);
+    pack_writer_add(writer, 42, stream, size);
+    pack_writer_close(writer);
+    free(stream);
+
+    unsigned char header[PACK_HEADER_SIZE];
+    file = fopen(TEST_PACK_PATH, "r+b");
+    int read_ok = fread(header, 1, PACK_HEADER_SIZE, file) == PACK_HEADER_SIZE;
+    header[8] = 2;
+    fseek(file, 0, SEEK_SET);
+    fwrite(header, 1, PACK_HEADER_SIZE, file);
+    fclose(file);
+    int bad_count = read_ok && pack_open(TEST_PACK_PATH) == NULL;
+
+    // An entry pointing outside the stream area is skipped at lookup
+    file = fopen(TEST_PACK_PATH, "r+b");
+    header[8] = 1;
+    fwrite(header, 1, PACK_HEADER_SIZE, file);
+    unsigned long long index_offset = 0;
+    for (int i = 0; i < 8; i++) index_offset |= (unsigned long long) header[16 + i] << (8 * i);
+    fseek(file, (long) index_offset + 16, SEEK_SET);
+    fputc(0xFF, file);
+    fputc(0xFF, file);
+    fputc(0xFF, file);
+    fclose(file);
+    PackReader *reader = pack_open(TEST_PACK_PATH);
+    PackEntry entry;
+    int bad_entry = reader && !pack_find(reader, 42, &entry) && !pack_decode(reader, 42, &width, &height);
+    pack_close(reader);
+    remove(TEST_PACK_PATH);
+
+    if (not_pack && bad_count && bad_entry) {
+        printf("Invalid pack test PASSED!\n\n");
+    } else {
+        printf("Invalid pack test FAILED!\n\n");
+    }
+}
+
+int main(void) {
+    printf("======================================\n");
+    printf("     Pack File Tests\n");
+    printf("======================================\n\n");
+
+    test_pack_round_trip();
+    test_invalid_pack();
+
+    printf("All tests completed!\n");
+    return 0;
+}
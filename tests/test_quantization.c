@@ -191,6 +191,282 @@ void test_adaptive_quantization(void) {
     quant_free(ctx);
 }
 
+// Test that the reciprocal kernel quantizes like division
+void test_quant_kernels(void) {
+    printf("\n=== Testing Quantization Kernels ===\n");
+
+    int sizes[4] = {4, 8, 16, 32};
+    for (int s = 0; s < 4; s++) {
+        int n = sizes[s];
+        QuantContext *divide = quant_init(n, 60, 0);
+        QuantContext *reciprocal = quant_init(n, 60, 0);
+        divide->kernel = QUANT_KERNEL_DIVIDE;
+        reciprocal->kernel = QUANT_KERNEL_RECIPROCAL;
+
+        double **coeffs = alloc_array(n, n);
+        int **expected = alloc_int_array(n, n);
+        int **actual = alloc_int_array(n, n);
+        int mismatches = 0;
+        for (int trial = 0; trial < 100; trial++) {
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    coeffs[i][j] = (rand() % 200000) / 100.0 - 1000.0;
+                }
+            }
+            quantize(divide, coeffs, expected, 0.0);
+            quantize(reciprocal, coeffs, actual, 0.0);
+            // Multiplying by a rounded reciprocal may only flip exact .5 ties
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    double ratio = coeffs[i][j] / divide->quant_matrix[i][j];
+                    int tie = fabs(fabs(ratio - floor(ratio)) - 0.5) < 1e-9;
+                    if (expected[i][j] != actual[i][j] && !(tie && abs(expected[i][j] - actual[i][j]) == 1)) {
+                        mismatches++;
+                    }
+                }
+            }
+        }
+
+        printf("%dx%d: %d mismatches between division and reciprocal kernels\n", n, n, mismatches);
+        if (mismatches == 0) {
+            printf("TEST PASSED: Reciprocal kernel matches division\n");
+        } else {
+            printf("TEST FAILED: Reciprocal kernel differs from division\n");
+        }
+
+        free_array(coeffs, n);
+        free_int_array(expected, n);
+        free_int_array(actual, n);
+        quant_free(divide);
+        quant_free(reciprocal);
+    }
+}
+
+// Test that sparse quantization matches quantize in zigzag order, and inverts like dequantize
+void test_sparse_quantization(void) {
+    printf("\n=== Testing Sparse Quantization ===\n");
+
+    int sizes[4] = {4, 8, 16, 32};
+    for (int s = 0; s < 4; s++) {
+        int n = sizes[s];
+        int mismatches = 0;
+        for (int adaptive = 0; adaptive < 2; adaptive++) {
+            QuantContext *ctx = quant_init(n, 50, adaptive);
+            double **coeffs = alloc_array(n, n);
+            double **expected_coeffs = alloc_array(n, n);
+            double **actual_coeffs = alloc_array(n, n);
+            int **dense = alloc_int_array(n, n);
+            SparseBlock sparse;
+            sparse.values = (int*)malloc((size_t) n * n * sizeof(int));
+
+            for (int trial = 0; trial < 50; trial++) {
+                // Energy falls off with frequency, so most high coefficients quantize to zero
+                for (int i = 0; i < n; i++) {
+                    for (int j = 0; j < n; j++) {
+                        coeffs[i][j] = ((rand() % 20000) / 10.0 - 1000.0) / (1 + i + j);
+                    }
+                }
+                double variance = (trial % 5) * 400.0;
+                quantize(ctx, coeffs, dense, variance);
+                quantize_sparse(ctx, coeffs, &sparse, variance);
+
+                // Walk the zigzag order, checking flags and packed values together
+                int next = 0;
+                for (int k = 0; k < n * n; k++) {
+                    int value = dense[ctx->zigzag_row[k]][ctx->zigzag_col[k]];
+                    int flagged = (int) ((sparse.bitmap[k / 64] >> (k % 64)) & 1);
+                    if (flagged != (value != 0) || (flagged && sparse.values[next++] != value)) {
+                        mismatches++;
+                    }
+                }
+                if (next != sparse.count) mismatches++;
+
+                dequantize(ctx, dense, expected_coeffs, variance);
+                dequantize_sparse(ctx, &sparse, actual_coeffs, variance);
+                for (int i = 0; i < n; i++) {
+                    for (int j = 0; j < n; j++) {
+                        if (expected_coeffs[i][j] != actual_coeffs[i][j]) mismatches++;
+                    }
+                }
+            }
+
+            free(sparse.values);
+            free_int_array(dense, n);
+            free_array(coeffs, n);
+            free_array(expected_coeffs, n);
+            free_array(actual_coeffs, n);
+            quant_free(ctx);
+        }
+
+        printf("%dx%d: %d mismatches between sparse and dense quantization\n", n, n, mismatches);
+        if (mismatches == 0) {
+            printf("TEST PASSED: Sparse quantization matches dense\n");
+        } else {
+            printf("TEST FAILED: Sparse quantization differs from dense\n");
+        }
+    }
+}
+
+// Test installing a custom scan order: sparse blocks follow it and invalid orders are refused
+void test_scan_order(void) {
+    printf("\n=== Testing Custom Scan Order ===\n");
+
+    int sizes[4] = {4, 8, 16, 32};
+    for (int s = 0; s < 4; s++) {
+        int n = sizes[s];
+        int mismatches = 0;
+        QuantContext *ctx = quant_init(n, 50, 0);
+        unsigned short *order = (unsigned short*)malloc((size_t) n * n * sizeof(unsigned short));
+
+        // Column by column, the transpose of a raster scan (DC is implied)
+        for (int k = 1; k < n * n; k++) {
+            order[k - 1] = (unsigned short) ((k % n) * n + k / n);
+        }
+        int accepted = quant_set_scan_order(ctx, order, n * n - 1);
+
+        double **coeffs = alloc_array(n, n);
+        double **restored = alloc_array(n, n);
+        int **dense = alloc_int_array(n, n);
+        SparseBlock sparse;
+        sparse.values = (int*)malloc((size_t) n * n * sizeof(int));
+        for (int trial = 0; trial < 20; trial++) {
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    coeffs[i][j] = ((rand() % 20000) / 10.0 - 1000.0) / (1 + i + j);
+                }
+            }
+            quantize(ctx, coeffs, dense, 0.0);
+            quantize_sparse(ctx, coeffs, &sparse, 0.0);
+
+            // Flags follow the custom order; the extent covers every position up to the last nonzero
+            int next = 0;
+            int last = dequantize_sparse(ctx, &sparse, restored, 0.0);
+            for (int k = 0; k < n * n; k++) {
+                int value = dense[k % n][k / n];
+                int flagged = (int) ((sparse.bitmap[k / 64] >> (k % 64)) & 1);
+                if (flagged != (value != 0) || (flagged && sparse.values[next++] != value)) {
+                    mismatches++;
+                }
+            }
+            int extent = ctx->zigzag_extent[last];
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    if (dense[i][j] != 0 && (i >= extent || j >= extent)) mismatches++;
+                }
+            }
+        }
+
+        // A partial list puts the first column up front; the rest keep zigzag order
+        QuantContext *zigzag = quant_init(n, 50, 0);
+        int partial = quant_set_scan_order(ctx, order, n - 1);
+        int next = 1;
+        for (int k = 1; k < n * n; k++) {
+            int expected_row = k < n ? k : -1;
+            int expected_col = 0;
+            if (k >= n) {
+                while (zigzag->zigzag_col[next] == 0) next++;
+                expected_row = zigzag->zigzag_row[next];
+                expected_col = zigzag->zigzag_col[next++];
+            }
+            if (ctx->zigzag_row[k] != expected_row || ctx->zigzag_col[k] != expected_col) mismatches++;
+        }
+        quant_free(zigzag);
+
+        // Repeated positions, a listed DC and out-of-range indexes or counts
+        order[1] = order[2];
+        int duplicate = quant_set_scan_order(ctx, order, 3);
+        order[1] = 0;
+        int listed_dc = quant_set_scan_order(ctx, order, 3);
+        order[1] = (unsigned short) (n * n);
+        int out_of_range = quant_valid_scan_order(order, 3, n) || quant_valid_scan_order(order, n * n, n);
+
+        free(sparse.values);
+        free_int_array(dense, n);
+        free_array(coeffs, n);
+        free_array(restored, n);
+        free(order);
+        quant_free(ctx);
+
+        printf("%dx%d: accepted %d, %d mismatches, invalid orders refused %d\n",
+               n, n, accepted && partial, mismatches, !duplicate && !listed_dc && !out_of_range);
+        if (accepted && partial && mismatches == 0 && !duplicate && !listed_dc && !out_of_range) {
+            printf("TEST PASSED: Custom scan order is followed\n");
+        } else {
+            printf("TEST FAILED: Custom scan order is not followed\n");
+        }
+    }
+}
+
+// Test that the tables of deeper samples scale with the range and stay within the coder's levels
+void test_bit_depth(void) {
+    printf("\n=== Testing Bit Depth Scaling ===\n");
+
+    int sizes[4] = {4, 8, 16, 32};
+    int depths[3] = {10, 12, 16};
+    int qualities[3] = {30, 75, 100};
+    int mismatches = 0;
+    for (int s = 0; s < 4; s++) {
+        for (int d = 0; d < 3; d++) {
+            for (int q = 0; q < 3; q++) {
+                int n = sizes[s];
+                int depth = depths[d];
+                double scale = (double) (1 << (depth - 8));
+                double floor_step = fmax(1.0, (double) (1 << (depth - 1)) * n / QUANT_MAX_LEVEL);
+                QuantContext *base = quant_init(n, qualities[q], 0);
+                QuantContext *deep = quant_init(n, qualities[q], 0);
+                quant_set_bit_depth(deep, depth);
+
+                // Steps scale with the range unless the floor holds them up
+                for (int i = 0; i < n; i++) {
+                    for (int j = 0; j < n; j++) {
+                        double step = deep->quant_matrix[i][j];
+                        double scaled = base->quant_matrix[i][j] * scale;
+                        if (step < floor_step - 1e-9 || (step > floor_step + 1e-9 && fabs(step - scaled) > 1e-9 &&
+                                                         base->quant_matrix[i][j] > 1.0) ||
+                            fabs(step * deep->dequant_matrix[i][j] - 1.0) > 1e-12 ||
+                            fabs(step * deep->reciprocal_matrix[i][j] - 1.0) > 1e-12) {
+                            mismatches++;
+                        }
+                    }
+                }
+
+                // A full-range block quantizes within the entropy coder's levels
+                double **coeffs = alloc_array(n, n);
+                int **quantized = alloc_int_array(n, n);
+                for (int i = 0; i < n; i++) {
+                    for (int j = 0; j < n; j++) {
+                        coeffs[i][j] = (i == 0 && j == 0 ? 1 : 0.5) * (double) (1 << (depth - 1)) * n;
+                    }
+                }
+                quantize(deep, coeffs, quantized, 0.0);
+                for (int i = 0; i < n; i++) {
+                    for (int j = 0; j < n; j++) {
+                        if (abs(quantized[i][j]) > QUANT_MAX_LEVEL) mismatches++;
+                    }
+                }
+
+                // Back to 8 bits restores the original tables
+                quant_set_bit_depth(deep, 8);
+                for (int i = 0; i < n; i++) {
+                    if (memcmp(deep->quant_matrix[i], base->quant_matrix[i], n * sizeof(double)) != 0) mismatches++;
+                }
+
+                free_array(coeffs, n);
+                free_int_array(quantized, n);
+                quant_free(base);
+                quant_free(deep);
+            }
+        }
+    }
+
+    printf("%d mismatches\n", mismatches);
+    if (mismatches == 0) {
+        printf("TEST PASSED: Tables scale with the bit depth\n");
+    } else {
+        printf("TEST FAILED: Tables do not scale with the bit depth\n");
+    }
+}
+
 // Main test function
 int main(void) {
     printf("Running quantization tests...\n\n");
@@ -198,6 +474,10 @@ int main(void) {
     test_quant_matrix_generation();
     test_basic_quantization();
     test_adaptive_quantization();
+    test_quant_kernels();
+    test_sparse_quantization();
+    test_scan_order();
+    test_bit_depth();
 
     printf("\nAll tests completed.\n");
     return 0;
@@ -0,0 +1,408 @@
+/**
+ * test_server.c - Test file for the local encode/decode daemon
+ * Part of Adaptive DCT Image Compressor
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <utils.h>
+#include "../include/server.h"
+
+#define CLIENT_THREADS 4
+#define CLIENT_REQUESTS 16
+#define TEST_MAX_PIXELS (256 * 256)
+
+static char socket_path[64];
+
+// Fill an image with a smooth gradient plus a little texture
+void fill_test_image(unsigned char *pixels, int width, int height) {
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            double value = 128.0 + 60.0 * sin(i / 9.0) * cos(j / 13.0) + (rand() % 16) - 8;
+            pixels[i * width + j] = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+    }
+}
+
+// Send one request with a payload copied into a fresh shared buffer
+static int request_with_payload(int fd, ServerRequest *request, const unsigned char *payload, size_t size,
+                                ServerResponse *response, SharedBuffer *output) {
+    SharedBuffer input;
+    if (!shared_buffer_create(&input, size)) {
+        return 0;
+    }
+    memcpy(input.data, payload, size);
+    request->magic = SERVER_MAGIC;
+    request->input_size = size;
+
+    int ok = client_request(fd, request, &input, response, output);
+    shared_buffer_release(&input);
+    return ok;
+}
+
+// Test that the daemon produces exactly what the in-process codec produces
+void test_round_trip(void) {
+    printf("=== Testing Daemon Round Trip ===\n");
+
+    int width = 120;
+    int height = 90;
+    unsigned char *pixels = (unsigned char*)malloc(width * height);
+    fill_test_image(pixels, width, height);
+
+    CodecParams params = codec_default_params();
+    params.tile_size = 64;
+    size_t local_size;
+    unsigned char *local_stream = codec_encode(pixels, width, height, &params, &local_size);
+    int local_width, local_height;
+    unsigned char *local_pixels = codec_decode(local_stream, local_size, &local_width, &local_height);
+
+    int fd = client_connect(socket_path);
+    ServerRequest request;
+    ServerResponse response;
+    SharedBuffer stream = {-1, NULL, 0};
+    SharedBuffer decoded = {-1, NULL, 0};
+
+    memset(&request, 0, sizeof(request));
+    request.op = SERVER_OP_ENCODE;
+    request.id = 7;
+    request.width = width;
+    request.height = height;
+    request.params = params;
+    int encoded = fd >= 0 && request_with_payload(fd, &request, pixels, (size_t) width * height, &response, &stream) &&
+                  response.status == SERVER_OK && response.id == 7 && stream.size == local_size &&
+                  memcmp(stream.data, local_stream, local_size) == 0;
+    printf("Encode: status %d, %zu bytes (in-process %zu), queue %.3f ms, service %.3f ms\n",
+           response.status, stream.size, local_size, response.queue_ms, response.service_ms);
+
+    memset(&request, 0, sizeof(request));
+    request.op = SERVER_OP_DECODE;
+    request.id = 8;
+    int decoded_ok = encoded && request_with_payload(fd, &request, stream.data, stream.size, &response, &decoded) &&
+                     response.status == SERVER_OK && response.width == local_width &&
+                     response.height == local_height && decoded.size == (size_t) width * height &&
+                     memcmp(decoded.data, local_pixels, decoded.size) == 0;
+    printf("Decode: status %d, %dx%d\n", response.status, response.width, response.height);
+
+    shared_buffer_release(&stream);
+    shared_buffer_release(&decoded);
+    if (fd >= 0) close(fd);
+    free(pixels);
+    free(local_stream);
+    free(local_pixels);
+
+    if (encoded && decoded_ok) {
+        printf("Round trip test PASSED!\n\n");
+    } else {
+        printf("Round trip test FAILED!\n\n");
+    }
+}
+
+// Test that bad requests get error statuses and leave the connection usable
+void test_errors(void) {
+    printf("=== Testing Daemon Errors ===\n");
+
+    int fd = client_connect(socket_path);
+    ServerRequest request;
+    ServerResponse response;
+    SharedBuffer output;
+    unsigned char garbage[64];
+    memset(garbage, 0x5A, sizeof(garbage));
+
+    // Corrupt stream
+    memset(&request, 0, sizeof(request));
+    request.op = SERVER_OP_DECODE;
+    int codec_error = fd >= 0 && request_with_payload(fd, &request, garbage, sizeof(garbage), &response, &output) &&
+                      response.status == SERVER_ERROR_CODEC && output.fd < 0;
+
+    // Payload size does not match the dimensions
+    memset(&request, 0, sizeof(request));
+    request.op = SERVER_OP_ENCODE;
+    request.width = 16;
+    request.height = 16;
+    request.params = codec_default_params();
+    int size_error = request_with_payload(fd, &request, garbage, sizeof(garbage), &response, &output) &&
+                     response.status == SERVER_ERROR_REQUEST;
+
+    // Missing payload descriptor and unknown operation
+    memset(&request, 0, sizeof(request));
+    request.magic = SERVER_MAGIC;
+    request.op = SERVER_OP_DECODE;
+    request.input_size = 10;
+    int missing_error = client_request(fd, &request, NULL, &response, &output) &&
+                        response.status == SERVER_ERROR_REQUEST;
+    request.op = 99;
+    int op_error = client_request(fd, &request, NULL, &response, &output) &&
+                   response.status == SERVER_ERROR_REQUEST;
+
+    // Invalid codec parameters
+    unsigned char pixels[16 * 16];
+    memset(pixels, 100, sizeof(pixels));
+    memset(&request, 0, sizeof(request));
+    request.op = SERVER_OP_ENCODE;
+    request.width = 16;
+    request.height = 16;
+    request.params = codec_default_params();
+    request.params.block_size = 5;
+    int params_error = request_with_payload(fd, &request, pixels, sizeof(pixels), &response, &output) &&
+                       response.status == SERVER_ERROR_CODEC;
+
+    if (fd >= 0) close(fd);
+    printf("Codec error %d, size error %d, missing payload %d, unknown op %d, bad params %d\n",
+           codec_error, size_error, missing_error, op_error, params_error);
+    if (codec_error && size_error && missing_error && op_error && params_error) {
+        printf("Error handling test PASSED!\n\n");
+    } else {
+        printf("Error handling test FAILED!\n\n");
+    }
+}
+
+// Test that images over the daemon's pixel cap are refused without taking the daemon down
+void test_pixel_cap(void) {
+    printf("=== Testing Daemon Pixel Cap ===\n");
+
+    int fd = client_connect(socket_path);
+    ServerRequest request;
+    ServerResponse response;
+    SharedBuffer output = {-1, NULL, 0};
+    CodecParams params = codec_default_params();
+
+    // One row over the cap, both ways
+    int width = 256;
+    int height = 257;
+    unsigned char *pixels = (unsigned char*)calloc((size_t) width * height, 1);
+    memset(&request, 0, sizeof(request));
+    request.op = SERVER_OP_ENCODE;
+    request.width = width;
+    request.height = height;
+    request.params = params;
+    int encode_refused = fd >= 0 &&
+                         request_with_payload(fd, &request, pixels, (size_t) width * height, &response, &output) &&
+                         response.status == SERVER_ERROR_REQUEST && output.fd < 0;
+
+    size_t size;
+    unsigned char *stream = codec_encode(pixels, width, height, &params, &size);
+    memset(&request, 0, sizeof(request));
+    request.op = SERVER_OP_DECODE;
+    int decode_refused = request_with_payload(fd, &request, stream, size, &response, &output) &&
+                         response.status == SERVER_ERROR_REQUEST && output.fd < 0;
+
+    // A tiny stream whose header claims 131072 x 131072
+    unsigned char *tiny = codec_encode(pixels, 16, 16, &params, &size);
+    for (int field = 12; field < 28; field += 4) {
+        tiny[field] = 0;
+        tiny[field + 1] = 0;
+        tiny[field + 2] = 2;
+        tiny[field + 3] = 0;
+    }
+    int oversized_refused = request_with_payload(fd, &request, tiny, size, &response, &output) &&
+                            response.status != SERVER_OK && output.fd < 0;
+
+    // The daemon still serves the same connection
+    memset(&request, 0, sizeof(request));
+    request.magic = SERVER_MAGIC;
+    request.op = SERVER_OP_STATS;
+    int alive = client_request(fd, &request, NULL, &response, NULL) && response.status == SERVER_OK;
+
+    if (fd >= 0) close(fd);
+    printf("Encode refused %d, decode refused %d, oversized header refused %d, still serving %d\n",
+           encode_refused, decode_refused, oversized_refused, alive);
+    free(pixels);
+    free(stream);
+    free(tiny);
+
+    if (encode_refused && decode_refused && oversized_refused && alive) {
+        printf("Pixel cap test PASSED!\n\n");
+    } else {
+        printf("Pixel cap test FAILED!\n\n");
+    }
+}
+
+// Send a request with a descriptor as it is, bypassing the sealing in client_request
+static int send_raw_request(int fd, const ServerRequest *request, int input_fd, ServerResponse *response) {
+    struct iovec iov = {(void *) request, sizeof(*request)};
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &input_fd, sizeof(int));
+    return sendmsg(fd, &msg, 0) == (ssize_t) sizeof(*request) &&
+           recv(fd, response, sizeof(*response), 0) == (ssize_t) sizeof(*response);
+}
+
+// Test that unsealed payloads are refused and that sent payloads can no longer shrink
+void test_sealing(void) {
+    printf("=== Testing Payload Sealing ===\n");
+
+    int width = 256;
+    int height = 256;
+    size_t size = (size_t) width * height;
+    int fd = client_connect(socket_path);
+    ServerRequest request;
+    ServerResponse response;
+    memset(&request, 0, sizeof(request));
+    request.magic = SERVER_MAGIC;
+    request.op = SERVER_OP_ENCODE;
+    request.width = width;
+    request.height = height;
+    request.params = codec_default_params();
+    request.input_size = size;
+
+    // A buffer the client could still shrink (or one that never allowed sealing) is not mapped
+    SharedBuffer unsealed;
+    int refused = fd >= 0 && shared_buffer_create(&unsealed, size) &&
+                  send_raw_request(fd, &request, unsealed.fd, &response) && response.status == SERVER_ERROR_REQUEST;
+    shared_buffer_release(&unsealed);
+    int plain_fd = memfd_create("adct-unsealable", MFD_CLOEXEC);
+    refused = refused && plain_fd >= 0 && ftruncate(plain_fd, (off_t) size) == 0 &&
+              send_raw_request(fd, &request, plain_fd, &response) && response.status == SERVER_ERROR_REQUEST;
+    if (plain_fd >= 0) close(plain_fd);
+
+    // After a request the input is sealed: shrinking and writing fail, reading still works
+    SharedBuffer input, stream = {-1, NULL, 0};
+    int sealed = shared_buffer_create(&input, size);
+    if (sealed) {
+        memset(input.data, 77, size);
+        sealed = client_request(fd, &request, &input, &response, &stream) && response.status == SERVER_OK &&
+                 ftruncate(input.fd, 0) != 0 && pwrite(input.fd, "x", 1, 0) < 0 && input.data[size - 1] == 77;
+    }
+    shared_buffer_release(&input);
+    shared_buffer_release(&stream);
+
+    // The connection still serves requests afterwards
+    request.op = SERVER_OP_STATS;
+    int alive = client_request(fd, &request, NULL, &response, NULL) && response.status == SERVER_OK;
+    if (fd >= 0) close(fd);
+
+    printf("Unsealed refused %d, input sealed %d, connection alive %d\n", refused, sealed, alive);
+    if (refused && sealed && alive) {
+        printf("Sealing test PASSED!\n\n");
+    } else {
+        printf("Sealing test FAILED!\n\n");
+    }
+}
+
+// One client: encode and decode a small image repeatedly over its own connection
+static void* client_main(void *arg) {
+    int *ok = (int *) arg;
+    int width = 64;
+    int height = 64;
+    unsigned char pixels[64 * 64];
+    for (int i = 0; i < width * height; i++) {
+        pixels[i] = (unsigned char) ((i * 7) ^ (i >> 6));
+    }
+
+    int fd = client_connect(socket_path);
+    *ok = fd >= 0;
+    for (int r = 0; r < CLIENT_REQUESTS && *ok; r++) {
+        ServerRequest request;
+        ServerResponse response;
+        SharedBuffer stream, decoded;
+
+        memset(&request, 0, sizeof(request));
+        request.op = SERVER_OP_ENCODE;
+        request.id = (unsigned) r;
+        request.width = width;
+        request.height = height;
+        request.params = codec_default_params();
+        if (!request_with_payload(fd, &request, pixels, sizeof(pixels), &response, &stream) ||
+            response.status != SERVER_OK || response.id != (unsigned) r) {
+            *ok = 0;
+            break;
+        }
+
+        request.op = SERVER_OP_DECODE;
+        *ok = request_with_payload(fd, &request, stream.data, stream.size, &response, &decoded) &&
+              response.status == SERVER_OK && decoded.size == sizeof(pixels);
+        shared_buffer_release(&stream);
+        shared_buffer_release(&decoded);
+    }
+
+    if (fd >= 0) close(fd);
+    return NULL;
+}
+
+// Test concurrent clients and the statistics they leave behind
+void test_concurrency(Server *server) {
+    printf("=== Testing Concurrent Clients ===\n");
+
+    ServerStats before;
+    server_get_stats(server, &before);
+
+    pthread_t threads[CLIENT_THREADS];
+    int ok[CLIENT_THREADS];
+    for (int t = 0; t < CLIENT_THREADS; t++) {
+        pthread_create(&threads[t], NULL, client_main, &ok[t]);
+    }
+    int all_ok = 1;
+    for (int t = 0; t < CLIENT_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+        all_ok &= ok[t];
+    }
+
+    // The STATS request reports the same counters as the in-process query
+    int fd = client_connect(socket_path);
+    ServerRequest request;
+    ServerResponse response;
+    memset(&request, 0, sizeof(request));
+    request.magic = SERVER_MAGIC;
+    request.op = SERVER_OP_STATS;
+    int stats_ok = fd >= 0 && client_request(fd, &request, NULL, &response, NULL) && response.status == SERVER_OK;
+    if (fd >= 0) close(fd);
+
+    ServerStats *stats = &response.stats;
+    unsigned long long expected = before.requests + 2ULL * CLIENT_THREADS * CLIENT_REQUESTS;
+    printf("Requests %llu (expected %llu), errors %llu, mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           stats->requests, expected, stats->errors, stats->mean_ms, stats->p50_ms, stats->p99_ms, stats->max_ms);
+    stats_ok = stats_ok && stats->requests == expected && stats->errors == before.errors &&
+               stats->p50_ms <= stats->p99_ms && stats->p99_ms <= stats->max_ms;
+
+    if (all_ok && stats_ok) {
+        printf("Concurrency test PASSED!\n\n");
+    } else {
+        printf("Concurrency test FAILED!\n\n");
+    }
+}
+
+int main(void) {
+    printf("======================================\n");
+    printf("     Daemon Tests\n");
+    printf("======================================\n\n");
+
+    snprintf(socket_path, sizeof(socket_path), "/tmp/adct-test-%d.sock", (int) getpid());
+    Server *server = server_start(socket_path, 2, TEST_MAX_PIXELS);
+    if (!server) {
+        printf("Server start FAILED!\n");
+        return 0;
+    }
+
+    test_round_trip();
+    test_errors();
+    test_pixel_cap();
+    test_sealing();
+    test_concurrency(server);
+
+    server_stop(server);
+    if (access(socket_path, F_OK) == 0) {
+        printf("Socket cleanup FAILED!\n\n");
+    }
+
+    printf("All tests completed!\n");
+    return 0;
+}
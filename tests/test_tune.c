@@ -0,0 +1,102 @@
+/**
+ * test_tune.c - Test file for the startup kernel autotuner
+ * Part of Adaptive DCT Image Compressor
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils.h>
+#include "../include/tune.h"
+
+#define TEST_PROFILE "test_tune.profile"
+
+static const int sizes[TUNE_SIZE_COUNT] = {4, 8, 16, 32};
+
+// Test that measuring picks an available bit-exact kernel for every size and applies it
+void test_measure(void) {
+    printf("=== Testing Kernel Measurement ===\n");
+
+    TuneProfile profile;
+    tune_measure(&profile);
+    tune_apply(&profile);
+    printf("CPU: %s\n", profile.cpu_model);
+
+    int ok = 1;
+    for (int s = 0; s < TUNE_SIZE_COUNT; s++) {
+        printf("%2dx%-2d dct:", sizes[s], sizes[s]);
+        for (int k = 0; k < DCT_KERNEL_COUNT; k++) {
+            printf(" %9.1f ns", profile.dct_ns[s][k]);
+        }
+        printf(" -> %d, quant: %7.1f / %7.1f ns -> %d\n", profile.dct_kernel[s],
+               profile.quant_ns[s][0], profile.quant_ns[s][1], profile.quant_kernel[s]);
+
+        DCTContext *dct = dct_init(sizes[s]);
+        QuantContext *quant = quant_init(sizes[s], 50, 0);
+        if (!dct_kernel_available(profile.dct_kernel[s]) || dct->kernel != profile.dct_kernel[s] ||
+            quant->kernel != profile.quant_kernel[s] || profile.dct_kernel[s] == DCT_KERNEL_FACTORIZED ||
+            profile.quant_kernel[s] != QUANT_KERNEL_DIVIDE) {
+            ok = 0;
+        }
+        dct_free(dct);
+        quant_free(quant);
+    }
+
+    if (ok) {
+        printf("Measurement test PASSED!\n\n");
+    } else {
+        printf("Measurement test FAILED!\n\n");
+    }
+}
+
+// Test that a profile survives a save/load round trip and is keyed by CPU model
+void test_profile_file(void) {
+    printf("=== Testing Profile File ===\n");
+
+    TuneProfile saved;
+    memset(&saved, 0, sizeof(saved));
+    snprintf(saved.cpu_model, sizeof(saved.cpu_model), "Imaginary CPU @ 1.00GHz");
+    for (int s = 0; s < TUNE_SIZE_COUNT; s++) {
+        saved.dct_kernel[s] = s % 2 ? DCT_KERNEL_FACTORIZED : DCT_KERNEL_MATRIX;
+        saved.quant_kernel[s] = s % 2 ? QUANT_KERNEL_DIVIDE : QUANT_KERNEL_RECIPROCAL;
+    }
+
+    TuneProfile loaded;
+    int round_trip = tune_save(&saved, TEST_PROFILE) && tune_load(&loaded, TEST_PROFILE) &&
+                     strcmp(saved.cpu_model, loaded.cpu_model) == 0 &&
+                     memcmp(saved.dct_kernel, loaded.dct_kernel, sizeof(saved.dct_kernel)) == 0 &&
+                     memcmp(saved.quant_kernel, loaded.quant_kernel, sizeof(saved.quant_kernel)) == 0;
+
+    // The stored profile belongs to another CPU, so the first init measures and
+    // overwrites it; the second init then loads it
+    int first = tune_init(TEST_PROFILE, NULL);
+    int second = tune_init(TEST_PROFILE, &loaded);
+    char cpu_model[TUNE_CPU_MODEL_LENGTH];
+    tune_cpu_model(cpu_model, sizeof(cpu_model));
+    int keyed = strcmp(loaded.cpu_model, cpu_model) == 0;
+
+    FILE *file = fopen(TEST_PROFILE, "w");
+    fputs("adct-tune 2\ncpu x\nsize 8 dct 7 quant 0\n", file);
+    fclose(file);
+    int rejected = !tune_load(&loaded, TEST_PROFILE);
+    remove(TEST_PROFILE);
+
+    printf("Round trip %d, first init loaded %d, second init loaded %d, keyed by CPU %d, malformed rejected %d\n",
+           round_trip, first, second, keyed, rejected);
+    if (round_trip && !first && second && keyed && rejected) {
+        printf("Profile file test PASSED!\n\n");
+    } else {
+        printf("Profile file test FAILED!\n\n");
+    }
+}
+
+int main(void) {
+    printf("======================================\n");
+    printf("     Autotuner Tests\n");
+    printf("======================================\n\n");
+
+    test_measure();
+    test_profile_file();
+
+    printf("All tests completed!\n");
+    return 0;
+}
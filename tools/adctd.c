@@ -0,0 +1,50 @@
+/**
+ * adctd.c - Encode/decode daemon entry point
+ * Part of Adaptive DCT Image Compressor
+ *
+ * Usage: adctd <socket-path> [workers] [tune-profile] [max-pixels]
+ * Runs until SIGINT or SIGTERM, then prints the latency statistics.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <signal.h>
+#include <unistd.h>
+#include <server.h>
+#include <tune.h>
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <socket-path> [workers] [tune-profile] [max-pixels]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = argc > 2 ? atoi(argv[2]) : (cpus > 0 ? (int) cpus : 1);
+    const char *profile = argc > 3 ? argv[3] : "adct-tune.profile";
+    unsigned long long max_pixels = argc > 4 ? strtoull(argv[4], NULL, 10) : 0;
+
+    // Pick the kernels once so every request runs on the tuned defaults
+    tune_init(profile, NULL);
+
+    // Block the shutdown signals before any thread starts so only sigwait sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    Server *server = server_start(argv[1], workers, max_pixels);
+    if (!server) {
+        return EXIT_FAILURE;
+    }
+    printf("Listening on %s with %d workers\n", argv[1], workers);
+    fflush(stdout);
+
+    int signal_number;
+    sigwait(&signals, &signal_number);
+
+    ServerStats stats;
+    server_get_stats(server, &stats);
+    server_stop(server);
+    printf("Served %llu requests (%llu errors): mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           stats.requests, stats.errors, stats.mean_ms, stats.p50_ms, stats.p99_ms, stats.max_ms);
+    return EXIT_SUCCESS;
+}